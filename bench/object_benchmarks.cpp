@@ -0,0 +1,287 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Server.hpp"
+#include "object_store.hpp"
+#include "object_type.hpp"
+#include "object_write_batch.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "stat_cache.hpp"
+
+/**
+ * Benchmarks of the object file functions behind `hash-object`, `write-tree` and `cat-file`, on synthetic
+ * working trees of different shapes. The trees are generated under the system temp directory on first
+ * use and removed when the run ends. Every benchmark reports the bytes and files it processed per second.
+ *
+ * Build with Google Benchmark installed and run e.g.
+ *   build/git_benchmarks --benchmark_filter='create_tree_format/.*'
+ */
+
+namespace {
+
+enum class RepoShape { ManySmallFiles, FewHugeBlobs, DeepTree, WideTree };
+
+struct ShapeInfo {
+    RepoShape shape;
+    const char *name;
+};
+
+constexpr ShapeInfo SHAPES[] = {
+    {RepoShape::ManySmallFiles, "many_small_files"}, // 100 directories of 100 files of 1 KiB.
+    {RepoShape::FewHugeBlobs, "few_huge_blobs"},     // 4 files of 16 MiB, above the streaming threshold.
+    {RepoShape::DeepTree, "deep_tree"},              // 200 nested directories with 8 files of 2 KiB each.
+    {RepoShape::WideTree, "wide_tree"},              // One directory of 10000 files of 256 bytes.
+};
+
+struct SyntheticRepo {
+    std::filesystem::path root;
+    std::vector<std::string> files; // Relative to `root`, starting with "./" as `create_tree_format` builds them.
+    uint64_t bytes = 0;
+};
+
+std::filesystem::path benchmark_root() {
+    static const std::filesystem::path root =
+        std::filesystem::temp_directory_path() / ("git_benchmarks_" + std::to_string(getpid()));
+    return root;
+}
+
+// Text-like content (words and lines, compressing about as well as source code), different for every `seed`.
+std::string file_content(uint64_t seed, std::size_t size) {
+    static constexpr const char *WORDS[] = {"const", "std::string", "return", "if", "for", "auto", "object", "tree",
+                                            "blob", "hash", "{", "}", "(", ")", "=", "0", "1", "size", "data", "id"};
+    std::string content;
+    content.reserve(size + 16);
+    uint64_t state = seed * 6364136223846793005ull + 1442695040888963407ull;
+    while (content.size() < size) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        content += WORDS[(state >> 33) % std::size(WORDS)];
+        content += (state >> 28) % 8 == 0 ? '\n' : ' ';
+    }
+    content.resize(size);
+    return content;
+}
+
+void add_file(SyntheticRepo& repo, const std::string& relative_path, std::size_t size) {
+    const std::filesystem::path path = repo.root / relative_path;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::binary) << file_content(repo.files.size(), size);
+    // Older than any stat cache written later, so the cache does not treat the file as racily clean.
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now() - std::chrono::hours(1));
+    repo.files.push_back("./" + relative_path);
+    repo.bytes += size;
+}
+
+// The working tree of `shape`, generated on first use, with an empty `.git/objects`.
+const SyntheticRepo& synthetic_repo(RepoShape shape) {
+    static std::map<RepoShape, SyntheticRepo> repos;
+    if (const auto it = repos.find(shape); it != repos.end()) {
+        return it->second;
+    }
+    SyntheticRepo& repo = repos[shape];
+    repo.root = benchmark_root() / std::to_string(static_cast<int>(shape));
+    std::filesystem::create_directories(repo.root / ".git/objects");
+    switch (shape) {
+        case RepoShape::ManySmallFiles:
+            for (int dir = 0; dir < 100; dir++) {
+                for (int file = 0; file < 100; file++) {
+                    add_file(repo, "dir" + std::to_string(dir) + "/file" + std::to_string(file) + ".txt", 1024);
+                }
+            }
+            break;
+        case RepoShape::FewHugeBlobs:
+            for (int file = 0; file < 4; file++) {
+                add_file(repo, "huge" + std::to_string(file) + ".bin", 16 << 20);
+            }
+            break;
+        case RepoShape::DeepTree: {
+            std::string dir;
+            for (int depth = 0; depth < 200; depth++) {
+                dir += "d" + std::to_string(depth) + "/";
+                for (int file = 0; file < 8; file++) {
+                    add_file(repo, dir + "file" + std::to_string(file) + ".txt", 2048);
+                }
+            }
+            break;
+        }
+        case RepoShape::WideTree:
+            for (int file = 0; file < 10000; file++) {
+                add_file(repo, "file" + std::to_string(file) + ".txt", 256);
+            }
+            break;
+    }
+    return repo;
+}
+
+// Makes `shape`'s working tree the current directory, which the functions under test expect.
+const SyntheticRepo& enter_repo(RepoShape shape) {
+    const SyntheticRepo& repo = synthetic_repo(shape);
+    std::filesystem::current_path(repo.root);
+    return repo;
+}
+
+// Empties `.git/objects`, so the writers measured next have to write every object.
+void clear_objects() {
+    std::filesystem::remove_all(".git/objects");
+    std::filesystem::create_directories(".git/objects");
+}
+
+void set_processed(benchmark::State& state, const SyntheticRepo& repo) {
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * repo.bytes));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * repo.files.size()));
+}
+
+template <typename Hash>
+void bench_create_sha_hash(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    for (auto _ : state) {
+        for (const std::string& file : repo.files) {
+            benchmark::DoNotOptimize(create_sha_hash<Hash>(file));
+        }
+    }
+    set_processed(state, repo);
+}
+
+// A full `write-tree` walk without a stat cache and without writing objects: listing, reading and hashing.
+void bench_create_tree_format(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    const unsigned jobs = static_cast<unsigned>(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(create_tree_format<Sha1>(".", jobs));
+    }
+    set_processed(state, repo);
+}
+
+// `write-tree` on an unchanged tree: every file and directory hash comes from a warm stat cache.
+void bench_create_tree_format_stat_cache(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    const std::string cache_path = ".git/bench-stat-cache";
+    StatCache<Sha1> warm;
+    create_tree_format<Sha1>(".", 1, &warm);
+    warm.save(cache_path);
+    for (auto _ : state) {
+        StatCache<Sha1> stat_cache;
+        stat_cache.load(cache_path);
+        benchmark::DoNotOptimize(create_tree_format<Sha1>(".", 1, &stat_cache));
+    }
+    set_processed(state, repo);
+}
+
+// `write-tree` into an empty object store: every blob and tree is compressed and written through a batch.
+void bench_write_tree_objects(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    for (auto _ : state) {
+        state.PauseTiming();
+        clear_objects();
+        state.ResumeTiming();
+        ObjectWriteBatch<Sha1> batch;
+        benchmark::DoNotOptimize(create_tree_format<Sha1>(".", 1, nullptr, &batch));
+        batch.flush();
+    }
+    set_processed(state, repo);
+}
+
+// The writer `hash-object -w` uses for new content: one pass that hashes, deflates and writes each file.
+void bench_hash_and_write_blob_streaming(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    for (auto _ : state) {
+        state.PauseTiming();
+        clear_objects();
+        state.ResumeTiming();
+        for (const std::string& file : repo.files) {
+            benchmark::DoNotOptimize(hash_and_write_blob_streaming<Sha1>(file, CompressionLevels().loose));
+        }
+    }
+    set_processed(state, repo);
+}
+
+// The writer for content that is already in memory, as trees, commits and tags are.
+void bench_object_store_write(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    std::vector<std::string> contents;
+    for (std::size_t i = 0; i < repo.files.size(); i++) {
+        contents.push_back(file_content(i, std::filesystem::file_size(repo.files[i])));
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        clear_objects();
+        ObjectStore<Sha1> store;
+        state.ResumeTiming();
+        for (const std::string& content : contents) {
+            benchmark::DoNotOptimize(store.write(ObjectType::Blob, content));
+        }
+    }
+    set_processed(state, repo);
+}
+
+// What `cat-file -p` does for a loose blob: read, inflate and strip the header.
+void bench_decompress_object(benchmark::State& state, RepoShape shape) {
+    const SyntheticRepo& repo = enter_repo(shape);
+    clear_objects();
+    ObjectStore<Sha1> store;
+    std::vector<std::string> object_paths;
+    for (const std::string& file : repo.files) {
+        const std::optional<ObjectId<Sha1>> id = store_blob_file<Sha1>(store, file, CompressionLevels().loose);
+        if (!id) {
+            state.SkipWithError("could not write the objects to read");
+            return;
+        }
+        object_paths.push_back(id->loose_path());
+    }
+    for (auto _ : state) {
+        for (const std::string& path : object_paths) {
+            benchmark::DoNotOptimize(decompress_git_object_and_remove_header(path));
+        }
+    }
+    set_processed(state, repo);
+}
+
+void register_benchmarks() {
+    const int max_jobs = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (const ShapeInfo& info : SHAPES) {
+        const RepoShape shape = info.shape;
+        const std::string suffix = std::string("/") + info.name;
+        auto add = [&](const std::string& name, auto function) {
+            return benchmark::RegisterBenchmark((name + suffix).c_str(), function, shape)
+                ->Unit(benchmark::kMillisecond)
+                ->UseRealTime();
+        };
+        add("create_sha_hash/sha1", bench_create_sha_hash<Sha1>);
+        add("create_sha_hash/sha256", bench_create_sha_hash<Sha256>);
+        auto *tree = add("create_tree_format", bench_create_tree_format)->ArgName("jobs")->Arg(1);
+        if (max_jobs > 1) {
+            tree->Arg(max_jobs);
+        }
+        add("create_tree_format_stat_cache", bench_create_tree_format_stat_cache);
+        add("write_tree_objects", bench_write_tree_objects);
+        add("hash_and_write_blob_streaming", bench_hash_and_write_blob_streaming);
+        add("object_store_write", bench_object_store_write);
+        add("decompress_git_object_and_remove_header", bench_decompress_object);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    std::error_code ec;
+    std::filesystem::current_path(std::filesystem::temp_directory_path(), ec);
+    std::filesystem::remove_all(benchmark_root(), ec);
+    return 0;
+}
@@ -3,529 +3,2095 @@
 #include <fstream>
 #include <string>
 #include <zlib.h>
-#include <sstream>
 #include <vector>
-#include <openssl/sha.h>
-#include <iomanip>
-#include <unordered_map>
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <bit>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "Server.hpp"
+#include "buffered_io.hpp"
+#include "commit.hpp"
+#include "commit_graph.hpp"
+#include "compression.hpp"
+#include "mapped_file.hpp"
+#include "object_format.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "object_write_batch.hpp"
+#include "pack_bitmap.hpp"
+#include "pack_indexer.hpp"
+#include "pack_writer.hpp"
+#include "revision_walk.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "smart_http.hpp"
+#include "stat_cache.hpp"
+#include "thread_pool.hpp"
+#include "tree_entry.hpp"
+#include "tree_prefetcher.hpp"
+#include "trace_perf.hpp"
+#include "tree_view.hpp"
+
+/**
+ * Scratch buffers shared by every object reader/writer running on a thread.
+ *
+ * The buffers only ever grow: once a thread has compressed its largest object, later objects
+ * reuse the same memory, so a batch of writes performs no allocations in steady state. Keeping
+ * them on the heap (instead of `unsigned char buf[compressBound(n)]` on the stack) means large
+ * objects no longer overflow the stack.
+ */
+struct ObjectBuffers {
+    std::vector<unsigned char> output;
+};
 
 /**
- * Reads and decompresses data from a blob object, then processes it to extract the actual content.
+ * Returns this thread's `ObjectBuffers` with `output` holding at least `output_size` bytes.
+ * Input never needs a buffer: files are handed to SHA-1 and zlib straight from a `MappedFile`.
+ */
+ObjectBuffers& object_buffers(std::size_t output_size) {
+    thread_local ObjectBuffers buffers;
+    if (buffers.output.size() < output_size) {
+        buffers.output.resize(output_size);
+    }
+    return buffers;
+}
+
+/**
+ * Reads and decompresses a loose object, returning only its content (the header is discarded).
  * Note: Blobs only store the contents of a file, not its name or permissions.
- * The formate of a blob object looks like this: blob <size>\0<content> (size is in bytes)
+ * Returns an empty string (after printing an error) if the object cannot be read.
+ */
+std::string decompress_git_object_and_remove_header(const std::string &file_path) {
+    std::string type;
+    std::string content;
+    if (!read_loose_object(file_path, type, content)) {
+        return "";
+    }
+    return content;
+}
+
+/**
+ * Compresses `data` into `dest` at `level` with the selected deflate codec (see `deflate_codec`), reading
+ * it in place. `dest` must hold `deflate_codec().bound(data.size())` bytes; on return `bound` holds the
+ * number of compressed bytes written to it, 0 on failure.
+ */
+void compressFile(std::string_view data, uLong *bound, unsigned char *dest, int level = DEFAULT_COMPRESSION_LEVEL) {
+    *bound = deflate_codec().compress({}, data, level, dest);
+}
+
+/**
+ * Hashes a file as a Git blob and writes it to `.git/objects`, reading the file exactly once.
+ * The format of a blob object looks like this: blob <size>\0<content> (size is in bytes)
+ *
+ * This function performs the following steps:
+ *
+ * 1. **Map the File and Build the Header**:
+ *    - Memory-maps the file (see `MappedFile`), so its size is known up front for the "blob <size>\0"
+ *      header and its pages go straight to the hash and zlib without passing through a userspace buffer.
+ *
+ * 2. **Set Up the Pipeline**:
+ *    - Initializes an incremental context of the repository's hash and a zlib `deflate` stream at `level`
+ *      (streaming needs zlib's incremental API, whichever `deflate_codec` is selected).
+ *    - Opens a temporary file in `.git/objects`, because the final object name is the hash we are about to compute.
+ *
+ * 3. **Stream the Content**:
+ *    - Feeds the header, then each `STREAM_CHUNK_SIZE` chunk of the mapping, to both the hash and `deflate`;
+ *      a chunk is still in cache when zlib reads it after the hash did.
+ *    - Compressed output is written to the temporary file as soon as zlib produces it, so the only heap
+ *      memory used is one output chunk regardless of the file size.
+ *
+ * 4. **Move the Object into Place**:
+ *    - Finalizes the hash, creates the `.git/objects/xx` fan-out directory and renames the temporary file
+ *      to `.git/objects/xx/yyyy...`. If the object already exists the temporary file is discarded.
+ *
+ * 5. **Return the Hash**:
+ *    - Returns the object id, or `std::nullopt` if any step failed.
+ */
+template <typename Hash>
+std::optional<ObjectId<Hash>> hash_and_write_blob_streaming(const std::string& file_path, int level) {
+    MappedFile file;
+    if (!file.open(file_path)) {
+        std::cerr << "Error: File '" << file_path << "' not found." << std::endl;
+        return std::nullopt;
+    }
+    std::error_code ec;
+    const std::string header = "blob " + std::to_string(file.size()) + '\0';
+
+    Hash sha;
+    z_stream strm{};
+    if (deflateInit(&strm, level) != Z_OK) {
+        std::cerr << "Error: Failed to initialize zlib deflate stream.\n";
+        return std::nullopt;
+    }
+
+    const std::string temp_path = make_temporary_object_path();
+    std::ofstream object_file(temp_path, std::ios::binary);
+    if (!object_file) {
+        std::cerr << "Error: Could not open file for writing: " << temp_path << '\n';
+        deflateEnd(&strm);
+        return std::nullopt;
+    }
+
+    unsigned char *out_chunk = object_buffers(STREAM_CHUNK_SIZE).output.data();
+    bool ok = true;
+    // Pushes `size` bytes through the hash and deflate, writing out whatever compressed data is produced.
+    auto feed = [&](const char *data, std::size_t size, int flush) {
+        sha.update(data, size);
+        strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        strm.avail_in = static_cast<uInt>(size);
+        do {
+            strm.next_out = out_chunk;
+            strm.avail_out = static_cast<uInt>(STREAM_CHUNK_SIZE);
+            int status;
+            {
+                const uInt avail_in = strm.avail_in;
+                PerfScope scope(PerfPhase::Deflate);
+                status = deflate(&strm, flush);
+                scope.add_bytes(avail_in - strm.avail_in);
+            }
+            if (status == Z_STREAM_ERROR) {
+                ok = false;
+                return;
+            }
+            const std::size_t produced = STREAM_CHUNK_SIZE - strm.avail_out;
+            PerfScope scope(PerfPhase::ObjectWrite, produced);
+            object_file.write(reinterpret_cast<char *>(out_chunk), produced);
+        } while (strm.avail_out == 0);
+    };
+
+    feed(header.data(), header.size(), file.size() == 0 ? Z_FINISH : Z_NO_FLUSH);
+    for (std::size_t offset = 0; ok && offset < file.size(); offset += STREAM_CHUNK_SIZE) {
+        const std::size_t n = std::min(STREAM_CHUNK_SIZE, file.size() - offset);
+        feed(file.data() + offset, n, offset + n == file.size() ? Z_FINISH : Z_NO_FLUSH);
+    }
+    deflateEnd(&strm);
+    object_file.close();
+
+    if (!ok || !object_file) {
+        std::cerr << "Error: Failed to write blob object for '" << file_path << "'.\n";
+        std::filesystem::remove(temp_path, ec);
+        return std::nullopt;
+    }
+
+    const ObjectId<Hash> id = sha.finish();
+    PerfScope scope(PerfPhase::ObjectWrite);
+    std::filesystem::create_directories(id.loose_directory(), ec);
+    const std::string object_path = id.loose_path();
+    if (std::filesystem::exists(object_path, ec)) {
+        // Objects are content addressed, an existing file already holds these exact bytes.
+        std::filesystem::remove(temp_path, ec);
+    } else {
+        std::filesystem::rename(temp_path, object_path, ec);
+        if (ec) {
+            std::cerr << "Error: Could not move object into place: " << object_path << '\n';
+            std::filesystem::remove(temp_path, ec);
+            return std::nullopt;
+        }
+    }
+    return id;
+}
+
+/**
+ * Compresses a full object ("<type> <size>\0<content>") at `level` and returns the compressed bytes,
+ * ready to be queued on an `ObjectWriteBatch`. Returns `std::nullopt` if compression fails.
+ */
+std::optional<std::string> compress_object_format(std::string_view object_format, int level) {
+    uLong bound = deflate_codec().bound(object_format.size());
+    unsigned char *compressedData = object_buffers(bound).output.data();
+    compressFile(object_format, &bound, compressedData, level);
+    if (bound == 0) {
+        return std::nullopt;
+    }
+    return std::string(reinterpret_cast<char *>(compressedData), bound);
+}
+
+/**
+ * Creates the object id (SHA-1 or SHA-256, per `Hash`) of the uncompressed contents of a file, using a Git-style header.
+ * The header format is "blob <size>\0" where <size> is the size of the file in bytes.
  *
  * This function performs the following steps:
  *
  * 1. **Open the File**:
- *    - Opens the file specified by the `file_path` parameter in binary mode for reading.
- *    - If the file cannot be opened, an error message is printed, and an empty string is returned.
- *
- * 2. **Read Compressed Data**:
- *    - Reads the entire content of the file into a `std::string` named `compressed_data`.
- *    - The file is read using an input stream iterator that iterates through each character in binary mode.
- *
- * 3. **Initialize zlib Stream**:
- *    - Initializes a `z_stream` structure for decompression with default values.
- *    - Sets the input size (`avail_in`) and the pointer to the compressed data (`next_in`).
- *    - Configures `zalloc`, `zfree`, and `opaque` to `Z_NULL` (default memory management).
- *    - Calls `inflateInit` to set up the decompression stream.
- *    - If initialization fails, an error message is printed, and an empty string is returned.
- *
- * 4. **Prepare for Decompression**:
- *    - Allocates a buffer (`std::vector<char>`) to hold decompressed data.
- *    - Uses a loop to call `inflate`, decompressing the data in chunks:
- *      - **Set Output Buffer**: Defines the size and location for decompressed data (`avail_out` and `next_out`).
- *      - **Call `inflate`**: Processes data from the input buffer and writes it to the output buffer.
- *      - **Check for Errors**: Handles any errors during decompression (e.g., stream error, data error, memory error).
- *      - **Append Data**: Adds the decompressed data from the buffer to the `decompressed_data` string.
- *      - Continues processing until all compressed data is decompressed (`Z_STREAM_END`).
- *    - Cleans up the zlib stream using `inflateEnd`.
- *
- * 5. **Process Decompressed Data**:
- *    - Initializes a `std::istringstream` with the decompressed data to facilitate further processing.
- *    - Reads the header part of the data using `std::getline` until a null terminator (`'\0'`).
- *    - Reads the remaining part of the data, which is the actual content, into a `std::string`.
- *
- * 6. **Return Actual Data**:
- *    - Returns the string containing the actual content after extracting the header.
- *
- * The function is designed to handle compressed Git object data and separate out the content from the header.
- */
-std::string decompress_git_object_and_remove_header(std::string &file_path) {
-    auto in = std::ifstream(file_path);
-    if(!in.is_open())
+ *    - Maps the file specified by the `file_name` parameter into memory (small files are read instead, see `MappedFile`).
+ *    - If the file cannot be opened, an error message is printed, and `std::nullopt` is returned.
+ *
+ * 2. **Create Git-Style Header**:
+ *    - Constructs a header string that includes the word "blob", the size of the file in bytes, and a null terminator (`'\0'`).
+ *    - The size is the size of the mapping, so header and hashed content always agree.
+ *
+ * 3. **Calculate the Hash**:
+ *    - Feeds the header and then the mapped contents into an incremental `Hash` context, without copying
+ *      the file through iostreams or a buffer first.
+ *    - The context runs on the backend selected for this CPU (see `sha1_backend` and `sha256_backend`).
+ *
+ * 4. **Return the Hash**:
+ *    - Returns the digest as an `ObjectId`, a plain 20- or 32-byte value; callers convert it to hex only for output.
+ *    - Returns `std::nullopt` if the file cannot be read.
+ *
+ * Notes: the SHA hash needs to be computed over the "uncompressed" contents of the file, not the compressed version.
+ * The input for the SHA hash is the header (blob <size>\0) + the actual contents of the file, not just the contents of the file.
+ */
+template <typename Hash>
+std::optional<ObjectId<Hash>> create_sha_hash(const std::string &file_name, bool is_symlink) {
+    std::string store_data;
+    MappedFile file;
+    if (is_symlink) {
+        // Handle symlink by reading its target
+        std::string target_path = std::filesystem::read_symlink(file_name).string();
+        // Create the Git-style header for symlinks: "blob <size>\0".
+        std::string header = "blob " + std::to_string(target_path.size()) + '\0';
+        store_data = header + target_path;
+    } else {
+        // Map the file for reading.
+        if (!file.open(file_name)) {
+            std::cerr << "Error: File '" << file_name << "' not found." << std::endl;
+            return std::nullopt; // No hash if the file cannot be opened.
+        }
+        // Create the Git-style header: "blob <size>\0".
+        store_data = "blob " + std::to_string(file.size()) + '\0';
+    }
+    // Calculate the hash of the header followed by the contents.
+    Hash sha;
+    sha.update(store_data);
+    sha.update(file.view());
+    return sha.finish();
+}
+/**
+ * Creates the object id of a full object string ("<type> <size>\0<content>"), such as a tree format string.
+ *
+ * The function is designed to create a hash for a tree object in Git, but works the same way for
+ * any object whose serialized form is already in memory (blobs of symlinks, commits).
+ */
+template <typename Hash>
+ObjectId<Hash> create_tree_hash(const std::string& tree_format) {
+    return Hash::hash(tree_format);
+}
+
+/**
+ * Stores a file as a blob for `hash-object -w` and returns its id, or `std::nullopt` on failure.
+ *
+ * Objects are content addressed, so a blob that is already in `store` (loose or packed) can never
+ * differ from the file. The file is therefore only hashed first, which is much cheaper than
+ * compressing it: storing the same content again costs one hash and an existence check, with nothing
+ * compressed or written. New content is streamed into the store by `hash_and_write_blob_streaming`,
+ * which hashes the file again while compressing it; a different id means the file changed in between.
+ */
+template <typename Hash>
+std::optional<ObjectId<Hash>> store_blob_file(ObjectStore<Hash>& store, const std::string& file_path, int level) {
+    const std::optional<ObjectId<Hash>> id = create_sha_hash<Hash>(file_path);
+    if (!id || store.exists(*id)) {
+        return id;
+    }
+    const std::optional<ObjectId<Hash>> written_id = hash_and_write_blob_streaming<Hash>(file_path, level);
+    if (written_id && written_id != id) {
+        std::cerr << "Error: '" << file_path << "' changed while it was being stored.\n";
+        return std::nullopt;
+    }
+    return written_id;
+}
+
+/**
+ * Writes the blob for a working tree file whose hash is already known, as part of `write-tree`.
+ *
+ * Small files and symlinks are read into memory, compressed on the calling thread and queued on
+ * `batch`. Files larger than `STREAM_CHUNK_SIZE` are streamed straight into the object store with
+ * `hash_and_write_blob_streaming`, so they are never held in memory. Either way the content is
+ * hashed again while it is written. Objects are compressed at `level`.
+ * Throws `std::runtime_error` if the blob cannot be written or its content no longer hashes to `id` (the
+ * file changed after it was hashed), since the tree would otherwise point at a blob that was never stored.
+ */
+template <typename Hash>
+void store_tree_entry_blob(const std::string& full_path, bool is_symlink, const ObjectId<Hash>& id,
+                           ObjectWriteBatch<Hash>& batch, int level) {
+    std::error_code ec;
+    std::optional<ObjectId<Hash>> written_id;
+    if (!is_symlink && std::filesystem::file_size(full_path, ec) > STREAM_CHUNK_SIZE) {
+        written_id = hash_and_write_blob_streaming<Hash>(full_path, level);
+    } else {
+        std::string content;
+        if (is_symlink) {
+            content = std::filesystem::read_symlink(full_path, ec).string();
+        } else {
+            content = MappedFile(full_path).view();
+        }
+        const std::string object_format = "blob " + std::to_string(content.size()) + '\0' + content;
+        written_id = create_tree_hash<Hash>(object_format);
+        if (written_id == id) {
+            std::optional<std::string> compressed = compress_object_format(object_format, level);
+            if (!compressed) {
+                throw std::runtime_error("unable to compress the blob of '" + full_path + "'");
+            }
+            batch.add(id, std::move(*compressed));
+        }
+    }
+    if (!written_id) {
+        throw std::runtime_error("unable to write the blob of '" + full_path + "'");
+    }
+    if (written_id != id) {
+        throw std::runtime_error("'" + full_path + "' changed while write-tree was running");
+    }
+}
+
+/**
+ * A directory whose tree object is being built by `create_tree_format`.
+ *
+ * `pending` counts the child tasks that still have to fill in their entry's hash, plus one for the
+ * task listing the directory. Whichever task brings it to zero assembles the tree, hands the tree
+ * hash to the parent directory and releases the parent in turn, so no thread ever blocks waiting
+ * for a subdirectory.
+ */
+template <typename Hash>
+struct TreeBuildNode {
+    std::string path;
+    // The entry names back to back; `entries` point into it. Written once, before the entries are made.
+    std::string names;
+    // One per entry, with its id filled in by the task that hashes the entry.
+    std::vector<TreeEntry<Hash>> entries;
+    std::vector<std::unique_ptr<TreeBuildNode<Hash>>> children;
+    std::atomic<std::size_t> pending{1};
+    TreeBuildNode<Hash> *parent = nullptr;
+    std::size_t parent_slot = 0;
+    // Set when any entry below this directory was not served by the stat cache.
+    std::atomic<bool> dirty{false};
+    std::string tree_format; // Only kept for the root; subtrees just report their hash.
+};
+
+/**
+ * State shared by every task of one `create_tree_format` run.
+ */
+template <typename Hash>
+struct TreeBuildContext {
+    TaskGroup& group;
+    // Optional, reuses blob hashes of unchanged files and tree hashes of unchanged directories.
+    StatCache<Hash> *stat_cache;
+    // Optional, receives every blob and tree object that is not in the object store yet.
+    ObjectWriteBatch<Hash> *batch;
+    int compression_level; // For the objects queued on `batch`.
+};
+
+// Stat cache keys are relative to the working directory, without the leading "./".
+std::string stat_cache_key(const std::string& full_path) {
+    return full_path.starts_with("./") ? full_path.substr(2) : full_path;
+}
+
+// Number of files of a directory hashed by one task, so a multi-buffer SHA-1 backend gets enough
+// messages to fill its lanes.
+constexpr std::size_t TREE_HASH_BATCH_SIZE = 2 * SHA1_LANES;
+
+/**
+ * A file or symlink entry of a directory, waiting for its blob hash.
+ */
+template <typename Hash>
+struct TreeBuildFile {
+    std::size_t slot; // Index into the directory's entries.
+    std::string full_path;
+    bool is_symlink;
+    ObjectId<Hash> id;
+    bool cache_hit = false; // Whether `id` came from the stat cache.
+};
+
+/**
+ * Computes the blob hashes of a batch of files and symlinks, reusing the stat cache for every file
+ * whose stat data is unchanged and hashing all the others together with `Hash::hash_many`. The results
+ * are recorded in the cache for the next run.
+ * Throws `std::runtime_error` if a file cannot be read, since the tree cannot be built without it.
+ */
+template <typename Hash>
+void hash_tree_entry_files(std::span<TreeBuildFile<Hash>> files, StatCache<Hash> *stat_cache) {
+    std::vector<StatData> stat_data(files.size());
+    std::vector<char> have_stat(files.size());
+    // Reserved up front: jobs point into these, and (small) contents must not move.
+    std::vector<MappedFile> contents;
+    std::vector<std::string> buffers;
+    std::vector<HashJob<Hash>> jobs;
+    std::vector<std::size_t> job_files;
+    contents.reserve(files.size());
+    buffers.reserve(2 * files.size());
+    jobs.reserve(files.size());
+    for (std::size_t i = 0; i < files.size(); i++) {
+        TreeBuildFile<Hash>& file = files[i];
+        have_stat[i] = stat_cache != nullptr && read_stat_data(file.full_path, stat_data[i]);
+        if (have_stat[i] && stat_cache->lookup(stat_cache_key(file.full_path), stat_data[i], file.id)) {
+            file.cache_hit = true;
+            continue;
+        }
+        std::string_view data;
+        if (file.is_symlink) {
+            std::error_code ec;
+            buffers.push_back(std::filesystem::read_symlink(file.full_path, ec).string());
+            if (ec) {
+                throw std::runtime_error("unable to hash '" + file.full_path + "'");
+            }
+            data = buffers.back();
+        } else {
+            if (!contents.emplace_back().open(file.full_path)) {
+                throw std::runtime_error("unable to hash '" + file.full_path + "'");
+            }
+            data = contents.back().view();
+        }
+        buffers.push_back("blob " + std::to_string(data.size()) + '\0');
+        jobs.push_back({buffers.back(), data, {}});
+        job_files.push_back(i);
+    }
+    Hash::hash_many(jobs);
+    for (std::size_t j = 0; j < jobs.size(); j++) {
+        files[job_files[j]].id = jobs[j].id;
+    }
+    for (std::size_t i = 0; i < files.size(); i++) {
+        if (have_stat[i]) {
+            stat_cache->record(stat_cache_key(files[i].full_path), stat_data[i], files[i].id);
+        }
+    }
+}
+
+template <typename Hash>
+void release_tree_node(TreeBuildNode<Hash> *node, TreeBuildContext<Hash> *context);
+
+/**
+ * Assembles a directory whose entries are all hashed and reports its tree hash to the parent.
+ *
+ * This is the cache-tree step: if every entry below the directory came from the stat cache and the
+ * directory still has the same number of entries as last time, its tree hash cannot have changed and
+ * the cached one is reused without serializing or hashing anything. After a one-file edit only the
+ * directories between that file and the root are rebuilt. The root is always serialized because
+ * `write-tree` needs its contents.
+ */
+template <typename Hash>
+void finish_tree_node(TreeBuildNode<Hash> *node, TreeBuildContext<Hash> *context) {
+    node->children.clear(); // Subtrees are done, free them as early as possible.
+    StatCache<Hash> *stat_cache = context->stat_cache;
+    ObjectWriteBatch<Hash> *batch = context->batch;
+    const std::string key = stat_cache_key(node->path);
+    ObjectId<Hash> tree_id;
+    bool reuse_cached = node->parent != nullptr && stat_cache != nullptr && !node->dirty &&
+                        stat_cache->lookup_tree(key, node->entries.size(), tree_id);
+    // A cached tree whose object went missing from the store has to be rebuilt so it can be written.
+    if (reuse_cached && batch != nullptr && !batch->contains(tree_id)) {
+        reuse_cached = false;
+    }
+    if (!reuse_cached) {
+        node->dirty = true;
+        // Sorting here, once every hash is in, keeps the result independent of the order they completed in.
+        std::string tree_format = serialize_tree<Hash>(node->entries);
+        tree_id = create_tree_hash<Hash>(tree_format);
+        if (batch != nullptr) {
+            if (batch->claim(tree_id)) {
+                std::optional<std::string> compressed = compress_object_format(tree_format, context->compression_level);
+                if (!compressed) {
+                    throw std::runtime_error("unable to compress the tree of '" + node->path + "'");
+                }
+                batch->add(tree_id, std::move(*compressed));
+            }
+        }
+        if (node->parent == nullptr) {
+            node->tree_format = std::move(tree_format);
+        }
+    }
+    if (stat_cache != nullptr) {
+        stat_cache->record_tree(key, node->entries.size(), tree_id);
+    }
+    if (node->parent == nullptr) {
+        return;
+    }
+    if (node->dirty) {
+        node->parent->dirty = true;
+    }
+    node->parent->entries[node->parent_slot].id = tree_id;
+    release_tree_node(node->parent, context);
+}
+
+// Marks one piece of work on `node` as done, finishing the directory when it was the last one.
+template <typename Hash>
+void release_tree_node(TreeBuildNode<Hash> *node, TreeBuildContext<Hash> *context) {
+    if (--node->pending == 0) {
+        finish_tree_node(node, context);
+    }
+}
+
+/**
+ * Lists one directory and schedules the work for each of its entries on `group`.
+ *
+ * 1. **List the Directory**:
+ *    - Collects every entry except `.git` and determines its mode (symlink, executable, regular file or directory).
+ *    - Copies all names into `node->names` and creates `node->entries` pointing into it, before any task is
+ *      started, so neither moves under the tasks later.
+ *
+ * 2. **Schedule the Entries**:
+ *    - Regular files and symlinks get a task that computes their blob hash, consulting the stat cache first.
+ *    - Subdirectories get a child `TreeBuildNode` and a task that lists them in turn.
+ *
+ * 3. **Release the Listing**:
+ *    - Drops the listing's own reference on `node`, which assembles the tree right away for empty directories.
+ */
+template <typename Hash>
+void scan_tree_node(TreeBuildNode<Hash> *node, TreeBuildContext<Hash> *context) {
+    std::vector<std::pair<std::size_t, TreeEntryMode>> listed; // Offset of the name in `names`, mode.
     {
-        std::cout<<"Failed to open " + file_path + " file.\n";
-        return "";
+        PerfScope scope(PerfPhase::DirectoryWalk);
+        for (const auto& entry : std::filesystem::directory_iterator(node->path)) {
+            const std::string_view path = entry.path().native();
+            const std::string_view name = path.substr(path.rfind('/') + 1);
+            if (name == ".git") {
+                continue; // Skip the .git directory.
+            }
+            TreeEntryMode mode;
+            if (entry.is_symlink()) {
+                mode = TreeEntryMode::Symlink;
+            } else if (entry.is_regular_file()) {
+                // Determine the file mode based on its permissions.
+                std::filesystem::perms permissions = entry.status().permissions();
+                if ((permissions & std::filesystem::perms::owner_exec) != std::filesystem::perms::none) {
+                    mode = TreeEntryMode::Executable;
+                } else {
+                    mode = TreeEntryMode::Regular;
+                }
+            } else if (entry.is_directory()) {
+                mode = TreeEntryMode::Directory;
+            } else {
+                continue; // Sockets, fifos and devices cannot be stored in a tree.
+            }
+            listed.emplace_back(node->names.size(), mode);
+            node->names.append(name);
+        }
+        scope.add_bytes(listed.size());
+    }
+    node->entries.reserve(listed.size());
+    for (std::size_t i = 0; i < listed.size(); i++) {
+        const std::size_t end = i + 1 < listed.size() ? listed[i + 1].first : node->names.size();
+        const std::string_view name = std::string_view(node->names).substr(listed[i].first, end - listed[i].first);
+        node->entries.push_back({listed[i].second, name, {}});
+    }
+
+    node->pending += node->entries.size();
+    // Hands a batch of files to a task that hashes them together and fills in their entries.
+    std::vector<TreeBuildFile<Hash>> files;
+    auto hash_files = [node, context](std::vector<TreeBuildFile<Hash>> batch) {
+        context->group.run([node, batch = std::move(batch), context]() mutable {
+            hash_tree_entry_files<Hash>(batch, context->stat_cache);
+            for (const TreeBuildFile<Hash>& file : batch) {
+                if (!file.cache_hit) {
+                    node->dirty = true;
+                }
+                // Only content that is not in the object store yet is read again and written.
+                if (context->batch != nullptr && context->batch->claim(file.id)) {
+                    store_tree_entry_blob(file.full_path, file.is_symlink, file.id, *context->batch,
+                                          context->compression_level);
+                }
+                node->entries[file.slot].id = file.id;
+                release_tree_node(node, context);
+            }
+        });
+    };
+    for (std::size_t slot = 0; slot < node->entries.size(); slot++) {
+        const TreeEntry<Hash>& entry = node->entries[slot];
+        std::string full_path = node->path;
+        full_path += '/';
+        full_path += entry.name;
+        if (entry.is_tree()) {
+            auto child = std::make_unique<TreeBuildNode<Hash>>();
+            child->path = std::move(full_path);
+            child->parent = node;
+            child->parent_slot = slot;
+            TreeBuildNode<Hash> *child_ptr = child.get();
+            node->children.push_back(std::move(child));
+            context->group.run([child_ptr, context] { scan_tree_node(child_ptr, context); });
+        } else {
+            files.push_back({slot, std::move(full_path), entry.mode == TreeEntryMode::Symlink, {}});
+            if (files.size() == TREE_HASH_BATCH_SIZE) {
+                hash_files(std::exchange(files, {}));
+            }
+        }
+    }
+    if (!files.empty()) {
+        hash_files(std::move(files));
+    }
+    release_tree_node(node, context);
+}
+
+/**
+ * Creates a tree format string representing the contents of a directory for use in a Git tree object.
+ *
+ * The directory is walked on a work-stealing `ThreadPool` of `jobs` threads: files are hashed and
+ * subdirectories are listed concurrently, and each directory's tree is assembled as soon as its last
+ * entry has been hashed (see `TreeBuildNode`). Entries are sorted in git's tree order (see
+ * `tree_entry_less`) before serialization, so the result is identical for any number of threads.
+ *
+ * When `stat_cache` is given, files whose stat data matches the cache are not read again, and
+ * directories without any changed entry reuse their cached tree hash.
+ *
+ * When `batch` is given, every blob and tree (including the root) that is not in the object store
+ * yet is compressed at `compression_level` and queued on it; the caller flushes it. Objects that
+ * already exist are not compressed again.
+ *
+ * Returns the root tree format string, including its "tree <size>\0" header.
+ * Filesystem errors are rethrown as `std::filesystem::filesystem_error`, unreadable files as `std::runtime_error`.
+ */
+template <typename Hash>
+std::string create_tree_format(const std::string& directory_path, unsigned jobs, StatCache<Hash> *stat_cache,
+                               ObjectWriteBatch<Hash> *batch, int compression_level) {
+    ThreadPool pool(jobs);
+    TaskGroup group(pool);
+    TreeBuildContext<Hash> context{group, stat_cache, batch, compression_level};
+    TreeBuildNode<Hash> root;
+    root.path = directory_path;
+    group.run([&root, &context] { scan_tree_node(&root, &context); });
+    group.wait();
+    return root.tree_format;
+}
+
+/*
+* The function `create_commit_info()` generates and returns the author and committer lines of a new
+* commit object, followed by the blank line that separates the header from the message:
+*
+*   author {author_name} <{author_email}> {author_date_seconds} {author_date_timezone}
+*   committer {committer_name} <{committer_email}> {committer_date_seconds} {committer_date_timezone}
+*
+* Names, emails and dates come from the environment and the config as in git (see `current_signature`):
+* GIT_AUTHOR_NAME, user.name and so on, and the current time in the local timezone by default.
+*/
+std::string create_commit_info()
+{
+    return "author " + current_signature("AUTHOR").format() + "\ncommitter " + current_signature("COMMITTER").format() + "\n\n";
+}
+
+struct LsTreeOptions {
+    bool recursive = false;
+    bool name_only = false;
+};
+
+/**
+ * Prints the entries of a tree for `ls-tree`, one per line, in the order they are stored
+ * (git stores them sorted already):
+ *
+ *   <mode> <type> <sha>\t<path>    (just <path> with `--name-only`)
+ *
+ * Modes are zero-padded to six digits as git prints them ("040000" for trees). With `-r`, subtrees
+ * are descended into instead of being listed, and paths are relative to the root tree. The subtrees
+ * come from `prefetcher`, which decodes them on the thread pool while the entries before them are
+ * printed. Returns `false` (after printing an error) if a tree cannot be read.
+ */
+template <typename Hash>
+bool list_tree(TreePrefetcher<Hash>& prefetcher, const ObjectId<Hash>& tree_id, std::string_view tree_data,
+               const std::string& prefix, const LsTreeOptions& options, OutputBuffer& output) {
+    // Walk the "<mode> <name>\0<raw id>" entries in place.
+    TreeView<Hash> tree(tree_data);
+    std::string line;
+    for (const TreeEntryView<Hash>& entry : tree) {
+        if (options.recursive && entry.is_tree()) {
+            const std::shared_ptr<const DecodedObject> subtree = prefetcher.get(entry.id);
+            if (!subtree || !list_tree(prefetcher, entry.id, subtree->data, prefix + std::string(entry.name) + "/", options, output)) {
+                return false;
+            }
+            continue;
+        }
+        line.clear();
+        if (!options.name_only) {
+            const std::string_view type = entry.is_tree() ? "tree" : entry.mode == "160000" ? "commit" : "blob";
+            line.append(entry.mode.size() < 6 ? 6 - entry.mode.size() : 0, '0');
+            line.append(entry.mode);
+            line += ' ';
+            line.append(type);
+            line += ' ';
+            line += entry.id.to_hex();
+            line += '\t';
+        }
+        line += prefix;
+        line.append(entry.name);
+        line += '\n';
+        output.write(line);
+    }
+    if (tree.corrupt()) {
+        std::cerr << "Corrupt tree object " << tree_id.to_hex() << '\n';
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Passes the content of an object streamed out of the `ObjectStore` on to an `OutputBuffer`.
+ */
+struct OutputSink : ObjectSink {
+    explicit OutputSink(OutputBuffer& output) : output(output) {}
+    void write(std::string_view data) override { output.write(data); }
+    OutputBuffer& output;
+};
+
+// How many files one checkout task writes; small files are cheap, so tasks take a few at a time.
+constexpr std::size_t CHECKOUT_BATCH_SIZE = 16;
+
+// One blob of a tree being checked out, at `path` relative to the working directory.
+template <typename Hash>
+struct CheckoutFile {
+    std::string path;
+    ObjectId<Hash> id;
+    TreeEntryMode mode = TreeEntryMode::Regular;
+};
+
+/**
+ * Passes the content of a blob streamed out of the `ObjectStore` into a file, or into `target` for a
+ * symbolic link, checking that it is a blob on the way.
+ */
+struct CheckoutSink : ObjectSink {
+    void header(ObjectType type, std::size_t size) override {
+        is_blob = type == ObjectType::Blob;
+        if (fd < 0) {
+            // Only a hint: the size comes from the object header, and link targets are short.
+            target.reserve(std::min<std::size_t>(size, 4096));
+        }
+    }
+    void write(std::string_view data) override {
+        if (fd < 0) {
+            target.append(data);
+            return;
+        }
+        while (ok && !data.empty()) {
+            const ssize_t written = ::write(fd, data.data(), data.size());
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            ok = written > 0;
+            data.remove_prefix(ok ? static_cast<std::size_t>(written) : data.size());
+        }
+    }
+    int fd = -1;
+    bool ok = true;
+    bool is_blob = false;
+    std::string target;
+};
+
+/**
+ * `true` if a tree entry name can be written into the working directory: git refuses empty names,
+ * "." and "..", names with a '/', and ".git" in any case, which could write outside the tree or into
+ * the repository itself.
+ */
+bool is_safe_entry_name(std::string_view name) {
+    if (name.empty() || name == "." || name == ".." || name.find('/') != std::string_view::npos) {
+        return false;
+    }
+    return !(name.size() == 4 && name[0] == '.' && std::tolower(name[1]) == 'g' && std::tolower(name[2]) == 'i' &&
+             std::tolower(name[3]) == 't');
+}
+
+/**
+ * Lists what checking out a tree creates, with the `ls-tree` parser: `directories` in walk order
+ * (parents before children; gitlinks become empty directories, as in git) and every blob in `files`.
+ * Subtrees come from `prefetcher`. Returns `false` (after printing an error) on an unreadable tree, an
+ * unsafe name (see `is_safe_entry_name`), or entries that repeat a name or are not in tree order (see
+ * `tree_entry_less`), which `git fsck` rejects too: files are written in parallel, so a symlink and a
+ * directory of the same name could make a file land outside the working tree.
+ */
+template <typename Hash>
+bool collect_checkout_entries(TreePrefetcher<Hash>& prefetcher, const ObjectId<Hash>& tree_id, std::string_view tree_data,
+                              const std::string& prefix, std::vector<std::string>& directories,
+                              std::vector<CheckoutFile<Hash>>& files) {
+    TreeView<Hash> tree(tree_data);
+    // A blob and a tree of the same name need not be adjacent ("a", "a.c", "a/"), so names are also remembered.
+    std::unordered_set<std::string_view> names;
+    std::optional<TreeEntryView<Hash>> previous;
+    for (const TreeEntryView<Hash>& entry : tree) {
+        if (!is_safe_entry_name(entry.name)) {
+            std::cerr << "error: invalid path '" << prefix << entry.name << "' in tree " << tree_id.to_hex() << '\n';
+            return false;
+        }
+        if (!names.insert(entry.name).second) {
+            std::cerr << "error: duplicate entry '" << prefix << entry.name << "' in tree " << tree_id.to_hex() << '\n';
+            return false;
+        }
+        if (previous && !tree_entry_less(previous->name, previous->is_tree(), entry.name, entry.is_tree())) {
+            std::cerr << "error: tree " << tree_id.to_hex() << " is not sorted at '" << prefix << entry.name << "'\n";
+            return false;
+        }
+        previous = entry;
+        std::string path = prefix + std::string(entry.name);
+        if (entry.is_tree()) {
+            directories.push_back(path);
+            const std::shared_ptr<const DecodedObject> subtree = prefetcher.get(entry.id);
+            if (!subtree || !collect_checkout_entries(prefetcher, entry.id, subtree->data, path + "/", directories, files)) {
+                return false;
+            }
+        } else if (entry.mode == "160000") {
+            directories.push_back(std::move(path));
+        } else {
+            const TreeEntryMode mode = entry.mode == "100755" ? TreeEntryMode::Executable
+                                       : entry.mode == "120000" ? TreeEntryMode::Symlink
+                                                                : TreeEntryMode::Regular;
+            files.push_back({std::move(path), entry.id, mode});
+        }
+    }
+    if (tree.corrupt()) {
+        std::cerr << "Corrupt tree object " << tree_id.to_hex() << '\n';
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes one blob of a checkout: a file with mode 0644 or 0755 (less the umask), or a symbolic link
+ * whose target is the blob's content. Whatever was at the path is replaced.
+ * Returns `false` (after printing an error) if it cannot be written.
+ */
+template <typename Hash>
+bool write_checkout_file(ObjectStore<Hash>& store, const CheckoutFile<Hash>& file) {
+    auto fail = [&](const std::string& what) {
+        std::cerr << ("error: unable to " + what + " '" + file.path + "': " + std::strerror(errno) + "\n");
+        return false;
+    };
+    if (::unlink(file.path.c_str()) != 0 && errno != ENOENT) {
+        // A directory in the way (a tree became a file): remove it with everything below.
+        std::error_code ec;
+        if (!std::filesystem::is_directory(std::filesystem::symlink_status(file.path, ec)) ||
+            !std::filesystem::remove_all(file.path, ec)) {
+            return fail("unlink");
+        }
+    }
+    CheckoutSink sink;
+    if (file.mode != TreeEntryMode::Symlink) {
+        const mode_t permissions = file.mode == TreeEntryMode::Executable ? 0777 : 0666;
+        sink.fd = ::open(file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, permissions);
+        if (sink.fd < 0) {
+            return fail("create file");
+        }
+    }
+    const bool streamed = store.stream(file.id, sink);
+    if (sink.fd >= 0 && ::close(sink.fd) != 0) {
+        sink.ok = false;
+    }
+    if (!streamed) {
+        return false;
+    }
+    if (!sink.is_blob) {
+        std::cerr << ("error: " + file.id.to_hex() + " for '" + file.path + "' is not a blob\n");
+        return false;
+    }
+    if (!sink.ok) {
+        return fail("write file");
+    }
+    if (file.mode == TreeEntryMode::Symlink && ::symlink(sink.target.c_str(), file.path.c_str()) != 0) {
+        return fail("create symlink");
+    }
+    return true;
+}
+
+/**
+ * Writes the tree `tree_id` into the working directory (the current directory), as `checkout` does.
+ *
+ * This function performs the following steps:
+ *
+ * 1. **Walk**:
+ *    - Lists every directory and blob with `collect_checkout_entries`, while a `TreePrefetcher` decodes
+ *      the subtrees on the pool ahead of the walk.
+ *
+ * 2. **Directories**:
+ *    - Creates all directories up front, parents first, replacing files that are in the way, so the
+ *      writers below never create or race on a directory.
+ *
+ * 3. **Files**:
+ *    - Writes the blobs concurrently on the pool, `CHECKOUT_BATCH_SIZE` per task. Each blob is streamed
+ *      into its file (see `ObjectStore::stream`): packed blobs are inflated straight out of the pack
+ *      mapping and written with one `write`, loose ones in chunks, and none of them enter the cache.
+ *
+ * Files that are not in the tree are left alone. Returns `false` (after printing an error) if anything
+ * could not be read or written.
+ */
+template <typename Hash>
+bool checkout_tree(ObjectStore<Hash>& store, const ObjectId<Hash>& tree_id, unsigned jobs) {
+    ThreadPool pool(jobs);
+    std::vector<std::string> directories;
+    std::vector<CheckoutFile<Hash>> files;
+    {
+        TreePrefetcher<Hash> prefetcher(store, pool);
+        prefetcher.prefetch(tree_id);
+        const std::shared_ptr<const DecodedObject> tree = prefetcher.get(tree_id);
+        if (!tree) {
+            return false;
+        }
+        if (tree->type != ObjectType::Tree) {
+            std::cerr << "Not a tree object " << tree_id.to_hex() << '\n';
+            return false;
+        }
+        if (!collect_checkout_entries(prefetcher, tree_id, tree->data, "", directories, files)) {
+            return false;
+        }
+    }
+
+    for (const std::string& directory : directories) {
+        if (::mkdir(directory.c_str(), 0777) == 0) {
+            continue;
+        }
+        std::error_code ec;
+        if (errno == EEXIST && std::filesystem::is_directory(std::filesystem::symlink_status(directory, ec))) {
+            continue;
+        }
+        if (errno != EEXIST || ::unlink(directory.c_str()) != 0 || ::mkdir(directory.c_str(), 0777) != 0) {
+            std::cerr << "error: unable to create directory '" << directory << "': " << std::strerror(errno) << '\n';
+            return false;
+        }
+    }
+
+    std::atomic<bool> ok{true};
+    TaskGroup group(pool);
+    for (std::size_t begin = 0; begin < files.size(); begin += CHECKOUT_BATCH_SIZE) {
+        const std::size_t end = std::min(files.size(), begin + CHECKOUT_BATCH_SIZE);
+        group.run([&, begin, end] {
+            for (std::size_t i = begin; i < end && ok; i++) {
+                if (!write_checkout_file(store, files[i])) {
+                    ok = false;
+                }
+            }
+        });
+    }
+    group.wait();
+    return ok;
+}
+
+/**
+ * Resolves an object name: a full hex id, which is taken as is (whether the object exists is up to the
+ * caller), or an abbreviation of at least `ObjectIdPrefix<Hash>::MIN_HEX_SIZE` digits, which must match
+ * exactly one object in `store` (see `ObjectStore::resolve_prefix`).
+ */
+template <typename Hash>
+typename ObjectStore<Hash>::PrefixMatch resolve_object_name(ObjectStore<Hash>& store, std::string_view name,
+                                                            ObjectId<Hash>& id) {
+    if (const std::optional<ObjectId<Hash>> full = ObjectId<Hash>::from_hex(name)) {
+        id = *full;
+        return ObjectStore<Hash>::PrefixMatch::Unique;
+    }
+    const std::optional<ObjectIdPrefix<Hash>> prefix = ObjectIdPrefix<Hash>::from_hex(name);
+    if (!prefix) {
+        return ObjectStore<Hash>::PrefixMatch::None;
+    }
+    return store.resolve_prefix(*prefix, id);
+}
+
+// `resolve_object_name` for command line arguments: returns `std::nullopt` after printing an error.
+template <typename Hash>
+std::optional<ObjectId<Hash>> parse_object_name(ObjectStore<Hash>& store, std::string_view name) {
+    ObjectId<Hash> id;
+    const typename ObjectStore<Hash>::PrefixMatch match = resolve_object_name(store, name, id);
+    if (match == ObjectStore<Hash>::PrefixMatch::Unique) {
+        return id;
+    }
+    if (match == ObjectStore<Hash>::PrefixMatch::Ambiguous) {
+        std::cerr << "error: short object ID " << name << " is ambiguous\n";
+    }
+    std::cerr << "Not a valid object name " << name << '\n';
+    return std::nullopt;
+}
+
+/**
+ * Serves `cat-file --batch` (`with_content`) and `cat-file --batch-check` from one process.
+ *
+ * Object ids are read from stdin, one per line, and answered in order on stdout with
+ *
+ *   <sha> <type> <size>\n<content>\n    (`--batch`)
+ *   <sha> <type> <size>\n               (`--batch-check`)
+ *   <input> missing\n                   (unknown or invalid ids)
+ *   <input> ambiguous\n                 (abbreviations matching several objects)
+ *
+ * Both sides are buffered (see `LineReader` and `OutputBuffer`), and blob content is streamed into the
+ * output buffer, or written straight from the decoded object when it is larger than the buffer. Output
+ * is only flushed when no complete request is left in the input buffer: a pipeline feeding thousands
+ * of ids gets large writes, while a caller sending one id at a time and waiting still gets each answer
+ * as soon as it is ready. Returns the process exit code.
+ */
+template <typename Hash>
+int cat_file_batch(ObjectStore<Hash>& store, bool with_content) {
+    // Prefixes the content with the "<sha> <type> <size>" line.
+    struct BatchSink : OutputSink {
+        BatchSink(OutputBuffer& output, const ObjectId<Hash>& id) : OutputSink(output), id(id) {}
+        void header(ObjectType type, std::size_t size) override {
+            output.write(id.to_hex());
+            output.put(' ');
+            output.write(object_type_name(type));
+            output.put(' ');
+            output.write(std::to_string(size));
+            output.put('\n');
+        }
+        const ObjectId<Hash>& id;
+    };
+
+    LineReader input;
+    OutputBuffer& output = standard_output();
+    std::string_view line;
+    while (true) {
+        if (!input.has_buffered_line() && !output.flush()) {
+            return EXIT_FAILURE;
+        }
+        if (!input.next(line)) {
+            break;
+        }
+        ObjectId<Hash> id;
+        const typename ObjectStore<Hash>::PrefixMatch match = resolve_object_name(store, line, id);
+        if (match != ObjectStore<Hash>::PrefixMatch::Unique || !store.exists(id)) {
+            output.write(line);
+            output.write(match == ObjectStore<Hash>::PrefixMatch::Ambiguous ? " ambiguous\n" : " missing\n");
+            continue;
+        }
+        BatchSink sink(output, id);
+        if (with_content) {
+            if (!store.stream(id, sink)) {
+                return EXIT_FAILURE;
+            }
+            output.put('\n');
+        } else {
+            ObjectType type;
+            std::size_t size;
+            if (!store.read_info(id, type, size)) {
+                return EXIT_FAILURE;
+            }
+            sink.header(type, size);
+        }
+    }
+    return output.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Most paths `hash-object` takes in at once, so memory stays bounded for any number of paths.
+constexpr std::size_t HASH_OBJECT_BATCH_SIZE = 1024;
+
+/**
+ * Serves `hash-object [-w] [--stdin-paths] <file>...`, printing the blob id of every path, one per line
+ * and in input order. With `write`, the blobs are also stored (see `store_blob_file`), so content the
+ * store already has is only hashed.
+ *
+ * Paths are handled in batches: every path of a batch is hashed (and compressed and written) by its own
+ * task on `pool`, and the ids are printed once the whole batch is done, so the output order never
+ * depends on which thread finished first. With `stdin_paths` the paths come from that reader, one per
+ * line, after `paths`. A batch then ends early when no complete line is left in the input buffer, and
+ * its answers are flushed before waiting for more input, so a caller feeding one path at a time still
+ * gets each id back.
+ * Processing stops at the first file that cannot be stored; the ids before it are still printed.
+ * Returns the process exit code.
+ */
+template <typename Hash>
+int hash_objects(ObjectStore<Hash>& store, const std::vector<std::string>& paths, LineReader *stdin_paths,
+                 bool write, int level, ThreadPool& pool) {
+    OutputBuffer& output = standard_output();
+    std::vector<std::string> batch;
+    std::vector<std::optional<ObjectId<Hash>>> ids;
+    std::size_t next_path = 0;
+    bool input_done = stdin_paths == nullptr;
+    while (true) {
+        batch.clear();
+        while (next_path < paths.size() && batch.size() < HASH_OBJECT_BATCH_SIZE) {
+            batch.push_back(paths[next_path++]);
+        }
+        std::string_view line;
+        while (!input_done && batch.size() < HASH_OBJECT_BATCH_SIZE) {
+            if (!stdin_paths->has_buffered_line()) {
+                if (!batch.empty()) {
+                    break; // Answer what has arrived before waiting for more.
+                }
+                if (!output.flush()) {
+                    return EXIT_FAILURE;
+                }
+            }
+            if (!stdin_paths->next(line)) {
+                input_done = true;
+            } else {
+                batch.emplace_back(line);
+            }
+        }
+        if (batch.empty()) {
+            break;
+        }
+
+        ids.assign(batch.size(), std::nullopt);
+        TaskGroup group(pool);
+        for (std::size_t i = 0; i < batch.size(); i++) {
+            group.run([&, i] {
+                ids[i] = write ? store_blob_file(store, batch[i], level) : create_sha_hash<Hash>(batch[i]);
+            });
+        }
+        group.wait();
+        for (const std::optional<ObjectId<Hash>>& id : ids) {
+            if (!id) {
+                output.flush();
+                return EXIT_FAILURE;
+            }
+            output.write(id->to_hex());
+            output.put('\n');
+        }
+    }
+    return output.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Returns the objects reachability starts from: what `.git/HEAD` points at (a ref or, when detached, a
+ * commit id), every ref under `.git/refs` and every entry of `.git/packed-refs`.
+ */
+template <typename Hash>
+std::vector<ObjectId<Hash>> collect_ref_tips() {
+    std::vector<ObjectId<Hash>> tips;
+    auto add_from_file = [&](const std::filesystem::path& path) {
+        std::ifstream file(path);
+        std::string line;
+        if (std::getline(file, line)) {
+            if (line.starts_with("ref: ")) {
+                return; // Symbolic refs point at a ref that is collected on its own.
+            }
+            if (auto id = ObjectId<Hash>::from_hex(line.substr(0, ObjectId<Hash>::HEX_SIZE))) {
+                tips.push_back(*id);
+            }
+        }
+    };
+    add_from_file(".git/HEAD");
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(".git/refs", ec)) {
+        if (entry.is_regular_file(ec)) {
+            add_from_file(entry.path());
+        }
+    }
+    std::ifstream packed_refs(".git/packed-refs");
+    std::string line;
+    while (std::getline(packed_refs, line)) {
+        // "<sha> <ref>", or "^<sha>" for the object an annotated tag above points at.
+        const std::size_t start = line.starts_with('^') ? 1 : 0;
+        if (auto id = ObjectId<Hash>::from_hex(line.substr(start, ObjectId<Hash>::HEX_SIZE))) {
+            tips.push_back(*id);
+        }
+    }
+    return tips;
+}
+
+/**
+ * Packs every loose object reachable from `tips` into a single new pack and removes the loose copies.
+ *
+ * This function performs the following steps:
+ *
+ * 1. **Walk the Object Graph**:
+ *    - Starting from the tips, follows commits to their tree and parents, tags to their object and trees to
+ *      their entries (submodule entries point into other repositories and are skipped).
+ *    - Packed objects are walked through too, since loose objects can be reachable from them, but only loose
+ *      objects are collected. Packed blobs are never read: a tree entry already says the object is a blob.
+ *    - Every blob and tree remembers the path it was found at, which groups delta candidates by file name.
+ *
+ * 2. **Write the Pack**:
+ *    - Hands the collected objects to `write_pack`, which searches deltas and writes the `.pack`/`.idx` pair.
+ *
+ * 3. **Prune**:
+ *    - Once the pack and its index are in place, deletes the loose files of the packed objects.
+ *      Unreachable loose objects are left alone.
+ *
+ * 4. **Bitmaps** (with `write_bitmaps`):
+ *    - Writes reachability bitmaps for the new pack (see `write_pack_bitmap`), provided it holds everything
+ *      reachable from the tips, i.e. no reachable object was packed before. Without them the pack is
+ *      still complete, so failing to write them only warns.
+ *
+ * Returns the process exit code.
+ */
+template <typename Hash>
+int repack_loose_objects(ObjectStore<Hash>& store, const std::vector<ObjectId<Hash>>& tips, const PackWriteOptions& options,
+                         bool write_bitmaps) {
+    std::unordered_set<ObjectId<Hash>, ObjectIdHash<Hash>> seen;
+    struct PendingObject {
+        ObjectId<Hash> id;
+        std::string path;
+        bool is_blob;
+    };
+    std::vector<PendingObject> stack;
+    for (auto tip = tips.rbegin(); tip != tips.rend(); ++tip) {
+        stack.push_back({*tip, "", false});
+    }
+
+    std::vector<PackObject<Hash>> objects;
+    std::vector<std::string> loose_paths;
+    while (!stack.empty()) {
+        PendingObject pending = std::move(stack.back());
+        stack.pop_back();
+        if (!seen.insert(pending.id).second) {
+            continue;
+        }
+        const bool is_loose = store.is_loose(pending.id);
+        if (!is_loose && pending.is_blob) {
+            if (!store.packs().contains(pending.id)) {
+                std::cerr << "Missing blob " << pending.id.to_hex() << '\n';
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        const std::shared_ptr<const DecodedObject> stored = store.read(pending.id);
+        if (!stored) {
+            return EXIT_FAILURE;
+        }
+        PackObject<Hash> object;
+        object.id = pending.id;
+        object.type = stored->type;
+        object.data = stored->data;
+        object.name_hash = pack_name_hash(pending.path);
+        const std::size_t children = stack.size();
+        if (object.type == ObjectType::Commit || object.type == ObjectType::Tag) {
+            // Header lines up to the first blank line: "tree <sha>", "parent <sha>" or "object <sha>".
+            const std::string_view data = object.data;
+            std::size_t line_start = 0;
+            while (line_start < data.size() && data[line_start] != '\n') {
+                const std::size_t line_end = std::min(data.find('\n', line_start), data.size());
+                const std::string_view line = data.substr(line_start, line_end - line_start);
+                const std::size_t space = line.find(' ');
+                const std::string_view key = line.substr(0, space);
+                if (space != std::string_view::npos && (key == "tree" || key == "parent" || key == "object")) {
+                    if (auto id = ObjectId<Hash>::from_hex(line.substr(space + 1))) {
+                        stack.push_back({*id, "", false});
+                    }
+                }
+                line_start = line_end + 1;
+            }
+        } else if (object.type == ObjectType::Tree) {
+            TreeView<Hash> tree(object.data);
+            for (const TreeEntryView<Hash>& entry : tree) {
+                if (entry.mode == "160000") {
+                    continue;
+                }
+                std::string path = pending.path.empty() ? std::string(entry.name)
+                                                        : pending.path + "/" + std::string(entry.name);
+                stack.push_back({entry.id, std::move(path), !entry.is_tree()});
+            }
+            if (tree.corrupt()) {
+                std::cerr << "Corrupt tree object " << pending.id.to_hex() << '\n';
+                return EXIT_FAILURE;
+            }
+        }
+        // Visit children in the order they were listed.
+        std::reverse(stack.begin() + children, stack.end());
+        if (is_loose) {
+            objects.push_back(std::move(object));
+            loose_paths.push_back(pending.id.loose_path(store.objects_dir()));
+        }
+    }
+
+    OutputBuffer& output = standard_output();
+    if (objects.empty()) {
+        output.write("Nothing new to pack.\n");
+        return EXIT_SUCCESS;
+    }
+    const std::optional<PackWriteResult> result = write_pack(objects, ".git/objects/pack", options);
+    if (!result) {
+        return EXIT_FAILURE;
+    }
+    std::error_code ec;
+    for (const std::string& path : loose_paths) {
+        std::filesystem::remove(path, ec);
+    }
+    output.write("Packed " + std::to_string(objects.size()) + " objects (" + std::to_string(result->deltas) +
+                 " deltas) into " + result->pack_path + "\n");
+    std::size_t bitmaps = 0;
+    if (write_bitmaps && write_pack_bitmap(result->pack_path, objects, tips, bitmaps)) {
+        output.write("Wrote bitmaps for " + std::to_string(bitmaps) + " commits\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Reads what ref `name` (e.g. "HEAD" or "refs/heads/main") points at, following symbolic refs
+ * ("ref: refs/heads/main") through loose ref files and `.git/packed-refs`. Returns `std::nullopt` if
+ * the ref does not exist, such as the branch of a repository without commits.
+ */
+template <typename Hash>
+std::optional<ObjectId<Hash>> read_ref(std::string name) {
+    // Bounds chains of symbolic refs, which could otherwise point at each other forever.
+    for (int depth = 0; depth < 5; depth++) {
+        std::ifstream file(".git/" + name);
+        std::string line;
+        if (std::getline(file, line)) {
+            if (!line.starts_with("ref: ")) {
+                return ObjectId<Hash>::from_hex(line.substr(0, ObjectId<Hash>::HEX_SIZE));
+            }
+            name = line.substr(5);
+            continue;
+        }
+        // "<sha> <ref>" lines; "^<sha>" lines peel the tag above and are skipped.
+        std::ifstream packed_refs(".git/packed-refs");
+        while (std::getline(packed_refs, line)) {
+            if (line.size() == ObjectId<Hash>::HEX_SIZE + 1 + name.size() && line.ends_with(name) &&
+                line[ObjectId<Hash>::HEX_SIZE] == ' ') {
+                return ObjectId<Hash>::from_hex(line.substr(0, ObjectId<Hash>::HEX_SIZE));
+            }
+        }
+        return std::nullopt;
+    }
+    return std::nullopt;
+}
+
+/**
+ * Resolves a revision argument as git does for the forms this tool has: a full hex id, then a ref
+ * ("HEAD", "refs/heads/main", or "main" for a branch or tag), then an abbreviated id. Annotated tags are
+ * peeled to the commit they point at when `commit` is set. Returns `std::nullopt` after printing an error.
+ */
+template <typename Hash>
+std::optional<ObjectId<Hash>> parse_revision(ObjectStore<Hash>& store, std::string_view name, bool commit = true) {
+    std::optional<ObjectId<Hash>> id = ObjectId<Hash>::from_hex(name);
+    if (!id && !name.empty()) {
+        const std::string ref(name);
+        for (const std::string& candidate : {ref, "refs/" + ref, "refs/tags/" + ref, "refs/heads/" + ref}) {
+            if (candidate == "HEAD" || candidate.starts_with("refs/")) {
+                if ((id = read_ref<Hash>(candidate))) {
+                    break;
+                }
+            }
+        }
+    }
+    if (!id && !(id = parse_object_name(store, name))) {
+        return std::nullopt;
+    }
+    // "object <sha>" is the first line of a tag.
+    for (int depth = 0; commit && depth < 16; depth++) {
+        ObjectType type = ObjectType::None;
+        std::size_t size = 0;
+        if (!store.read_info(*id, type, size) || type != ObjectType::Tag) {
+            break;
+        }
+        const std::shared_ptr<const DecodedObject> tag = store.read(*id);
+        if (!tag || !tag->data.starts_with("object ") ||
+            !(id = ObjectId<Hash>::from_hex(std::string_view(tag->data).substr(7, ObjectId<Hash>::HEX_SIZE)))) {
+            std::cerr << "Corrupt tag object in " << name << '\n';
+            return std::nullopt;
+        }
+    }
+    return id;
+}
+
+/**
+ * Checks out `revision` (a commit, tag or tree, see `parse_revision`) into the working directory with
+ * `checkout_tree`. Returns `false` after printing an error.
+ */
+template <typename Hash>
+bool checkout_revision(ObjectStore<Hash>& store, std::string_view revision, unsigned jobs) {
+    const std::optional<ObjectId<Hash>> id = parse_revision(store, revision);
+    if (!id) {
+        return false;
+    }
+    const std::shared_ptr<const DecodedObject> object = store.read(*id);
+    if (!object) {
+        return false;
+    }
+    ObjectId<Hash> tree = *id;
+    if (object->type == ObjectType::Commit) {
+        const std::optional<CommitView<Hash>> commit = parse_commit<Hash>(object->data);
+        if (!commit) {
+            std::cerr << "Corrupt commit object " << id->to_hex() << '\n';
+            return false;
+        }
+        tree = commit->tree;
+    }
+    return checkout_tree(store, tree, jobs);
+}
+
+/**
+ * Points HEAD at a new commit: the branch HEAD names (created if it does not exist yet), or HEAD itself
+ * when it is detached. Returns `false` (after printing an error) if the ref cannot be written.
+ */
+template <typename Hash>
+bool advance_head(const ObjectId<Hash>& commit_id) {
+    std::string ref = "HEAD";
+    if (std::ifstream head(".git/HEAD"); head) {
+        std::string line;
+        if (std::getline(head, line) && line.starts_with("ref: ")) {
+            ref = line.substr(5);
+        }
+    }
+    const std::filesystem::path path = ".git/" + ref;
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    std::ofstream file(path);
+    file << commit_id.to_hex() << '\n';
+    if (!file) {
+        std::cerr << "Failed to update " << path.string() << '\n';
+        return false;
+    }
+    return true;
+}
+
+/**
+ * How many digits ids are abbreviated to at least: `core.abbrev` if it is a number, else git's automatic
+ * length, which grows with the repository so abbreviations stay unique for long. With about 2^n packed
+ * objects two ids are expected to share n/2 bits, so that many bits rounded up to hex digits, but never
+ * fewer than 7.
+ */
+template <typename Hash>
+std::size_t default_abbrev_length(ObjectStore<Hash>& store) {
+    const std::optional<std::string> configured = repository_config().get("core.abbrev");
+    if (configured && *configured != "auto") {
+        if (const std::optional<long long> length = repository_config().get_int("core.abbrev")) {
+            return static_cast<std::size_t>(std::clamp<long long>(*length, ObjectIdPrefix<Hash>::MIN_HEX_SIZE,
+                                                                  ObjectId<Hash>::HEX_SIZE));
+        }
+    }
+    uint64_t count = 0;
+    for (const std::unique_ptr<Packfile<Hash>>& pack : store.packs().packs()) {
+        count += pack->index().size();
+    }
+    const std::size_t bits = count == 0 ? 0 : std::bit_width(count);
+    return std::max<std::size_t>(7, (bits + 1) / 2);
+}
+
+// The shortest abbreviation of `id` from `default_abbrev_length` digits up that names no other object.
+template <typename Hash>
+std::string abbreviate_object_id(ObjectStore<Hash>& store, const ObjectId<Hash>& id) {
+    static const std::size_t min_length = default_abbrev_length(store);
+    const std::string hex = id.to_hex();
+    for (std::size_t length = min_length; length < hex.size(); length++) {
+        ObjectId<Hash> match;
+        const std::optional<ObjectIdPrefix<Hash>> prefix = ObjectIdPrefix<Hash>::from_hex(std::string_view(hex).substr(0, length));
+        if (prefix && store.resolve_prefix(*prefix, match) != ObjectStore<Hash>::PrefixMatch::Ambiguous) {
+            return hex.substr(0, length);
+        }
+    }
+    return hex;
+}
+
+/**
+ * The commits a history command starts from and stops at, from arguments such as `main`, `^v1.0` and
+ * `v1.0..main` (an empty side of ".." means HEAD). With no positive revision `default_head` makes HEAD
+ * the start. Returns `false` (after printing an error) on an unknown revision.
+ */
+template <typename Hash>
+bool parse_revision_range(ObjectStore<Hash>& store, RevisionWalker<Hash>& walker,
+                          const std::vector<std::string>& revisions, bool default_head,
+                          std::vector<uint32_t>& include, std::vector<uint32_t>& exclude) {
+    auto add = [&](std::string_view name, std::vector<uint32_t>& out) {
+        const std::optional<ObjectId<Hash>> id = parse_revision(store, name.empty() ? "HEAD" : name);
+        if (!id) {
+            return false;
+        }
+        const std::optional<uint32_t> node = walker.lookup(*id);
+        if (!node) {
+            return false;
+        }
+        out.push_back(*node);
+        return true;
+    };
+    for (const std::string& revision : revisions) {
+        const std::string_view name = revision;
+        if (const std::size_t dots = name.find(".."); dots != std::string_view::npos) {
+            if (!add(name.substr(0, dots), exclude) || !add(name.substr(dots + 2), include)) {
+                return false;
+            }
+        } else if (name.starts_with('^')) {
+            if (!add(name.substr(1), exclude)) {
+                return false;
+            }
+        } else if (!add(name, include)) {
+            return false;
+        }
+    }
+    if (include.empty() && default_head) {
+        const std::optional<ObjectId<Hash>> head = read_ref<Hash>("HEAD");
+        if (!head) {
+            std::cerr << "fatal: your current branch does not have any commits yet\n";
+            return false;
+        }
+        const std::optional<uint32_t> node = walker.lookup(*head);
+        if (!node) {
+            return false;
+        }
+        include.push_back(*node);
+    }
+    return true;
+}
+
+struct LogOptions {
+    bool oneline = false;
+    bool count = false;   // rev-list: print how many commits there are instead.
+    bool parents = false; // rev-list: print the parents after each commit.
+    bool objects = false; // rev-list: list (or count) the trees and blobs of the commits as well.
+    std::optional<std::size_t> max_count;
+};
+
+/**
+ * Prints the commits of a walk for `log`, as git's default (medium) format does:
+ *
+ *   commit <sha>
+ *   Merge: <parent> <parent>          (merges only, abbreviated)
+ *   Author: <name> <<email>>
+ *   Date:   <author date>
+ *
+ *       <message, indented>
+ *
+ * or one "<abbreviated sha> <subject>" line each with `--oneline`. The walk itself does not read commits
+ * that are in the commit-graph; printing reads each commit it shows. Returns `false` on an unreadable commit.
+ */
+template <typename Hash>
+bool print_log_entry(ObjectStore<Hash>& store, const ObjectId<Hash>& id, const LogOptions& options, bool first,
+                     OutputBuffer& output) {
+    const std::shared_ptr<const DecodedObject> object = store.read(id);
+    if (!object) {
+        return false;
+    }
+    const std::optional<CommitView<Hash>> commit = parse_commit<Hash>(object->data);
+    if (!commit) {
+        std::cerr << "error: corrupt commit " << id.to_hex() << '\n';
+        return false;
+    }
+    std::string text;
+    if (options.oneline) {
+        // The subject is the first paragraph, joined into one line.
+        std::string_view message = commit->message;
+        std::string subject;
+        while (!message.empty() && message.front() != '\n') {
+            const std::size_t end = std::min(message.find('\n'), message.size());
+            subject += subject.empty() ? "" : " ";
+            subject.append(message.substr(0, end));
+            message.remove_prefix(std::min(end + 1, message.size()));
+        }
+        text = abbreviate_object_id(store, id) + " " + subject + "\n";
+        output.write(text);
+        return true;
+    }
+    if (!first) {
+        text += '\n';
+    }
+    text += "commit " + id.to_hex() + '\n';
+    if (commit->parents.size() > 1) {
+        text += "Merge:";
+        for (const ObjectId<Hash>& parent : commit->parents) {
+            text += ' ' + abbreviate_object_id(store, parent);
+        }
+        text += '\n';
+    }
+    const std::optional<Signature> author = Signature::parse(commit->author);
+    if (author) {
+        text += "Author: " + author->name + " <" + author->email + ">\n";
+        text += "Date:   " + format_log_date(author->time, author->tz_offset) + '\n';
+    }
+    text += '\n';
+    std::string_view message = commit->message;
+    while (!message.empty() && message.front() == '\n') {
+        message.remove_prefix(1);
+    }
+    while (message.ends_with('\n')) {
+        message.remove_suffix(1);
+    }
+    while (!message.empty()) {
+        const std::size_t end = std::min(message.find('\n'), message.size());
+        text += "    ";
+        text.append(message.substr(0, end));
+        text += '\n';
+        message.remove_prefix(std::min(end + 1, message.size()));
+    }
+    output.write(text);
+    return true;
+}
+
+/**
+ * Answers `rev-list --count [--objects]` from the reachability bitmaps of a pack: the objects reachable
+ * from `include` AND-NOT those reachable from `exclude`, restricted to commits without `objects`.
+ * Unlike the walk, exclusions cover everything reachable from the excluded commits, not just the trees
+ * of the commits at the boundary (as with git's bitmaps). Returns `std::nullopt` if there are no
+ * bitmaps or they do not cover the commits asked about.
+ */
+template <typename Hash>
+std::optional<std::size_t> count_with_bitmaps(ObjectStore<Hash>& store, const std::vector<ObjectId<Hash>>& include,
+                                              const std::vector<ObjectId<Hash>>& exclude, bool objects) {
+    const std::optional<PackBitmap<Hash>> bitmaps = find_pack_bitmap(store);
+    if (!bitmaps) {
+        return std::nullopt;
+    }
+    std::optional<Bitmap> reachable = bitmaps->reachable(store, include);
+    if (!reachable) {
+        return std::nullopt;
+    }
+    if (!exclude.empty()) {
+        const std::optional<Bitmap> excluded = bitmaps->reachable(store, exclude);
+        if (!excluded) {
+            return std::nullopt;
+        }
+        reachable->and_not(*excluded);
+    }
+    if (!objects) {
+        *reachable &= bitmaps->type_bitmap(ObjectType::Commit);
+    }
+    return reachable->count();
+}
+
+/**
+ * The trees and blobs of `--objects`, after the commits, as git lists them: the tree of every commit
+ * in the order the commits were listed, each depth-first in entry order with the tree before its
+ * entries, as "<sha> <path>" (the root tree has an empty path). Objects reachable from `excluded_trees`
+ * (the trees of the excluded commits at the edge of the walk) and objects listed before are skipped.
+ * Submodule commits are not objects of this repository. Returns `false` on an unreadable tree.
+ */
+template <typename Hash>
+bool list_tree_objects(ObjectStore<Hash>& store, const std::vector<ObjectId<Hash>>& trees,
+                       const std::vector<ObjectId<Hash>>& excluded_trees, bool print, std::size_t& count,
+                       OutputBuffer& output) {
+    std::unordered_set<ObjectId<Hash>, ObjectIdHash<Hash>> seen;
+    auto visit = [&](auto& self, const ObjectId<Hash>& id, bool is_tree, const std::string& path, bool show) -> bool {
+        if (!seen.insert(id).second) {
+            return true;
+        }
+        if (show) {
+            ++count;
+            if (print) {
+                output.write(id.to_hex() + " " + path + "\n");
+            }
+        }
+        if (!is_tree) {
+            return true;
+        }
+        const std::shared_ptr<const DecodedObject> tree = store.read(id);
+        if (!tree) {
+            return false;
+        }
+        TreeView<Hash> view(tree->data);
+        for (const TreeEntryView<Hash>& entry : view) {
+            if (entry.mode == "160000") {
+                continue;
+            }
+            const std::string entry_path = path.empty() ? std::string(entry.name) : path + "/" + std::string(entry.name);
+            if (!self(self, entry.id, entry.is_tree(), entry_path, show)) {
+                return false;
+            }
+        }
+        if (view.corrupt()) {
+            std::cerr << "Corrupt tree object " << id.to_hex() << '\n';
+            return false;
+        }
+        return true;
+    };
+    for (const ObjectId<Hash>& tree : excluded_trees) {
+        if (!visit(visit, tree, true, "", false)) {
+            return false;
+        }
     }
-    const auto blob_data = std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    for (const ObjectId<Hash>& tree : trees) {
+        if (!visit(visit, tree, true, "", true)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    auto buf = std::string();
-    buf.resize(blob_data.size());
-    while(true)
-    {
-        auto len = buf.size();
-        if(auto res = uncompress((uint8_t*)buf.data(), &len, (const uint8_t*)blob_data.data(), blob_data.size()); res == Z_BUF_ERROR)
-        {
-            buf.resize(buf.size()*2);
-        } 
-        else if(res != Z_OK)
-        {
-            std::cout<<"Failed to uncompress (git object)Zlib. (code: " + std::to_string(res) + ")\n";
-            return "";
-        }
-        else
-        {
-            buf.resize(len);
-            break;
+/**
+ * Runs `log` (`with_messages`) or `rev-list` over `revisions`. `rev-list --count` is answered from
+ * reachability bitmaps when a pack has them (and `pack.useBitmaps` is not off), otherwise by walking.
+ * Returns the process exit code.
+ */
+template <typename Hash>
+int list_history(ObjectStore<Hash>& store, const std::vector<std::string>& revisions, const LogOptions& options,
+                 bool with_messages) {
+    RevisionWalker<Hash> walker(store, store.objects_dir() + "/info/commit-graph",
+                                repository_config().get_bool("core.commitGraph").value_or(true));
+    std::vector<uint32_t> include, exclude;
+    if (!parse_revision_range(store, walker, revisions, with_messages, include, exclude)) {
+        return EXIT_FAILURE;
+    }
+    OutputBuffer& output = standard_output();
+    if (options.count && !options.max_count && !options.parents &&
+        repository_config().get_bool("pack.useBitmaps").value_or(true)) {
+        std::vector<ObjectId<Hash>> include_ids, exclude_ids;
+        for (const uint32_t node : include) {
+            include_ids.push_back(walker.commit(node).id);
+        }
+        for (const uint32_t node : exclude) {
+            exclude_ids.push_back(walker.commit(node).id);
+        }
+        if (const std::optional<std::size_t> count = count_with_bitmaps(store, include_ids, exclude_ids, options.objects)) {
+            output.write(std::to_string(*count) + "\n");
+            return EXIT_SUCCESS;
         }
     }
 
-    std::string trimmed_data = buf.substr(buf.find('\0')+1);
-    return trimmed_data;
+    std::size_t shown = 0;
+    bool ok = true;
+    const std::size_t limit = options.max_count.value_or(SIZE_MAX);
+    std::vector<uint32_t> listed; // For `--objects`.
+    const bool walked = limit == 0 || walker.walk(include, exclude, [&](uint32_t node) {
+        const typename RevisionWalker<Hash>::Commit& commit = walker.commit(node);
+        if (with_messages) {
+            ok = print_log_entry(store, commit.id, options, shown == 0, output);
+        } else if (!options.count) {
+            std::string line = commit.id.to_hex();
+            if (options.parents) {
+                ok = walker.load_parents(node);
+                for (const uint32_t parent : walker.commit(node).parents) {
+                    line += ' ' + walker.commit(parent).id.to_hex();
+                }
+            }
+            line += '\n';
+            output.write(line);
+        }
+        if (options.objects) {
+            listed.push_back(node);
+        }
+        return ok && ++shown < limit;
+    });
+    if (!walked || !ok) {
+        return EXIT_FAILURE;
+    }
+    if (options.objects) {
+        // The excluded parents of listed commits: what they reach is already on the other side.
+        std::vector<ObjectId<Hash>> trees, excluded_trees;
+        std::unordered_set<uint32_t> listed_set(listed.begin(), listed.end());
+        for (const uint32_t node : listed) {
+            trees.push_back(walker.commit(node).tree);
+            if (exclude.empty()) {
+                continue;
+            }
+            if (!walker.load_parents(node)) {
+                return EXIT_FAILURE;
+            }
+            for (const uint32_t parent : walker.commit(node).parents) {
+                if (!listed_set.contains(parent)) {
+                    excluded_trees.push_back(walker.commit(parent).tree);
+                }
+            }
+        }
+        if (!list_tree_objects(store, trees, excluded_trees, !options.count, shown, output)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.count) {
+        output.write(std::to_string(shown) + "\n");
+    }
+    return EXIT_SUCCESS;
 }
 
 /**
- * Compresses the contents of a file and formats it as a Git-style blob object.
- * The format of a blob object looks like this: blob <size>\0<content> (size is in bytes)
- *
- * This function performs the following steps:
+ * Writes `.git/objects/info/commit-graph` with every commit reachable from HEAD and the refs.
  *
- * 1. **Open the File**:
- *    - Opens the file specified by the `file_path` parameter in binary mode for reading.
- *    - If the file cannot be opened, an error message is printed, and an empty string is returned.
- *
- * 2. **Read File Data**:
- *    - Reads the entire content of the file into a `std::vector<char>` named `file_data`.
- *    - The file is read using an input stream iterator that iterates through each character in binary mode.
- *    - The `file_data` vector will hold the raw bytes read from the file.
- *
- * 3. **Create Git-style Header**:
- *    - Constructs a header string in the Git object format: "blob <size>\0".
- *    - `file_data.size()` gives the size of the file content, which is converted to a string and appended after "blob ".
- *    - The header is terminated with a null character (`'\0'`).
- *
- * 4. **Combine Header and Data**:
- *    - Combines the Git-style header and the file data into a single `std::string` called `full_data`.
- *    - This string will be the input data for compression.
- *
- * 5. **Initialize zlib Stream**:
- *    - Initializes a `z_stream` structure for compression with default values.
- *    - Sets the input size (`avail_in`) and the pointer to the data to be compressed (`next_in`).
- *    - The `reinterpret_cast<Bytef*>(full_data.data())` converts the `char*` pointer from `std::string::data()` to `Bytef*` needed by zlib.
- *    - Configures `zalloc`, `zfree`, and `opaque` to `Z_NULL` (default memory management).
- *    - Calls `deflateInit` to set up the compression stream with zlib's best compression setting (`Z_BEST_COMPRESSION`).
- *    - If initialization fails, an error message is printed, and an empty string is returned.
- *
- * 6. **Prepare for Compression**:
- *    - Allocates a buffer (`std::vector<char>`) to hold compressed data chunks.
- *    - Uses a loop to call `deflate`, compressing the data in chunks:
- *      - **Set Output Buffer**: Defines the size and location for compressed data (`avail_out` and `next_out`).
- *      - **Call `deflate`**: Processes data from the input buffer and writes compressed data to the output buffer.
- *      - **Check for Errors**: Handles any errors during compression (e.g., stream error).
- *      - **Append Data**: Adds the compressed data from the buffer to the `compressed_data` string.
- *      - Continues processing until all data has been compressed (`strm.avail_out` is not zero).
- *    - Cleans up the zlib stream using `deflateEnd`.
- *
- * 7. **Return Compressed Data**:
- *    - Returns the string containing the compressed data after the compression process is completed.
- *
- * This function is designed to handle file data and compress it in the Git object format.
- */
-
-// This is just utility function below, the description above is for the function underneath this function
-void compressFile(const std::string data, uLong *bound, unsigned char *dest) {
-    compress(dest, bound, (const Bytef *)data.c_str(), data.size());
-}
-
-void compress_blob_data_and_write_to_objects(const std::string& file_path, std::string& buffer) {
-    std::ifstream file(file_path);
-    if (!file.is_open()) {
-        std::cerr << "Error: File '" << file_path << "' not found." << std::endl;
-        return;
+ * Commits already in an existing graph are taken from it, so rewriting the graph after a few new commits
+ * only inflates those. Returns the process exit code.
+ */
+template <typename Hash>
+int write_reachable_commit_graph(ObjectStore<Hash>& store) {
+    const std::string path = store.objects_dir() + "/info/commit-graph";
+    RevisionWalker<Hash> walker(store, path);
+    std::vector<uint32_t> tips;
+    for (const ObjectId<Hash>& tip : collect_ref_tips<Hash>()) {
+        ObjectType type = ObjectType::None;
+        std::size_t size = 0;
+        // Refs may name trees or blobs; annotated tags are peeled to what they point at.
+        const std::optional<ObjectId<Hash>> peeled = parse_revision(store, tip.to_hex());
+        if (peeled && store.read_info(*peeled, type, size) && type == ObjectType::Commit) {
+            const std::optional<uint32_t> node = walker.lookup(*peeled);
+            if (!node) {
+                return EXIT_FAILURE;
+            }
+            tips.push_back(*node);
+        }
     }
-
-    std::stringstream file_data;
-    file_data << file.rdbuf();
-
-    // Combine the header and file data
-    std::string full_data = "blob " + std::to_string(file_data.str().length()) + '\0' + file_data.str();
-
-    uLong bound = compressBound(full_data.size());
-    unsigned char compressedData[bound];
-    compressFile(full_data, &bound, compressedData);
-
-    std::string dir = ".git/objects/" + buffer.substr(0,2);
-    std::filesystem::create_directory(dir);
-    std::string objectPath = dir + "/" + buffer.substr(2);
-    std::ofstream objectFile(objectPath, std::ios::binary);
-    // Ensure the file stream is open before writing
-    if (!objectFile) {
-        std::cerr << "Error: Could not open file for writing: " << objectPath << '\n';
-        return;
+    std::vector<CommitGraphEntry<Hash>> commits;
+    bool ok = true;
+    if (!walker.walk(tips, {}, [&](uint32_t node) {
+            ok = walker.load_parents(node);
+            const typename RevisionWalker<Hash>::Commit& commit = walker.commit(node);
+            CommitGraphEntry<Hash> entry{commit.id, commit.tree, {}, commit.time};
+            for (const uint32_t parent : commit.parents) {
+                entry.parents.push_back(walker.commit(parent).id);
+            }
+            commits.push_back(std::move(entry));
+            return ok;
+        }) || !ok) {
+        return EXIT_FAILURE;
+    }
+    if (!write_commit_graph(commits, path)) {
+        return EXIT_FAILURE;
     }
-    objectFile.write((char *)compressedData, bound);
-    objectFile.close();
-    std::cout<<buffer<<std::endl;
+    standard_output().write("Wrote " + std::to_string(commits.size()) + " commits to " + path + "\n");
+    return EXIT_SUCCESS;
 }
 
 /**
- * Compresses a tree format string using zlib with the best compression settings.
- * 
- * This function performs the following steps:
+ * Creates `.git` in the current directory, with objects named by `format` and HEAD on `branch`.
  *
- * 1. **Initialize zlib Stream**:
- *    - Sets up the zlib stream (`z_stream`) with default values for compression.
- *    - Specifies the input data's size and starting point.
- *    - Initializes the compression process using the best compression level.
- *    - If initialization fails, an error is reported, and the function returns an empty string.
- *
- * 2. **Set Up Compression Buffer**:
- *    - Prepares a buffer to store chunks of compressed data.
- *    - Uses a loop to perform compression in steps:
- *      - **Configure Output Buffer**: Specifies the size and location for storing compressed data.
- *      - **Call `deflate`**: Compresses the input data in chunks.
- *      - **Check for Errors**: Handles any compression errors (e.g., stream error).
- *      - **Append Compressed Data**: Adds the compressed data from the buffer to the final string.
- *      - Continues compression until all input data is processed.
- *    - Ends the compression process and cleans up resources.
- *
- * 3. **Return Compressed Data**:
- *    - Returns the final compressed string containing the tree format.
- * 
- * The function is designed to compress a tree format string in preparation for storage or transmission.
- */
-void compress_tree_format_and_write_to_objects(const std::string& tree_format, std::string& tree_hash_hex) {
-    // Combine the header and file data
-    uLong bound = compressBound(tree_format.size());
-    unsigned char compressedData[bound];
-    compressFile(tree_format, &bound, compressedData);
-
-    std::string dir = ".git/objects/" + tree_hash_hex.substr(0,2);
-    std::filesystem::create_directories(dir);
-    std::string objectPath = dir + "/" + tree_hash_hex.substr(2);
-    std::ofstream objectFile(objectPath, std::ios::binary);
-    // Ensure the file stream is open before writing
-    if (!objectFile) {
-        std::cerr << "Error: Could not open file for writing: " << objectPath << '\n';
-        return;
+ * SHA-1 repositories get no config file, like before. A SHA-256 repository records its format in
+ * `.git/config` as git does, with `core.repositoryformatversion = 1` since older readers must refuse it.
+ * Returns `false` (after printing an error) if something cannot be created.
+ */
+bool create_repository(ObjectFormat format, const std::string& branch = "main") {
+    try {
+        std::filesystem::create_directory(".git");
+        std::filesystem::create_directory(".git/objects");
+        std::filesystem::create_directory(".git/refs");
+
+        std::ofstream headFile(".git/HEAD");
+        if (headFile.is_open()) {
+            headFile << "ref: refs/heads/" << branch << "\n";
+            headFile.close();
+        } else {
+            std::cerr << "Failed to create .git/HEAD file.\n";
+            return false;
+        }
+        if (format == ObjectFormat::Sha256) {
+            std::ofstream config(".git/config");
+            config << "[core]\n\trepositoryformatversion = 1\n[extensions]\n\tobjectformat = " << Sha256::NAME << '\n';
+            if (!config) {
+                std::cerr << "Failed to create .git/config file.\n";
+                return false;
+            }
+        }
+    } catch (const std::filesystem::filesystem_error& e) {
+        std::cerr << e.what() << '\n';
+        return false;
     }
-    objectFile.write((char *)compressedData, bound);
-    objectFile.close();
-    std::cout<<tree_hash_hex<<std::endl;
+    return true;
 }
 
 /**
- * Creates a SHA-1 hash of the uncompressed contents of a file, using a Git-style header.
- * The header format is "blob <size>\0" where <size> is the size of the file in bytes.
- *
- * This function performs the following steps:
- *
- * 1. **Open the File**:
- *    - Opens the file specified by the `file_name` parameter in binary mode for reading.
- *    - If the file cannot be opened, an error message is printed, and an empty string is returned.
- *
- * 2. **Read File Contents**:
- *    - Reads the entire content of the file into a `std::vector<char>` named `file_data`.
- *    - The file is read using an input stream iterator that iterates through each character in binary mode.
- *
- * 3. **Create Git-Style Header**:
- *    - Constructs a header string that includes the word "blob", the size of the file in bytes, and a null terminator (`'\0'`).
- *    - This header, combined with the actual file contents, forms the data to be hashed.
- *
- * 4. **Concatenate Header and File Contents**:
- *    - Concatenates the header and the file data into a single string named `store_data`.
- *
- * 5. **Calculate SHA-1 Hash**:
- *    - Uses the `SHA1` function from a cryptographic library to calculate the SHA-1 hash of the `store_data` string.
- *    - The `hash` array, of size `SHA_DIGEST_LENGTH`, holds the resulting 20-byte (160-bit) hash.
- *
- * 6. **Convert Hash to Hexadecimal String**:
- *    - **Initialize Output Stream**:
- *      - An `std::ostringstream` object named `oss` is created to format the hash as a hexadecimal string.
- *    - **Iterate Over Each Byte**:
- *      - The `hash` array contains 20 bytes of data. Each byte is 8 bits, so the total hash size is 160 bits (20 bytes * 8 bits/byte).
- *      - Each element in the `hash` array is an `unsigned char`, which holds one byte of data.
- *    - **Hexadecimal Conversion**:
- *      - **`std::hex`**: This manipulator sets the output stream to hexadecimal mode. It tells the `ostringstream` to interpret and format the integers in hexadecimal (base 16).
- *      - **`std::setw(2)`**: Ensures that each hexadecimal value is two characters wide. This is crucial because each byte (8 bits) is represented by two hexadecimal digits. For instance, a byte with a value of 15 would be displayed as "0f" in hexadecimal.
- *      - **`std::setfill('0')`**: Pads the output with leading zeros if the hexadecimal value is less than two characters. For example, a value of 5 would be padded to "05".
- *      - **`static_cast<int>(hash[i])`**: Converts the `unsigned char` to an `int` for formatting purposes. This conversion is necessary because the stream manipulators (`std::hex`, `std::setw`, and `std::setfill`) work with `int` values. It ensures that the byte is properly interpreted and displayed as a hexadecimal number.
- *      - Each byte in the `hash` array is processed individually, converted to its hexadecimal representation, and appended to the `oss` stream.
- *    - **Resulting Hexadecimal String**:
- *      - After the loop completes, the `oss` object contains the complete hexadecimal string representation of the SHA-1 hash.
- *      - The `oss.str()` method is used to retrieve this string, which represents the entire hash in a human-readable hexadecimal format.
- *
- * The function assumes that the SHA-1 implementation and relevant libraries are properly included and linked in your project.
- * Notes: the SHA hash needs to be computed over the "uncompressed" contents of the file, not the compressed version.
- * The input for the SHA hash is the header (blob <size>\0) + the actual contents of the file, not just the contents of the file.
+ * Creates `.git` in the current directory for `init [--object-format=<sha1|sha256>]`.
+ * Returns the process exit code.
  */
-std::string create_sha_hash(const std::string &file_name, bool return_in_binary, bool is_symlink = false) {
-    std::string store_data;
-    if (is_symlink) {
-        // Handle symlink by reading its target
-        std::string target_path = std::filesystem::read_symlink(file_name).string();
-        // Create the Git-style header for symlinks: "blob <size>\0".
-        std::string header = "blob " + std::to_string(target_path.size()) + '\0';
-        store_data = header + target_path;
-    } else {
-        // Open the file in binary mode for reading.
-        std::ifstream file(file_name, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Error: File '" << file_name << "' not found." << std::endl;
-            return ""; // Return an empty string if the file cannot be opened.
+int init_repository(int argc, char *argv[]) {
+    ObjectFormat format = ObjectFormat::Sha1;
+    for (int i = 2; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        std::optional<ObjectFormat> requested;
+        if (arg.starts_with("--object-format=")) {
+            requested = object_format_from_name(arg.substr(arg.find('=') + 1));
         }
-        // Read file contents into a vector of characters.
-        std::vector<char> file_data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        file.close(); // Close the file as it is no longer needed.
-        // Create the Git-style header: "blob <size>\0".
-        std::string header = "blob " + std::to_string(file_data.size()) + '\0';
-        store_data = header + std::string(file_data.begin(), file_data.end());
-    }
-    // Array to hold the SHA-1 hash (20 bytes, 160 bits).
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    // Calculate the SHA-1 hash of the concatenated header and file contents.
-    SHA1(reinterpret_cast<const unsigned char *>(store_data.c_str()), store_data.size(), hash);
-
-    if (return_in_binary) {
-        // Return the binary representation of the SHA-1 hash.
-        return std::string(reinterpret_cast<char*>(hash), SHA_DIGEST_LENGTH);
-    } 
-    else {
-        // Create a string stream to convert the hash to a hexadecimal string.
-        std::ostringstream oss;
-        for (int i = 0; i < SHA_DIGEST_LENGTH; ++i) {
-            oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+        if (!requested) {
+            std::cerr << "Invalid arguments for init, expected `[--object-format=<sha1|sha256>]`\n";
+            return EXIT_FAILURE;
         }
-        // Return the final hexadecimal string representation of the SHA-1 hash.
-        return oss.str();
+        format = *requested;
+    }
+    if (!create_repository(format)) {
+        return EXIT_FAILURE;
     }
+    standard_output().write("Initialized mygit repository\n");
+    return EXIT_SUCCESS;
 }
+
 /**
- * Creates a SHA-1 hash of a given tree format string and optionally returns it in hexadecimal format.
- *
- * This function performs the following steps:
- *
- * 1. **Compute SHA-1 Hash**:
- *    - Computes the SHA-1 hash of the input `tree_format` string.
- *    - The hash is stored in a 20-byte array (`hash`).
- *
- * 2. **Return in Desired Format**:
- *    - If `return_in_hex` is `true`, converts the hash to a hexadecimal string.
- *    - If `return_in_hex` is `false`, returns the raw binary hash as a string.
- * 
- * The function is designed to create a hash for a tree object in Git and return it in the desired format.
- */
-std::string create_tree_hash(const std::string& tree_format, bool return_in_hex) {
-    // Step 1: Compute the SHA-1 hash of the tree format string.
-    unsigned char hash[SHA_DIGEST_LENGTH]; // Array to hold the 20-byte SHA-1 hash.
-    SHA1(reinterpret_cast<const unsigned char*>(tree_format.c_str()), tree_format.size(), hash); // Compute the SHA-1 hash.
-    // Step 2: Return the hash in the desired format.
-    if (return_in_hex) {
-        // If the hexadecimal format is requested, convert the hash to a hex string.
-        std::ostringstream hex_stream; // Stream to hold the hex string.
-        for (unsigned char c : hash) {
-            // Convert each byte of the hash to a 2-digit hex value and append to the stream.
-            hex_stream << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
-        }
-        return hex_stream.str(); // Return the hexadecimal string.
+ * Fetches everything reachable from `wants` from `remote` into a pack of the repository in the current
+ * directory. The pack is indexed while it downloads and its deltas are resolved on `jobs` threads (see
+ * `PackIndexer`). Returns `false` after printing an error.
+ */
+template <typename Hash>
+bool fetch_pack(SmartHttpRemote& remote, const std::vector<std::string>& wants, unsigned jobs) {
+    ThreadPool pool(jobs);
+    PackIndexer<Hash> indexer(".git/objects/pack", pool);
+    if (!remote.fetch(wants, [&](std::string_view data) { return indexer.feed(data); })) {
+        return false;
+    }
+    const std::optional<PackWriteResult> result = indexer.finish();
+    if (!result) {
+        return false;
+    }
+    std::cerr << "Received " << indexer.object_count() << " objects, resolved " << result->deltas << " deltas\n";
+    return true;
+}
+
+/**
+ * Writes the refs of a fresh clone from what `ls-refs` listed: branches become `refs/remotes/origin/<branch>`
+ * and tags stay `refs/tags/<tag>`, all in `.git/packed-refs` (with peeled tags) as git writes them, plus
+ * `refs/remotes/origin/HEAD`. The branch the remote HEAD names is created locally with HEAD on it; a
+ * detached remote HEAD is copied as is. Returns `false` after printing an error.
+ */
+bool write_clone_refs(const std::vector<RemoteRef>& refs, const std::string& head_branch) {
+    std::vector<std::pair<std::string, const RemoteRef *>> packed;
+    const RemoteRef *head = nullptr;
+    for (const RemoteRef& ref : refs) {
+        if (ref.name == "HEAD") {
+            head = &ref;
+        } else if (ref.name.starts_with("refs/heads/")) {
+            packed.emplace_back("refs/remotes/origin/" + ref.name.substr(11), &ref);
+        } else if (ref.name.starts_with("refs/tags/")) {
+            packed.emplace_back(ref.name, &ref);
+        }
+    }
+    std::sort(packed.begin(), packed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::string text = "# pack-refs with: peeled fully-peeled sorted \n";
+    for (const auto& [name, ref] : packed) {
+        text += ref->id + ' ' + name + '\n';
+        if (!ref->peeled.empty()) {
+            text += '^' + ref->peeled + '\n';
+        }
+    }
+    std::ofstream packed_refs(".git/packed-refs");
+    packed_refs << text;
+    if (!packed_refs) {
+        std::cerr << "Failed to write .git/packed-refs\n";
+        return false;
+    }
+    if (!head) {
+        return true;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(".git/refs/remotes/origin", ec);
+    std::filesystem::create_directories(".git/refs/heads", ec);
+    std::ofstream local, remote_head;
+    if (!head_branch.empty()) {
+        local.open(".git/refs/heads/" + head_branch);
+        local << head->id << '\n';
+        remote_head.open(".git/refs/remotes/origin/HEAD");
+        remote_head << "ref: refs/remotes/origin/" << head_branch << '\n';
     } else {
-        // Return the raw binary hash as a string.
-        return std::string(reinterpret_cast<char*>(hash), SHA_DIGEST_LENGTH);
+        local.open(".git/HEAD");
+        local << head->id << '\n';
+    }
+    if (!local || (!head_branch.empty() && !remote_head)) {
+        std::cerr << "Failed to write the refs of the clone\n";
+        return false;
     }
+    return true;
 }
 
 /**
- * Creates a tree format string representing the contents of a directory for use in a Git tree object.
+ * `clone [-n] [-j <threads>] <url> [<directory>]`: clones a repository served over smart HTTP(S) using git
+ * protocol version 2.
  *
  * This function performs the following steps:
  *
- * 1. **Initialize Structures**:
- *    - Creates necessary variables and data structures to hold file modes, names, and hashes.
- *
- * 2. **Iterate Through Directory Entries**:
- *    - Loops through all files and subdirectories in the specified `directory_path`.
- *    - For each file, directory, or symlink, calculates the SHA-1 hash, determines the mode, and stores the information.
- *    - Skips the `.git` directory.
- *
- * 3. **Sort Entries**:
- *    - Sorts the collected directory entries alphabetically by their filenames.
- *
- * 4. **Build Tree Format String**:
- *    - Constructs the tree format string by concatenating the mode, name, and hash of each entry.
- *    - Prepends the string with the tree header indicating the type and size of the content.
- *
- * 5. **Return Tree Format String**:
- *    - Returns the final tree format string that can be used to create a Git tree object.
- */
-std::string create_tree_format(const std::string& directory_path) {
-    // Step 1: Initialize structures.
-    std::filesystem::path path(directory_path); // Filesystem path object representing the directory.
-    std::string entries_string; // String to accumulate the entries in the tree format.
-    std::string mode; // String to hold the file mode (permissions).
-    std::string file_hash; // String to hold the SHA-1 hash of the file's content or subtree.
-    std::unordered_map<std::string, std::pair<std::string, std::string>> entries; // Map to store filename, mode, and hash.
-    // Step 2: Iterate through directory entries.
-    for (const auto& entry : std::filesystem::directory_iterator(path)) {
-        if (entry.path().filename() == ".git") {
-            continue; // Skip the .git directory.
-        }
-        // Check if the entry is a regular file.
-        if (entry.is_regular_file()) {
-            std::string full_file_path = entry.path().string(); // Get the full file path.
-            file_hash = create_sha_hash(full_file_path, true); // Compute the SHA-1 hash of the file.
-            // Determine the file mode based on its permissions.
-            std::filesystem::perms permissions = entry.status().permissions();
-            if ((permissions & std::filesystem::perms::owner_exec) != std::filesystem::perms::none) {
-                mode = "100755"; // Executable file mode.
-            } else {
-                mode = "100644"; // Regular file mode.
-            }
-            entries[entry.path().filename().string()] = {mode, file_hash}; // Store the mode and hash.
-        } 
-        // Check if the entry is a symbolic link.
-        else if (entry.is_symlink()) {
-            std::string full_file_path = entry.path().string(); // Get the full path of the symlink.
-            file_hash = create_sha_hash(full_file_path, true, true); // Compute the SHA-1 hash of the symlink.
-            mode = "120000"; // Symlink mode.
-            entries[entry.path().filename().string()] = {mode, file_hash}; // Store the mode and hash.
-        } 
-        // Check if the entry is a directory.
-        else if (entry.is_directory()) {
-            mode = "40000"; // Directory mode.
-            std::string full_directory_path = entry.path().string(); // Get the full path of the directory.
-            std::string tree_format = create_tree_format(full_directory_path); // Recursively create the tree format for the subdirectory.
-            file_hash = create_tree_hash(tree_format, false); // Compute the SHA-1 hash of the subdirectory tree format.
-            entries[entry.path().filename().string()] = {mode, file_hash}; // Store the mode and hash.
+ * 1. **Discovery**:
+ *    - Reads the remote's capabilities, including its object format, which the new repository gets too.
+ *    - Lists HEAD, branches and tags with `ls-refs`.
+ *
+ * 2. **Fetch**:
+ *    - Asks for everything reachable from those refs and indexes the pack as it streams in (`fetch_pack`).
+ *
+ * 3. **Refs and Config**:
+ *    - Writes the refs (`write_clone_refs`) and an `origin` remote with the branch tracking it, as git does.
+ *
+ * 4. **Checkout**:
+ *    - Writes the files of HEAD into the new working tree (`checkout_tree`), unless `-n` is given.
+ *
+ * The directory (default: the last part of the URL without ".git") must not exist or be empty; it is
+ * removed again if the clone fails. For https the server's
+ * certificate is verified unless `http.sslVerify` is off or `GIT_SSL_NO_VERIFY` is set.
+ * Returns the process exit code.
+ */
+int clone_repository(int argc, char *argv[]) {
+    unsigned jobs = parse_job_count(nullptr);
+    bool checkout = true;
+    std::vector<std::string> positional;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-n" || arg == "--no-checkout") {
+            checkout = false;
+        } else if (arg == "-j" && i + 1 < argc) {
+            jobs = parse_job_count(argv[++i]);
+        } else if (arg.starts_with("-j") && arg.size() > 2) {
+            jobs = parse_job_count(arg.c_str() + 2);
+        } else if (arg.starts_with("-") || positional.size() == 2) {
+            positional.clear();
+            break;
+        } else {
+            positional.push_back(arg);
         }
     }
-    // Step 3: Sort the entries by filename.
-    std::vector<std::string> sorted_keys; // Vector to hold sorted filenames.
-    for (const auto& [key, value] : entries) {
-        sorted_keys.push_back(key); // Add the filename to the vector.
+    if (positional.empty()) {
+        std::cerr << "Invalid arguments for clone, expected `[-n] [-j <threads>] <url> [<directory>]`\n";
+        return EXIT_FAILURE;
     }
-    std::sort(sorted_keys.begin(), sorted_keys.end()); // Sort the filenames alphabetically.
-    // Step 4: Build the tree format string.
-    for (int i = 0; i < sorted_keys.size(); i++) {
-        // Concatenate the mode, filename, and hash for each entry in the sorted order.
-        entries_string += entries[sorted_keys[i]].first + " " + sorted_keys[i] + '\0' + entries[sorted_keys[i]].second;
+    const std::optional<Url> url = Url::parse(positional[0]);
+    if (!url) {
+        std::cerr << "Only http:// and https:// URLs can be cloned: " << positional[0] << '\n';
+        return EXIT_FAILURE;
+    }
+    std::string directory = positional.size() == 2 ? positional[1] : "";
+    if (directory.empty()) {
+        std::string_view path = url->path.substr(0, url->path.find('?'));
+        while (path.size() > 1 && path.ends_with('/')) {
+            path.remove_suffix(1);
+        }
+        path = path.substr(path.rfind('/') + 1);
+        if (path.ends_with(".git")) {
+            path.remove_suffix(4);
+        }
+        directory = path.empty() ? url->host : std::string(path);
     }
-    // Prepend the tree header to the accumulated entries string.
-    std::string tree_format_string = "tree " + std::to_string(entries_string.size()) + '\0' + entries_string;
-    // Step 5: Return the final tree format string.
-    return tree_format_string;
-}
-
-
-
-/*
-* The function `get_current_timestamp()` generates and returns the current timestamp
-* as a formatted string. This timestamp includes the date, time, year, and timezone
-* in a format that is used in Git commit objects. The timestamp will be in
-* the format: "Day Month Date HH:MM:SS Year Timezone", e.g., "Mon Aug 26 15:45:30 2024 +0000"
-*/
-std::string get_current_timestamp()
-{
-    // Get the current time as a time_t object, representing the number of seconds since the Unix epoch (January 1, 1970).
-    std::time_t now = std::time(nullptr);
-
-    // Convert the time_t object to a local time structure (std::tm), which breaks
-    // down the time into components like year, month, day, hour, etc.
-    std::tm* local_time = std::localtime(&now);
-
-    // Create a buffer to hold the formatted timestamp string.
-    char buffer[64];
-
-    // Format the local time into a human-readable string using std::strftime,
-    // and store it in the buffer. The format used is:
-    // "%a %b %d %H:%M:%S %Y %Z" which corresponds to:
-    // - %a: Abbreviated weekday name (e.g., Mon)
-    // - %b: Abbreviated month name (e.g., Aug)
-    // - %d: Day of the month (01-31)
-    // - %H:%M:%S: Hour:Minute:Second in 24-hour format
-    // - %Y: Full year (e.g., 2024)
-    // - %z: Timezone offset from UTC (e.g., +0000)
-    std::strftime(buffer, sizeof(buffer), "%a %b %d %H:%M:%S %Y %z", local_time);
-
-    // Return the formatted timesamp as a std::string
-    return std::string(buffer);
-}
-
-/*
-* The function `create_commit_info()` generates and returns a formatted string
-* containing the author and committer information for a Git commit object.
-* The information includes the name, email, and timestamp for both the author
-* and committer, following Git's commit object format. The result is a string
-* with two lines, one for the author and one for the committer, each followed
-* by a newline character.
-*/
-std::string create_commit_info()
-{
-    // Hardcoded values for the author and committer information.
-    // In a real-world scenario, these values would typically be
-    // dynamically generated or retrieved from configuration files.
-
-    std::string author_name = "Author Name";
-    std::string author_email = "authorname@example.com";
-    std::string committer_name = "Author Name";
-    std::string committer_email = "authorname@example.com";
-
-    // Retrieve the current timestamp using the get_current_timestamp() function.
-    // This timestamp will be used for both the author and committer fields.
-    std::string timestamp = get_current_timestamp();
-
-    // Initialize a string to hold the complete commit information
-    std::string commit_info;
-
-    // Format the author information by combining the name, email, and timestamp.
-    // The format used is "author {author_name} <{author_email}> {timestamp}".
-    commit_info += "author" + author_name + " <" + author_email + "> " + timestamp + '\n';
-
-    // Format the committer information similarly, following the pattern:
-    // "committer {committer_name} <{committer_email}> {timestamp}".
-    commit_info += "committer " + committer_name  + " <" + committer_email + "> " + timestamp + '\n';
 
-    // Add an extra newline at the end to separate the commit information from the commit message.
-    commit_info += '\n';
+    std::error_code ec;
+    if (std::filesystem::exists(directory, ec) && !std::filesystem::is_empty(directory, ec)) {
+        std::cerr << "Destination path '" << directory << "' already exists and is not an empty directory.\n";
+        return EXIT_FAILURE;
+    }
+    const bool created = std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        std::cerr << "Could not create directory '" << directory << "': " << ec.message() << '\n';
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path original_directory = std::filesystem::current_path();
+    std::filesystem::current_path(directory, ec);
+    if (ec) {
+        std::cerr << "Could not enter directory '" << directory << "': " << ec.message() << '\n';
+        return EXIT_FAILURE;
+    }
+    std::cerr << "Cloning into '" << directory << "'...\n";
 
-    // Return the fully formatted commit information string
-    return commit_info;
+    // The config read from here on is that of the new repository, which only has the `-c` overrides.
+    HttpOptions http_options;
+    http_options.verify_tls = !std::getenv("GIT_SSL_NO_VERIFY") &&
+                              repository_config().get_bool("http.sslVerify").value_or(true);
+    SmartHttpRemote remote(*url, http_options);
+    std::vector<RemoteRef> refs;
+    const bool ok = [&] {
+        if (!remote.connect() || !remote.list_refs({"HEAD", "refs/heads/", "refs/tags/"}, refs)) {
+            return false;
+        }
+        std::string head_branch = "main";
+        std::vector<std::string> wants;
+        std::unordered_set<std::string> wanted;
+        for (const RemoteRef& ref : refs) {
+            if (ref.name == "HEAD") {
+                head_branch = ref.symref_target.starts_with("refs/heads/") ? ref.symref_target.substr(11) : "";
+            }
+            if (wanted.insert(ref.id).second) {
+                wants.push_back(ref.id);
+            }
+        }
+        if (!create_repository(remote.object_format(), head_branch.empty() ? "main" : head_branch)) {
+            return false;
+        }
+        std::ofstream config(".git/config", std::ios::app);
+        config << "[remote \"origin\"]\n\turl = " << url->to_string() << "\n\tfetch = +refs/heads/*:refs/remotes/origin/*\n";
+        if (!head_branch.empty() && !wants.empty()) {
+            config << "[branch \"" << head_branch << "\"]\n\tremote = origin\n\tmerge = refs/heads/" << head_branch << '\n';
+        }
+        if (!config) {
+            std::cerr << "Failed to write .git/config\n";
+            return false;
+        }
+        config.close();
+        if (wants.empty()) {
+            std::cerr << "warning: You appear to have cloned an empty repository.\n";
+            return true;
+        }
+        const bool has_head = std::any_of(refs.begin(), refs.end(), [](const RemoteRef& ref) { return ref.name == "HEAD"; });
+        return with_object_format(remote.object_format(), [&]<typename Hash>() {
+            if (!fetch_pack<Hash>(remote, wants, jobs) || !write_clone_refs(refs, head_branch)) {
+                return false;
+            }
+            ObjectStore<Hash> store;
+            return !checkout || !has_head || checkout_revision(store, "HEAD", jobs);
+        });
+    }();
+    std::filesystem::current_path(original_directory, ec);
+    if (!ok) {
+        std::filesystem::remove_all(created ? std::filesystem::path(directory) : std::filesystem::path(directory) / ".git", ec);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
 }
 
-int main(int argc, char *argv[])
-{
-    // Flush after every std::cout / std::cerr
-    std::cout << std::unitbuf;
-    std::cerr << std::unitbuf;
-    
-    if (argc < 2) {
-        std::cerr << "No command provided.\n";
+/**
+ * Runs every command that works on an existing repository, whose objects are named with `Hash`.
+ */
+template <typename Hash>
+int run_command(const std::string& command, int argc, char *argv[]) {
+    OutputBuffer& output = standard_output();
+    const std::optional<CompressionLevels> levels = compression_levels();
+    if (!levels) {
         return EXIT_FAILURE;
     }
-    
-    std::string command = argv[1];
-    
-    if (command == "init") { 
-        try {
-            std::filesystem::create_directory(".git");
-            std::filesystem::create_directory(".git/objects");
-            std::filesystem::create_directory(".git/refs");
-    
-            std::ofstream headFile(".git/HEAD");
-            if (headFile.is_open()) {
-                headFile << "ref: refs/heads/main\n";
-                headFile.close();
-            } else {
-                std::cerr << "Failed to create .git/HEAD file.\n";
-                return EXIT_FAILURE;
-            }
-    
-            std::cout << "Initialized mygit repository\n";
-        } catch (const std::filesystem::filesystem_error& e) {
-            std::cerr << e.what() << '\n';
-            return EXIT_FAILURE;
-        }
+    // One object database for the whole command, so every lookup shares its packs and caches.
+    ObjectStore<Hash> store;
+    store.set_compression_level(levels->loose);
+
+    if (command == "cat-file" && argc == 3 && (std::string(argv[2]) == "--batch" || std::string(argv[2]) == "--batch-check")) {
+        return cat_file_batch(store, std::string(argv[2]) == "--batch");
     }
     else if (command == "cat-file") {
         if (argc <= 3) {
@@ -537,89 +2103,208 @@ int main(int argc, char *argv[])
             std::cerr << "Invalid flag for cat-file, expected `-p`\n";
             return EXIT_FAILURE;
         }
-        const std::string value = argv[3];
-        const std::string dir_name = value.substr(0, 2);
-        const std::string blob_sha = value.substr(2);
-        std::string path = ".git/objects/" + dir_name + "/" + blob_sha;
-        std::string file_content = decompress_git_object_and_remove_header(path);
-        std::cout << file_content;
+        const std::optional<ObjectId<Hash>> id = parse_object_name(store, argv[3]);
+        if (!id) {
+            return EXIT_FAILURE;
+        }
+        OutputSink sink(output);
+        if (!store.stream(*id, sink)) {
+            return EXIT_FAILURE;
+        }
     }
     else if(command == "hash-object") {
-        if (argc <= 3) {
-            std::cerr << "Invalid arguments, required `-w test.txt`\n";
-            return EXIT_FAILURE;
+        // `hash-object [-w] [-j N] (--stdin-paths | <file>...)`; `-j` sets the threads hashing and writing.
+        bool write = false;
+        bool stdin_paths = false;
+        unsigned jobs = parse_job_count(nullptr);
+        std::vector<std::string> paths;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-w") {
+                write = true;
+            } else if (arg == "--stdin-paths") {
+                stdin_paths = true;
+            } else if (arg == "-j" && i + 1 < argc) {
+                jobs = parse_job_count(argv[++i]);
+            } else if (arg.starts_with("-j") && arg.size() > 2) {
+                jobs = parse_job_count(arg.c_str() + 2);
+            } else if (arg == "--") {
+                paths.insert(paths.end(), argv + i + 1, argv + argc);
+                break;
+            } else if (!arg.starts_with("-")) {
+                paths.push_back(std::move(arg));
+            } else {
+                paths.clear();
+                stdin_paths = false;
+                break;
+            }
         }
-        std::string flag = argv[2];
-        if (flag != "-w") {
-            std::cerr << "Invalid flag for hash-object, expected `-w`\n";
+        if (stdin_paths == !paths.empty()) {
+            std::cerr << "Invalid arguments for hash-object, expected `[-w] [-j <threads>] (--stdin-paths | <file>...)`\n";
             return EXIT_FAILURE;
         }
-        std::string file_name = argv[3];
-        std::string sha_hash = create_sha_hash(file_name, false);
-        compress_blob_data_and_write_to_objects(file_name, sha_hash);
+        ThreadPool pool(jobs);
+        LineReader input;
+        return hash_objects(store, paths, stdin_paths ? &input : nullptr, write, levels->loose, pool);
     }
     else if (command == "ls-tree") {
-        if (argc <= 3) {
-            std::cerr << "Invalid arguments, required `--name-only <tree_sha>`\n";
+        // `ls-tree [-r] [--name-only] [-j N] <tree_sha>`; `-j` sets the threads prefetching subtrees for `-r`.
+        LsTreeOptions options;
+        unsigned jobs = parse_job_count(nullptr);
+        std::optional<ObjectId<Hash>> tree_id;
+        bool valid = true;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-r") {
+                options.recursive = true;
+            } else if (arg == "--name-only") {
+                options.name_only = true;
+            } else if (arg == "-j" && i + 1 < argc) {
+                jobs = parse_job_count(argv[++i]);
+            } else if (arg.starts_with("-j") && arg.size() > 2) {
+                jobs = parse_job_count(arg.c_str() + 2);
+            } else if (!tree_id && !arg.starts_with("-")) {
+                tree_id = parse_object_name(store, arg);
+                if (!tree_id) {
+                    return EXIT_FAILURE;
+                }
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid || !tree_id) {
+            std::cerr << "Invalid arguments for ls-tree, expected `[-r] [--name-only] [-j <threads>] <tree_sha>`\n";
             return EXIT_FAILURE;
         }
-        std::string flag = argv[2];
-        if (flag != "--name-only") {
-            std::cerr << "Invalid flag for ls-tree, expected `--name-only`\n";
+
+        ThreadPool pool(options.recursive ? jobs : 1);
+        TreePrefetcher<Hash> prefetcher(store, pool);
+        if (options.recursive) {
+            prefetcher.prefetch(*tree_id);
+        }
+        // The tree's content without its header, from its loose file or a pack.
+        const std::shared_ptr<const DecodedObject> tree_object = prefetcher.get(*tree_id);
+        if (!tree_object) {
+            return EXIT_FAILURE;
+        }
+        if (tree_object->type != ObjectType::Tree) {
+            std::cerr << "Not a tree object " << tree_id->to_hex() << '\n';
+            return EXIT_FAILURE;
+        }
+        if (!list_tree(prefetcher, *tree_id, tree_object->data, "", options, standard_output())) {
+            return EXIT_FAILURE;
+        }
+    }
+    else if (command == "checkout") {
+        // `checkout [-j N] [<tree-ish>]`: writes the files of a commit or tree (default HEAD) into the working
+        // directory, on `-j` threads. HEAD is not moved.
+        unsigned jobs = parse_job_count(nullptr);
+        std::optional<std::string> revision;
+        bool valid = true;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-j" && i + 1 < argc) {
+                jobs = parse_job_count(argv[++i]);
+            } else if (arg.starts_with("-j") && arg.size() > 2) {
+                jobs = parse_job_count(arg.c_str() + 2);
+            } else if (!revision && !arg.starts_with("-")) {
+                revision = arg;
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            std::cerr << "Invalid arguments for checkout, expected `[-j <threads>] [<tree-ish>]`\n";
             return EXIT_FAILURE;
         }
-        std::string tree_hash = argv[3];
-        std::string dir = ".git/objects/" + tree_hash.substr(0, 2);
-        std::string file = tree_hash.substr(2);
-        std::string path = dir + "/" + file;
-        //change function name to decompress zlib data
-        //after this function, the tree header will be discarded
-        std::string decompressed_tree_data = decompress_git_object_and_remove_header(path);
-
-        // Store the tree object names inside this vector
-        std::vector<std::string> names;
-        // Loop until the decompressed_tree_data string is empty
-        while (!decompressed_tree_data.empty()) {
-            // The decompressed tree_data string is in this format: 
-            // "<mode> <name>\0<20_byte_sha><mode> <name>\0<20_byte_sha>"
-            // Initialize variables to hold parts of the current tree object entry
-            std::string mode = "";               // Will hold the file mode (e.g., "100644")
-            std::string twenty_byte_hash = "";   // Will hold the SHA-1 hash of the object (20 bytes)
-            std::string tree_file_name = "";     // Will hold the file name
-            // Find the position of the first space in the string, which separates the mode from the file name
-            int empty_space_position = decompressed_tree_data.find(' ');
-            // Extract the mode from the beginning of the string up to the first space
-            mode = decompressed_tree_data.substr(0, empty_space_position);
-
-            // Remove the extracted mode and the space from the original string
-            decompressed_tree_data.erase(0, empty_space_position + 1);
-            // Find the position of the null terminator ('\0') that separates the file name from the SHA-1 hash
-            int null_terminator_position = decompressed_tree_data.find('\0');            
-            // Extract the file name from the string up to the null terminator
-            tree_file_name = decompressed_tree_data.substr(0, null_terminator_position);           
-            // Remove the extracted file name and the null terminator from the original string
-            decompressed_tree_data.erase(0, null_terminator_position + 1);
-            // Extract the next 20 characters, which represent the SHA-1 hash (20 bytes)
-            twenty_byte_hash = decompressed_tree_data.substr(0, 20);         
-            // Remove the extracted SHA-1 hash from the original string
-            decompressed_tree_data.erase(0, 20);
-            // Output the extracted file name to the console
-            names.push_back(tree_file_name);
-        }
-
-        sort(names.begin(), names.end());
-
-        for(int i = 0; i < names.size(); i++)
-        {
-            std::cout<<names[i]<<"\n";
+        if (!checkout_revision(store, revision.value_or("HEAD"), jobs)) {
+            return EXIT_FAILURE;
         }
     }
     else if(command == "write-tree") {
+        // Optional `-j N` selects the number of hashing threads (defaults to all cores).
+        unsigned jobs = parse_job_count(nullptr);
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-j" && i + 1 < argc) {
+                jobs = parse_job_count(argv[++i]);
+            } else if (arg.starts_with("-j") && arg.size() > 2) {
+                jobs = parse_job_count(arg.c_str() + 2);
+            } else {
+                std::cerr << "Invalid arguments for write-tree, expected `[-j <threads>]`\n";
+                return EXIT_FAILURE;
+            }
+        }
         // Generate the tree format string and hash from the working directory
         std::string directory_path = "."; // Assuming current working directory
-        std::string tree_format = create_tree_format(directory_path);
-        std::string tree_hash_hex = create_tree_hash(tree_format, true); // Get hex hash
-        compress_tree_format_and_write_to_objects(tree_format, tree_hash_hex);
+        std::string tree_format;
+        StatCache<Hash> stat_cache;
+        stat_cache.load(".git/stat-cache");
+        // Objects the store already has, loose or packed, are not written again.
+        ObjectWriteBatch<Hash> batch(store.objects_dir(), &store.packs());
+        try {
+            tree_format = create_tree_format<Hash>(directory_path, jobs, &stat_cache, &batch, levels->loose);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+        // Every blob and subtree has been queued on the batch, write out whatever is left.
+        if (!batch.flush()) {
+            return EXIT_FAILURE;
+        }
+        if (!stat_cache.save(".git/stat-cache")) {
+            std::cerr << "Warning: could not update .git/stat-cache\n";
+        }
+        output.write(create_tree_hash<Hash>(tree_format).to_hex());
+        output.put('\n');
+    }
+    else if(command == "repack") {
+        // `repack [-j N] [--window N] [--depth N] [-b] [<object>...]`: objects are extra tips besides HEAD and
+        // refs; `-b` (or `repack.writeBitmaps`) also writes reachability bitmaps.
+        unsigned jobs = parse_job_count(nullptr);
+        bool write_bitmaps = repository_config().get_bool("repack.writeBitmaps").value_or(false);
+        PackWriteOptions options;
+        options.compression_level = levels->pack;
+        std::vector<ObjectId<Hash>> tips = collect_ref_tips<Hash>();
+        auto parse_count = [](const char *value, unsigned& out) {
+            char *end = nullptr;
+            const unsigned long parsed = std::strtoul(value, &end, 10);
+            if (end == value || *end != '\0') {
+                return false;
+            }
+            out = static_cast<unsigned>(parsed);
+            return true;
+        };
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            bool ok = true;
+            if (arg == "-j" && i + 1 < argc) {
+                jobs = parse_job_count(argv[++i]);
+            } else if (arg.starts_with("-j") && arg.size() > 2) {
+                jobs = parse_job_count(arg.c_str() + 2);
+            } else if (arg == "--window" && i + 1 < argc) {
+                ok = parse_count(argv[++i], options.window);
+            } else if (arg == "--depth" && i + 1 < argc) {
+                ok = parse_count(argv[++i], options.depth);
+            } else if (arg == "-b" || arg == "--write-bitmap-index") {
+                write_bitmaps = true;
+            } else if (!arg.starts_with("-")) {
+                const std::optional<ObjectId<Hash>> id = parse_object_name(store, arg);
+                if (!id) {
+                    return EXIT_FAILURE;
+                }
+                tips.push_back(*id);
+            } else {
+                ok = false;
+            }
+            if (!ok) {
+                std::cerr << "Invalid arguments for repack, expected `[-j <threads>] [--window <n>] [--depth <n>] [-b] [<object>...]`\n";
+                return EXIT_FAILURE;
+            }
+        }
+        ThreadPool pool(jobs);
+        options.pool = &pool;
+        return repack_loose_objects(store, tips, options, write_bitmaps);
     }
     else if(command == "commit-tree")
     {
@@ -628,7 +2313,7 @@ int main(int argc, char *argv[])
         * A commit object is a record that includes the current state of the repository,
         * linking it to previous states (if any), and documenting the changes made with 
         * an associated message. The commit object is more complex than other Git objects
-        * like blobs and trees because it includes references to a parent commit (if any),
+        * like blobs and trees because it includes references to its parent commits (if any),
         * author and committer information, and the commit message itself.
         * Unlike other Git objects which are stored as a single line, the commit format
         * contains multiple lines, with each line separated by a newline character('\n').
@@ -636,70 +2321,229 @@ int main(int argc, char *argv[])
         * The commit object format is as follows:
         * 
         * commit {size}\0tree {tree_sha}
-        * parent {parent_sha}   // One or more lines, each starting with "parent {parent_sha}"
+        * parent {parent_sha}   // Zero or more lines, one per `-p`, each starting with "parent {parent_sha}"
         * author {author_name} <{author_email}> {author_date_seconds} {author_date_timezone}
         * committer {committer_name} <{committer_email}> {committer_date_seconds} {committer_date_timezone}
         * 
         * {commit_message}  // The message describing the changes made in this commit
         * 
-        * The commit format is not a single line of text; newlines are used to separate the
-        * different ports of the commit. This structure is necessary for Git to properly
-        * interpret and process the commit object.
-        * 
-        * IMPORTANT TO NOTE: Stirngs that are concatenated with a null byte ('\0'), then concatenated
-        * with some other text, does not mean that test is discarded. This is because  the function is using
-        * std::string rather than c-style strings, which are terminated with the null byte. The ability
-        * to include null bytes within a std::string without terminating the string or losing content is
-        * due to the fact that std::string internally tracks the size of the string independently of the 
-        * null byte. The null byte is just another character within the string, with no special 
-        * terminating role as it has in C-style strings.
+        * Usage: `commit-tree <tree> [-p <parent>]... [-m <message>]...`. Several `-m` options become
+        * separate paragraphs; without any, the message is read from stdin. The tree and parents may be
+        * given as anything `parse_revision` understands (abbreviated ids, HEAD, branch names).
         */
-
-       // Extract the tree hash, commit message, and parent SHA from the command-line arguments.
-       std::string tree_hash = argv[2];
-       std::string commit_message = argv[argc-1];
-       std::string parent_sha = argv[argc-3];
-
-        // Create the commit information, which includes author, committer, and timestamps.
-        std::string commit_info = create_commit_info();
+        std::optional<ObjectId<Hash>> tree_id;
+        std::vector<ObjectId<Hash>> parents;
+        std::string commit_message;
+        bool has_message = false;
+        for (int i = 2; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "-p" && i + 1 < argc) {
+                const std::optional<ObjectId<Hash>> parent = parse_revision(store, argv[++i]);
+                if (!parent) {
+                    return EXIT_FAILURE;
+                }
+                if (std::find(parents.begin(), parents.end(), *parent) != parents.end()) {
+                    std::cerr << "error: duplicate parent " << parent->to_hex() << " ignored\n";
+                    continue;
+                }
+                parents.push_back(*parent);
+            } else if (arg == "-m" && i + 1 < argc) {
+                // Each message is a paragraph of its own and ends with a newline.
+                if (has_message) {
+                    commit_message += '\n';
+                }
+                commit_message += argv[++i];
+                if (!commit_message.ends_with('\n')) {
+                    commit_message += '\n';
+                }
+                has_message = true;
+            } else if (!tree_id && !arg.starts_with("-")) {
+                if (!(tree_id = parse_revision(store, arg, false))) {
+                    return EXIT_FAILURE;
+                }
+            } else {
+                tree_id.reset();
+                break;
+            }
+        }
+        if (!tree_id) {
+            std::cerr << "Invalid arguments for commit-tree, expected `<tree> [-p <parent>]... [-m <message>]...`\n";
+            return EXIT_FAILURE;
+        }
+        ObjectType type = ObjectType::None;
+        std::size_t size = 0;
+        if (!store.read_info(*tree_id, type, size) || type != ObjectType::Tree) {
+            std::cerr << "fatal: " << tree_id->to_hex() << " is not a valid 'tree' object\n";
+            return EXIT_FAILURE;
+        }
+        for (const ObjectId<Hash>& parent : parents) {
+            if (!store.read_info(parent, type, size) || type != ObjectType::Commit) {
+                std::cerr << "fatal: " << parent.to_hex() << " is not a valid 'commit' object\n";
+                return EXIT_FAILURE;
+            }
+        }
+        if (!has_message) {
+            commit_message.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        }
 
         // Format the commit content with the required structure:
         // - The "tree" line followed by the tree hash.
-        // - The "parent" line followed by the parent commit SHA (if applicable).
-        // - The commit info (author and committer information).
+        // - One "parent" line for each parent commit.
+        // - The commit info (author and committer information, and the blank line ending the header).
         // - The commit message.
-        // Each of these parts is separated by a newline character ('\n').
-        std::string commit_content_format = "tree " + tree_hash + '\n' + "parent " + parent_sha + '\n' + commit_info + commit_message + '\n';
-
-        // Create the final commit object format:
-        // - The "commit" line followed by the size of the commit content.
-        // - A null byte ('\0') to separate the header from the content.
-        // - The actual commit content created above.
-
-        std::string commit_format = "commit " + std::to_string(commit_content_format.size()) + '\0' + commit_content_format;
-
-        // Generate the commit hash by creating a SHA-1 hash of the commit object format.
-        // The second argument 'true' indicates that this is the final hash (including compression, etc.).
-        std::string commit_hash = create_tree_hash(commit_format, true); // Even though the function is called create_tree_hash, functionally the commit hash is made the same way
+        std::string commit_content_format = "tree " + tree_id->to_hex() + '\n';
+        for (const ObjectId<Hash>& parent : parents) {
+            commit_content_format += "parent " + parent.to_hex() + '\n';
+        }
+        commit_content_format += create_commit_info() + commit_message;
 
-        // Write the commit hash to the .git/HEAD file, which points to the latest commit.
-        std::ofstream main_directory_path(".git/HEAD");
-        if(main_directory_path.is_open())
-        {
-            main_directory_path << commit_hash;
-            main_directory_path.close();
+        // Store the commit object. The store adds the "commit <size>\0" header in front of the content,
+        // and the commit id is the hash of the resulting commit object format.
+        const std::optional<ObjectId<Hash>> commit_id = store.write(ObjectType::Commit, commit_content_format);
+        if (!commit_id) {
+            return EXIT_FAILURE;
         }
 
-        // Prepare to store the commit object in the .git/objects directory.
-        // The commit hash is split into two parts:
-        // - The first two characters determine the directory name.
-        // - The remaining characters are used for the file name.
-        compress_tree_format_and_write_to_objects(commit_format, commit_hash);
+        // Move HEAD (the branch it names) to the new commit, so `log` and `repack` start from it.
+        if (!advance_head(*commit_id)) {
+            return EXIT_FAILURE;
+        }
+        output.write(commit_id->to_hex());
+        output.put('\n');
+    }
+    else if (command == "log" || command == "rev-list") {
+        // `log [--oneline] [-n <count>] [<revision>...]` (HEAD by default) and
+        // `rev-list [--count] [--parents] [--objects] [-n <count>] <revision>...`; revisions may be `^<rev>`
+        // or `<a>..<b>`.
+        const bool is_log = command == "log";
+        LogOptions options;
+        std::vector<std::string> revisions;
+        bool valid = true;
+        auto parse_max_count = [&](const char *value) {
+            char *end = nullptr;
+            const unsigned long long parsed = std::strtoull(value, &end, 10);
+            valid = valid && end != value && *end == '\0';
+            options.max_count = static_cast<std::size_t>(parsed);
+        };
+        for (int i = 2; i < argc && valid; i++) {
+            const std::string arg = argv[i];
+            if (is_log && arg == "--oneline") {
+                options.oneline = true;
+            } else if (!is_log && arg == "--count") {
+                options.count = true;
+            } else if (!is_log && arg == "--parents") {
+                options.parents = true;
+            } else if (!is_log && arg == "--objects") {
+                options.objects = true;
+            } else if (arg == "-n" && i + 1 < argc) {
+                parse_max_count(argv[++i]);
+            } else if (arg.starts_with("-n") && arg.size() > 2) {
+                parse_max_count(argv[i] + 2);
+            } else if (arg.starts_with("--max-count=")) {
+                parse_max_count(argv[i] + 12);
+            } else if (arg.size() > 1 && arg[0] == '-' && std::isdigit(static_cast<unsigned char>(arg[1]))) {
+                parse_max_count(argv[i] + 1);
+            } else if (arg == "--") {
+                break;
+            } else if (!arg.starts_with("-")) {
+                revisions.push_back(arg);
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid || (!is_log && revisions.empty())) {
+            std::cerr << (is_log ? "Invalid arguments for log, expected `[--oneline] [-n <count>] [<revision>...]`\n"
+                                 : "Invalid arguments for rev-list, expected `[--count] [--parents] [--objects] [-n <count>] <revision>...`\n");
+            return EXIT_FAILURE;
+        }
+        const int status = list_history(store, revisions, options, is_log);
+        if (status != EXIT_SUCCESS) {
+            output.flush();
+            return status;
+        }
+    }
+    else if (command == "merge-base") {
+        // `merge-base [--all] <a> <b>` prints the best common ancestor(s);
+        // `merge-base --is-ancestor <a> <b>` exits with 0 if <a> is an ancestor of <b> and 1 otherwise.
+        bool all = false;
+        bool is_ancestor = false;
+        std::vector<std::string> revisions;
+        for (int i = 2; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--all") {
+                all = true;
+            } else if (arg == "--is-ancestor") {
+                is_ancestor = true;
+            } else if (!arg.starts_with("-")) {
+                revisions.push_back(arg);
+            } else {
+                revisions.clear();
+                break;
+            }
+        }
+        if (revisions.size() != 2) {
+            std::cerr << "Invalid arguments for merge-base, expected `[--all] <commit> <commit>` or `--is-ancestor <commit> <commit>`\n";
+            return EXIT_FAILURE;
+        }
+        RevisionWalker<Hash> walker(store, store.objects_dir() + "/info/commit-graph",
+                                    repository_config().get_bool("core.commitGraph").value_or(true));
+        std::optional<uint32_t> nodes[2];
+        for (int i = 0; i < 2; i++) {
+            const std::optional<ObjectId<Hash>> id = parse_revision(store, revisions[i]);
+            if (!id || !(nodes[i] = walker.lookup(*id))) {
+                return EXIT_FAILURE;
+            }
+        }
+        if (is_ancestor) {
+            const std::optional<bool> result = walker.is_ancestor(*nodes[0], *nodes[1]);
+            if (!result) {
+                return 128;
+            }
+            return *result ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        const std::optional<std::vector<uint32_t>> bases = walker.merge_bases(*nodes[0], *nodes[1]);
+        if (!bases) {
+            return 128;
+        }
+        if (bases->empty()) {
+            return EXIT_FAILURE;
+        }
+        for (const uint32_t base : *bases) {
+            output.write(walker.commit(base).id.to_hex());
+            output.put('\n');
+            if (!all) {
+                break;
+            }
+        }
+    }
+    else if (command == "commit-graph") {
+        // `commit-graph write`: one graph of every commit reachable from HEAD and the refs.
+        if (argc != 3 || std::string_view(argv[2]) != "write") {
+            std::cerr << "Invalid arguments for commit-graph, expected `write`\n";
+            return EXIT_FAILURE;
+        }
+        const int status = write_reachable_commit_graph(store);
+        if (status != EXIT_SUCCESS) {
+            return status;
+        }
     }
     else {
         std::cerr << "Unknown command " << command << '\n';
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    // A failed final write (a full disk, a closed pipe) must not look like success.
+    return output.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+
+template std::optional<ObjectId<Sha1>> hash_and_write_blob_streaming<Sha1>(const std::string&, int);
+template std::optional<ObjectId<Sha256>> hash_and_write_blob_streaming<Sha256>(const std::string&, int);
+template std::optional<ObjectId<Sha1>> create_sha_hash<Sha1>(const std::string&, bool);
+template std::optional<ObjectId<Sha256>> create_sha_hash<Sha256>(const std::string&, bool);
+template std::optional<ObjectId<Sha1>> store_blob_file<Sha1>(ObjectStore<Sha1>&, const std::string&, int);
+template std::optional<ObjectId<Sha256>> store_blob_file<Sha256>(ObjectStore<Sha256>&, const std::string&, int);
+template std::string create_tree_format<Sha1>(const std::string&, unsigned, StatCache<Sha1> *, ObjectWriteBatch<Sha1> *, int);
+template std::string create_tree_format<Sha256>(const std::string&, unsigned, StatCache<Sha256> *, ObjectWriteBatch<Sha256> *,
+                                                int);
+template int run_command<Sha1>(const std::string&, int, char *[]);
+template int run_command<Sha256>(const std::string&, int, char *[]);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "compression.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "object_write_batch.hpp"
+#include "stat_cache.hpp"
+
+/**
+ * The commands and the object file functions of `Server.cpp`, for `main.cpp` and the benchmarks in
+ * `bench/`. The templates are instantiated for `Sha1` and `Sha256` at the end of `Server.cpp`.
+ */
+
+// Reads and decompresses a loose object, returning only its content; empty (after printing an error) on failure.
+std::string decompress_git_object_and_remove_header(const std::string &file_path);
+
+// Hashes a file as a blob and streams it compressed at `level` into `.git/objects`; `std::nullopt` on failure.
+template <typename Hash>
+std::optional<ObjectId<Hash>> hash_and_write_blob_streaming(const std::string& file_path, int level);
+
+// The blob id of a file (or of a symlink's target), without writing anything; `std::nullopt` if it cannot be read.
+template <typename Hash>
+std::optional<ObjectId<Hash>> create_sha_hash(const std::string &file_name, bool is_symlink = false);
+
+// Stores a file as a blob for `hash-object -w`, compressing it only if the store does not have it yet.
+template <typename Hash>
+std::optional<ObjectId<Hash>> store_blob_file(ObjectStore<Hash>& store, const std::string& file_path, int level);
+
+// The tree object ("tree <size>\0" and entries) of a directory, built on `jobs` threads; see `Server.cpp`.
+template <typename Hash>
+std::string create_tree_format(const std::string& directory_path, unsigned jobs = 1, StatCache<Hash> *stat_cache = nullptr,
+                               ObjectWriteBatch<Hash> *batch = nullptr,
+                               int compression_level = CompressionLevels().loose);
+
+// `init` and `clone`, which run before there is a repository whose object format could be read.
+int init_repository(int argc, char *argv[]);
+int clone_repository(int argc, char *argv[]);
+
+// Every other command, in a repository that uses `Hash`.
+template <typename Hash>
+int run_command(const std::string& command, int argc, char *argv[]);
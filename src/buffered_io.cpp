@@ -0,0 +1,133 @@
+#include "buffered_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+
+OutputBuffer::OutputBuffer(int fd, std::size_t capacity, FlushPolicy policy)
+    : fd_(fd), buffer_(std::max<std::size_t>(capacity, 1)), policy_(policy) {}
+
+OutputBuffer& standard_output() {
+    static OutputBuffer output(STDOUT_FILENO, OutputBuffer::DEFAULT_CAPACITY,
+                               isatty(STDOUT_FILENO) ? FlushPolicy::EachLine : FlushPolicy::WhenFull);
+    return output;
+}
+
+void OutputBuffer::write(std::string_view data) {
+    write_buffered(data);
+    if (policy_ == FlushPolicy::EachLine && data.find('\n') != std::string_view::npos) {
+        flush();
+    }
+}
+
+void OutputBuffer::write_buffered(std::string_view data) {
+    if (data.size() <= buffer_.size() - used_) {
+        std::memcpy(buffer_.data() + used_, data.data(), data.size());
+        used_ += data.size();
+        return;
+    }
+    if (data.size() < buffer_.size()) {
+        // Fill the buffer up, write it out, keep the rest.
+        const std::size_t head = buffer_.size() - used_;
+        std::memcpy(buffer_.data() + used_, data.data(), head);
+        used_ = buffer_.size();
+        flush();
+        std::memcpy(buffer_.data(), data.data() + head, data.size() - head);
+        used_ = data.size() - head;
+        return;
+    }
+    // A large region goes out directly, together with whatever was buffered before it.
+    iovec regions[2] = {{buffer_.data(), used_}, {const_cast<char *>(data.data()), data.size()}};
+    if (!write_regions(regions, 2)) {
+        failed_ = true;
+    }
+    used_ = 0;
+}
+
+bool OutputBuffer::flush() {
+    if (used_ > 0) {
+        iovec region = {buffer_.data(), used_};
+        if (!write_regions(&region, 1)) {
+            failed_ = true;
+        }
+        used_ = 0;
+    }
+    return !failed_;
+}
+
+bool OutputBuffer::write_regions(iovec *regions, int count) {
+    while (count > 0) {
+        if (regions->iov_len == 0) {
+            ++regions;
+            --count;
+            continue;
+        }
+        const ssize_t written = ::writev(fd_, regions, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // Skip past what was written, which may end in the middle of a region.
+        std::size_t left = static_cast<std::size_t>(written);
+        while (count > 0 && left >= regions->iov_len) {
+            left -= regions->iov_len;
+            ++regions;
+            --count;
+        }
+        if (count > 0) {
+            regions->iov_base = static_cast<char *>(regions->iov_base) + left;
+            regions->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+LineReader::LineReader(int fd, std::size_t capacity) : fd_(fd), buffer_(std::max<std::size_t>(capacity, 1)) {}
+
+bool LineReader::has_buffered_line() const {
+    return std::find(buffer_.begin() + begin_, buffer_.begin() + end_, '\n') != buffer_.begin() + end_ ||
+           (eof_ && begin_ < end_);
+}
+
+bool LineReader::next(std::string_view& line) {
+    std::size_t scanned = begin_;
+    while (true) {
+        const auto newline = std::find(buffer_.begin() + scanned, buffer_.begin() + end_, '\n');
+        if (newline != buffer_.begin() + end_) {
+            const std::size_t end = newline - buffer_.begin();
+            line = std::string_view(buffer_.data() + begin_, end - begin_);
+            begin_ = end + 1;
+            return true;
+        }
+        if (eof_) {
+            if (begin_ == end_) {
+                return false;
+            }
+            line = std::string_view(buffer_.data() + begin_, end_ - begin_);
+            begin_ = end_;
+            return true;
+        }
+        // Make room: move the partial line to the front, and grow if it fills the whole buffer.
+        if (begin_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        scanned = end_;
+        const ssize_t n = ::read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            eof_ = true;
+        } else {
+            end_ += static_cast<std::size_t>(n);
+        }
+    }
+}
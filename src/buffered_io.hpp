@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+// When an `OutputBuffer` writes out what it has collected, see below.
+enum class FlushPolicy { WhenFull, EachLine };
+
+/**
+ * Buffered output straight to a file descriptor, bypassing iostreams.
+ *
+ * Small writes are collected in one large buffer and leave the process with a single `write` once it
+ * fills up. Writes of at least a buffer's worth (a whole blob, say) are not copied at all: the
+ * buffered bytes and the new region go out together in one `writev`.
+ *
+ * When output becomes visible is an explicit policy:
+ *   - `FlushPolicy::WhenFull` writes only when the buffer is full, on `flush` and on destruction. This is
+ *     what pipes and files get, so listing a large tree takes a handful of syscalls instead of one per line.
+ *   - `FlushPolicy::EachLine` also writes at the end of every line, for a person watching a terminal.
+ */
+class OutputBuffer {
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 256 * 1024;
+
+    explicit OutputBuffer(int fd = STDOUT_FILENO, std::size_t capacity = DEFAULT_CAPACITY,
+                          FlushPolicy policy = FlushPolicy::WhenFull);
+    ~OutputBuffer() { flush(); }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(std::string_view data);
+    void put(char c) {
+        if (used_ == buffer_.size()) {
+            flush();
+        }
+        buffer_[used_++] = c;
+        if (c == '\n' && policy_ == FlushPolicy::EachLine) {
+            flush();
+        }
+    }
+
+    // Writes out everything buffered. Returns `false` if any write failed so far.
+    bool flush();
+
+    bool ok() const { return !failed_; }
+
+private:
+    void write_buffered(std::string_view data);
+
+    // Writes `count` regions completely, retrying short writes. Returns `false` on error.
+    bool write_regions(struct iovec *regions, int count);
+
+    int fd_;
+    std::vector<char> buffer_;
+    std::size_t used_ = 0;
+    FlushPolicy policy_;
+    bool failed_ = false;
+};
+
+/**
+ * The process-wide buffer for stdout, which every command writes through. It flushes each line when
+ * stdout is a terminal and only when full otherwise, and is flushed when the process exits.
+ */
+OutputBuffer& standard_output();
+
+/**
+ * Reads newline-terminated lines from a file descriptor through a buffer, like `std::getline` without
+ * iostreams. `has_buffered_line` tells whether the next line is already in memory, so a caller serving
+ * requests interactively can flush its answers exactly when it is about to wait for more input.
+ */
+class LineReader {
+public:
+    explicit LineReader(int fd = STDIN_FILENO, std::size_t capacity = 64 * 1024);
+
+    // Returns the next line (without its '\n') in `line`, valid until the next call, or `false` at the end
+    // of the input. A final line without a newline is returned as well.
+    bool next(std::string_view& line);
+
+    // `true` if `next` can return a line without reading from the descriptor.
+    bool has_buffered_line() const;
+
+private:
+    int fd_;
+    std::vector<char> buffer_;
+    std::size_t begin_ = 0; // Start of the unread data.
+    std::size_t end_ = 0;   // End of the data read so far.
+    bool eof_ = false;
+};
@@ -0,0 +1,100 @@
+#include "commit.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+namespace {
+
+// Parses "<seconds> <+hhmm>". Returns `false` if either part is malformed.
+bool parse_date(std::string_view text, int64_t& time, int& tz_offset) {
+    const std::size_t space = text.find(' ');
+    if (space == std::string_view::npos) {
+        return false;
+    }
+    const std::string_view seconds = text.substr(0, space);
+    const std::string_view zone = text.substr(space + 1);
+    const auto [end, error] = std::from_chars(seconds.data(), seconds.data() + seconds.size(), time);
+    if (error != std::errc() || end != seconds.data() + seconds.size() || zone.size() != 5 ||
+        (zone[0] != '+' && zone[0] != '-')) {
+        return false;
+    }
+    int hhmm = 0;
+    const auto [zone_end, zone_error] = std::from_chars(zone.data() + 1, zone.data() + zone.size(), hhmm);
+    if (zone_error != std::errc() || zone_end != zone.data() + zone.size()) {
+        return false;
+    }
+    tz_offset = (hhmm / 100 * 60 + hhmm % 100) * (zone[0] == '-' ? -1 : 1);
+    return true;
+}
+
+// `GIT_<role>_<field>`, or `std::nullopt` if it is unset.
+std::optional<std::string> role_variable(std::string_view role, std::string_view field) {
+    const std::string name = "GIT_" + std::string(role) + "_" + std::string(field);
+    const char *value = std::getenv(name.c_str());
+    return value != nullptr ? std::optional<std::string>(value) : std::nullopt;
+}
+
+} // namespace
+
+std::string Signature::format() const {
+    const int minutes = tz_offset < 0 ? -tz_offset : tz_offset;
+    char zone[8];
+    std::snprintf(zone, sizeof(zone), "%c%02d%02d", tz_offset < 0 ? '-' : '+', minutes / 60 % 100, minutes % 60);
+    return name + " <" + email + "> " + std::to_string(time) + " " + zone;
+}
+
+std::optional<Signature> Signature::parse(std::string_view text) {
+    const std::size_t open = text.find('<');
+    const std::size_t close = text.find('>', open == std::string_view::npos ? 0 : open);
+    if (open == std::string_view::npos || close == std::string_view::npos) {
+        return std::nullopt;
+    }
+    Signature signature;
+    signature.name = text.substr(0, open > 0 && text[open - 1] == ' ' ? open - 1 : open);
+    signature.email = text.substr(open + 1, close - open - 1);
+    std::string_view date = text.substr(close + 1);
+    if (date.starts_with(' ')) {
+        date.remove_prefix(1);
+    }
+    if (!parse_date(date, signature.time, signature.tz_offset)) {
+        return std::nullopt;
+    }
+    return signature;
+}
+
+Signature current_signature(std::string_view role, const GitConfig& config) {
+    Signature signature;
+    signature.name = role_variable(role, "NAME").value_or(config.get("user.name").value_or("Author Name"));
+    signature.email = role_variable(role, "EMAIL").value_or(config.get("user.email").value_or("authorname@example.com"));
+
+    std::optional<std::string> date = role_variable(role, "DATE");
+    if (date && date->starts_with('@')) {
+        date->erase(0, 1);
+    }
+    if (!date || !parse_date(*date, signature.time, signature.tz_offset)) {
+        const std::time_t now = std::time(nullptr);
+        std::tm local{};
+        localtime_r(&now, &local);
+        signature.time = now;
+        signature.tz_offset = static_cast<int>(local.tm_gmtoff / 60);
+    }
+    return signature;
+}
+
+std::string format_log_date(int64_t time, int tz_offset) {
+    // The calendar fields in the signature's own timezone: shift the time and read it as UTC.
+    const std::time_t shifted = static_cast<std::time_t>(time + int64_t(tz_offset) * 60);
+    std::tm fields{};
+    gmtime_r(&shifted, &fields);
+    static constexpr const char *DAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static constexpr const char *MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    const int minutes = tz_offset < 0 ? -tz_offset : tz_offset;
+    char text[64];
+    std::snprintf(text, sizeof(text), "%s %s %d %02d:%02d:%02d %d %c%02d%02d", DAYS[fields.tm_wday],
+                  MONTHS[fields.tm_mon], fields.tm_mday, fields.tm_hour, fields.tm_min, fields.tm_sec,
+                  fields.tm_year + 1900, tz_offset < 0 ? '-' : '+', minutes / 60 % 100, minutes % 60);
+    return text;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.hpp"
+#include "object_id.hpp"
+
+/**
+ * The identity and date of an "author" or "committer" line: "<name> <<email>> <seconds> <+hhmm>".
+ */
+struct Signature {
+    std::string name;
+    std::string email;
+    int64_t time = 0;       // Seconds since the epoch.
+    int tz_offset = 0;      // Minutes east of UTC.
+
+    // The signature as it is written in commit objects.
+    std::string format() const;
+
+    // Parses the part of an author/committer line after the key. Returns `std::nullopt` if it is malformed.
+    static std::optional<Signature> parse(std::string_view text);
+};
+
+/**
+ * The signature of whoever is making a commit now, as git builds it for `role` "AUTHOR" or "COMMITTER":
+ * the name and email from `GIT_<role>_NAME`/`GIT_<role>_EMAIL`, else `user.name`/`user.email` in
+ * `config`, else fixed placeholders; the date from `GIT_<role>_DATE` ("<seconds> <+hhmm>", optionally
+ * with a leading '@'), else the current time in the local timezone.
+ */
+Signature current_signature(std::string_view role, const GitConfig& config = repository_config());
+
+// Formats a date as git's default log format does, in its own timezone: "Mon Aug 26 15:45:30 2024 +0000".
+std::string format_log_date(int64_t time, int tz_offset);
+
+/**
+ * The header of a commit object, pointing into the buffer the commit was decompressed into:
+ *
+ *   tree <id>
+ *   parent <id>      (any number)
+ *   author <signature>
+ *   committer <signature>
+ *   <other headers>
+ *
+ *   <message>
+ */
+template <typename Hash>
+struct CommitView {
+    ObjectId<Hash> tree;
+    std::vector<ObjectId<Hash>> parents;
+    std::string_view author;
+    std::string_view committer;
+    std::string_view message;
+
+    // The committer's date, which orders history walks (0 if it cannot be parsed).
+    int64_t commit_time() const {
+        const std::optional<Signature> signature = Signature::parse(committer);
+        return signature ? signature->time : 0;
+    }
+};
+
+// Parses the content of a commit object (without its "commit <size>\0" header). Returns `std::nullopt`
+// if it has no valid tree line.
+template <typename Hash>
+std::optional<CommitView<Hash>> parse_commit(std::string_view data) {
+    CommitView<Hash> commit;
+    bool has_tree = false;
+    std::size_t line_start = 0;
+    while (line_start < data.size() && data[line_start] != '\n') {
+        const std::size_t line_end = std::min(data.find('\n', line_start), data.size());
+        const std::string_view line = data.substr(line_start, line_end - line_start);
+        const std::size_t space = line.find(' ');
+        const std::string_view key = line.substr(0, space);
+        const std::string_view value = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+        if (key == "tree" && !has_tree) {
+            const std::optional<ObjectId<Hash>> id = ObjectId<Hash>::from_hex(value);
+            if (!id) {
+                return std::nullopt;
+            }
+            commit.tree = *id;
+            has_tree = true;
+        } else if (key == "parent") {
+            const std::optional<ObjectId<Hash>> id = ObjectId<Hash>::from_hex(value);
+            if (!id) {
+                return std::nullopt;
+            }
+            commit.parents.push_back(*id);
+        } else if (key == "author") {
+            commit.author = value;
+        } else if (key == "committer") {
+            commit.committer = value;
+        }
+        line_start = line_end + 1;
+    }
+    if (!has_tree) {
+        return std::nullopt;
+    }
+    commit.message = line_start < data.size() ? data.substr(line_start + 1) : std::string_view();
+    return commit;
+}
@@ -0,0 +1,350 @@
+#include "commit_graph.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <unistd.h>
+
+#include "sha1.hpp"
+#include "sha256.hpp"
+
+namespace {
+
+constexpr std::size_t HEADER_SIZE = 8;
+constexpr std::size_t CHUNK_ENTRY_SIZE = 12;
+constexpr std::size_t FANOUT_SIZE = 256 * 4;
+constexpr uint32_t CHUNK_OID_FANOUT = 0x4f494446;  // "OIDF"
+constexpr uint32_t CHUNK_OID_LOOKUP = 0x4f49444c;  // "OIDL"
+constexpr uint32_t CHUNK_COMMIT_DATA = 0x43444154; // "CDAT"
+constexpr uint32_t CHUNK_EXTRA_EDGES = 0x45444745; // "EDGE"
+
+// Parent words of CDAT and EDGE entries.
+constexpr uint32_t PARENT_NONE = 0x70000000;
+constexpr uint32_t PARENT_EDGE = 0x80000000;      // In the second parent: the rest start at EDGE[low bits].
+constexpr uint32_t PARENT_LAST_EDGE = 0x80000000; // In EDGE: this is the last parent.
+
+// Generation numbers get the top 30 bits of the 64-bit date word, commit times the other 34.
+constexpr uint32_t GENERATION_MAX = 0x3fffffff;
+constexpr uint64_t COMMIT_TIME_MASK = (uint64_t(1) << 34) - 1;
+
+// The `hash version` byte: 1 for SHA-1, 2 for SHA-256.
+template <typename Hash>
+constexpr uint8_t HASH_VERSION = std::is_same_v<Hash, Sha256> ? 2 : 1;
+
+template <typename Hash>
+constexpr std::size_t COMMIT_DATA_SIZE = ObjectId<Hash>::RAW_SIZE + 16;
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t load_be64(const unsigned char *p) {
+    return (uint64_t(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+void append_be32(std::string& out, uint32_t value) {
+    const char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+    out.append(bytes, 4);
+}
+
+void append_be64(std::string& out, uint64_t value) {
+    append_be32(out, static_cast<uint32_t>(value >> 32));
+    append_be32(out, static_cast<uint32_t>(value));
+}
+
+} // namespace
+
+template <typename Hash>
+bool CommitGraph<Hash>::open(const std::string& path) {
+    if (!file_.open(path, 0)) {
+        return false;
+    }
+    auto corrupt = [&](const char *reason) {
+        std::cerr << "warning: ignoring commit-graph " << path << ": " << reason << '\n';
+        file_.close();
+        count_ = 0;
+        return false;
+    };
+    const auto *data = reinterpret_cast<const unsigned char *>(file_.data());
+    const std::size_t size = file_.size();
+    if (size < HEADER_SIZE + CHUNK_ENTRY_SIZE + Hash::DIGEST_SIZE || std::memcmp(data, "CGPH", 4) != 0) {
+        return corrupt("not a commit-graph file");
+    }
+    if (data[4] != 1 || data[5] != HASH_VERSION<Hash> || data[7] != 0) {
+        return corrupt("unsupported version, hash or graph chain");
+    }
+
+    // The chunk table: (id, offset) pairs, closed by an entry with id 0 holding the end of the last chunk.
+    const std::size_t chunks = data[6];
+    const std::size_t data_end = size - Hash::DIGEST_SIZE;
+    if (HEADER_SIZE + (chunks + 1) * CHUNK_ENTRY_SIZE > data_end) {
+        return corrupt("truncated chunk table");
+    }
+    std::size_t lookup_size = 0, data_size = 0, edges_size = 0;
+    for (std::size_t i = 0; i < chunks; i++) {
+        const unsigned char *entry = data + HEADER_SIZE + i * CHUNK_ENTRY_SIZE;
+        const uint64_t offset = load_be64(entry + 4);
+        const uint64_t next = load_be64(entry + CHUNK_ENTRY_SIZE + 4);
+        if (offset > next || next > data_end) {
+            return corrupt("bad chunk offsets");
+        }
+        const unsigned char *chunk = data + offset;
+        const std::size_t chunk_size = next - offset;
+        switch (load_be32(entry)) {
+            case CHUNK_OID_FANOUT:
+                if (chunk_size != FANOUT_SIZE) {
+                    return corrupt("bad fanout chunk");
+                }
+                fanout_ = chunk;
+                break;
+            case CHUNK_OID_LOOKUP: ids_ = chunk; lookup_size = chunk_size; break;
+            case CHUNK_COMMIT_DATA: data_ = chunk; data_size = chunk_size; break;
+            case CHUNK_EXTRA_EDGES: edges_ = chunk; edges_size = chunk_size; break;
+            default: break; // Optional chunks we do not use (generation data, Bloom filters).
+        }
+    }
+    if (fanout_ == nullptr || ids_ == nullptr || data_ == nullptr) {
+        return corrupt("missing required chunk");
+    }
+    // `find` bisects between neighbouring fanout entries, so they must never decrease (which also keeps
+    // them at most `count_`, the last one).
+    for (std::size_t byte = 1; byte < 256; byte++) {
+        if (load_be32(fanout_ + (byte - 1) * 4) > load_be32(fanout_ + byte * 4)) {
+            return corrupt("fanout is not monotonic");
+        }
+    }
+    count_ = load_be32(fanout_ + 255 * 4);
+    if (lookup_size != std::size_t(count_) * ObjectId<Hash>::RAW_SIZE ||
+        data_size != std::size_t(count_) * COMMIT_DATA_SIZE<Hash> || edges_size % 4 != 0) {
+        return corrupt("chunk sizes do not match the commit count");
+    }
+    edge_count_ = edges_size / 4;
+    return true;
+}
+
+template <typename Hash>
+std::optional<uint32_t> CommitGraph<Hash>::find(const ObjectId<Hash>& id) const {
+    if (count_ == 0) {
+        return std::nullopt;
+    }
+    uint32_t low = id.bytes[0] == 0 ? 0 : load_be32(fanout_ + (std::size_t(id.bytes[0]) - 1) * 4);
+    uint32_t high = load_be32(fanout_ + std::size_t(id.bytes[0]) * 4);
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+        const int order = std::memcmp(ids_ + std::size_t(mid) * ObjectId<Hash>::RAW_SIZE, id.bytes.data(),
+                                      ObjectId<Hash>::RAW_SIZE);
+        if (order == 0) {
+            return mid;
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return std::nullopt;
+}
+
+template <typename Hash>
+const unsigned char *CommitGraph<Hash>::commit_data(uint32_t position) const {
+    return data_ + std::size_t(position) * COMMIT_DATA_SIZE<Hash>;
+}
+
+template <typename Hash>
+ObjectId<Hash> CommitGraph<Hash>::id_at(uint32_t position) const {
+    return ObjectId<Hash>::from_raw(ids_ + std::size_t(position) * ObjectId<Hash>::RAW_SIZE);
+}
+
+template <typename Hash>
+ObjectId<Hash> CommitGraph<Hash>::tree_at(uint32_t position) const {
+    return ObjectId<Hash>::from_raw(commit_data(position));
+}
+
+template <typename Hash>
+uint32_t CommitGraph<Hash>::generation_at(uint32_t position) const {
+    return load_be32(commit_data(position) + ObjectId<Hash>::RAW_SIZE + 8) >> 2;
+}
+
+template <typename Hash>
+int64_t CommitGraph<Hash>::commit_time_at(uint32_t position) const {
+    return static_cast<int64_t>(load_be64(commit_data(position) + ObjectId<Hash>::RAW_SIZE + 8) & COMMIT_TIME_MASK);
+}
+
+template <typename Hash>
+bool CommitGraph<Hash>::parents_at(uint32_t position, std::vector<uint32_t>& parents) const {
+    const unsigned char *entry = commit_data(position) + ObjectId<Hash>::RAW_SIZE;
+    const uint32_t first = load_be32(entry);
+    const uint32_t second = load_be32(entry + 4);
+    if (first == PARENT_NONE) {
+        return true;
+    }
+    if (first >= count_) {
+        return false;
+    }
+    parents.push_back(first);
+    if (second == PARENT_NONE) {
+        return true;
+    }
+    if ((second & PARENT_EDGE) == 0) {
+        if (second >= count_) {
+            return false;
+        }
+        parents.push_back(second);
+        return true;
+    }
+    // An octopus merge: every remaining parent is in the edge list, the last one flagged.
+    for (std::size_t edge = second & ~PARENT_EDGE; edge < edge_count_; edge++) {
+        const uint32_t word = load_be32(edges_ + edge * 4);
+        if ((word & ~PARENT_LAST_EDGE) >= count_) {
+            return false;
+        }
+        parents.push_back(word & ~PARENT_LAST_EDGE);
+        if (word & PARENT_LAST_EDGE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Hash>
+bool write_commit_graph(std::vector<CommitGraphEntry<Hash>>& commits, const std::string& path) {
+    std::sort(commits.begin(), commits.end(),
+              [](const CommitGraphEntry<Hash>& a, const CommitGraphEntry<Hash>& b) { return a.id < b.id; });
+    commits.erase(std::unique(commits.begin(), commits.end(),
+                              [](const CommitGraphEntry<Hash>& a, const CommitGraphEntry<Hash>& b) { return a.id == b.id; }),
+                  commits.end());
+    const uint32_t count = static_cast<uint32_t>(commits.size());
+    auto position_of = [&](const ObjectId<Hash>& id) -> uint32_t {
+        const auto it = std::lower_bound(commits.begin(), commits.end(), id,
+                                         [](const CommitGraphEntry<Hash>& entry, const ObjectId<Hash>& key) { return entry.id < key; });
+        return it != commits.end() && it->id == id ? static_cast<uint32_t>(it - commits.begin()) : CommitGraph<Hash>::NONE;
+    };
+
+    // Parent positions, flattened: the parents of commit i are `parents[parent_start[i], parent_start[i + 1])`.
+    std::vector<uint32_t> parent_start(count + 1, 0);
+    std::vector<uint32_t> parents;
+    for (uint32_t i = 0; i < count; i++) {
+        parent_start[i] = static_cast<uint32_t>(parents.size());
+        for (const ObjectId<Hash>& parent : commits[i].parents) {
+            const uint32_t position = position_of(parent);
+            if (position == CommitGraph<Hash>::NONE) {
+                std::cerr << "Error: parent " << parent.to_hex() << " of commit " << commits[i].id.to_hex()
+                          << " is missing from the commit-graph\n";
+                return false;
+            }
+            parents.push_back(position);
+        }
+    }
+    parent_start[count] = static_cast<uint32_t>(parents.size());
+
+    // Generations: a commit is finished once all its parents are, so walk depth-first with an explicit stack.
+    // Ids are hashes of the content that names the parents, so there are no cycles.
+    std::vector<uint32_t> generations(count, 0);
+    std::vector<uint32_t> stack;
+    for (uint32_t root = 0; root < count; root++) {
+        if (generations[root] != 0) {
+            continue;
+        }
+        stack.push_back(root);
+        while (!stack.empty()) {
+            const uint32_t commit = stack.back();
+            uint32_t generation = 1;
+            bool ready = true;
+            for (uint32_t p = parent_start[commit]; p < parent_start[commit + 1]; p++) {
+                const uint32_t parent_generation = generations[parents[p]];
+                if (parent_generation == 0) {
+                    ready = false;
+                    stack.push_back(parents[p]);
+                } else {
+                    generation = std::max(generation, std::min(parent_generation + 1, GENERATION_MAX));
+                }
+            }
+            if (ready) {
+                generations[commit] = generation;
+                stack.pop_back();
+            }
+        }
+    }
+
+    // Chunk payloads.
+    std::string fanout, lookup, data, edges;
+    fanout.reserve(FANOUT_SIZE);
+    std::size_t next = 0;
+    for (int byte = 0; byte < 256; ++byte) {
+        while (next < commits.size() && commits[next].id.bytes[0] <= byte) {
+            ++next;
+        }
+        append_be32(fanout, static_cast<uint32_t>(next));
+    }
+    lookup.reserve(std::size_t(count) * ObjectId<Hash>::RAW_SIZE);
+    data.reserve(std::size_t(count) * COMMIT_DATA_SIZE<Hash>);
+    for (uint32_t i = 0; i < count; i++) {
+        lookup.append(commits[i].id.raw());
+        data.append(commits[i].tree.raw());
+        const uint32_t first = parent_start[i], end = parent_start[i + 1];
+        append_be32(data, end > first ? parents[first] : PARENT_NONE);
+        if (end - first <= 2) {
+            append_be32(data, end - first == 2 ? parents[first + 1] : PARENT_NONE);
+        } else {
+            append_be32(data, PARENT_EDGE | static_cast<uint32_t>(edges.size() / 4));
+            for (uint32_t p = first + 1; p < end; p++) {
+                append_be32(edges, parents[p] | (p + 1 == end ? PARENT_LAST_EDGE : 0));
+            }
+        }
+        const uint64_t time = static_cast<uint64_t>(std::max<int64_t>(commits[i].commit_time, 0)) & COMMIT_TIME_MASK;
+        append_be64(data, (uint64_t(generations[i]) << 34) | time);
+    }
+
+    struct Chunk {
+        uint32_t id;
+        const std::string *payload;
+    };
+    std::vector<Chunk> chunks = {{CHUNK_OID_FANOUT, &fanout}, {CHUNK_OID_LOOKUP, &lookup}, {CHUNK_COMMIT_DATA, &data}};
+    if (!edges.empty()) {
+        chunks.push_back({CHUNK_EXTRA_EDGES, &edges});
+    }
+    std::string file = "CGPH";
+    file += char(1);
+    file += char(HASH_VERSION<Hash>);
+    file += char(chunks.size());
+    file += char(0);
+    uint64_t offset = HEADER_SIZE + (chunks.size() + 1) * CHUNK_ENTRY_SIZE;
+    for (const Chunk& chunk : chunks) {
+        append_be32(file, chunk.id);
+        append_be64(file, offset);
+        offset += chunk.payload->size();
+    }
+    append_be32(file, 0);
+    append_be64(file, offset);
+    for (const Chunk& chunk : chunks) {
+        file += *chunk.payload;
+    }
+    file.append(Hash::hash(file).raw());
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    const std::string temp_path = path + ".tmp_" + std::to_string(getpid());
+    std::ofstream out(temp_path, std::ios::binary);
+    out.write(file.data(), file.size());
+    out.close();
+    if (!out) {
+        std::filesystem::remove(temp_path, ec);
+        std::cerr << "Error: Could not write " << temp_path << '\n';
+        return false;
+    }
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        std::cerr << "Error: Could not move commit-graph into place: " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+template class CommitGraph<Sha1>;
+template class CommitGraph<Sha256>;
+template bool write_commit_graph(std::vector<CommitGraphEntry<Sha1>>&, const std::string&);
+template bool write_commit_graph(std::vector<CommitGraphEntry<Sha256>>&, const std::string&);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "object_id.hpp"
+
+/**
+ * A commit-graph file (`.git/objects/info/commit-graph`), read through a memory mapping.
+ *
+ * The file is git's format (version 1, without a chain of base graphs), so git reads ours and we read
+ * git's:
+ *   "CGPH" | version 1 | hash version | chunk count | 0 | chunk table | chunks | checksum
+ * with the chunks
+ *   OIDF  fanout[256] over the ids, as in a pack index,
+ *   OIDL  the sorted commit ids,
+ *   CDAT  per commit: root tree id | first parent | second parent | generation << 34 | commit time,
+ *   EDGE  the third and later parents of octopus merges (only present if there are any).
+ * Parents are positions in the id table, so walking history through the graph never inflates, parses
+ * or even hashes a commit. The generation of a commit is one more than the largest generation of its
+ * parents (1 for root commits): a commit can only be an ancestor of commits with a larger generation,
+ * which bounds how far ancestry queries have to walk.
+ *
+ * Every parent of a commit in the graph is in the graph too. Commits made after it was written are not.
+ */
+template <typename Hash>
+class CommitGraph {
+public:
+    // A position that is not a commit: the "no parent" marker.
+    static constexpr uint32_t NONE = 0xffffffff;
+
+    // Opens the graph at `path`. Returns `false` if it is missing, or (after printing a warning) corrupt.
+    bool open(const std::string& path);
+
+    // Number of commits in the graph.
+    uint32_t size() const { return count_; }
+
+    // Position of commit `id`, if it is in the graph.
+    std::optional<uint32_t> find(const ObjectId<Hash>& id) const;
+
+    ObjectId<Hash> id_at(uint32_t position) const;
+    ObjectId<Hash> tree_at(uint32_t position) const;
+    uint32_t generation_at(uint32_t position) const;
+    int64_t commit_time_at(uint32_t position) const;
+
+    // Appends the positions of the parents of the commit at `position` to `parents`, in order.
+    // Returns `false` if the graph's parent data is corrupt.
+    bool parents_at(uint32_t position, std::vector<uint32_t>& parents) const;
+
+private:
+    const unsigned char *commit_data(uint32_t position) const;
+
+    MappedFile file_;
+    uint32_t count_ = 0;
+    const unsigned char *fanout_ = nullptr;
+    const unsigned char *ids_ = nullptr;
+    const unsigned char *data_ = nullptr;
+    const unsigned char *edges_ = nullptr;
+    std::size_t edge_count_ = 0;
+};
+
+/**
+ * One commit handed to `write_commit_graph`.
+ */
+template <typename Hash>
+struct CommitGraphEntry {
+    ObjectId<Hash> id;
+    ObjectId<Hash> tree;
+    std::vector<ObjectId<Hash>> parents;
+    int64_t commit_time = 0;
+};
+
+/**
+ * Writes `commits`, which must include every parent of every commit in it, as a commit-graph at `path`.
+ *
+ * 1. **Order**: sorts the commits by id, which makes their positions a binary search away.
+ * 2. **Generations**: computes every commit's generation number with an iterative depth-first walk over
+ *    parent positions, so long histories do not recurse.
+ * 3. **Write**: builds the file in memory, appends its checksum and renames it into place, so readers
+ *    see the old graph or the new one.
+ *
+ * Returns `false` (after printing an error) if a parent is missing or the file cannot be written.
+ */
+template <typename Hash>
+bool write_commit_graph(std::vector<CommitGraphEntry<Hash>>& commits, const std::string& path);
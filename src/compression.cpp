@@ -0,0 +1,178 @@
+#include "compression.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <zlib.h>
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "trace_perf.hpp"
+
+namespace {
+
+/**
+ * A deflate stream kept per thread and reset between objects: `deflateInit` allocates a few hundred KB
+ * of state, which would otherwise be paid for every small tree and blob. It is only set up again when
+ * the level changes.
+ */
+struct ZlibDeflater {
+    z_stream strm{};
+    int level = 0;
+    bool initialized = false;
+
+    ~ZlibDeflater() {
+        if (initialized) {
+            deflateEnd(&strm);
+        }
+    }
+
+    z_stream *start(int new_level) {
+        if (initialized && level == new_level) {
+            deflateReset(&strm);
+            return &strm;
+        }
+        if (initialized) {
+            deflateEnd(&strm);
+        }
+        strm = {};
+        initialized = deflateInit(&strm, new_level) == Z_OK;
+        level = new_level;
+        return initialized ? &strm : nullptr;
+    }
+};
+
+std::size_t zlib_bound(std::size_t size) {
+    return compressBound(static_cast<uLong>(size));
+}
+
+std::size_t zlib_compress(std::string_view header, std::string_view data, int level, unsigned char *out) {
+    PerfScope scope(PerfPhase::Deflate, header.size() + data.size());
+    thread_local ZlibDeflater deflater;
+    z_stream *strm = deflater.start(level);
+    if (strm == nullptr) {
+        return 0;
+    }
+    strm->next_out = out;
+    strm->avail_out = static_cast<uInt>(zlib_bound(header.size() + data.size()));
+    strm->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(header.data()));
+    strm->avail_in = static_cast<uInt>(header.size());
+    int res = deflate(strm, data.empty() ? Z_FINISH : Z_NO_FLUSH);
+    if (!data.empty() && res == Z_OK) {
+        strm->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+        strm->avail_in = static_cast<uInt>(data.size());
+        res = deflate(strm, Z_FINISH);
+    }
+    return res == Z_STREAM_END ? strm->total_out : 0;
+}
+
+#ifdef HAVE_LIBDEFLATE
+// libdeflate's levels go up to 12; zlib's -1..9 map onto the same numbers, with -1 as its default 6.
+constexpr int LIBDEFLATE_MAX_LEVEL = 12;
+
+std::size_t libdeflate_bound(std::size_t size) {
+    return libdeflate_zlib_compress_bound(nullptr, size);
+}
+
+std::size_t libdeflate_compress(std::string_view header, std::string_view data, int level, unsigned char *out) {
+    PerfScope scope(PerfPhase::Deflate, header.size() + data.size());
+    struct FreeCompressor {
+        void operator()(libdeflate_compressor *compressor) const { libdeflate_free_compressor(compressor); }
+    };
+    // One compressor per level and thread, since allocating one costs more than compressing a small object.
+    thread_local std::unique_ptr<libdeflate_compressor, FreeCompressor> compressors[LIBDEFLATE_MAX_LEVEL + 1];
+    thread_local std::string joined;
+    const int index = level < 0 ? 6 : std::min(level, LIBDEFLATE_MAX_LEVEL);
+    if (!compressors[index]) {
+        compressors[index].reset(libdeflate_alloc_compressor(index));
+        if (!compressors[index]) {
+            return 0;
+        }
+    }
+    // libdeflate only takes one contiguous input.
+    std::string_view input = data;
+    if (!header.empty()) {
+        joined.assign(header);
+        joined.append(data);
+        input = joined;
+    }
+    return libdeflate_zlib_compress(compressors[index].get(), input.data(), input.size(), out,
+                                    libdeflate_bound(input.size()));
+}
+#endif
+
+std::vector<DeflateCodec> detect_codecs() {
+    std::vector<DeflateCodec> codecs;
+#ifdef HAVE_LIBDEFLATE
+    codecs.push_back({"libdeflate", libdeflate_bound, libdeflate_compress});
+#endif
+    codecs.push_back({"zlib", zlib_bound, zlib_compress});
+    return codecs;
+}
+
+const DeflateCodec& select_codec() {
+    const std::vector<DeflateCodec>& codecs = deflate_codecs();
+    if (const char *requested = std::getenv("GIT_DEFLATE_CODEC"); requested != nullptr && *requested != '\0') {
+        for (const DeflateCodec& codec : codecs) {
+            if (std::strcmp(codec.name, requested) == 0) {
+                return codec;
+            }
+        }
+        std::cerr << "warning: deflate codec '" << requested << "' is not available, using '"
+                  << codecs.front().name << "'.\n";
+    }
+    return codecs.front();
+}
+
+// Reads a level setting; `true` if it is unset or valid.
+bool read_level(const GitConfig& config, std::string_view key, std::optional<int>& level) {
+    if (!config.get(key)) {
+        return true;
+    }
+    const std::optional<long long> value = config.get_int(key);
+    if (!value) {
+        return false;
+    }
+    if (*value < -1 || *value > 9) {
+        std::cerr << "fatal: bad zlib compression level " << *value << '\n';
+        return false;
+    }
+    level = static_cast<int>(*value);
+    return true;
+}
+
+} // namespace
+
+const std::vector<DeflateCodec>& deflate_codecs() {
+    static const std::vector<DeflateCodec> codecs = detect_codecs();
+    return codecs;
+}
+
+const DeflateCodec& deflate_codec() {
+    static const DeflateCodec& codec = select_codec();
+    return codec;
+}
+
+bool deflate_object(std::string_view header, std::string_view data, int level, std::string& out) {
+    const DeflateCodec& codec = deflate_codec();
+    out.resize(codec.bound(header.size() + data.size()));
+    const std::size_t size = codec.compress(header, data, level, reinterpret_cast<unsigned char *>(out.data()));
+    out.resize(size);
+    return size != 0;
+}
+
+std::optional<CompressionLevels> compression_levels(const GitConfig& config) {
+    std::optional<int> core, loose, pack;
+    if (!read_level(config, "core.compression", core) || !read_level(config, "core.looseCompression", loose) ||
+        !read_level(config, "pack.compression", pack)) {
+        return std::nullopt;
+    }
+    CompressionLevels levels;
+    levels.loose = loose.value_or(core.value_or(levels.loose));
+    levels.pack = pack.value_or(core.value_or(levels.pack));
+    return levels;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.hpp"
+
+// Compression levels are numbered as in zlib: 0 stores, 1 is fastest, 9 is smallest, -1 means the default.
+constexpr int DEFAULT_COMPRESSION_LEVEL = -1;
+
+/**
+ * A one-shot deflate implementation producing zlib streams (RFC 1950), the format of loose objects and
+ * of pack entries.
+ *
+ * `compress` takes "<header><data>" as two pieces, since objects are a small generated header in front
+ * of content that already lives somewhere else (a mapped file, a tree buffer); pack entries pass an
+ * empty header. It returns the number of bytes written to `out`, which must hold `bound(header.size() +
+ * data.size())` bytes, or 0 on failure.
+ */
+struct DeflateCodec {
+    const char *name;
+    std::size_t (*bound)(std::size_t size);
+    std::size_t (*compress)(std::string_view header, std::string_view data, int level, unsigned char *out);
+};
+
+/**
+ * Every codec this build has, in order of preference:
+ *   - "libdeflate": libdeflate, several times faster than zlib at the same level. Only present when
+ *                   the build found `libdeflate.h` (`HAVE_LIBDEFLATE`).
+ *   - "zlib":       whatever provides zlib; linking zlib-ng in its compatibility mode speeds this up too.
+ */
+const std::vector<DeflateCodec>& deflate_codecs();
+
+/**
+ * The codec used for every in-memory object: the first of `deflate_codecs()`, unless the
+ * `GIT_DEFLATE_CODEC` environment variable names another available one. Chosen once per process.
+ * Streaming writers need an incremental API and always use zlib, at the same levels.
+ */
+const DeflateCodec& deflate_codec();
+
+// Compresses "<header><data>" at `level` into `out` with `deflate_codec()`. Returns `false` on failure.
+bool deflate_object(std::string_view header, std::string_view data, int level, std::string& out);
+
+/**
+ * How hard objects are compressed, from the repository config as git reads it:
+ *   - `loose`: `core.looseCompression`, else `core.compression`, else 1 (fastest).
+ *   - `pack`:  `pack.compression`, else `core.compression`, else zlib's default.
+ */
+struct CompressionLevels {
+    int loose = 1;
+    int pack = DEFAULT_COMPRESSION_LEVEL;
+};
+
+// Returns `std::nullopt` (after printing an error) if a level is not a number from -1 to 9.
+std::optional<CompressionLevels> compression_levels(const GitConfig& config = repository_config());
@@ -0,0 +1,223 @@
+#include "config.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+namespace {
+
+std::string to_lower(std::string_view text) {
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    return lower;
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front()))) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// "section.key" and "section.subsection.key" with the case-insensitive parts lowercased.
+std::string canonical_key(std::string_view key) {
+    const std::size_t first = key.find('.');
+    const std::size_t last = key.rfind('.');
+    if (first == std::string_view::npos) {
+        return to_lower(key);
+    }
+    return to_lower(key.substr(0, first)) + std::string(key.substr(first, last - first)) + "." +
+           to_lower(key.substr(last + 1));
+}
+
+// Parses a value after the '=': unquoted whitespace is collapsed at the ends, comments end it.
+bool parse_value(std::string_view text, std::string& value) {
+    value.clear();
+    bool quoted = false;
+    std::size_t kept = 0; // Length of `value` without unquoted trailing whitespace.
+    for (std::size_t i = 0; i < text.size(); i++) {
+        const char c = text[i];
+        if (!quoted && (c == '#' || c == ';')) {
+            break;
+        }
+        if (c == '"') {
+            quoted = !quoted;
+            kept = value.size();
+            continue;
+        }
+        if (c == '\\') {
+            if (++i == text.size()) {
+                return false;
+            }
+            switch (text[i]) {
+                case 'n': value += '\n'; break;
+                case 't': value += '\t'; break;
+                case 'b': value += '\b'; break;
+                case '"': value += '"'; break;
+                case '\\': value += '\\'; break;
+                default: return false;
+            }
+            kept = value.size();
+            continue;
+        }
+        if (!quoted && std::isspace(static_cast<unsigned char>(c))) {
+            if (!value.empty()) {
+                value += c;
+            }
+            continue;
+        }
+        value += c;
+        kept = value.size();
+    }
+    value.resize(kept);
+    return !quoted;
+}
+
+std::vector<std::pair<std::string, std::string>>& config_overrides() {
+    static std::vector<std::pair<std::string, std::string>> overrides;
+    return overrides;
+}
+
+} // namespace
+
+bool GitConfig::load(const std::string& path) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return true;
+    }
+    std::string_view rest = file.view();
+    std::string section;
+    int line_number = 0;
+    while (!rest.empty()) {
+        const std::size_t newline = rest.find('\n');
+        std::string_view line = trim(rest.substr(0, newline));
+        rest.remove_prefix(newline == std::string_view::npos ? rest.size() : newline + 1);
+        line_number++;
+        if (line.empty() || line.front() == '#' || line.front() == ';') {
+            continue;
+        }
+        auto fail = [&] {
+            std::cerr << "fatal: bad config line " << line_number << " in file " << path << '\n';
+            return false;
+        };
+        if (line.front() == '[') {
+            const std::size_t close = line.rfind(']');
+            if (close == std::string_view::npos) {
+                return fail();
+            }
+            const std::string_view header = trim(line.substr(1, close - 1));
+            const std::size_t quote = header.find('"');
+            if (quote == std::string_view::npos) {
+                // `[section]`, or the old `[section.subsection]` spelling.
+                section = to_lower(header);
+            } else {
+                if (header.size() < quote + 2 || header.back() != '"') {
+                    return fail();
+                }
+                section = to_lower(trim(header.substr(0, quote))) + "." +
+                          std::string(header.substr(quote + 1, header.size() - quote - 2));
+            }
+            continue;
+        }
+        if (section.empty()) {
+            return fail();
+        }
+        const std::size_t equals = line.find('=');
+        const std::string name = to_lower(trim(line.substr(0, equals)));
+        if (name.empty() || !std::all_of(name.begin(), name.end(), [](unsigned char c) {
+                return std::isalnum(c) || c == '-';
+            })) {
+            return fail();
+        }
+        std::string value = "true";
+        if (equals != std::string_view::npos && !parse_value(line.substr(equals + 1), value)) {
+            return fail();
+        }
+        values_[section + "." + name] = std::move(value);
+    }
+    return true;
+}
+
+std::optional<std::string> GitConfig::get(std::string_view key) const {
+    const auto found = values_.find(canonical_key(key));
+    if (found == values_.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
+
+void GitConfig::set(std::string_view key, std::string value) {
+    values_[canonical_key(key)] = std::move(value);
+}
+
+std::optional<long long> GitConfig::get_int(std::string_view key) const {
+    const std::optional<std::string> value = get(key);
+    if (!value) {
+        return std::nullopt;
+    }
+    const char *text = value->c_str();
+    char *end = nullptr;
+    errno = 0;
+    long long number = std::strtoll(text, &end, 0);
+    long long factor = 1;
+    switch (std::tolower(static_cast<unsigned char>(*end))) {
+        case 'k': factor = 1024; end++; break;
+        case 'm': factor = 1024 * 1024; end++; break;
+        case 'g': factor = 1024 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (end == text || *end != '\0' || errno == ERANGE) {
+        std::cerr << "fatal: bad numeric config value '" << *value << "' for '" << key << "'\n";
+        return std::nullopt;
+    }
+    return number * factor;
+}
+
+std::optional<bool> GitConfig::get_bool(std::string_view key) const {
+    const std::optional<std::string> value = get(key);
+    if (!value) {
+        return std::nullopt;
+    }
+    const std::string lower = to_lower(*value);
+    if (lower == "true" || lower == "yes" || lower == "on" || lower == "1") {
+        return true;
+    }
+    if (lower == "false" || lower == "no" || lower == "off" || lower == "0" || lower.empty()) {
+        return false;
+    }
+    std::cerr << "fatal: bad boolean config value '" << *value << "' for '" << key << "'\n";
+    return std::nullopt;
+}
+
+const GitConfig& repository_config() {
+    static const GitConfig config = [] {
+        GitConfig loaded;
+        loaded.load(".git/config");
+        for (auto& [key, value] : config_overrides()) {
+            loaded.set(key, std::move(value));
+        }
+        return loaded;
+    }();
+    return config;
+}
+
+bool add_config_override(std::string_view assignment) {
+    const std::size_t equals = assignment.find('=');
+    const std::string_view key = assignment.substr(0, equals);
+    if (key.find('.') == std::string_view::npos || key.front() == '.' || key.back() == '.') {
+        std::cerr << "error: key does not contain a section: " << key << '\n';
+        return false;
+    }
+    std::string value = equals == std::string_view::npos ? "true" : std::string(assignment.substr(equals + 1));
+    config_overrides().emplace_back(std::string(key), std::move(value));
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * The settings of a git config file such as `.git/config`.
+ *
+ * Understands the parts of the format that repository configs use: `[section]` and
+ * `[section "subsection"]` headers, `key = value` lines, `#`/`;` comments, quoted values with
+ * backslash escapes, and keys without a value (which mean `true`). Section and key names are
+ * case-insensitive, subsection names are not. Keys are looked up as "section.key" or
+ * "section.subsection.key"; when a key is set more than once the last value wins, as in git.
+ */
+class GitConfig {
+public:
+    // Reads `path`, adding to (and overriding) what was loaded before. A missing file is an empty config.
+    // Returns `false` (after printing an error) if the file cannot be parsed.
+    bool load(const std::string& path);
+
+    // The value of `key`, or `std::nullopt` if it is not set.
+    std::optional<std::string> get(std::string_view key) const;
+
+    // The value of `key` as an integer with an optional k/m/g suffix. Prints an error and returns
+    // `std::nullopt` if it is set to something else.
+    std::optional<long long> get_int(std::string_view key) const;
+
+    // Sets `key` to `value`, as a line at the end of the last file loaded would.
+    void set(std::string_view key, std::string value);
+
+    // The value of `key` as a boolean (true/yes/on/1 or false/no/off/0).
+    std::optional<bool> get_bool(std::string_view key) const;
+
+private:
+    std::unordered_map<std::string, std::string> values_;
+};
+
+/**
+ * The config of the repository in the current directory, `.git/config`, read once per process, with the
+ * overrides given on the command line applied on top.
+ */
+const GitConfig& repository_config();
+
+/**
+ * Records a `-c <name>=<value>` option (just `<name>` means `true`), which takes precedence over
+ * `.git/config`. Must be called before the first `repository_config()`.
+ * Returns `false` (after printing an error) if `assignment` does not name a "section.key".
+ */
+bool add_config_override(std::string_view assignment);
@@ -0,0 +1,186 @@
+#include "delta.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+constexpr std::size_t BLOCK = DeltaIndex::BLOCK_SIZE;
+
+// Largest run a single copy instruction is given; git's own encoder uses the same limit.
+constexpr std::size_t MAX_COPY_SIZE = 0x10000;
+constexpr std::size_t MAX_INSERT_SIZE = 0x7f;
+
+// Polynomial rolling hash over BLOCK bytes (arithmetic modulo 2^32).
+constexpr uint32_t HASH_MULTIPLIER = 0x01000193;
+
+constexpr uint32_t pow_multiplier(std::size_t exponent) {
+    uint32_t result = 1;
+    for (std::size_t i = 0; i < exponent; ++i) {
+        result *= HASH_MULTIPLIER;
+    }
+    return result;
+}
+
+// Weight of the byte that leaves the window when it rolls forward.
+constexpr uint32_t OUTGOING_WEIGHT = pow_multiplier(BLOCK - 1);
+
+uint32_t hash_block(const unsigned char *data) {
+    uint32_t hash = 0;
+    for (std::size_t i = 0; i < BLOCK; ++i) {
+        hash = hash * HASH_MULTIPLIER + data[i];
+    }
+    return hash;
+}
+
+uint32_t roll_hash(uint32_t hash, unsigned char outgoing, unsigned char incoming) {
+    return (hash - outgoing * OUTGOING_WEIGHT) * HASH_MULTIPLIER + incoming;
+}
+
+void append_size(std::string& out, uint64_t size) {
+    do {
+        unsigned char byte = size & 0x7f;
+        size >>= 7;
+        if (size != 0) {
+            byte |= 0x80;
+        }
+        out.push_back(static_cast<char>(byte));
+    } while (size != 0);
+}
+
+void append_insert(std::string& out, const char *data, std::size_t size) {
+    while (size > 0) {
+        const std::size_t n = std::min(size, MAX_INSERT_SIZE);
+        out.push_back(static_cast<char>(n));
+        out.append(data, n);
+        data += n;
+        size -= n;
+    }
+}
+
+void append_copy(std::string& out, uint64_t offset, std::size_t size) {
+    while (size > 0) {
+        const std::size_t n = std::min(size, MAX_COPY_SIZE);
+        char instruction[8];
+        std::size_t length = 1;
+        unsigned char op = 0x80;
+        for (int i = 0; i < 4; ++i) {
+            if (const unsigned char byte = (offset >> (8 * i)) & 0xff) {
+                op |= 1 << i;
+                instruction[length++] = static_cast<char>(byte);
+            }
+        }
+        // A size of 0x10000 is encoded as no size bytes at all.
+        const std::size_t encoded_size = n == MAX_COPY_SIZE ? 0 : n;
+        for (int i = 0; i < 3; ++i) {
+            if (const unsigned char byte = (encoded_size >> (8 * i)) & 0xff) {
+                op |= 0x10 << i;
+                instruction[length++] = static_cast<char>(byte);
+            }
+        }
+        instruction[0] = static_cast<char>(op);
+        out.append(instruction, length);
+        offset += n;
+        size -= n;
+    }
+}
+
+} // namespace
+
+DeltaIndex::DeltaIndex(std::string_view source) : source_(source) {
+    // Copy offsets are encoded in 32 bits; larger sources are simply never matched against.
+    if (source.size() < BLOCK || source.size() > UINT32_MAX) {
+        return;
+    }
+    const std::size_t blocks = source.size() / BLOCK;
+    const std::size_t buckets = std::bit_ceil(std::max<std::size_t>(blocks, 16));
+    bucket_shift_ = 32 - std::countr_zero(buckets);
+    heads_.assign(buckets, 0);
+    next_.assign(blocks, 0);
+    std::vector<uint8_t> counts(buckets, 0);
+
+    const auto *data = reinterpret_cast<const unsigned char *>(source.data());
+    for (std::size_t block = 0; block < blocks; ++block) {
+        const std::size_t bucket = (hash_block(data + block * BLOCK) * 2654435761u) >> bucket_shift_;
+        // Keep the earliest blocks; further identical repeats add nothing a known offset cannot copy.
+        if (counts[bucket] == MAX_BUCKET_ENTRIES) {
+            continue;
+        }
+        next_[block] = heads_[bucket];
+        heads_[bucket] = static_cast<uint32_t>(block + 1);
+        ++counts[bucket];
+    }
+}
+
+std::size_t DeltaIndex::find_match(uint32_t hash, std::string_view target, std::size_t pos,
+                                   std::size_t& source_offset) const {
+    if (heads_.empty()) {
+        return 0;
+    }
+    const std::size_t bucket = (hash * 2654435761u) >> bucket_shift_;
+    std::size_t best = 0;
+    for (uint32_t entry = heads_[bucket]; entry != 0; entry = next_[entry - 1]) {
+        const std::size_t offset = std::size_t(entry - 1) * BLOCK;
+        const std::size_t limit = std::min(source_.size() - offset, target.size() - pos);
+        if (limit <= best) {
+            continue;
+        }
+        std::size_t length = 0;
+        while (length < limit && source_[offset + length] == target[pos + length]) {
+            ++length;
+        }
+        if (length > best) {
+            best = length;
+            source_offset = offset;
+            if (best >= MAX_COPY_SIZE) {
+                break; // Long enough; a longer match saves at most a few instruction bytes.
+            }
+        }
+    }
+    return best;
+}
+
+bool create_delta(const DeltaIndex& index, std::string_view target, std::size_t max_size, std::string& delta) {
+    const std::string_view source = index.source();
+    delta.clear();
+    append_size(delta, source.size());
+    append_size(delta, target.size());
+
+    const auto *data = reinterpret_cast<const unsigned char *>(target.data());
+    const std::size_t size = target.size();
+    // Worst-case bytes still needed for the literal run [insert_start, pos): one opcode per 127 bytes.
+    auto pending_insert_size = [](std::size_t length) { return length + (length + MAX_INSERT_SIZE - 1) / MAX_INSERT_SIZE; };
+
+    std::size_t pos = 0;
+    std::size_t insert_start = 0;
+    uint32_t hash = size >= BLOCK ? hash_block(data) : 0;
+    while (pos + BLOCK <= size) {
+        std::size_t source_offset = 0;
+        std::size_t length = index.find_match(hash, target, pos, source_offset);
+        if (length >= BLOCK) {
+            // Grow the match backwards over literal bytes that also precede it in the source.
+            while (pos > insert_start && source_offset > 0 && source[source_offset - 1] == target[pos - 1]) {
+                --pos;
+                --source_offset;
+                ++length;
+            }
+            append_insert(delta, target.data() + insert_start, pos - insert_start);
+            append_copy(delta, source_offset, length);
+            pos += length;
+            insert_start = pos;
+            if (pos + BLOCK <= size) {
+                hash = hash_block(data + pos);
+            }
+        } else {
+            if (pos + BLOCK < size) {
+                hash = roll_hash(hash, data[pos], data[pos + BLOCK]);
+            }
+            ++pos;
+        }
+        if (max_size != 0 && delta.size() + pending_insert_size(pos - insert_start) > max_size) {
+            return false;
+        }
+    }
+    append_insert(delta, target.data() + insert_start, size - insert_start);
+    return max_size == 0 || delta.size() <= max_size;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A hash index over the blocks of a delta source, for matching target data against it.
+ *
+ * The source is cut into `BLOCK_SIZE`-byte blocks and each block is filed under its rolling hash.
+ * `create_delta` then slides the same rolling hash over the target one byte at a time, so a match is
+ * found wherever a block of the source reappears in the target, at any alignment. Highly repetitive
+ * sources (runs of zeros, say) would put thousands of blocks in one bucket, so each bucket keeps at
+ * most `MAX_BUCKET_ENTRIES` of them.
+ *
+ * Building an index is the expensive half of delta computation, so the windowed delta search builds
+ * one per candidate base and reuses it against every target in the window. The index refers to the
+ * source bytes, which must outlive it.
+ */
+class DeltaIndex {
+public:
+    static constexpr std::size_t BLOCK_SIZE = 16;
+    static constexpr std::size_t MAX_BUCKET_ENTRIES = 64;
+
+    explicit DeltaIndex(std::string_view source);
+
+    std::string_view source() const { return source_; }
+
+    // Finds the longest stretch of the source equal to `target` starting at `pos`, among the source
+    // blocks whose rolling hash is `hash`. Returns the length of the match (0 if none) and its source offset.
+    std::size_t find_match(uint32_t hash, std::string_view target, std::size_t pos, std::size_t& source_offset) const;
+
+private:
+    std::string_view source_;
+    unsigned bucket_shift_ = 32;
+    std::vector<uint32_t> heads_; // Per bucket: index of the first block + 1, or 0 if empty.
+    std::vector<uint32_t> next_;  // Per block: index of the next block in the same bucket + 1, or 0.
+};
+
+/**
+ * Encodes `target` as a git delta against the source of `index` into `delta`.
+ *
+ * Returns `false` if the delta would exceed `max_size` bytes (0 means no limit); the search gives
+ * up as soon as that is certain, which keeps trying poor candidate bases cheap.
+ * The resulting format is the one understood by `apply_delta` and by git itself.
+ */
+bool create_delta(const DeltaIndex& index, std::string_view target, std::size_t max_size, std::string& delta);
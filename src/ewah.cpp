@@ -0,0 +1,153 @@
+#include "ewah.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+constexpr unsigned RUNNING_BITS = 32;
+constexpr unsigned LITERAL_BITS = 31;
+constexpr uint64_t MAX_RUNNING = (uint64_t(1) << RUNNING_BITS) - 1;
+constexpr uint64_t MAX_LITERALS = (uint64_t(1) << LITERAL_BITS) - 1;
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t load_be64(const unsigned char *p) {
+    return (uint64_t(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+void append_be32(std::string& out, uint32_t value) {
+    const char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+    out.append(bytes, 4);
+}
+
+void append_be64(std::string& out, uint64_t value) {
+    append_be32(out, static_cast<uint32_t>(value >> 32));
+    append_be32(out, static_cast<uint32_t>(value));
+}
+
+} // namespace
+
+Bitmap& Bitmap::operator|=(const Bitmap& other) {
+    if (other.words_.size() > words_.size()) {
+        words_.resize(other.words_.size(), 0);
+    }
+    for (std::size_t i = 0; i < other.words_.size(); i++) {
+        words_[i] |= other.words_[i];
+    }
+    return *this;
+}
+
+Bitmap& Bitmap::operator^=(const Bitmap& other) {
+    if (other.words_.size() > words_.size()) {
+        words_.resize(other.words_.size(), 0);
+    }
+    for (std::size_t i = 0; i < other.words_.size(); i++) {
+        words_[i] ^= other.words_[i];
+    }
+    return *this;
+}
+
+Bitmap& Bitmap::operator&=(const Bitmap& other) {
+    words_.resize(std::min(words_.size(), other.words_.size()));
+    for (std::size_t i = 0; i < words_.size(); i++) {
+        words_[i] &= other.words_[i];
+    }
+    return *this;
+}
+
+Bitmap& Bitmap::and_not(const Bitmap& other) {
+    const std::size_t common = std::min(words_.size(), other.words_.size());
+    for (std::size_t i = 0; i < common; i++) {
+        words_[i] &= ~other.words_[i];
+    }
+    return *this;
+}
+
+std::size_t Bitmap::count() const {
+    std::size_t bits = 0;
+    for (const uint64_t word : words_) {
+        bits += std::popcount(word);
+    }
+    return bits;
+}
+
+namespace ewah {
+
+void append(std::string& out, const Bitmap& bitmap, std::size_t bits) {
+    const std::size_t word_count = (bits + 63) / 64;
+    auto word_at = [&](std::size_t i) {
+        uint64_t word = i < bitmap.words().size() ? bitmap.words()[i] : 0;
+        // Bits past the end are never set, so a partial last word is a literal unless it is empty.
+        if (i + 1 == word_count && bits % 64 != 0) {
+            word &= (uint64_t(1) << (bits % 64)) - 1;
+        }
+        return word;
+    };
+    std::vector<uint64_t> words;
+    std::size_t last_marker = 0;
+    std::size_t i = 0;
+    do {
+        last_marker = words.size();
+        words.push_back(0);
+        // A run of clean words, then the dirty words up to the next clean one.
+        uint64_t running = 0;
+        const bool running_bit = i < word_count && word_at(i) == ~uint64_t(0);
+        const uint64_t clean = running_bit ? ~uint64_t(0) : 0;
+        while (i < word_count && word_at(i) == clean && running < MAX_RUNNING) {
+            i++;
+            running++;
+        }
+        uint64_t literals = 0;
+        while (i < word_count && word_at(i) != 0 && word_at(i) != ~uint64_t(0) && literals < MAX_LITERALS) {
+            words.push_back(word_at(i++));
+            literals++;
+        }
+        words[last_marker] = uint64_t(running_bit) | (running << 1) | (literals << (1 + RUNNING_BITS));
+    } while (i < word_count);
+
+    append_be32(out, static_cast<uint32_t>(bits));
+    append_be32(out, static_cast<uint32_t>(words.size()));
+    for (const uint64_t word : words) {
+        append_be64(out, word);
+    }
+    append_be32(out, static_cast<uint32_t>(last_marker));
+}
+
+bool read(std::string_view data, Bitmap& bitmap, std::size_t& consumed) {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data.data());
+    if (data.size() < 12) {
+        return false;
+    }
+    const uint32_t bits = load_be32(bytes);
+    const std::size_t word_count = load_be32(bytes + 4);
+    if ((data.size() - 12) / 8 < word_count) {
+        return false;
+    }
+    const unsigned char *words = bytes + 8;
+    bitmap = Bitmap(bits);
+    std::vector<uint64_t>& out = bitmap.words();
+    std::size_t position = 0; // In words of the uncompressed bitmap.
+    for (std::size_t i = 0; i < word_count;) {
+        const uint64_t marker = load_be64(words + 8 * i++);
+        const uint64_t running = (marker >> 1) & MAX_RUNNING;
+        const uint64_t literals = marker >> (1 + RUNNING_BITS);
+        // Runs of zeros may reach past the bit count; ones and literals may not.
+        if (literals > word_count - i || ((marker & 1 || literals > 0) && position + running + literals > out.size())) {
+            return false;
+        }
+        if (marker & 1) {
+            std::fill_n(out.begin() + position, running, ~uint64_t(0));
+        }
+        position = std::min<uint64_t>(position + running, out.size());
+        for (uint64_t l = 0; l < literals; l++) {
+            out[position++] = load_be64(words + 8 * i++);
+        }
+    }
+    consumed = 8 + 8 * word_count + 4;
+    return true;
+}
+
+} // namespace ewah
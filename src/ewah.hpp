@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A plain, growable bitset: bit `i` is bit `i % 64` of word `i / 64`. Reachability queries combine
+ * these with word-wide OR and AND-NOT, which is a few thousand instructions even for packs with a
+ * million objects.
+ */
+class Bitmap {
+public:
+    Bitmap() = default;
+    explicit Bitmap(std::size_t bits) : words_((bits + 63) / 64, 0) {}
+
+    bool test(std::size_t bit) const { return bit / 64 < words_.size() && (words_[bit / 64] >> (bit % 64)) & 1; }
+
+    void set(std::size_t bit) {
+        if (bit / 64 >= words_.size()) {
+            words_.resize(bit / 64 + 1, 0);
+        }
+        words_[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    Bitmap& operator|=(const Bitmap& other);
+    Bitmap& operator^=(const Bitmap& other);
+    Bitmap& operator&=(const Bitmap& other);
+
+    // Clears every bit that is set in `other`.
+    Bitmap& and_not(const Bitmap& other);
+
+    // Number of set bits.
+    std::size_t count() const;
+
+    const std::vector<uint64_t>& words() const { return words_; }
+    std::vector<uint64_t>& words() { return words_; }
+
+private:
+    std::vector<uint64_t> words_;
+};
+
+/**
+ * EWAH, the word-aligned run-length compression git stores bitmaps in (as in `ewah/` of git).
+ *
+ * A compressed bitmap is a sequence of marker words, each followed by literal words. A marker says
+ * how many words of all zeros or all ones (bit 0) come first (bits 1-32), then how many literal
+ * words follow it (bits 33-63). Serialized, as in `.bitmap` files:
+ *
+ *   bit count (be32) | word count (be32) | words (be64 each) | position of the last marker (be32)
+ */
+namespace ewah {
+
+// Appends the serialized compression of the first `bits` bits of `bitmap` to `out`.
+void append(std::string& out, const Bitmap& bitmap, std::size_t bits);
+
+// Decodes the serialized bitmap at the start of `data` into `bitmap`, and the bytes it took into
+// `consumed`. Returns `false` if it is truncated or malformed.
+bool read(std::string_view data, Bitmap& bitmap, std::size_t& consumed);
+
+} // namespace ewah
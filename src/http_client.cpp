@@ -0,0 +1,429 @@
+#include "http_client.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Bytes asked from the socket at a time.
+constexpr std::size_t READ_SIZE = 64 * 1024;
+
+std::string to_lower(std::string_view text) {
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    return lower;
+}
+
+std::string openssl_error() {
+    const unsigned long code = ERR_get_error();
+    if (code == 0) {
+        return "unknown TLS error";
+    }
+    char text[256];
+    ERR_error_string_n(code, text, sizeof(text));
+    return text;
+}
+
+} // namespace
+
+/**
+ * One TCP connection, with TLS on top for https.
+ */
+class HttpConnection {
+public:
+    HttpConnection() = default;
+    ~HttpConnection() {
+        if (ssl_) {
+            SSL_shutdown(ssl_);
+            SSL_free(ssl_);
+        }
+        if (context_) {
+            SSL_CTX_free(context_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    HttpConnection(const HttpConnection&) = delete;
+    HttpConnection& operator=(const HttpConnection&) = delete;
+
+    // Connects to the host of `url`, trying every address it resolves to. Prints an error on failure.
+    bool open(const Url& url, const HttpOptions& options) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        if (const int status = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addresses); status != 0) {
+            std::cerr << "Could not resolve host " << url.host << ": " << gai_strerror(status) << '\n';
+            return false;
+        }
+        int error = 0;
+        for (addrinfo *address = addresses; address && fd_ < 0; address = address->ai_next) {
+            fd_ = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd_ >= 0 && ::connect(fd_, address->ai_addr, address->ai_addrlen) != 0) {
+                error = errno;
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd_ < 0) {
+            std::cerr << "Could not connect to " << url.host << " port " << url.port << ": " << std::strerror(error)
+                      << '\n';
+            return false;
+        }
+        return url.scheme != "https" || start_tls(url.host, options.verify_tls);
+    }
+
+    bool write_all(std::string_view data) {
+        while (!data.empty()) {
+            const long written = ssl_ ? SSL_write(ssl_, data.data(), static_cast<int>(std::min<std::size_t>(data.size(), 1u << 30)))
+                                      : ::write(fd_, data.data(), data.size());
+            if (written <= 0) {
+                if (!ssl_ && written < 0 && errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Failed to send the request: " << (ssl_ ? openssl_error() : std::strerror(errno)) << '\n';
+                return false;
+            }
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+        return true;
+    }
+
+    // Returns the number of bytes read, 0 when the server closed the connection, or -1 on error.
+    long read_some(char *out, std::size_t size) {
+        while (true) {
+            if (ssl_) {
+                const int n = SSL_read(ssl_, out, static_cast<int>(std::min<std::size_t>(size, 1u << 30)));
+                if (n > 0) {
+                    return n;
+                }
+                const int error = SSL_get_error(ssl_, n);
+                // Servers that close without a TLS close_notify (most of them, after a response) end the stream too.
+                if (error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && ERR_peek_error() == 0)) {
+                    return 0;
+                }
+                std::cerr << "Failed to receive the response: " << openssl_error() << '\n';
+                return -1;
+            }
+            const long n = ::read(fd_, out, size);
+            if (n >= 0) {
+                return n;
+            }
+            if (errno != EINTR) {
+                std::cerr << "Failed to receive the response: " << std::strerror(errno) << '\n';
+                return -1;
+            }
+        }
+    }
+
+private:
+    bool start_tls(const std::string& host, bool verify) {
+        context_ = SSL_CTX_new(TLS_client_method());
+        if (!context_) {
+            std::cerr << "Could not set up TLS: " << openssl_error() << '\n';
+            return false;
+        }
+        SSL_CTX_set_min_proto_version(context_, TLS1_2_VERSION);
+        if (verify) {
+            SSL_CTX_set_default_verify_paths(context_);
+            SSL_CTX_set_verify(context_, SSL_VERIFY_PEER, nullptr);
+        }
+        ssl_ = SSL_new(context_);
+        if (!ssl_ || !SSL_set_fd(ssl_, fd_) || !SSL_set_tlsext_host_name(ssl_, host.c_str()) ||
+            (verify && !SSL_set1_host(ssl_, host.c_str()))) {
+            std::cerr << "Could not set up TLS: " << openssl_error() << '\n';
+            return false;
+        }
+        if (SSL_connect(ssl_) != 1) {
+            const long result = SSL_get_verify_result(ssl_);
+            std::cerr << "TLS handshake with " << host << " failed: "
+                      << (result != X509_V_OK ? X509_verify_cert_error_string(result) : openssl_error()) << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    SSL_CTX *context_ = nullptr;
+    SSL *ssl_ = nullptr;
+};
+
+std::optional<Url> Url::parse(std::string_view text) {
+    Url url;
+    const std::size_t scheme_end = text.find("://");
+    if (scheme_end == std::string_view::npos) {
+        return std::nullopt;
+    }
+    url.scheme = to_lower(text.substr(0, scheme_end));
+    if (url.scheme != "http" && url.scheme != "https") {
+        return std::nullopt;
+    }
+    text.remove_prefix(scheme_end + 3);
+    const std::size_t authority_end = std::min(text.find('/'), text.find('?'));
+    std::string_view authority = text.substr(0, authority_end);
+    url.path = authority_end == std::string_view::npos ? "/" : std::string(text.substr(authority_end));
+    if (url.path.front() != '/') {
+        url.path.insert(0, 1, '/');
+    }
+    // Credentials in the URL are not supported; drop them rather than send them to the wrong place.
+    if (const std::size_t at = authority.rfind('@'); at != std::string_view::npos) {
+        authority.remove_prefix(at + 1);
+    }
+    std::size_t port_start = std::string_view::npos;
+    if (authority.starts_with('[')) { // [IPv6]:port
+        const std::size_t close = authority.find(']');
+        if (close == std::string_view::npos) {
+            return std::nullopt;
+        }
+        url.host = std::string(authority.substr(1, close - 1));
+        if (close + 1 < authority.size() && authority[close + 1] == ':') {
+            port_start = close + 2;
+        }
+    } else {
+        const std::size_t colon = authority.rfind(':');
+        url.host = std::string(authority.substr(0, colon));
+        if (colon != std::string_view::npos) {
+            port_start = colon + 1;
+        }
+    }
+    url.port = port_start != std::string_view::npos ? std::string(authority.substr(port_start)) : "";
+    if (url.port.empty()) {
+        url.port = url.scheme == "https" ? "443" : "80";
+    }
+    if (url.host.empty() || !std::all_of(url.port.begin(), url.port.end(), ::isdigit)) {
+        return std::nullopt;
+    }
+    return url;
+}
+
+std::string Url::authority() const {
+    const bool default_port = port == (scheme == "https" ? "443" : "80");
+    const std::string host_part = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+    return host_part + (default_port ? "" : ":" + port);
+}
+
+std::string Url::to_string() const { return scheme + "://" + authority() + path; }
+
+HttpResponse::HttpResponse(std::unique_ptr<HttpConnection> connection) : connection_(std::move(connection)) {}
+
+HttpResponse::~HttpResponse() = default;
+
+std::optional<std::string> HttpResponse::header(std::string_view name) const {
+    const std::string lower = to_lower(name);
+    for (const auto& [key, value] : headers_) {
+        if (key == lower) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+long HttpResponse::read_raw(char *out, std::size_t size) {
+    if (pos_ == buffer_.size()) {
+        buffer_.resize(READ_SIZE);
+        const long n = connection_->read_some(buffer_.data(), buffer_.size());
+        buffer_.resize(std::max(n, 0L));
+        pos_ = 0;
+        if (n <= 0) {
+            return n;
+        }
+    }
+    const std::size_t n = std::min(size, buffer_.size() - pos_);
+    std::memcpy(out, buffer_.data() + pos_, n);
+    pos_ += n;
+    return static_cast<long>(n);
+}
+
+bool HttpResponse::read_line(std::string& line) {
+    line.clear();
+    char c;
+    while (true) {
+        const long n = read_raw(&c, 1);
+        if (n <= 0) {
+            if (n == 0) {
+                std::cerr << "The server closed the connection in the middle of the response\n";
+            }
+            return false;
+        }
+        if (c == '\n') {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return true;
+        }
+        // Status, header and chunk-size lines are short; anything else is not HTTP.
+        if (line.size() > 64 * 1024) {
+            std::cerr << "Malformed HTTP response\n";
+            return false;
+        }
+        line.push_back(c);
+    }
+}
+
+bool HttpResponse::read_head() {
+    std::string line;
+    // Interim responses (100 Continue) come before the real one.
+    do {
+        if (!read_line(line)) {
+            return false;
+        }
+        int status = 0;
+        if (!line.starts_with("HTTP/1.") || line.size() < 12 ||
+            std::from_chars(line.data() + 9, line.data() + 12, status).ec != std::errc()) {
+            std::cerr << "Malformed HTTP response from " << url_.host << '\n';
+            return false;
+        }
+        status_ = status;
+        headers_.clear();
+        while (read_line(line) && !line.empty()) {
+            const std::size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::size_t value_start = colon + 1;
+            while (value_start < line.size() && (line[value_start] == ' ' || line[value_start] == '\t')) {
+                value_start++;
+            }
+            headers_.emplace_back(to_lower(std::string_view(line).substr(0, colon)), line.substr(value_start));
+        }
+    } while (status_ >= 100 && status_ < 200);
+
+    const std::optional<std::string> encoding = header("Transfer-Encoding");
+    chunked_ = encoding && to_lower(*encoding).find("chunked") != std::string::npos;
+    if (chunked_) {
+        remaining_ = 0;
+    } else if (const std::optional<std::string> length = header("Content-Length")) {
+        uint64_t size = 0;
+        if (std::from_chars(length->data(), length->data() + length->size(), size).ec != std::errc()) {
+            std::cerr << "Malformed Content-Length in HTTP response\n";
+            return false;
+        }
+        remaining_ = size;
+    }
+    done_ = status_ == 204 || status_ == 304 || (!chunked_ && remaining_ == 0);
+    return true;
+}
+
+long HttpResponse::read(char *out, std::size_t size) {
+    if (done_ || size == 0) {
+        return 0;
+    }
+    if (chunked_ && *remaining_ == 0) {
+        // "<hex size>[;extensions]" then the data and CRLF; a zero size ends the body (after any trailers).
+        std::string line;
+        if (!read_line(line)) {
+            return -1;
+        }
+        uint64_t chunk = 0;
+        if (std::from_chars(line.data(), line.data() + line.size(), chunk, 16).ec != std::errc()) {
+            std::cerr << "Malformed chunk in HTTP response\n";
+            return -1;
+        }
+        if (chunk == 0) {
+            while (read_line(line) && !line.empty()) {
+            }
+            done_ = true;
+            return 0;
+        }
+        remaining_ = chunk;
+    }
+    const std::size_t wanted = remaining_ ? std::min<uint64_t>(size, *remaining_) : size;
+    const long n = read_raw(out, wanted);
+    if (n < 0) {
+        return -1;
+    }
+    if (n == 0) {
+        if (remaining_) {
+            std::cerr << "The server closed the connection in the middle of the response\n";
+            return -1;
+        }
+        done_ = true;
+        return 0;
+    }
+    if (remaining_) {
+        *remaining_ -= static_cast<uint64_t>(n);
+        if (*remaining_ == 0) {
+            if (chunked_) {
+                std::string line;
+                if (!read_line(line) || !line.empty()) {
+                    std::cerr << "Malformed chunk in HTTP response\n";
+                    return -1;
+                }
+            } else {
+                done_ = true;
+            }
+        }
+    }
+    return n;
+}
+
+bool HttpResponse::read_all(std::string& body) {
+    body.clear();
+    char chunk[READ_SIZE];
+    long n;
+    while ((n = read(chunk, sizeof(chunk))) > 0) {
+        body.append(chunk, static_cast<std::size_t>(n));
+    }
+    return n == 0;
+}
+
+std::unique_ptr<HttpResponse> http_request(std::string_view method, const Url& url,
+                                           const std::vector<std::string>& headers, std::string_view body,
+                                           const HttpOptions& options) {
+    Url target = url;
+    for (int redirects = 0;; redirects++) {
+        auto connection = std::make_unique<HttpConnection>();
+        if (!connection->open(target, options)) {
+            return nullptr;
+        }
+        std::string request = std::string(method) + ' ' + target.path + " HTTP/1.1\r\n";
+        request += "Host: " + target.authority() + "\r\n";
+        request += "User-Agent: git/mygit\r\nConnection: close\r\n";
+        for (const std::string& header : headers) {
+            request += header + "\r\n";
+        }
+        if (method == "POST") {
+            request += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+        request += "\r\n";
+        if (!connection->write_all(request) || !connection->write_all(body)) {
+            return nullptr;
+        }
+
+        auto response = std::make_unique<HttpResponse>(std::move(connection));
+        response->url_ = target;
+        if (!response->read_head()) {
+            return nullptr;
+        }
+        const int status = response->status();
+        const std::optional<std::string> location = response->header("Location");
+        if (method != "GET" || status < 300 || status >= 400 || status == 304 || !location) {
+            return response;
+        }
+        if (redirects == options.max_redirects) {
+            std::cerr << "Too many redirects from " << url.to_string() << '\n';
+            return nullptr;
+        }
+        // Relative locations keep the scheme and host.
+        if (std::optional<Url> next = Url::parse(*location)) {
+            target = *next;
+        } else if (location->starts_with('/')) {
+            target.path = *location;
+        } else {
+            std::cerr << "Unsupported redirect to " << *location << '\n';
+            return nullptr;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * An `http://` or `https://` URL, split into what a request needs.
+ */
+struct Url {
+    std::string scheme; // "http" or "https".
+    std::string host;
+    std::string port;   // The scheme's default port if the URL has none.
+    std::string path;   // Starts with '/'; includes the query, if any.
+
+    // Returns `std::nullopt` for anything but an http(s) URL with a host.
+    static std::optional<Url> parse(std::string_view text);
+
+    // The host, bracketed if it is an IPv6 address, and the port unless it is the default: the
+    // authority of `to_string` and the value of the Host header.
+    std::string authority() const;
+    std::string to_string() const;
+};
+
+struct HttpOptions {
+    bool verify_tls = true;   // Check the server's certificate chain and host name for https.
+    int max_redirects = 5;    // Followed for GET requests only, as git does for the ref advertisement.
+};
+
+class HttpConnection;
+
+/**
+ * The status, headers and body of a response, with the body read as it arrives: fixed-length,
+ * chunked, or until the server closes the connection. Each request uses its own connection.
+ */
+class HttpResponse {
+public:
+    explicit HttpResponse(std::unique_ptr<HttpConnection> connection);
+    ~HttpResponse();
+
+    int status() const { return status_; }
+    const Url& url() const { return url_; }
+
+    // The value of header `name` (case-insensitive), if the response has it.
+    std::optional<std::string> header(std::string_view name) const;
+
+    // Reads up to `size` body bytes into `out`. Returns the number read, 0 at the end of the body, or
+    // -1 (after printing an error) if the connection failed or the framing is broken.
+    long read(char *out, std::size_t size);
+
+    // Reads the rest of the body into `body`. Returns `false` (after printing an error) on failure.
+    bool read_all(std::string& body);
+
+private:
+    friend std::unique_ptr<HttpResponse> http_request(std::string_view, const Url&, const std::vector<std::string>&,
+                                                      std::string_view, const HttpOptions&);
+    bool read_head();
+    bool read_line(std::string& line);
+    long read_raw(char *out, std::size_t size);
+
+    std::unique_ptr<HttpConnection> connection_;
+    Url url_;
+    int status_ = 0;
+    std::vector<std::pair<std::string, std::string>> headers_; // Names in lower case.
+    std::string buffer_; // Received bytes that were not returned yet start at `pos_`.
+    std::size_t pos_ = 0;
+    bool chunked_ = false;
+    std::optional<uint64_t> remaining_; // Of the body, or of the current chunk when chunked.
+    bool done_ = false;
+};
+
+/**
+ * Sends `method` (GET or POST) for `url` with the extra `headers` ("Name: value") and `body`, and returns
+ * the response once its headers have arrived. Redirects of GET requests are followed; `url()` of the
+ * response is where it finally came from. Returns null after printing an error if the server could not
+ * be reached or did not answer with HTTP.
+ */
+std::unique_ptr<HttpResponse> http_request(std::string_view method, const Url& url,
+                                           const std::vector<std::string>& headers, std::string_view body,
+                                           const HttpOptions& options);
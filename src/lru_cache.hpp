@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * A thread-safe least-recently-used cache bounded by the total cost (usually bytes) of its values.
+ *
+ * Values are shared, immutable objects: `lookup` hands out a `shared_ptr`, so an entry evicted while
+ * a caller still uses it stays alive until that caller is done. Values costing more than the whole
+ * cache are not stored at all.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+    explicit LruCache(std::size_t max_cost) : max_cost_(max_cost) {}
+
+    LruCache(const LruCache&) = delete;
+    LruCache& operator=(const LruCache&) = delete;
+
+    std::size_t max_cost() const { return max_cost_; }
+
+    // The value stored for `key`, or null. Marks it as most recently used.
+    std::shared_ptr<const Value> lookup(const Key& key) {
+        std::lock_guard lock(mutex_);
+        auto found = entries_.find(key);
+        if (found == entries_.end()) {
+            return nullptr;
+        }
+        lru_.splice(lru_.begin(), lru_, found->second);
+        return found->second->value;
+    }
+
+    // Stores `value` for `key` unless it is already cached, evicting the least recently used entries to make room.
+    void insert(const Key& key, std::shared_ptr<const Value> value, std::size_t cost) {
+        if (cost > max_cost_) {
+            return;
+        }
+        std::lock_guard lock(mutex_);
+        if (entries_.contains(key)) {
+            return;
+        }
+        while (!lru_.empty() && cost_ + cost > max_cost_) {
+            cost_ -= lru_.back().cost;
+            entries_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+        lru_.push_front({key, std::move(value), cost});
+        entries_.emplace(key, lru_.begin());
+        cost_ += cost;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        std::shared_ptr<const Value> value;
+        std::size_t cost;
+    };
+
+    std::mutex mutex_;
+    std::size_t max_cost_;
+    std::size_t cost_ = 0;
+    std::list<Entry> lru_; // Most recently used first.
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> entries_;
+};
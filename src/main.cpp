@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "Server.hpp"
+#include "buffered_io.hpp"
+#include "config.hpp"
+#include "object_format.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "trace_perf.hpp"
+
+namespace {
+
+// Runs the command named by `argv[1]` and returns its exit status.
+int run_git(int argc, char *argv[]) {
+    OutputBuffer& output = standard_output();
+    std::string command = argv[1];
+    if (command == "init") {
+        const int status = init_repository(argc, argv);
+        return output.flush() ? status : EXIT_FAILURE;
+    }
+    if (command == "clone") {
+        const int status = clone_repository(argc, argv);
+        return output.flush() ? status : EXIT_FAILURE;
+    }
+    // Every other command runs with the ids of the repository's object format.
+    const std::optional<ObjectFormat> format = repository_object_format();
+    if (!format) {
+        return EXIT_FAILURE;
+    }
+    return with_object_format(*format, [&]<typename Hash>() { return run_command<Hash>(command, argc, argv); });
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // Everything written to stdout goes through one large buffer (see `standard_output`), flushed when
+    // the process exits or, if stdout is a terminal, at the end of each line. std::cerr stays unbuffered.
+    standard_output();
+
+    if (argc < 2) {
+        std::cerr << "No command provided.\n";
+        return EXIT_FAILURE;
+    }
+
+    // Leading `-c <name>=<value>` options override the repository config, as in git. `--trace-perf`
+    // (or GIT_TRACE_PERFORMANCE) reports where the command spent its time, see `trace_perf.hpp`.
+    perf_trace::enable_from_environment();
+    int first = 1;
+    while (first < argc) {
+        const std::string_view option = argv[first];
+        if (option == "--trace-perf") {
+            perf_trace::enable("1");
+            first++;
+        } else if (option == "-c" && first + 1 < argc) {
+            if (!add_config_override(argv[first + 1])) {
+                return EXIT_FAILURE;
+            }
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    argc -= first - 1;
+    argv += first - 1;
+    if (argc < 2) {
+        std::cerr << "No command provided.\n";
+        return EXIT_FAILURE;
+    }
+
+    if (!perf_trace::enabled()) {
+        return run_git(argc, argv);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const int status = run_git(argc, argv);
+    std::string command_line = "git";
+    for (int i = 1; i < argc; i++) {
+        command_line += ' ';
+        command_line += argv[i];
+    }
+    perf_trace::report(command_line, std::chrono::steady_clock::now() - start);
+    return status;
+}
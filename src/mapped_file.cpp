@@ -0,0 +1,102 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "trace_perf.hpp"
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        mapping_ = std::exchange(other.mapping_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        is_open_ = std::exchange(other.is_open_, false);
+        buffer_ = std::move(other.buffer_);
+        data_ = mapping_ != nullptr ? static_cast<const char *>(mapping_) : buffer_.data();
+        other.data_ = nullptr;
+        other.buffer_.clear();
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string& path, std::size_t min_map_size) {
+    close();
+    PerfScope scope(PerfPhase::FileRead);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const bool map = S_ISREG(st.st_mode) && st.st_size > 0 && static_cast<std::size_t>(st.st_size) >= min_map_size;
+    if (map) {
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            // Hashing and inflating walk the file front to back.
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            ::close(fd);
+            mapping_ = mapping;
+            data_ = static_cast<const char *>(mapping);
+            size_ = st.st_size;
+            is_open_ = true;
+            scope.add_bytes(size_);
+            return true;
+        }
+        // Fall back to reading if the file cannot be mapped (e.g. on some network filesystems).
+    }
+
+    // Small or non-regular file: read it in full. The size of a regular file is known up front.
+    buffer_.resize(S_ISREG(st.st_mode) ? static_cast<std::size_t>(st.st_size) : 0);
+    std::size_t filled = 0;
+    while (true) {
+        if (filled == buffer_.size()) {
+            if (S_ISREG(st.st_mode)) {
+                break;
+            }
+            buffer_.resize(buffer_.empty() ? 64 * 1024 : buffer_.size() * 2);
+        }
+        ssize_t n = ::read(fd, buffer_.data() + filled, buffer_.size() - filled);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            ::close(fd);
+            buffer_.clear();
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    ::close(fd);
+    buffer_.resize(filled);
+    data_ = buffer_.data();
+    size_ = filled;
+    is_open_ = true;
+    scope.add_bytes(size_);
+    return true;
+}
+
+void MappedFile::close() {
+    if (mapping_ != nullptr) {
+        munmap(mapping_, size_);
+        mapping_ = nullptr;
+    }
+    buffer_.clear();
+    data_ = nullptr;
+    size_ = 0;
+    is_open_ = false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * Read-only access to the whole contents of a file, memory-mapped when that pays off.
+ *
+ * Regular files of at least `min_map_size` bytes are mapped with `mmap`, so their contents can be
+ * handed straight to SHA-1 or zlib without copying them through iostreams or a userspace buffer.
+ * Smaller files (where setting up and tearing down a mapping costs more than a `read`), empty files
+ * and non-regular files such as pipes are read into an owned buffer instead. Either way `view()`
+ * covers the complete contents.
+ *
+ * The mapping is private and read-only; it stays valid until the `MappedFile` is destroyed or moved from.
+ */
+class MappedFile {
+public:
+    // Files below this size are read rather than mapped unless the caller asks otherwise.
+    static constexpr std::size_t DEFAULT_MIN_MAP_SIZE = 64 * 1024;
+
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path, std::size_t min_map_size = DEFAULT_MIN_MAP_SIZE) {
+        open(path, min_map_size);
+    }
+    ~MappedFile() { close(); }
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Opens `path`, replacing anything opened before. Returns `false` if it cannot be read.
+    bool open(const std::string& path, std::size_t min_map_size = DEFAULT_MIN_MAP_SIZE);
+    void close();
+
+    bool is_open() const { return is_open_; }
+    bool is_mapped() const { return mapping_ != nullptr; }
+    const char *data() const { return data_; }
+    std::size_t size() const { return size_; }
+    std::string_view view() const { return std::string_view(data_, size_); }
+
+private:
+    void *mapping_ = nullptr;
+    const char *data_ = nullptr;
+    std::size_t size_ = 0;
+    std::string buffer_; // Contents of files that were read instead of mapped.
+    bool is_open_ = false;
+};
@@ -0,0 +1,15 @@
+#include "object_format.hpp"
+
+#include <iostream>
+
+std::optional<ObjectFormat> repository_object_format(const GitConfig& config) {
+    const std::optional<std::string> name = config.get("extensions.objectFormat");
+    if (!name) {
+        return ObjectFormat::Sha1;
+    }
+    const std::optional<ObjectFormat> format = object_format_from_name(*name);
+    if (!format) {
+        std::cerr << "fatal: unknown repository extension found:\n\tobjectformat = " << *name << '\n';
+    }
+    return format;
+}
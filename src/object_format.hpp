@@ -0,0 +1,46 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+#include "config.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+
+/**
+ * The hash algorithm a repository names its objects with.
+ *
+ * Everything that handles object ids is a template over the hash (`ObjectId<Sha1>`,
+ * `ObjectStore<Sha256>`, ...), so each format gets its own specialized code. The format is only
+ * looked at once per command, to pick which instantiation runs, via `with_object_format`.
+ */
+enum class ObjectFormat { Sha1, Sha256 };
+
+// Parses the value of `extensions.objectFormat` or `init --object-format`.
+constexpr std::optional<ObjectFormat> object_format_from_name(std::string_view name) {
+    if (name == Sha1::NAME) {
+        return ObjectFormat::Sha1;
+    }
+    if (name == Sha256::NAME) {
+        return ObjectFormat::Sha256;
+    }
+    return std::nullopt;
+}
+
+/**
+ * The format of the repository `config` belongs to: `extensions.objectFormat`, SHA-1 if unset.
+ * Returns `std::nullopt` (after printing an error) for a format this build does not know.
+ */
+std::optional<ObjectFormat> repository_object_format(const GitConfig& config = repository_config());
+
+/**
+ * Calls `function.template operator()<Hash>()` with the hash type of `format`, typically a
+ * generic lambda `[&]<typename Hash>() { ... }`, and returns its result.
+ */
+template <typename Function>
+decltype(auto) with_object_format(ObjectFormat format, Function&& function) {
+    if (format == ObjectFormat::Sha256) {
+        return function.template operator()<Sha256>();
+    }
+    return function.template operator()<Sha1>();
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * Table-driven hexadecimal encoding and decoding.
+ *
+ * Both tables are built at compile time: encoding looks up the two output characters of a byte
+ * in a single load, decoding maps every input character to its nibble value (or -1 if it is not a
+ * lowercase/uppercase hex digit). No iostreams, locales or allocations are involved.
+ */
+namespace hex {
+
+constexpr std::array<std::array<char, 2>, 256> make_encode_table() {
+    constexpr char digits[] = "0123456789abcdef";
+    std::array<std::array<char, 2>, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        table[i] = {digits[i >> 4], digits[i & 0xf]};
+    }
+    return table;
+}
+
+constexpr std::array<int8_t, 256> make_decode_table() {
+    std::array<int8_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        table[i] = -1;
+    }
+    for (int i = 0; i < 10; i++) {
+        table['0' + i] = static_cast<int8_t>(i);
+    }
+    for (int i = 0; i < 6; i++) {
+        table['a' + i] = static_cast<int8_t>(10 + i);
+        table['A' + i] = static_cast<int8_t>(10 + i);
+    }
+    return table;
+}
+
+inline constexpr auto ENCODE_TABLE = make_encode_table();
+inline constexpr auto DECODE_TABLE = make_decode_table();
+
+// Writes the 2 * `size` hex characters of `bytes` to `out` (not NUL terminated).
+constexpr void encode(const uint8_t *bytes, std::size_t size, char *out) {
+    for (std::size_t i = 0; i < size; i++) {
+        out[2 * i] = ENCODE_TABLE[bytes[i]][0];
+        out[2 * i + 1] = ENCODE_TABLE[bytes[i]][1];
+    }
+}
+
+// Decodes exactly 2 * `size` hex characters from `text` into `out`. Returns `false` on any non-hex character.
+constexpr bool decode(std::string_view text, uint8_t *out, std::size_t size) {
+    if (text.size() != 2 * size) {
+        return false;
+    }
+    for (std::size_t i = 0; i < size; i++) {
+        const int8_t high = DECODE_TABLE[static_cast<unsigned char>(text[2 * i])];
+        const int8_t low = DECODE_TABLE[static_cast<unsigned char>(text[2 * i + 1])];
+        if ((high | low) < 0) {
+            return false;
+        }
+        out[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+}
+
+} // namespace hex
+
+/**
+ * The name of a Git object: the digest of its "<type> <size>\0<content>" form under the repository's
+ * hash algorithm `Hash` (`Sha1` or `Sha256`, see `object_format.hpp`).
+ *
+ * `ObjectId` is a trivially copyable value: comparing, hashing and copying it never allocates.
+ * The digest width is a compile-time constant of each instantiation, so none of that branches on the
+ * repository's format either. Hex strings are only produced at the edges (command line arguments,
+ * output, loose object paths).
+ */
+template <typename Hash>
+struct ObjectId {
+    static constexpr std::size_t RAW_SIZE = Hash::DIGEST_SIZE;
+    static constexpr std::size_t HEX_SIZE = 2 * RAW_SIZE;
+
+    std::array<uint8_t, RAW_SIZE> bytes{};
+
+    // Parses a full hex id (either case) of this format's length. Returns `std::nullopt` for anything else.
+    static std::optional<ObjectId> from_hex(std::string_view text) {
+        ObjectId id;
+        if (!hex::decode(text, id.bytes.data(), RAW_SIZE)) {
+            return std::nullopt;
+        }
+        return id;
+    }
+
+    // Copies `RAW_SIZE` raw bytes, e.g. straight out of a tree entry or a pack index.
+    static ObjectId from_raw(const void *raw) {
+        ObjectId id;
+        std::memcpy(id.bytes.data(), raw, RAW_SIZE);
+        return id;
+    }
+
+    std::string to_hex() const {
+        std::string text(HEX_SIZE, '\0');
+        hex::encode(bytes.data(), RAW_SIZE, text.data());
+        return text;
+    }
+
+    // The raw bytes as they appear inside tree objects.
+    std::string_view raw() const {
+        return std::string_view(reinterpret_cast<const char *>(bytes.data()), RAW_SIZE);
+    }
+
+    // The index of the `objects/xx` fan-out directory this object lives in.
+    uint8_t fanout() const { return bytes[0]; }
+
+    // `<objects_dir>/xx`, the fan-out directory holding this loose object.
+    std::string loose_directory(std::string_view objects_dir = ".git/objects") const {
+        std::string path(objects_dir.size() + 3, '/');
+        std::memcpy(path.data(), objects_dir.data(), objects_dir.size());
+        hex::encode(bytes.data(), 1, path.data() + objects_dir.size() + 1);
+        return path;
+    }
+
+    // `<objects_dir>/xx/yyyy...`, the path of this loose object, built with a single allocation.
+    std::string loose_path(std::string_view objects_dir = ".git/objects") const {
+        std::string path(objects_dir.size() + HEX_SIZE + 2, '/');
+        std::memcpy(path.data(), objects_dir.data(), objects_dir.size());
+        char *out = path.data() + objects_dir.size() + 1;
+        hex::encode(bytes.data(), 1, out);
+        hex::encode(bytes.data() + 1, RAW_SIZE - 1, out + 3);
+        return path;
+    }
+
+    friend bool operator==(const ObjectId&, const ObjectId&) = default;
+    friend auto operator<=>(const ObjectId&, const ObjectId&) = default;
+};
+
+/**
+ * An abbreviated object id as users type it: the first `length` hex digits of an id.
+ *
+ * `low` is those digits followed by zeros, the smallest id the prefix can stand for, so the ids matching
+ * it form one contiguous run in any sorted id table, starting at the first id not less than `low`.
+ */
+template <typename Hash>
+struct ObjectIdPrefix {
+    // The shortest abbreviation accepted, as in git.
+    static constexpr std::size_t MIN_HEX_SIZE = 4;
+
+    ObjectId<Hash> low;
+    std::size_t length = 0;
+
+    // Parses `MIN_HEX_SIZE` up to `ObjectId<Hash>::HEX_SIZE` hex digits (either case).
+    static std::optional<ObjectIdPrefix> from_hex(std::string_view text) {
+        if (text.size() < MIN_HEX_SIZE || text.size() > ObjectId<Hash>::HEX_SIZE) {
+            return std::nullopt;
+        }
+        ObjectIdPrefix prefix;
+        prefix.length = text.size();
+        for (std::size_t i = 0; i < text.size(); i++) {
+            const int8_t nibble = hex::DECODE_TABLE[static_cast<unsigned char>(text[i])];
+            if (nibble < 0) {
+                return std::nullopt;
+            }
+            prefix.low.bytes[i / 2] |= static_cast<uint8_t>(i % 2 == 0 ? nibble << 4 : nibble);
+        }
+        return prefix;
+    }
+
+    bool matches(const ObjectId<Hash>& id) const {
+        const std::size_t whole_bytes = length / 2;
+        if (std::memcmp(id.bytes.data(), low.bytes.data(), whole_bytes) != 0) {
+            return false;
+        }
+        return length % 2 == 0 || (id.bytes[whole_bytes] >> 4) == (low.bytes[whole_bytes] >> 4);
+    }
+};
+
+/**
+ * Hash functor for unordered containers keyed by `ObjectId`. Digests are already uniformly
+ * distributed, so the first 8 bytes are used as-is.
+ */
+template <typename Hash>
+struct ObjectIdHash {
+    std::size_t operator()(const ObjectId<Hash>& id) const noexcept {
+        std::size_t value;
+        std::memcpy(&value, id.bytes.data(), sizeof(value));
+        return value;
+    }
+};
+
+/**
+ * One message for `Hash::hash_many`: the hash of `header` followed by `data` is stored in `id`.
+ */
+template <typename Hash>
+struct HashJob {
+    std::string_view header;
+    std::string_view data;
+    ObjectId<Hash> id;
+};
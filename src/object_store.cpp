@@ -0,0 +1,436 @@
+#include "object_store.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+#include "mapped_file.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "trace_perf.hpp"
+
+namespace {
+
+/**
+ * Incremental reader for a zlib-compressed loose object file.
+ * The format of a loose object looks like this: <type> <size>\0<content> (size is in bytes)
+ *
+ * The reader works as follows:
+ *
+ * 1. **Open the Object**:
+ *    - Maps the object file (small objects are simply read, see `MappedFile`) and initializes a zlib `inflate` stream.
+ *
+ * 2. **Parse the Header**:
+ *    - Inflates only the first few bytes of the object, enough to find the `'\0'` that ends the header,
+ *      and parses `type()` and `size()` from it.
+ *    - Content bytes that were inflated together with the header are kept aside and returned first by `read`.
+ *
+ * 3. **Read the Content**:
+ *    - `read` inflates straight from the mapped file into the caller's buffer, so the compressed bytes are
+ *      never copied and each of them is inflated exactly once.
+ *
+ * If anything fails, an error message is printed and `ok()` returns `false`.
+ */
+class LooseObjectReader {
+public:
+    explicit LooseObjectReader(const std::string& file_path) : path_(file_path) {
+        if (!file_.open(file_path)) {
+            std::cerr << "Failed to open " + file_path + " file.\n";
+            return;
+        }
+        if (inflateInit(&strm_) != Z_OK) {
+            std::cerr << "Failed to initialize zlib inflate stream.\n";
+            return;
+        }
+        stream_initialized_ = true;
+        ok_ = parse_header();
+    }
+
+    ~LooseObjectReader() {
+        if (stream_initialized_) {
+            inflateEnd(&strm_);
+        }
+    }
+
+    LooseObjectReader(const LooseObjectReader&) = delete;
+    LooseObjectReader& operator=(const LooseObjectReader&) = delete;
+
+    bool ok() const { return ok_; }
+    const std::string& type() const { return type_; }
+    std::size_t size() const { return size_; }
+
+    /**
+     * Inflates up to `max` content bytes into `dest` and returns how many were written.
+     * Returns 0 once the whole content has been read or an error occurred.
+     */
+    std::size_t read(char *dest, std::size_t max) {
+        std::size_t written = 0;
+        // Serve the content bytes that were inflated together with the header first.
+        if (pending_pos_ < pending_.size()) {
+            written = std::min(max, pending_.size() - pending_pos_);
+            std::copy_n(pending_.data() + pending_pos_, written, dest);
+            pending_pos_ += written;
+        }
+        if (written < max && ok_) {
+            written += inflate_into(reinterpret_cast<unsigned char *>(dest) + written, max - written);
+        }
+        delivered_ += written;
+        if (written == 0 && ok_ && stream_ended_ && delivered_ != size_) {
+            std::cerr << "Corrupt object " + path_ + ": size does not match header.\n";
+            ok_ = false;
+        }
+        return written;
+    }
+
+private:
+    // Inflates into `dest` until it is full or the stream ends, refilling input from the file as needed.
+    std::size_t inflate_into(unsigned char *dest, std::size_t max) {
+        strm_.next_out = dest;
+        strm_.avail_out = static_cast<uInt>(max);
+        while (strm_.avail_out > 0 && !stream_ended_) {
+            if (strm_.avail_in == 0) {
+                // zlib counts input in 32-bit units, so hand over huge objects a gigabyte at a time.
+                const std::size_t remaining = file_.size() - input_pos_;
+                strm_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(file_.data() + input_pos_));
+                strm_.avail_in = static_cast<uInt>(std::min<std::size_t>(remaining, 1u << 30));
+                input_pos_ += strm_.avail_in;
+                if (strm_.avail_in == 0) {
+                    std::cerr << "Failed to uncompress (git object)Zlib: truncated object " + path_ + "\n";
+                    ok_ = false;
+                    break;
+                }
+            }
+            const uInt avail_out = strm_.avail_out;
+            PerfScope scope(PerfPhase::Inflate);
+            int res = inflate(&strm_, Z_NO_FLUSH);
+            scope.add_bytes(avail_out - strm_.avail_out);
+            if (res == Z_STREAM_END) {
+                stream_ended_ = true;
+            } else if (res != Z_OK && res != Z_BUF_ERROR) {
+                std::cerr << "Failed to uncompress (git object)Zlib. (code: " + std::to_string(res) + ")\n";
+                ok_ = false;
+                break;
+            }
+        }
+        return max - strm_.avail_out;
+    }
+
+    // Inflates a small prefix of the object and parses "<type> <size>\0" out of it.
+    bool parse_header() {
+        // The longest header ("commit " + 20 digits + '\0') is well below this.
+        constexpr std::size_t header_probe = 64;
+        pending_.resize(header_probe);
+        std::size_t filled = 0;
+        std::size_t nul = std::string::npos;
+        ok_ = true;
+        while (nul == std::string::npos && filled < header_probe && ok_ && !stream_ended_) {
+            filled += inflate_into(reinterpret_cast<unsigned char *>(pending_.data()) + filled, header_probe - filled);
+            nul = pending_.find('\0');
+            if (nul >= filled) {
+                nul = std::string::npos;
+            }
+        }
+        const std::size_t space = pending_.find(' ');
+        if (nul == std::string::npos || space > nul) {
+            std::cerr << "Corrupt object " + path_ + ": missing header.\n";
+            return false;
+        }
+        type_ = pending_.substr(0, space);
+        // Only plain decimal digits, without sign, spaces or trailing junk, and small enough for `size_`.
+        const char *digits = pending_.data() + space + 1;
+        const char *digits_end = pending_.data() + nul;
+        const auto [end, ec] = std::from_chars(digits, digits_end, size_);
+        if (digits == digits_end || ec != std::errc() || end != digits_end) {
+            std::cerr << "Corrupt object " + path_ + ": invalid size in header.\n";
+            return false;
+        }
+        pending_.resize(filled);
+        pending_pos_ = nul + 1;
+        return true;
+    }
+
+    MappedFile file_;
+    std::string path_;
+    std::size_t input_pos_ = 0; // How much of `file_` has been handed to zlib.
+    z_stream strm_{};
+    bool stream_initialized_ = false;
+    bool stream_ended_ = false;
+    bool ok_ = false;
+    std::string type_;
+    std::size_t size_ = 0;
+    std::size_t delivered_ = 0;
+    std::string pending_;
+    std::size_t pending_pos_ = 0;
+};
+
+// Loose objects up to this size get their whole buffer up front; larger ones grow it while inflating.
+constexpr std::size_t MAX_PRESIZED_CONTENT = 16 << 20;
+
+} // namespace
+
+bool read_loose_object(const std::string &file_path, std::string &type, std::string &content) {
+    LooseObjectReader reader(file_path);
+    if (!reader.ok()) {
+        return false;
+    }
+    type = reader.type();
+    // The size in the header is not trusted with an allocation: a corrupt object can claim any size.
+    // The buffer starts at most `MAX_PRESIZED_CONTENT` large and grows with what actually inflates.
+    content.resize(std::min(reader.size(), MAX_PRESIZED_CONTENT));
+    std::size_t filled = 0;
+    while (filled < reader.size()) {
+        if (filled == content.size()) {
+            content.resize(std::min(reader.size(), 2 * content.size()));
+        }
+        const std::size_t n = reader.read(content.data() + filled, content.size() - filled);
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    content.resize(filled);
+    if (!reader.ok()) {
+        return false;
+    }
+    // Anything left in the stream means the content is longer than the header says.
+    char extra;
+    if (filled != reader.size() || reader.read(&extra, 1) != 0) {
+        std::cerr << "Corrupt object " + file_path + ": size does not match header.\n";
+        return false;
+    }
+    return true;
+}
+
+
+std::string make_temporary_object_path(const std::string& objects_dir) {
+    static std::atomic<unsigned long> counter{0};
+    while (true) {
+        std::string path = objects_dir + "/tmp_obj_" + std::to_string(getpid()) + "_" + std::to_string(counter++);
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            ::close(fd);
+            return path;
+        }
+        if (errno != EEXIST) {
+            return path; // Opening it again fails the same way and reports the error.
+        }
+    }
+}
+
+bool write_loose_object_file(const std::string& objects_dir, const std::string& object_path,
+                             std::string_view compressed) {
+    PerfScope scope(PerfPhase::ObjectWrite, compressed.size());
+    const std::string temp_path = make_temporary_object_path(objects_dir);
+    std::ofstream object_file(temp_path, std::ios::binary);
+    if (!object_file) {
+        std::cerr << "Error: Could not open file for writing: " << temp_path << '\n';
+        return false;
+    }
+    object_file.write(compressed.data(), compressed.size());
+    object_file.close();
+    std::error_code ec;
+    if (object_file) {
+        std::filesystem::rename(temp_path, object_path, ec);
+    }
+    if (!object_file || ec) {
+        std::cerr << "Error: Could not write object " << object_path << '\n';
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+template <typename Hash>
+ObjectStore<Hash>::ObjectStore(std::string objects_dir, std::size_t cache_bytes)
+    : objects_dir_(objects_dir), packs_(std::move(objects_dir)), cache_(cache_bytes) {}
+
+template <typename Hash>
+bool ObjectStore<Hash>::is_loose(const ObjectId<Hash>& id) const {
+    std::error_code ec;
+    return std::filesystem::exists(id.loose_path(objects_dir_), ec);
+}
+
+template <typename Hash>
+bool ObjectStore<Hash>::exists(const ObjectId<Hash>& id) {
+    return cache_.lookup(id) != nullptr || is_loose(id) || packs_.contains(id);
+}
+
+template <typename Hash>
+std::shared_ptr<const DecodedObject> ObjectStore<Hash>::read(const ObjectId<Hash>& id) {
+    if (auto cached = cache_.lookup(id)) {
+        return cached;
+    }
+    auto object = std::make_shared<DecodedObject>();
+    const std::string path = id.loose_path(objects_dir_);
+    if (is_loose(id)) {
+        std::string type_name;
+        if (!read_loose_object(path, type_name, object->data)) {
+            return nullptr;
+        }
+        object->type = object_type_from_name(type_name);
+        if (object->type == ObjectType::None) {
+            std::cerr << "Corrupt object " << path << ": unknown type " << type_name << '\n';
+            return nullptr;
+        }
+    } else if (!packs_.read(id, object->type, object->data)) {
+        std::cerr << "Not a valid object name " << id.to_hex() << '\n';
+        return nullptr;
+    }
+    cache_.insert(id, object, object->data.size());
+    return object;
+}
+
+template <typename Hash>
+bool ObjectStore<Hash>::read_info(const ObjectId<Hash>& id, ObjectType& type, std::size_t& size) {
+    if (!cache_.lookup(id) && is_loose(id)) {
+        const std::string path = id.loose_path(objects_dir_);
+        LooseObjectReader reader(path);
+        if (!reader.ok()) {
+            return false;
+        }
+        type = object_type_from_name(reader.type());
+        if (type == ObjectType::None) {
+            std::cerr << "Corrupt object " << path << ": unknown type " << reader.type() << '\n';
+            return false;
+        }
+        size = reader.size();
+        return true;
+    }
+    const std::shared_ptr<const DecodedObject> object = read(id);
+    if (!object) {
+        return false;
+    }
+    type = object->type;
+    size = object->data.size();
+    return true;
+}
+
+template <typename Hash>
+bool ObjectStore<Hash>::stream(const ObjectId<Hash>& id, ObjectSink& sink) {
+    if (!cache_.lookup(id) && is_loose(id)) {
+        const std::string path = id.loose_path(objects_dir_);
+        LooseObjectReader reader(path);
+        if (!reader.ok()) {
+            return false;
+        }
+        const ObjectType type = object_type_from_name(reader.type());
+        if (type == ObjectType::None) {
+            std::cerr << "Corrupt object " << path << ": unknown type " << reader.type() << '\n';
+            return false;
+        }
+        sink.header(type, reader.size());
+        std::vector<char> chunk(std::min(STREAM_CHUNK_SIZE, std::max<std::size_t>(reader.size(), 1)));
+        while (std::size_t n = reader.read(chunk.data(), chunk.size())) {
+            sink.write(std::string_view(chunk.data(), n));
+        }
+        return reader.ok();
+    }
+    if (const std::shared_ptr<const DecodedObject> cached = cache_.lookup(id)) {
+        sink.header(cached->type, cached->data.size());
+        sink.write(cached->data);
+        return true;
+    }
+    // Inflated from the pack mapping into a buffer that this thread reuses for every object it streams.
+    thread_local std::string data;
+    ObjectType type = ObjectType::None;
+    if (!packs_.read(id, type, data)) {
+        std::cerr << "Not a valid object name " << id.to_hex() << '\n';
+        return false;
+    }
+    sink.header(type, data.size());
+    sink.write(data);
+    return true;
+}
+
+template <typename Hash>
+std::optional<ObjectId<Hash>> ObjectStore<Hash>::write(ObjectType type, std::string_view data) {
+    const std::string header = std::string(object_type_name(type)) + ' ' + std::to_string(data.size()) + '\0';
+    Hash sha;
+    sha.update(header);
+    sha.update(data);
+    const ObjectId<Hash> id = sha.finish();
+    if (exists(id)) {
+        return id;
+    }
+
+    std::string compressed;
+    if (!deflate_object(header, data, compression_level_, compressed)) {
+        std::cerr << "Error: Failed to compress object " << id.to_hex() << ".\n";
+        return std::nullopt;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(id.loose_directory(objects_dir_), ec);
+    if (!write_loose_object_file(objects_dir_, id.loose_path(objects_dir_), compressed)) {
+        return std::nullopt;
+    }
+    return id;
+}
+
+template <typename Hash>
+const std::vector<ObjectId<Hash>>& ObjectStore<Hash>::loose_ids(const ObjectId<Hash>& id) {
+    LooseIndex& index = loose_index_[id.fanout()];
+    std::call_once(index.listed, [&] {
+        const std::string dir = id.loose_directory(objects_dir_);
+        const std::string prefix = dir.substr(dir.size() - 2);
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            // Temporary files and other strays do not parse as ids and are ignored.
+            if (auto loose = ObjectId<Hash>::from_hex(prefix + entry.path().filename().string())) {
+                index.ids.push_back(*loose);
+            }
+        }
+        std::sort(index.ids.begin(), index.ids.end());
+    });
+    return index.ids;
+}
+
+template <typename Hash>
+typename ObjectStore<Hash>::PrefixMatch ObjectStore<Hash>::resolve_prefix(const ObjectIdPrefix<Hash>& prefix,
+                                                                          ObjectId<Hash>& id) {
+    std::optional<ObjectId<Hash>> found;
+    // Records a candidate; `false` once a second, different object matches.
+    auto add = [&](const ObjectId<Hash>& candidate) {
+        if (found && *found != candidate) {
+            return false;
+        }
+        found = candidate;
+        return true;
+    };
+    // Ids matching the prefix are contiguous in each sorted table, and the scan of a table stops at the
+    // second different match, so each lookup reads at most a couple of ids past the binary search.
+    const std::vector<ObjectId<Hash>>& loose = loose_ids(prefix.low);
+    for (auto it = std::lower_bound(loose.begin(), loose.end(), prefix.low); it != loose.end() && prefix.matches(*it);
+         ++it) {
+        if (!add(*it)) {
+            return PrefixMatch::Ambiguous;
+        }
+    }
+    for (const auto& pack : packs_.packs()) {
+        const PackIndex<Hash>& index = pack->index();
+        for (uint32_t position = index.lower_bound(prefix.low); position < index.size(); position++) {
+            const ObjectId<Hash> candidate = index.id_at(position);
+            if (!prefix.matches(candidate)) {
+                break;
+            }
+            if (!add(candidate)) {
+                return PrefixMatch::Ambiguous;
+            }
+        }
+    }
+    if (!found) {
+        return PrefixMatch::None;
+    }
+    id = *found;
+    return PrefixMatch::Unique;
+}
+
+template class ObjectStore<Sha1>;
+template class ObjectStore<Sha256>;
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compression.hpp"
+#include "lru_cache.hpp"
+#include "object_id.hpp"
+#include "object_type.hpp"
+#include "pack.hpp"
+
+// Size of the chunks read from disk and handed to SHA-1/zlib by the streaming object readers and writers.
+constexpr std::size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * The type and content (without the "<type> <size>\0" header) of an object.
+ */
+struct DecodedObject {
+    ObjectType type = ObjectType::None;
+    std::string data;
+};
+
+/**
+ * Receives an object from `ObjectStore::stream`: first its type and size, then its content in pieces.
+ */
+class ObjectSink {
+public:
+    virtual ~ObjectSink() = default;
+    virtual void header(ObjectType type, std::size_t size) { (void)type, (void)size; }
+    virtual void write(std::string_view data) = 0;
+};
+
+/**
+ * Reads and decompresses the loose object file at `file_path` into its `type` (e.g. "blob") and `content`.
+ * Returns `false` (after printing an error) if the object cannot be read.
+ */
+bool read_loose_object(const std::string& file_path, std::string& type, std::string& content);
+
+/**
+ * Returns the path of a new, empty file inside `objects_dir`, used as the staging file for an object
+ * whose final name (its hash) is not known until it has been written. The file is created with
+ * `O_EXCL`, so no two writers, threads or processes sharing the repository, ever stage into the same file.
+ */
+std::string make_temporary_object_path(const std::string& objects_dir = ".git/objects");
+
+/**
+ * Writes the compressed bytes of a loose object to a temporary file in `objects_dir` and renames it to
+ * `object_path`, whose fan-out directory must exist. Readers see either no object or the whole object;
+ * when several writers store the same object at once, each rename installs the same complete bytes.
+ * Returns `false` (after printing an error) if the object could not be written.
+ */
+bool write_loose_object_file(const std::string& objects_dir, const std::string& object_path,
+                             std::string_view compressed);
+
+/**
+ * The object database of a repository: loose objects and packs behind one interface.
+ *
+ * 1. **Backends**:
+ *    - Objects are looked up as loose files first and in the packs of `objects/pack` otherwise.
+ *      The packs are opened once, on first use, and keep their mappings and delta-base caches for
+ *      as long as the store lives.
+ *
+ * 2. **Decoded-Object Cache**:
+ *    - Every object read is kept, decoded, in a least-recently-used cache bounded by `cache_bytes`,
+ *      so walks that revisit objects (recursive trees, history) inflate each of them only once.
+ *    - Cached objects are shared and immutable; `read` hands out `shared_ptr`s to them.
+ *
+ * 3. **Writes**:
+ *    - `write` hashes an object and only compresses and writes it if the store does not have it yet.
+ *      New objects are written to a temporary file and renamed into place.
+ *
+ * Ids are `ObjectId<Hash>`, named with the repository's hash algorithm. All member functions are safe
+ * to call from many threads.
+ */
+template <typename Hash>
+class ObjectStore {
+public:
+    static constexpr std::size_t DEFAULT_CACHE_BYTES = 64 * 1024 * 1024;
+
+    explicit ObjectStore(std::string objects_dir = ".git/objects", std::size_t cache_bytes = DEFAULT_CACHE_BYTES);
+
+    ObjectStore(const ObjectStore&) = delete;
+    ObjectStore& operator=(const ObjectStore&) = delete;
+
+    const std::string& objects_dir() const { return objects_dir_; }
+    const PackSet<Hash>& packs() const { return packs_; }
+
+    // Reads object `id`. Returns null (after printing an error) if it is missing or cannot be read.
+    std::shared_ptr<const DecodedObject> read(const ObjectId<Hash>& id);
+
+    // Returns `true` if the object is cached, loose or in a pack.
+    bool exists(const ObjectId<Hash>& id);
+
+    // Returns `true` if the object has a loose file.
+    bool is_loose(const ObjectId<Hash>& id) const;
+
+    // Stores an object of `type` with content `data` and returns its id, or `std::nullopt` on failure.
+    std::optional<ObjectId<Hash>> write(ObjectType type, std::string_view data);
+
+    // Sets the level `write` compresses new loose objects at. Not synchronized: call it before sharing the store.
+    void set_compression_level(int level) { compression_level_ = level; }
+
+    // Looks up the type and size of object `id`. For loose objects only the header is inflated.
+    // Returns `false` (after printing an error) if it is missing or cannot be read.
+    bool read_info(const ObjectId<Hash>& id, ObjectType& type, std::size_t& size);
+
+    /**
+     * Hands the type, size and content of object `id` to `sink`. Loose objects are inflated in
+     * `STREAM_CHUNK_SIZE` pieces and not cached, so printing a large blob never holds all of it in memory.
+     * Packed objects are inflated straight from the pack mapping into a per-thread buffer, also bypassing
+     * the cache, so streaming many blobs (as `checkout` does) neither copies them nor evicts trees.
+     * Returns `false` (after printing an error) if the object cannot be read.
+     */
+    bool stream(const ObjectId<Hash>& id, ObjectSink& sink);
+
+    enum class PrefixMatch { None, Unique, Ambiguous };
+
+    /**
+     * Resolves an abbreviated id, storing the object it stands for in `id` when exactly one matches.
+     *
+     * Loose objects are looked up in a sorted index of the `objects/xx` directory the prefix falls in,
+     * listed the first time that directory is asked about; packed ones by binary search in every pack
+     * index. Later lookups never touch the directory again. The loose index is a snapshot: objects
+     * written after it was built, even through this store, are only found by their full id.
+     */
+    PrefixMatch resolve_prefix(const ObjectIdPrefix<Hash>& prefix, ObjectId<Hash>& id);
+
+private:
+    // The sorted ids of one `objects/xx` directory.
+    struct LooseIndex {
+        std::once_flag listed;
+        std::vector<ObjectId<Hash>> ids;
+    };
+
+    const std::vector<ObjectId<Hash>>& loose_ids(const ObjectId<Hash>& id);
+
+    std::string objects_dir_;
+    PackSet<Hash> packs_;
+    LruCache<ObjectId<Hash>, DecodedObject, ObjectIdHash<Hash>> cache_;
+    int compression_level_ = CompressionLevels().loose;
+    std::array<LooseIndex, 256> loose_index_;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string_view>
+
+/**
+ * Git object types, numbered as in the packfile format (type 5 is reserved, 6 and 7 only exist inside packs).
+ */
+enum class ObjectType {
+    None = 0,
+    Commit = 1,
+    Tree = 2,
+    Blob = 3,
+    Tag = 4,
+    OfsDelta = 6,
+    RefDelta = 7,
+};
+
+// The name used in loose object headers ("commit", "tree", "blob", "tag"), or "" for anything else.
+constexpr std::string_view object_type_name(ObjectType type) {
+    switch (type) {
+        case ObjectType::Commit: return "commit";
+        case ObjectType::Tree: return "tree";
+        case ObjectType::Blob: return "blob";
+        case ObjectType::Tag: return "tag";
+        default: return "";
+    }
+}
+
+// Parses a loose object type name; returns `ObjectType::None` if it is not one.
+constexpr ObjectType object_type_from_name(std::string_view name) {
+    if (name == "commit") return ObjectType::Commit;
+    if (name == "tree") return ObjectType::Tree;
+    if (name == "blob") return ObjectType::Blob;
+    if (name == "tag") return ObjectType::Tag;
+    return ObjectType::None;
+}
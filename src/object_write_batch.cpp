@@ -0,0 +1,126 @@
+#include "object_write_batch.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "object_store.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+
+namespace {
+// A batch is written once it holds this many objects or this many compressed bytes.
+constexpr std::size_t BATCH_MAX_OBJECTS = 512;
+constexpr std::size_t BATCH_MAX_BYTES = 8 * 1024 * 1024;
+}
+
+template <typename Hash>
+ObjectWriteBatch<Hash>::ObjectWriteBatch(std::string objects_dir, const PackSet<Hash> *packs)
+    : objects_dir_(std::move(objects_dir)), packs_(packs) {}
+
+template <typename Hash>
+ObjectWriteBatch<Hash>::~ObjectWriteBatch() {
+    flush();
+}
+
+template <typename Hash>
+typename ObjectWriteBatch<Hash>::Fanout& ObjectWriteBatch<Hash>::fanout_for(const ObjectId<Hash>& id) {
+    Fanout& fanout = fanouts_[id.fanout()];
+    std::call_once(fanout.listed, [&] {
+        std::error_code ec;
+        const std::string dir = id.loose_directory(objects_dir_);
+        const std::string prefix = dir.substr(dir.size() - 2);
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            // Temporary files and other strays do not parse as ids and are ignored.
+            if (auto existing = ObjectId<Hash>::from_hex(prefix + entry.path().filename().string())) {
+                fanout.existing.insert(*existing);
+            }
+        }
+        if (!ec) {
+            fanout.directory_ready = true;
+        }
+    });
+    return fanout;
+}
+
+template <typename Hash>
+bool ObjectWriteBatch<Hash>::exists(const ObjectId<Hash>& id) {
+    return fanout_for(id).existing.count(id) > 0 || (packs_ != nullptr && packs_->contains(id));
+}
+
+template <typename Hash>
+bool ObjectWriteBatch<Hash>::contains(const ObjectId<Hash>& id) {
+    if (exists(id)) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return claimed_.count(id) > 0;
+}
+
+template <typename Hash>
+bool ObjectWriteBatch<Hash>::claim(const ObjectId<Hash>& id) {
+    if (exists(id)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return claimed_.insert(id).second;
+}
+
+template <typename Hash>
+void ObjectWriteBatch<Hash>::add(const ObjectId<Hash>& id, std::string compressed) {
+    std::vector<PendingObject> full_batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_bytes_ += compressed.size();
+        pending_.push_back({id, std::move(compressed)});
+        if (pending_.size() >= BATCH_MAX_OBJECTS || pending_bytes_ >= BATCH_MAX_BYTES) {
+            full_batch.swap(pending_);
+            pending_bytes_ = 0;
+        }
+    }
+    // The batch is written outside the lock so other threads can keep queueing objects.
+    write_objects(full_batch);
+}
+
+template <typename Hash>
+bool ObjectWriteBatch<Hash>::flush() {
+    std::vector<PendingObject> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch.swap(pending_);
+        pending_bytes_ = 0;
+    }
+    write_objects(batch);
+    return !failed_;
+}
+
+template <typename Hash>
+void ObjectWriteBatch<Hash>::write_objects(std::vector<PendingObject>& objects) {
+    // Sorting groups objects by fan-out directory.
+    std::sort(objects.begin(), objects.end(), [](const PendingObject& a, const PendingObject& b) {
+        return a.id < b.id;
+    });
+    for (const auto& object : objects) {
+        if (!write_object(object.id, object.compressed)) {
+            failed_ = true;
+        }
+    }
+}
+
+template <typename Hash>
+std::string ObjectWriteBatch<Hash>::prepare_object_path(const ObjectId<Hash>& id) {
+    Fanout& fanout = fanout_for(id);
+    if (!fanout.directory_ready) {
+        std::error_code ec;
+        std::filesystem::create_directories(id.loose_directory(objects_dir_), ec);
+        fanout.directory_ready = true;
+    }
+    return id.loose_path(objects_dir_);
+}
+
+template <typename Hash>
+bool ObjectWriteBatch<Hash>::write_object(const ObjectId<Hash>& id, const std::string& compressed) {
+    return write_loose_object_file(objects_dir_, prepare_object_path(id), compressed);
+}
+
+template class ObjectWriteBatch<Sha1>;
+template class ObjectWriteBatch<Sha256>;
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "object_id.hpp"
+#include "pack.hpp"
+
+/**
+ * Collects loose objects produced by many threads and writes them to `.git/objects` in batches.
+ *
+ * It keeps the filesystem metadata cost of writing many objects low:
+ *
+ * 1. **Existence Checks**:
+ *    - Each `objects/xx` fan-out directory is listed once, on first use, instead of calling `stat`
+ *      for every object. With `packs`, their indexes are consulted too. Objects that already exist
+ *      are never compressed or written again.
+ *
+ * 2. **Deduplication**:
+ *    - `claim` hands every hash to exactly one caller, so identical content appearing several times
+ *      in a tree (or produced concurrently by several threads) is compressed and written once.
+ *
+ * 3. **Batched Writes**:
+ *    - Compressed objects are queued and written in batches sorted by hash, so writes to the same
+ *      fan-out directory happen together and each directory is created at most once.
+ *    - Every object is written to a temporary file and renamed into place (see
+ *      `write_loose_object_file`), so a reader never sees a partially written object.
+ *
+ * All member functions are safe to call from many threads.
+ */
+template <typename Hash>
+class ObjectWriteBatch {
+public:
+    // `packs`, if given, must outlive the batch.
+    explicit ObjectWriteBatch(std::string objects_dir = ".git/objects", const PackSet<Hash> *packs = nullptr);
+    ~ObjectWriteBatch();
+
+    ObjectWriteBatch(const ObjectWriteBatch&) = delete;
+    ObjectWriteBatch& operator=(const ObjectWriteBatch&) = delete;
+
+    // Returns `true` if the object already exists on disk or has been claimed in this batch.
+    bool contains(const ObjectId<Hash>& id);
+
+    // Returns `true` if the caller is the first to ask for `id` and the object does not exist yet.
+    // The caller is then responsible for passing the compressed object to `add` (or writing it itself).
+    bool claim(const ObjectId<Hash>& id);
+
+    // Queues the zlib-compressed bytes of a claimed object for writing.
+    void add(const ObjectId<Hash>& id, std::string compressed);
+
+    // Returns `.git/objects/xx/yyyy...` for `id`, creating the fan-out directory if needed.
+    std::string prepare_object_path(const ObjectId<Hash>& id);
+
+    // Writes all queued objects. Returns `false` if any write in this batch failed so far.
+    bool flush();
+
+private:
+    struct PendingObject {
+        ObjectId<Hash> id;
+        std::string compressed;
+    };
+
+    // What we know about one `objects/xx` directory.
+    struct Fanout {
+        std::once_flag listed;
+        std::unordered_set<ObjectId<Hash>, ObjectIdHash<Hash>> existing;
+        std::atomic<bool> directory_ready{false};
+    };
+
+    Fanout& fanout_for(const ObjectId<Hash>& id);
+    // Whether the object is loose on disk (as of the directory listing) or in one of `packs_`.
+    bool exists(const ObjectId<Hash>& id);
+    void write_objects(std::vector<PendingObject>& objects);
+    bool write_object(const ObjectId<Hash>& id, const std::string& compressed);
+
+    std::string objects_dir_;
+    const PackSet<Hash> *packs_;
+    std::array<Fanout, 256> fanouts_;
+    std::mutex mutex_;
+    std::unordered_set<ObjectId<Hash>, ObjectIdHash<Hash>> claimed_;
+    std::vector<PendingObject> pending_;
+    std::size_t pending_bytes_ = 0;
+    std::atomic<bool> failed_{false};
+};
@@ -0,0 +1,491 @@
+#include "pack.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <zlib.h>
+
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "trace_perf.hpp"
+
+namespace {
+
+constexpr unsigned char IDX_MAGIC[4] = {0xff, 't', 'O', 'c'};
+constexpr std::size_t IDX_HEADER_SIZE = 8;
+constexpr std::size_t IDX_FANOUT_SIZE = 256 * 4;
+constexpr std::size_t PACK_HEADER_SIZE = 12;
+// Packs and indexes end in checksums of the repository's hash.
+template <typename Hash>
+constexpr std::size_t TRAILER_SIZE = Hash::DIGEST_SIZE;
+
+// Guards against cyclic or absurdly deep delta chains in a corrupt pack.
+constexpr std::size_t MAX_DELTA_CHAIN = 10000;
+// The same for chains that jump between packs, each jump being a nested `PackSet::read` on the stack.
+constexpr unsigned MAX_PACK_HOPS = 64;
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t load_be64(const unsigned char *p) {
+    return (uint64_t(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+// Delta size header: little-endian base-128, high bit means "more bytes follow".
+bool read_delta_size(std::string_view delta, std::size_t& pos, uint64_t& size) {
+    size = 0;
+    int shift = 0;
+    while (pos < delta.size() && shift < 64) {
+        const unsigned char byte = delta[pos++];
+        size |= uint64_t(byte & 0x7f) << shift;
+        shift += 7;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Entries and delta results up to this size get their whole buffer up front. Sizes come from headers a
+// corrupt or hostile pack controls, so larger ones only grow while data actually arrives.
+constexpr uint64_t MAX_PRESIZED_OUTPUT = 16 << 20;
+
+// The most a copy instruction (at least one byte of the delta) can add to the result.
+constexpr uint64_t MAX_DELTA_COPY_SIZE = 0xffffff;
+
+} // namespace
+
+template <typename Hash>
+bool PackIndex<Hash>::open(const std::string& idx_path) {
+    if (!file_.open(idx_path, 0)) {
+        return false;
+    }
+    const auto *data = reinterpret_cast<const unsigned char *>(file_.data());
+    const std::size_t size = file_.size();
+    if (size < IDX_HEADER_SIZE + IDX_FANOUT_SIZE + 2 * TRAILER_SIZE<Hash> ||
+        std::memcmp(data, IDX_MAGIC, sizeof(IDX_MAGIC)) != 0 || load_be32(data + 4) != 2) {
+        file_.close();
+        return false;
+    }
+
+    // Lookups bisect between neighbouring fanout entries, so they must never decrease (which also keeps
+    // them at most `count_`, the last one).
+    for (int byte = 1; byte < 256; byte++) {
+        if (fanout(byte - 1) > fanout(byte)) {
+            file_.close();
+            return false;
+        }
+    }
+    count_ = fanout(255);
+    const std::size_t tables = IDX_HEADER_SIZE + IDX_FANOUT_SIZE;
+    const std::size_t fixed =
+        tables + std::size_t(count_) * (ObjectId<Hash>::RAW_SIZE + 4 + 4) + 2 * TRAILER_SIZE<Hash>;
+    if (fixed > size || (size - fixed) % 8 != 0) {
+        file_.close();
+        return false;
+    }
+    ids_ = data + tables;
+    offsets32_ = ids_ + std::size_t(count_) * (ObjectId<Hash>::RAW_SIZE + 4);
+    offsets64_ = offsets32_ + std::size_t(count_) * 4;
+    offsets64_count_ = (size - fixed) / 8;
+    return true;
+}
+
+template <typename Hash>
+uint32_t PackIndex<Hash>::fanout(int byte) const {
+    if (byte < 0) {
+        return 0;
+    }
+    const auto *data = reinterpret_cast<const unsigned char *>(file_.data());
+    return load_be32(data + IDX_HEADER_SIZE + std::size_t(byte) * 4);
+}
+
+template <typename Hash>
+std::pair<uint32_t, uint32_t> PackIndex<Hash>::fanout_range(uint8_t first_byte) const {
+    return {fanout(int(first_byte) - 1), fanout(first_byte)};
+}
+
+template <typename Hash>
+uint32_t PackIndex<Hash>::lower_bound(const ObjectId<Hash>& id) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    auto [low, high] = fanout_range(id.bytes[0]);
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+        if (std::memcmp(ids_ + std::size_t(mid) * ObjectId<Hash>::RAW_SIZE, id.bytes.data(),
+                        ObjectId<Hash>::RAW_SIZE) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+template <typename Hash>
+std::optional<uint32_t> PackIndex<Hash>::find(const ObjectId<Hash>& id) const {
+    const uint32_t position = lower_bound(id);
+    if (position < count_ && std::memcmp(ids_ + std::size_t(position) * ObjectId<Hash>::RAW_SIZE, id.bytes.data(),
+                                         ObjectId<Hash>::RAW_SIZE) == 0) {
+        return position;
+    }
+    return std::nullopt;
+}
+
+template <typename Hash>
+ObjectId<Hash> PackIndex<Hash>::id_at(uint32_t position) const {
+    return ObjectId<Hash>::from_raw(ids_ + std::size_t(position) * ObjectId<Hash>::RAW_SIZE);
+}
+
+template <typename Hash>
+uint64_t PackIndex<Hash>::offset_at(uint32_t position) const {
+    const uint32_t offset = load_be32(offsets32_ + std::size_t(position) * 4);
+    if ((offset & 0x80000000u) == 0) {
+        return offset;
+    }
+    const uint32_t large = offset & 0x7fffffffu;
+    // An out-of-range index can only come from a corrupt file; no pack entry lives at offset 0.
+    return large < offsets64_count_ ? load_be64(offsets64_ + std::size_t(large) * 8) : 0;
+}
+
+template <typename Hash>
+bool Packfile<Hash>::open(const std::string& pack_path, const PackSet<Hash> *owner) {
+    static constexpr std::string_view PACK_SUFFIX = ".pack";
+    if (pack_path.size() <= PACK_SUFFIX.size() || !pack_path.ends_with(PACK_SUFFIX)) {
+        return false;
+    }
+    const std::string idx_path = pack_path.substr(0, pack_path.size() - PACK_SUFFIX.size()) + ".idx";
+    if (!index_.open(idx_path) || !pack_.open(pack_path, 0)) {
+        return false;
+    }
+    const auto *data = reinterpret_cast<const unsigned char *>(pack_.data());
+    if (pack_.size() < PACK_HEADER_SIZE + TRAILER_SIZE<Hash> || std::memcmp(data, "PACK", 4) != 0) {
+        pack_.close();
+        return false;
+    }
+    const uint32_t version = load_be32(data + 4);
+    if ((version != 2 && version != 3) || load_be32(data + 8) != index_.size()) {
+        pack_.close();
+        return false;
+    }
+    path_ = pack_path;
+    owner_ = owner;
+    return true;
+}
+
+template <typename Hash>
+bool Packfile<Hash>::parse_entry_header(uint64_t offset, EntryHeader& header) const {
+    const auto *data = reinterpret_cast<const unsigned char *>(pack_.data());
+    const uint64_t end = pack_.size() - TRAILER_SIZE<Hash>;
+    if (offset < PACK_HEADER_SIZE || offset >= end) {
+        return false;
+    }
+
+    // Type and size: first byte is 1|ttt|ssss, further bytes add 7 size bits each (little-endian).
+    uint64_t pos = offset;
+    unsigned char byte = data[pos++];
+    header.type = static_cast<ObjectType>((byte >> 4) & 0x7);
+    header.size = byte & 0x0f;
+    int shift = 4;
+    while (byte & 0x80) {
+        if (pos >= end || shift > 57) {
+            return false;
+        }
+        byte = data[pos++];
+        header.size |= uint64_t(byte & 0x7f) << shift;
+        shift += 7;
+    }
+
+    switch (header.type) {
+        case ObjectType::Commit:
+        case ObjectType::Tree:
+        case ObjectType::Blob:
+        case ObjectType::Tag:
+            break;
+        case ObjectType::OfsDelta: {
+            // Big-endian base-128 with an implicit +1 per continuation byte, relative to this entry.
+            if (pos >= end) {
+                return false;
+            }
+            byte = data[pos++];
+            uint64_t distance = byte & 0x7f;
+            while (byte & 0x80) {
+                if (pos >= end || distance > (UINT64_MAX >> 7)) {
+                    return false;
+                }
+                byte = data[pos++];
+                distance = ((distance + 1) << 7) | (byte & 0x7f);
+            }
+            if (distance == 0 || distance > offset) {
+                return false;
+            }
+            header.base_offset = offset - distance;
+            break;
+        }
+        case ObjectType::RefDelta:
+            if (end - pos < ObjectId<Hash>::RAW_SIZE) {
+                return false;
+            }
+            header.base_id = ObjectId<Hash>::from_raw(data + pos);
+            pos += ObjectId<Hash>::RAW_SIZE;
+            break;
+        default:
+            return false;
+    }
+    header.data_offset = pos;
+    return true;
+}
+
+template <typename Hash>
+bool Packfile<Hash>::inflate_at(uint64_t data_offset, uint64_t size, std::string& out) const {
+    if (data_offset >= pack_.size()) {
+        return false;
+    }
+    PerfScope scope(PerfPhase::Inflate, size);
+    out.resize(std::min(size, MAX_PRESIZED_OUTPUT));
+
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+    const auto *input = reinterpret_cast<const unsigned char *>(pack_.data()) + data_offset;
+    uint64_t input_left = pack_.size() - data_offset;
+    uint64_t output_pos = 0;
+    // Once the announced size is filled, let zlib write into a scratch byte: it must still see the
+    // end of the stream, and anything it produces there means the entry is larger than announced.
+    unsigned char scratch;
+    bool ok = false;
+    while (true) {
+        // zlib counts in `uInt`; hand it at most 1 GiB of either side at a time.
+        const uInt in_chunk = static_cast<uInt>(std::min<uint64_t>(input_left, 1u << 30));
+        const bool full = output_pos == size;
+        if (!full && output_pos == out.size()) {
+            out.resize(std::min<uint64_t>(size, 2 * out.size()));
+        }
+        const uInt out_chunk = full ? 1 : static_cast<uInt>(std::min<uint64_t>(out.size() - output_pos, 1u << 30));
+        stream.next_in = const_cast<Bytef *>(input);
+        stream.avail_in = in_chunk;
+        stream.next_out = full ? &scratch : reinterpret_cast<Bytef *>(out.data()) + output_pos;
+        stream.avail_out = out_chunk;
+
+        const int status = inflate(&stream, Z_NO_FLUSH);
+        const uInt consumed = in_chunk - stream.avail_in;
+        const uInt produced = out_chunk - stream.avail_out;
+        input += consumed;
+        input_left -= consumed;
+        if (full && produced != 0) {
+            break;
+        }
+        output_pos += produced;
+        if (status == Z_STREAM_END) {
+            ok = output_pos == size;
+            break;
+        }
+        if ((status != Z_OK && status != Z_BUF_ERROR) || (consumed == 0 && produced == 0)) {
+            break;
+        }
+    }
+    inflateEnd(&stream);
+    return ok;
+}
+
+template <typename Hash>
+bool Packfile<Hash>::read(const ObjectId<Hash>& id, ObjectType& type, std::string& data, unsigned pack_hops) const {
+    const auto position = index_.find(id);
+    return position && read_at(index_.offset_at(*position), type, data, pack_hops);
+}
+
+template <typename Hash>
+bool Packfile<Hash>::read_at(uint64_t offset, ObjectType& type, std::string& data, unsigned pack_hops) const {
+    // Walk down the delta chain until a cached base or the stored base object, collecting the deltas
+    // on the way, then apply them from the base upwards. This keeps the stack flat however deep the
+    // chain is.
+    std::vector<std::pair<uint64_t, std::string>> deltas; // Entry offset and inflated delta.
+    std::shared_ptr<const DeltaBaseCache::Base> cached;
+    EntryHeader header;
+    while (true) {
+        if (deltas.size() > MAX_DELTA_CHAIN) {
+            return false;
+        }
+        if ((cached = base_cache_.lookup(offset))) {
+            type = cached->type;
+            break;
+        }
+        if (!parse_entry_header(offset, header)) {
+            return false;
+        }
+        if (header.type != ObjectType::OfsDelta && header.type != ObjectType::RefDelta) {
+            type = header.type;
+            if (!inflate_at(header.data_offset, header.size, data)) {
+                std::cerr << "Corrupt pack entry at offset " << offset << " in " << path_ << '\n';
+                return false;
+            }
+            if (!deltas.empty()) {
+                base_cache_.insert(offset, type, data);
+            }
+            break;
+        }
+
+        std::string& delta = deltas.emplace_back(offset, std::string()).second;
+        if (!inflate_at(header.data_offset, header.size, delta)) {
+            std::cerr << "Corrupt pack entry at offset " << offset << " in " << path_ << '\n';
+            return false;
+        }
+        if (header.type == ObjectType::OfsDelta) {
+            offset = header.base_offset;
+            continue;
+        }
+        if (const auto position = index_.find(header.base_id)) {
+            offset = index_.offset_at(*position);
+            continue;
+        }
+        // A REF_DELTA whose base lives in another pack (which caches it on its side).
+        if (pack_hops >= MAX_PACK_HOPS) {
+            std::cerr << "Delta chain through other packs too deep at offset " << offset << " in " << path_ << '\n';
+            return false;
+        }
+        if (owner_ == nullptr || !owner_->read(header.base_id, type, data, pack_hops + 1)) {
+            return false;
+        }
+        break;
+    }
+
+    if (cached && deltas.empty()) {
+        data = cached->data;
+        return true;
+    }
+    std::string result;
+    for (auto delta = deltas.rbegin(); delta != deltas.rend(); ++delta) {
+        const std::string_view base = (cached && delta == deltas.rbegin()) ? std::string_view(cached->data) : data;
+        if (!apply_delta(base, delta->second, result)) {
+            std::cerr << "Corrupt delta at offset " << delta->first << " in " << path_ << '\n';
+            return false;
+        }
+        data.swap(result);
+        // Everything below the requested object was a base of the next delta up.
+        if (std::next(delta) != deltas.rend()) {
+            base_cache_.insert(delta->first, type, data);
+        }
+    }
+    return true;
+}
+
+template <typename Hash>
+void PackSet<Hash>::load() const {
+    const std::string pack_dir = objects_dir_ + "/pack";
+    DIR *dir = opendir(pack_dir.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    std::vector<std::string> names;
+    while (dirent *entry = readdir(dir)) {
+        const std::string_view name = entry->d_name;
+        if (name.starts_with("pack-") && name.ends_with(".pack")) {
+            names.emplace_back(name);
+        }
+    }
+    closedir(dir);
+    // Keep the order independent of the directory listing.
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names) {
+        auto pack = std::make_unique<Packfile<Hash>>();
+        if (pack->open(pack_dir + "/" + name, this)) {
+            packs_.push_back(std::move(pack));
+        }
+    }
+}
+
+template <typename Hash>
+const std::vector<std::unique_ptr<Packfile<Hash>>>& PackSet<Hash>::packs() const {
+    std::call_once(loaded_, [this] { load(); });
+    return packs_;
+}
+
+template <typename Hash>
+bool PackSet<Hash>::contains(const ObjectId<Hash>& id) const {
+    for (const auto& pack : packs()) {
+        if (pack->contains(id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Hash>
+bool PackSet<Hash>::read(const ObjectId<Hash>& id, ObjectType& type, std::string& data, unsigned pack_hops) const {
+    for (const auto& pack : packs()) {
+        if (pack->read(id, type, data, pack_hops)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool apply_delta(std::string_view base, std::string_view delta, std::string& out) {
+    std::size_t pos = 0;
+    uint64_t base_size = 0;
+    uint64_t result_size = 0;
+    if (!read_delta_size(delta, pos, base_size) || !read_delta_size(delta, pos, result_size) ||
+        base_size != base.size()) {
+        return false;
+    }
+    // Every instruction is at least one byte, so a size the instructions cannot produce is corrupt.
+    if (result_size / MAX_DELTA_COPY_SIZE > delta.size() - pos) {
+        return false;
+    }
+
+    // Grows with the instructions applied, up to the checked `result_size`.
+    out.clear();
+    out.reserve(std::min(result_size, MAX_PRESIZED_OUTPUT));
+    while (pos < delta.size()) {
+        const unsigned char op = delta[pos++];
+        if (op & 0x80) {
+            // Copy from base: bits 0-3 select offset bytes, bits 4-6 select size bytes (little-endian).
+            uint64_t copy_offset = 0;
+            uint64_t copy_size = 0;
+            for (int i = 0; i < 4; ++i) {
+                if (op & (1 << i)) {
+                    if (pos >= delta.size()) {
+                        return false;
+                    }
+                    copy_offset |= uint64_t(static_cast<unsigned char>(delta[pos++])) << (8 * i);
+                }
+            }
+            for (int i = 0; i < 3; ++i) {
+                if (op & (0x10 << i)) {
+                    if (pos >= delta.size()) {
+                        return false;
+                    }
+                    copy_size |= uint64_t(static_cast<unsigned char>(delta[pos++])) << (8 * i);
+                }
+            }
+            if (copy_size == 0) {
+                copy_size = 0x10000;
+            }
+            if (copy_offset + copy_size > base.size() || copy_size > result_size - out.size()) {
+                return false;
+            }
+            out.append(base.data() + copy_offset, copy_size);
+        } else if (op != 0) {
+            // Insert the next `op` bytes of the delta literally.
+            if (op > delta.size() - pos || op > result_size - out.size()) {
+                return false;
+            }
+            out.append(delta.data() + pos, op);
+            pos += op;
+        } else {
+            return false; // Opcode 0 is reserved.
+        }
+    }
+    return out.size() == result_size;
+}
+
+template class PackIndex<Sha1>;
+template class PackIndex<Sha256>;
+template class Packfile<Sha1>;
+template class Packfile<Sha256>;
+template class PackSet<Sha1>;
+template class PackSet<Sha256>;
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lru_cache.hpp"
+#include "mapped_file.hpp"
+#include "object_id.hpp"
+#include "object_type.hpp"
+
+/**
+ * A version 2 pack index (`.git/objects/pack/pack-*.idx`), read through a memory mapping.
+ *
+ * Layout:
+ *   "\377tOc" | version 2 | fanout[256] | sorted ids[N] | crc32[N] | offset32[N] | offset64[...] | trailer
+ * `fanout[b]` is the number of ids whose first byte is <= b, so the ids starting with byte b are
+ * exactly the range [fanout[b - 1], fanout[b]) and a lookup is one binary search inside that range.
+ * Offsets with the high bit set index into the 64-bit offset table. Ids and the trailing checksums
+ * are `ObjectId<Hash>::RAW_SIZE` bytes wide, as in git's SHA-256 repositories.
+ */
+template <typename Hash>
+class PackIndex {
+public:
+    bool open(const std::string& idx_path);
+
+    // Number of objects in the pack.
+    uint32_t size() const { return count_; }
+
+    // Position of `id` in the sorted id table, if present.
+    std::optional<uint32_t> find(const ObjectId<Hash>& id) const;
+
+    // Position of the first id not less than `id` (`size()` if there is none), by binary search.
+    uint32_t lower_bound(const ObjectId<Hash>& id) const;
+
+    ObjectId<Hash> id_at(uint32_t position) const;
+    uint64_t offset_at(uint32_t position) const;
+
+    // The half-open position range of all ids starting with `first_byte`.
+    std::pair<uint32_t, uint32_t> fanout_range(uint8_t first_byte) const;
+
+private:
+    uint32_t fanout(int byte) const;
+
+    MappedFile file_;
+    uint32_t count_ = 0;
+    const unsigned char *ids_ = nullptr;
+    const unsigned char *offsets32_ = nullptr;
+    const unsigned char *offsets64_ = nullptr;
+    std::size_t offsets64_count_ = 0;
+};
+
+/**
+ * A bounded LRU cache of inflated delta bases of one pack, keyed by the offset of their entry.
+ *
+ * Objects in a delta chain share most of it with their siblings (every version of a file is a delta
+ * against a neighbouring version), so remembering the objects that served as bases lets the next
+ * lookup apply a single delta instead of re-inflating the whole chain. The cache holds at most
+ * `max_bytes` of object data and evicts the least recently used bases first. It is thread-safe.
+ */
+class DeltaBaseCache {
+public:
+    // The same default as git's `core.deltaBaseCacheLimit`.
+    static constexpr std::size_t DEFAULT_MAX_BYTES = 96 * 1024 * 1024;
+
+    struct Base {
+        ObjectType type;
+        std::string data;
+    };
+
+    explicit DeltaBaseCache(std::size_t max_bytes = DEFAULT_MAX_BYTES) : cache_(max_bytes) {}
+
+    // The base stored for `offset`, or null. Marks it as most recently used.
+    std::shared_ptr<const Base> lookup(uint64_t offset) { return cache_.lookup(offset); }
+
+    // Caches a copy of `data` for `offset`; bases larger than the whole cache are not kept.
+    void insert(uint64_t offset, ObjectType type, std::string_view data) {
+        if (data.size() <= cache_.max_cost()) {
+            cache_.insert(offset, std::make_shared<const Base>(Base{type, std::string(data)}), data.size());
+        }
+    }
+
+private:
+    LruCache<uint64_t, Base> cache_;
+};
+
+template <typename Hash>
+class PackSet;
+
+/**
+ * A packfile (`pack-*.pack`) together with its index.
+ *
+ * The pack is memory-mapped and objects are inflated straight out of the mapping.
+ * Reading an object resolves its delta chain: OFS_DELTA bases are found by their (relative) offset,
+ * REF_DELTA bases by id in this pack's index, or through the owning `PackSet` if they live elsewhere.
+ * Every object that serves as a base on the way is kept in a `DeltaBaseCache`, so objects in the
+ * same chain found later start from the nearest cached base.
+ */
+template <typename Hash>
+class Packfile {
+public:
+    bool open(const std::string& pack_path, const PackSet<Hash> *owner = nullptr);
+
+    const std::string& path() const { return path_; }
+    const PackIndex<Hash>& index() const { return index_; }
+    bool contains(const ObjectId<Hash>& id) const { return index_.find(id).has_value(); }
+
+    // Reads and fully resolves the object `id`. Returns `false` if it is not in this pack or is corrupt.
+    // `pack_hops` counts the REF_DELTA bases already being resolved in other packs (see `PackSet::read`).
+    bool read(const ObjectId<Hash>& id, ObjectType& type, std::string& data, unsigned pack_hops = 0) const;
+
+    // Reads and fully resolves the object stored at `offset`.
+    bool read_at(uint64_t offset, ObjectType& type, std::string& data, unsigned pack_hops = 0) const;
+
+    // Header of the entry at `offset`: its in-pack type (possibly a delta type) and inflated size.
+    struct EntryHeader {
+        ObjectType type = ObjectType::None;
+        uint64_t size = 0;         // Size of the inflated entry (the delta itself for delta entries).
+        uint64_t data_offset = 0;  // Where the zlib stream starts.
+        uint64_t base_offset = 0;  // OFS_DELTA only.
+        ObjectId<Hash> base_id;    // REF_DELTA only.
+    };
+    bool parse_entry_header(uint64_t offset, EntryHeader& header) const;
+
+    // Inflates `size` bytes from the zlib stream starting at `data_offset`.
+    bool inflate_at(uint64_t data_offset, uint64_t size, std::string& out) const;
+
+private:
+    std::string path_;
+    MappedFile pack_;
+    PackIndex<Hash> index_;
+    const PackSet<Hash> *owner_ = nullptr;
+    mutable DeltaBaseCache base_cache_;
+};
+
+/**
+ * Every pack in `.git/objects/pack`, opened lazily on first use. Safe to share between threads.
+ */
+template <typename Hash>
+class PackSet {
+public:
+    explicit PackSet(std::string objects_dir = ".git/objects") : objects_dir_(std::move(objects_dir)) {}
+
+    bool contains(const ObjectId<Hash>& id) const;
+    // A REF_DELTA base in another pack is read back through here with `pack_hops` one higher, which
+    // bounds the recursion when corrupt packs have REF_DELTAs on each other's objects.
+    bool read(const ObjectId<Hash>& id, ObjectType& type, std::string& data, unsigned pack_hops = 0) const;
+    const std::vector<std::unique_ptr<Packfile<Hash>>>& packs() const;
+
+private:
+    void load() const;
+
+    std::string objects_dir_;
+    mutable std::once_flag loaded_;
+    mutable std::vector<std::unique_ptr<Packfile<Hash>>> packs_;
+};
+
+/**
+ * Applies a git delta (as stored in OFS_DELTA/REF_DELTA entries) to `base`, producing `out`.
+ *
+ * A delta is: source size (varint) | target size (varint) | instructions, where an instruction with
+ * the high bit set copies a range of `base` (offset and size bytes selected by the low 7 bits) and
+ * any other non-zero instruction inserts that many literal bytes from the delta itself.
+ * Returns `false` if the delta is malformed or does not match `base`.
+ */
+bool apply_delta(std::string_view base, std::string_view delta, std::string& out);
@@ -0,0 +1,414 @@
+#include "pack_bitmap.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "tree_view.hpp"
+
+namespace {
+
+constexpr uint16_t BITMAP_VERSION = 1;
+constexpr uint16_t BITMAP_OPT_FULL_DAG = 0x1; // Required: every bitmap is closed under reachability.
+constexpr std::size_t HEADER_SIZE = 12;
+constexpr std::size_t MAX_XOR_OFFSET = 160;
+
+uint16_t load_be16(const unsigned char *p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void append_be16(std::string& out, uint16_t value) {
+    const char bytes[2] = {char(value >> 8), char(value)};
+    out.append(bytes, 2);
+}
+
+void append_be32(std::string& out, uint32_t value) {
+    const char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+    out.append(bytes, 4);
+}
+
+// "<dir>/pack-<hash>.pack" -> "<dir>/pack-<hash>.bitmap".
+std::string bitmap_path(const std::string& pack_path) {
+    return pack_path.substr(0, pack_path.size() - std::string_view(".pack").size()) + ".bitmap";
+}
+
+// The checksum a pack is named after, from its path.
+template <typename Hash>
+std::optional<ObjectId<Hash>> pack_checksum(const std::string& pack_path) {
+    const std::string name = std::filesystem::path(pack_path).stem().string();
+    return name.starts_with("pack-") ? ObjectId<Hash>::from_hex(std::string_view(name).substr(5)) : std::nullopt;
+}
+
+// Index positions in pack order, i.e. sorted by offset.
+template <typename Hash>
+std::vector<uint32_t> pack_order(const PackIndex<Hash>& index) {
+    std::vector<uint32_t> order(index.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<uint64_t> offsets(index.size());
+    for (uint32_t i = 0; i < index.size(); i++) {
+        offsets[i] = index.offset_at(i);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return offsets[a] < offsets[b]; });
+    return order;
+}
+
+// Index into the type bitmaps, or -1 for types that have none.
+int type_slot(ObjectType type) {
+    switch (type) {
+        case ObjectType::Commit: return 0;
+        case ObjectType::Tree: return 1;
+        case ObjectType::Blob: return 2;
+        case ObjectType::Tag: return 3;
+        default: return -1;
+    }
+}
+
+/**
+ * Whether every bit set in `bitmap` is below `bits`, the number of objects in the pack. git records
+ * the bit count of its bitmaps rounded up to whole (allocated) words, so only the set bits can be
+ * checked against the pack.
+ */
+bool fits_pack(const Bitmap& bitmap, std::size_t bits) {
+    const std::vector<uint64_t>& words = bitmap.words();
+    const std::size_t full_words = bits / 64;
+    for (std::size_t w = full_words; w < words.size(); w++) {
+        const uint64_t allowed = w == full_words ? (uint64_t(1) << (bits % 64)) - 1 : 0;
+        if (words[w] & ~allowed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Pushes the objects `data` (of an object of `type`) points at: a commit's tree and parents, a tree's
+ * entries (not submodule commits) and a tag's object. Returns `false` if it is malformed.
+ */
+template <typename Hash>
+bool push_references(ObjectType type, std::string_view data, std::vector<ObjectId<Hash>>& stack) {
+    if (type == ObjectType::Tree) {
+        TreeView<Hash> tree(data);
+        for (const TreeEntryView<Hash>& entry : tree) {
+            if (entry.mode != "160000") {
+                stack.push_back(entry.id);
+            }
+        }
+        return !tree.corrupt();
+    }
+    if (type != ObjectType::Commit && type != ObjectType::Tag) {
+        return true;
+    }
+    // Header lines up to the first blank line: "tree <sha>", "parent <sha>" or "object <sha>".
+    std::size_t line_start = 0;
+    while (line_start < data.size() && data[line_start] != '\n') {
+        const std::size_t line_end = std::min(data.find('\n', line_start), data.size());
+        const std::string_view line = data.substr(line_start, line_end - line_start);
+        const std::size_t space = line.find(' ');
+        const std::string_view key = line.substr(0, space);
+        if (space != std::string_view::npos && (key == "tree" || key == "parent" || key == "object")) {
+            const std::optional<ObjectId<Hash>> id = ObjectId<Hash>::from_hex(line.substr(space + 1));
+            if (!id) {
+                return false;
+            }
+            stack.push_back(*id);
+        }
+        line_start = line_end + 1;
+    }
+    return true;
+}
+
+} // namespace
+
+template <typename Hash>
+bool PackBitmap<Hash>::open(const Packfile<Hash>& pack) {
+    const std::string path = bitmap_path(pack.path());
+    MappedFile file;
+    if (!std::filesystem::exists(path) || !file.open(path, 0)) {
+        return false;
+    }
+    auto unusable = [&](const char *reason) {
+        std::cerr << "warning: ignoring bitmap " << path << ": " << reason << '\n';
+        return false;
+    };
+    const auto *data = reinterpret_cast<const unsigned char *>(file.data());
+    const std::size_t size = file.size();
+    if (size < HEADER_SIZE + 2 * Hash::DIGEST_SIZE || std::memcmp(data, "BITM", 4) != 0) {
+        return unusable("not a bitmap file");
+    }
+    if (load_be16(data + 4) != BITMAP_VERSION || !(load_be16(data + 6) & BITMAP_OPT_FULL_DAG)) {
+        return unusable("unsupported version or options");
+    }
+    const std::optional<ObjectId<Hash>> checksum = pack_checksum<Hash>(pack.path());
+    if (!checksum || std::memcmp(data + HEADER_SIZE, checksum->bytes.data(), Hash::DIGEST_SIZE) != 0) {
+        return unusable("written for another pack");
+    }
+    const uint32_t entries = load_be32(data + 8);
+
+    const PackIndex<Hash>& index = pack.index();
+    index_position_ = pack_order(index);
+    bit_position_.assign(index.size(), 0);
+    for (uint32_t bit = 0; bit < index_position_.size(); bit++) {
+        bit_position_[index_position_[bit]] = bit;
+    }
+
+    std::string_view rest(file.data() + HEADER_SIZE + Hash::DIGEST_SIZE, size - HEADER_SIZE - 2 * Hash::DIGEST_SIZE);
+    std::size_t consumed = 0;
+    for (Bitmap& type : types_) {
+        if (!ewah::read(rest, type, consumed)) {
+            return unusable("truncated type bitmaps");
+        }
+        if (!fits_pack(type, index.size())) {
+            return unusable("type bitmap has bits past the pack's objects");
+        }
+        rest.remove_prefix(consumed);
+    }
+    bitmaps_.reserve(entries);
+    for (uint32_t i = 0; i < entries; i++) {
+        if (rest.size() < 6) {
+            return unusable("truncated entry");
+        }
+        const auto *entry = reinterpret_cast<const unsigned char *>(rest.data());
+        const uint32_t position = load_be32(entry);
+        const std::size_t xor_offset = entry[4];
+        rest.remove_prefix(6);
+        Bitmap bitmap;
+        if (position >= index.size() || xor_offset > MAX_XOR_OFFSET || xor_offset > i ||
+            !ewah::read(rest, bitmap, consumed)) {
+            return unusable("corrupt entry");
+        }
+        if (!fits_pack(bitmap, index.size())) {
+            return unusable("commit bitmap has bits past the pack's objects");
+        }
+        rest.remove_prefix(consumed);
+        if (xor_offset > 0) {
+            bitmap ^= bitmaps_[i - xor_offset];
+        }
+        selected_.emplace(index.id_at(position), i);
+        bitmaps_.push_back(std::move(bitmap));
+    }
+    pack_ = &pack;
+    return true;
+}
+
+template <typename Hash>
+std::optional<uint32_t> PackBitmap<Hash>::bit_of(const ObjectId<Hash>& id) const {
+    const std::optional<uint32_t> position = pack_->index().find(id);
+    return position ? std::optional<uint32_t>(bit_position_[*position]) : std::nullopt;
+}
+
+template <typename Hash>
+const Bitmap& PackBitmap<Hash>::type_bitmap(ObjectType type) const {
+    static const Bitmap empty;
+    const int slot = type_slot(type);
+    return slot < 0 ? empty : types_[slot];
+}
+
+template <typename Hash>
+const Bitmap *PackBitmap<Hash>::commit_bitmap(const ObjectId<Hash>& id) const {
+    const auto it = selected_.find(id);
+    return it == selected_.end() ? nullptr : &bitmaps_[it->second];
+}
+
+template <typename Hash>
+std::optional<Bitmap> PackBitmap<Hash>::reachable(ObjectStore<Hash>& store, const std::vector<ObjectId<Hash>>& tips) const {
+    Bitmap result(size());
+    std::vector<ObjectId<Hash>> stack(tips.rbegin(), tips.rend());
+    while (!stack.empty()) {
+        const ObjectId<Hash> id = stack.back();
+        stack.pop_back();
+        const std::optional<uint32_t> bit = bit_of(id);
+        if (!bit) {
+            return std::nullopt;
+        }
+        if (result.test(*bit)) {
+            continue;
+        }
+        if (const Bitmap *bitmap = commit_bitmap(id)) {
+            result |= *bitmap;
+            continue;
+        }
+        result.set(*bit);
+        if (type_bitmap(ObjectType::Blob).test(*bit)) {
+            continue;
+        }
+        const std::shared_ptr<const DecodedObject> object = store.read(id);
+        if (!object || !push_references<Hash>(object->type, object->data, stack)) {
+            return std::nullopt;
+        }
+    }
+    return result;
+}
+
+template <typename Hash>
+std::optional<PackBitmap<Hash>> find_pack_bitmap(ObjectStore<Hash>& store) {
+    for (const std::unique_ptr<Packfile<Hash>>& pack : store.packs().packs()) {
+        PackBitmap<Hash> bitmap;
+        if (bitmap.open(*pack)) {
+            return bitmap;
+        }
+    }
+    return std::nullopt;
+}
+
+template <typename Hash>
+bool write_pack_bitmap(const std::string& pack_path, const std::vector<PackObject<Hash>>& objects,
+                       const std::vector<ObjectId<Hash>>& tips, std::size_t& selected) {
+    PackIndex<Hash> index;
+    const std::optional<ObjectId<Hash>> checksum = pack_checksum<Hash>(pack_path);
+    if (!checksum || !index.open(pack_path.substr(0, pack_path.size() - 5) + ".idx")) {
+        std::cerr << "Error: Could not open the index of " << pack_path << '\n';
+        return false;
+    }
+    const std::vector<uint32_t> order = pack_order(index);
+    std::vector<uint32_t> bit_position(index.size());
+    for (uint32_t bit = 0; bit < order.size(); bit++) {
+        bit_position[order[bit]] = bit;
+    }
+    std::unordered_map<ObjectId<Hash>, std::size_t, ObjectIdHash<Hash>> object_of;
+    object_of.reserve(objects.size());
+    for (std::size_t i = 0; i < objects.size(); i++) {
+        object_of.emplace(objects[i].id, i);
+    }
+    // The pack entry (and its bit) of `id`, or `std::nullopt` if it is not in the pack.
+    auto find = [&](const ObjectId<Hash>& id) -> std::optional<std::pair<const PackObject<Hash> *, uint32_t>> {
+        const auto it = object_of.find(id);
+        const std::optional<uint32_t> position = index.find(id);
+        if (it == object_of.end() || !position) {
+            std::cerr << "warning: " << id.to_hex() << " is reachable but not in " << pack_path
+                      << ", not writing bitmaps\n";
+            return std::nullopt;
+        }
+        return std::make_pair(&objects[it->second], bit_position[*position]);
+    };
+
+    // Selection: the tips, then every BITMAP_COMMIT_INTERVAL-th commit in the order they are reached.
+    std::vector<ObjectId<Hash>> commits;
+    {
+        std::unordered_map<ObjectId<Hash>, bool, ObjectIdHash<Hash>> seen;
+        std::vector<ObjectId<Hash>> pending;
+        for (const ObjectId<Hash>& tip : tips) {
+            const auto object = find(tip);
+            if (!object) {
+                return false;
+            }
+            if (object->first->type == ObjectType::Commit && seen.emplace(tip, true).second) {
+                pending.push_back(tip);
+                commits.push_back(tip);
+            }
+        }
+        const std::size_t tip_count = commits.size();
+        std::size_t reached = 0;
+        for (std::size_t next = 0; next < pending.size(); next++) {
+            const auto object = find(pending[next]);
+            if (!object) {
+                return false;
+            }
+            std::vector<ObjectId<Hash>> references;
+            if (!push_references<Hash>(ObjectType::Commit, object->first->data, references)) {
+                return false;
+            }
+            // The first reference is the tree, the rest are parents.
+            for (std::size_t r = 1; r < references.size(); r++) {
+                if (seen.emplace(references[r], true).second) {
+                    pending.push_back(references[r]);
+                    if (++reached % BITMAP_COMMIT_INTERVAL == 0) {
+                        commits.push_back(references[r]);
+                    }
+                }
+            }
+        }
+        // Oldest first, so bitmaps of ancestors are ready when their descendants need them.
+        std::reverse(commits.begin() + tip_count, commits.end());
+        std::rotate(commits.begin(), commits.begin() + tip_count, commits.end());
+    }
+
+    std::vector<Bitmap> bitmaps;
+    std::unordered_map<ObjectId<Hash>, std::size_t, ObjectIdHash<Hash>> done;
+    for (const ObjectId<Hash>& commit : commits) {
+        Bitmap bitmap(index.size());
+        std::vector<ObjectId<Hash>> stack = {commit};
+        while (!stack.empty()) {
+            const ObjectId<Hash> id = stack.back();
+            stack.pop_back();
+            const auto object = find(id);
+            if (!object) {
+                return false;
+            }
+            if (bitmap.test(object->second)) {
+                continue;
+            }
+            if (const auto it = done.find(id); it != done.end()) {
+                bitmap |= bitmaps[it->second];
+                continue;
+            }
+            bitmap.set(object->second);
+            if (!push_references<Hash>(object->first->type, object->first->data, stack)) {
+                return false;
+            }
+        }
+        done.emplace(commit, bitmaps.size());
+        bitmaps.push_back(std::move(bitmap));
+    }
+
+    Bitmap types[4];
+    for (const PackObject<Hash>& object : objects) {
+        const auto found = find(object.id);
+        const int slot = type_slot(object.type);
+        if (found && slot >= 0) {
+            types[slot].set(found->second);
+        }
+    }
+
+    std::string file = "BITM";
+    append_be16(file, BITMAP_VERSION);
+    append_be16(file, BITMAP_OPT_FULL_DAG);
+    append_be32(file, static_cast<uint32_t>(bitmaps.size()));
+    file.append(checksum->raw());
+    for (const Bitmap& type : types) {
+        ewah::append(file, type, index.size());
+    }
+    for (std::size_t i = 0; i < commits.size(); i++) {
+        append_be32(file, *index.find(commits[i]));
+        file += char(0); // No XOR base.
+        file += char(0); // No flags.
+        ewah::append(file, bitmaps[i], index.size());
+    }
+    file.append(Hash::hash(file).raw());
+
+    const std::string path = bitmap_path(pack_path);
+    const std::string temp_path = path + ".tmp_" + std::to_string(getpid());
+    std::ofstream out(temp_path, std::ios::binary);
+    out.write(file.data(), file.size());
+    out.close();
+    std::error_code ec;
+    if (out) {
+        std::filesystem::rename(temp_path, path, ec);
+    }
+    if (!out || ec) {
+        std::filesystem::remove(temp_path, ec);
+        std::cerr << "Error: Could not write " << path << '\n';
+        return false;
+    }
+    selected = bitmaps.size();
+    return true;
+}
+
+template class PackBitmap<Sha1>;
+template class PackBitmap<Sha256>;
+template std::optional<PackBitmap<Sha1>> find_pack_bitmap(ObjectStore<Sha1>&);
+template std::optional<PackBitmap<Sha256>> find_pack_bitmap(ObjectStore<Sha256>&);
+template bool write_pack_bitmap(const std::string&, const std::vector<PackObject<Sha1>>&,
+                                const std::vector<ObjectId<Sha1>>&, std::size_t&);
+template bool write_pack_bitmap(const std::string&, const std::vector<PackObject<Sha256>>&,
+                                const std::vector<ObjectId<Sha256>>&, std::size_t&);
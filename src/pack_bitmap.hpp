@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ewah.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "pack.hpp"
+#include "pack_writer.hpp"
+
+/**
+ * The reachability bitmaps of one pack (`pack-*.bitmap` next to `pack-*.pack`), in git's version 1 format:
+ *
+ *   "BITM" | version 1 | options | entry count | pack checksum
+ *   commit, tree, blob and tag type bitmaps (EWAH)
+ *   entries: index position of the commit | XOR offset | flags | EWAH bitmap
+ *   checksum
+ *
+ * Bit `i` of every bitmap stands for the `i`-th object of the pack in pack order (by offset). A
+ * commit's bitmap has a bit for every object reachable from it, itself included, so the objects
+ * reachable from a set of commits are the OR of their bitmaps and "reachable from A but not from B" is
+ * an AND-NOT, without reading a single commit or tree. Entries can be stored XORed with an earlier
+ * entry (git's writer does this); they are all decoded when the file is opened.
+ *
+ * Bitmaps only describe a pack that holds everything reachable from its selected commits.
+ */
+template <typename Hash>
+class PackBitmap {
+public:
+    // Opens the bitmap of `pack`. Returns `false` if it has none, or (after a warning) it does not fit the pack.
+    bool open(const Packfile<Hash>& pack);
+
+    // Number of objects in the pack, which is the size of every bitmap.
+    uint32_t size() const { return static_cast<uint32_t>(index_position_.size()); }
+
+    // Number of commits that have a bitmap.
+    std::size_t commit_count() const { return bitmaps_.size(); }
+
+    // The bit standing for object `id`, if it is in the pack.
+    std::optional<uint32_t> bit_of(const ObjectId<Hash>& id) const;
+
+    // The objects of one type: `Commit`, `Tree`, `Blob` or `Tag`.
+    const Bitmap& type_bitmap(ObjectType type) const;
+
+    // The bitmap of commit `id`, or null if it was not selected.
+    const Bitmap *commit_bitmap(const ObjectId<Hash>& id) const;
+
+    /**
+     * The objects reachable from `tips`: the bitmaps of tips that have one, and for any other tip a walk
+     * through `store` that sets the bits of what it reaches until it meets commits with a bitmap (or
+     * objects already set). Returns `std::nullopt` if the walk reaches an object outside the pack, where
+     * the bitmaps cannot answer; the caller then has to walk everything.
+     */
+    std::optional<Bitmap> reachable(ObjectStore<Hash>& store, const std::vector<ObjectId<Hash>>& tips) const;
+
+private:
+    const Packfile<Hash> *pack_ = nullptr;
+    std::vector<uint32_t> index_position_; // Bit -> position in the pack index.
+    std::vector<uint32_t> bit_position_;   // Position in the pack index -> bit.
+    Bitmap types_[4];                      // Commits, trees, blobs, tags.
+    std::vector<Bitmap> bitmaps_;
+    std::unordered_map<ObjectId<Hash>, uint32_t, ObjectIdHash<Hash>> selected_;
+};
+
+/**
+ * The bitmaps of the first pack in `store` that has them, or `std::nullopt`.
+ */
+template <typename Hash>
+std::optional<PackBitmap<Hash>> find_pack_bitmap(ObjectStore<Hash>& store);
+
+// One commit in this many gets a bitmap, besides the tips (git's writer is similar for old history).
+constexpr std::size_t BITMAP_COMMIT_INTERVAL = 100;
+
+/**
+ * Writes the bitmap file of the pack at `pack_path`, which was just written from `objects`.
+ *
+ * 1. **Selection**:
+ *    - Walks the commits from `tips` and picks the tips plus every `BITMAP_COMMIT_INTERVAL`-th commit
+ *      reached, so a walk from any commit meets a bitmap after about that many commits.
+ *
+ * 2. **Bitmaps**:
+ *    - Builds the selected commits' bitmaps oldest first, by walking from each one through the data in
+ *      `objects` and stopping at objects already set and at commits whose bitmap is done (OR-ing it in),
+ *      so every tree is read about once per bitmap that covers new history.
+ *
+ * Returns `false` (after printing why) if something reachable from the tips is not in `objects`, so the
+ * pack is not closed under reachability and must not get bitmaps, or if the file cannot be written.
+ * `selected` receives the number of commits given a bitmap.
+ */
+template <typename Hash>
+bool write_pack_bitmap(const std::string& pack_path, const std::vector<PackObject<Hash>>& objects,
+                       const std::vector<ObjectId<Hash>>& tips, std::size_t& selected);
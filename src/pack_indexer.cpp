@@ -0,0 +1,468 @@
+#include "pack_indexer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "mapped_file.hpp"
+#include "pack.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "thread_pool.hpp"
+#include "trace_perf.hpp"
+
+namespace {
+
+constexpr std::size_t PACK_HEADER_SIZE = 12;
+
+// Output of the incremental inflate per step; objects are hashed in pieces of this size.
+constexpr std::size_t INFLATE_BUFFER_SIZE = 64 * 1024;
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+std::string object_header(ObjectType type, uint64_t size) {
+    return std::string(object_type_name(type)) + ' ' + std::to_string(size) + '\0';
+}
+
+// Inflates the zlib stream at the start of `input`, which must produce exactly `size` bytes, into `out`.
+bool inflate_exact(std::string_view input, uint64_t size, std::string& out) {
+    PerfScope scope(PerfPhase::Inflate, size);
+    out.resize(size);
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+    // Pack entries are bounded by the mapping; one extra output byte detects entries larger than announced.
+    unsigned char scratch;
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream.avail_in = static_cast<uInt>(std::min<std::size_t>(input.size(), 1u << 30));
+    uint64_t produced = 0;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        const bool full = produced == size;
+        const uInt chunk = full ? 1 : static_cast<uInt>(std::min<uint64_t>(size - produced, 1u << 30));
+        stream.next_out = full ? &scratch : reinterpret_cast<Bytef *>(out.data()) + produced;
+        stream.avail_out = chunk;
+        status = inflate(&stream, Z_NO_FLUSH);
+        if (full && stream.avail_out == 0) {
+            status = Z_DATA_ERROR;
+            break;
+        }
+        produced += chunk - stream.avail_out;
+        if (status == Z_BUF_ERROR && stream.avail_in == 0) {
+            const std::size_t used = reinterpret_cast<const char *>(stream.next_in) - input.data();
+            stream.avail_in = static_cast<uInt>(std::min<std::size_t>(input.size() - used, 1u << 30));
+            status = stream.avail_in > 0 ? Z_OK : Z_DATA_ERROR;
+        }
+    }
+    inflateEnd(&stream);
+    return status == Z_STREAM_END && produced == size;
+}
+
+} // namespace
+
+template <typename Hash>
+PackIndexer<Hash>::PackIndexer(std::string pack_dir, ThreadPool& pool)
+    : pack_dir_(std::move(pack_dir)), pool_(pool), inflate_buffer_(INFLATE_BUFFER_SIZE) {
+    std::error_code ec;
+    std::filesystem::create_directories(pack_dir_, ec);
+    temp_path_ = pack_dir_ + "/tmp_pack_" + std::to_string(getpid());
+    file_.open(temp_path_, std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        fail("Could not open file for writing: " + temp_path_);
+    }
+}
+
+template <typename Hash>
+PackIndexer<Hash>::~PackIndexer() {
+    if (stream_open_) {
+        inflateEnd(&stream_);
+    }
+    if (state_ != State::Done) {
+        file_.close();
+        std::error_code ec;
+        std::filesystem::remove(temp_path_, ec);
+    }
+}
+
+template <typename Hash>
+bool PackIndexer<Hash>::fail(const std::string& message) {
+    if (state_ != State::Failed) {
+        std::cerr << "Error: " << message << '\n';
+        state_ = State::Failed;
+    }
+    return false;
+}
+
+template <typename Hash>
+void PackIndexer<Hash>::consume(std::size_t size) {
+    const auto *bytes = reinterpret_cast<const Bytef *>(buffer_.data() + pos_);
+    pack_hash_.update(bytes, size);
+    if (state_ == State::EntryHeader || state_ == State::EntryData) {
+        current_.crc = static_cast<uint32_t>(crc32(current_.crc, bytes, static_cast<uInt>(size)));
+    }
+    pos_ += size;
+    offset_ += size;
+}
+
+template <typename Hash>
+bool PackIndexer<Hash>::parse_entry_header() {
+    const auto *data = reinterpret_cast<const unsigned char *>(buffer_.data() + pos_);
+    const std::size_t available = buffer_.size() - pos_;
+    std::size_t pos = 0;
+    if (available == 0) {
+        return false;
+    }
+    // Type and size: 1|ttt|ssss, then 7 more size bits per byte (see `Packfile::parse_entry_header`).
+    Entry entry;
+    entry.offset = offset_;
+    unsigned char byte = data[pos++];
+    entry.stored_type = static_cast<ObjectType>((byte >> 4) & 0x7);
+    entry.size = byte & 0x0f;
+    int shift = 4;
+    while (byte & 0x80) {
+        if (pos == available) {
+            return false;
+        }
+        if (shift > 57) {
+            return fail("Corrupt pack entry at offset " + std::to_string(offset_));
+        }
+        byte = data[pos++];
+        entry.size |= uint64_t(byte & 0x7f) << shift;
+        shift += 7;
+    }
+    switch (entry.stored_type) {
+        case ObjectType::Commit:
+        case ObjectType::Tree:
+        case ObjectType::Blob:
+        case ObjectType::Tag:
+            entry.type = entry.stored_type;
+            break;
+        case ObjectType::OfsDelta: {
+            if (pos == available) {
+                return false;
+            }
+            byte = data[pos++];
+            uint64_t distance = byte & 0x7f;
+            while (byte & 0x80) {
+                if (pos == available) {
+                    return false;
+                }
+                if (distance > (UINT64_MAX >> 7)) {
+                    return fail("Corrupt delta base offset at offset " + std::to_string(offset_));
+                }
+                byte = data[pos++];
+                distance = ((distance + 1) << 7) | (byte & 0x7f);
+            }
+            if (distance == 0 || distance > offset_ - PACK_HEADER_SIZE) {
+                return fail("Delta base offset out of bounds at offset " + std::to_string(offset_));
+            }
+            entry.base_offset = offset_ - distance;
+            break;
+        }
+        case ObjectType::RefDelta:
+            if (available - pos < ObjectId<Hash>::RAW_SIZE) {
+                return false;
+            }
+            entry.base_id = ObjectId<Hash>::from_raw(data + pos);
+            pos += ObjectId<Hash>::RAW_SIZE;
+            break;
+        default:
+            return fail("Unknown object type " + std::to_string(int(entry.stored_type)) + " at offset " +
+                        std::to_string(offset_));
+    }
+    current_ = entry;
+    current_.header_size = static_cast<uint16_t>(pos);
+    current_.crc = static_cast<uint32_t>(crc32(0, nullptr, 0));
+    consume(pos);
+
+    stream_ = z_stream{};
+    if (inflateInit(&stream_) != Z_OK) {
+        return fail("Failed to initialize zlib inflate stream.");
+    }
+    stream_open_ = true;
+    inflated_ = 0;
+    if (current_.type != ObjectType::None) {
+        object_hash_ = Hash();
+        object_hash_.update(object_header(current_.type, current_.size));
+    }
+    return true;
+}
+
+template <typename Hash>
+bool PackIndexer<Hash>::inflate_entry_data() {
+    // zlib may hold more output than fits the buffer after taking all input; keep going until it is drained.
+    bool output_full = false;
+    while (pos_ < buffer_.size() || output_full) {
+        const std::size_t in_chunk = std::min<std::size_t>(buffer_.size() - pos_, 1u << 30);
+        stream_.next_in = reinterpret_cast<Bytef *>(buffer_.data() + pos_);
+        stream_.avail_in = static_cast<uInt>(in_chunk);
+        stream_.next_out = inflate_buffer_.data();
+        stream_.avail_out = static_cast<uInt>(inflate_buffer_.size());
+        int status;
+        std::size_t produced;
+        {
+            PerfScope scope(PerfPhase::Inflate);
+            status = inflate(&stream_, Z_NO_FLUSH);
+            produced = inflate_buffer_.size() - stream_.avail_out;
+            scope.add_bytes(produced);
+        }
+        const std::size_t consumed = in_chunk - stream_.avail_in;
+        consume(consumed);
+        output_full = stream_.avail_out == 0;
+        inflated_ += produced;
+        if (inflated_ > current_.size) {
+            return fail("Pack entry at offset " + std::to_string(current_.offset) + " is larger than announced");
+        }
+        if (current_.type != ObjectType::None) {
+            object_hash_.update(inflate_buffer_.data(), produced);
+        }
+        if (status == Z_STREAM_END) {
+            inflateEnd(&stream_);
+            stream_open_ = false;
+            if (inflated_ != current_.size) {
+                return fail("Pack entry at offset " + std::to_string(current_.offset) + " is smaller than announced");
+            }
+            if (current_.type != ObjectType::None) {
+                current_.id = object_hash_.finish();
+            } else {
+                deltas_++;
+            }
+            entries_.push_back(current_);
+            state_ = entries_.size() == object_count_ ? State::Trailer : State::EntryHeader;
+            return true;
+        }
+        if ((status != Z_OK && status != Z_BUF_ERROR) || (consumed == 0 && produced == 0 && in_chunk > 0)) {
+            return fail("Corrupt zlib stream in pack entry at offset " + std::to_string(current_.offset));
+        }
+    }
+    return false;
+}
+
+template <typename Hash>
+bool PackIndexer<Hash>::feed(std::string_view data) {
+    if (state_ == State::Failed) {
+        return false;
+    }
+    {
+        PerfScope scope(PerfPhase::ObjectWrite, data.size());
+        file_.write(data.data(), data.size());
+    }
+    if (!file_) {
+        return fail("Could not write " + temp_path_);
+    }
+    buffer_.append(data);
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        switch (state_) {
+            case State::Header: {
+                if (buffer_.size() - pos_ < PACK_HEADER_SIZE) {
+                    break;
+                }
+                const auto *header = reinterpret_cast<const unsigned char *>(buffer_.data() + pos_);
+                const uint32_t version = load_be32(header + 4);
+                if (std::string_view(buffer_.data() + pos_, 4) != "PACK" || (version != 2 && version != 3)) {
+                    return fail("Received data is not a version 2 pack");
+                }
+                object_count_ = load_be32(header + 8);
+                entries_.reserve(object_count_);
+                consume(PACK_HEADER_SIZE);
+                state_ = object_count_ == 0 ? State::Trailer : State::EntryHeader;
+                progress = true;
+                break;
+            }
+            case State::EntryHeader:
+                if (parse_entry_header()) {
+                    state_ = State::EntryData;
+                    progress = true;
+                }
+                break;
+            case State::EntryData:
+                progress = inflate_entry_data();
+                break;
+            case State::Trailer:
+                if (buffer_.size() - pos_ < ObjectId<Hash>::RAW_SIZE) {
+                    break;
+                }
+                checksum_ = ObjectId<Hash>::from_raw(buffer_.data() + pos_);
+                pos_ += ObjectId<Hash>::RAW_SIZE;
+                if (checksum_ != pack_hash_.finish()) {
+                    return fail("Pack checksum mismatch");
+                }
+                state_ = State::Done;
+                progress = true;
+                break;
+            case State::Done:
+                if (pos_ != buffer_.size()) {
+                    return fail("Pack has junk at the end");
+                }
+                break;
+            case State::Failed:
+                return false;
+        }
+    }
+    // Keep only the unparsed tail, which is never more than an entry header or a trailer.
+    buffer_.erase(0, pos_);
+    pos_ = 0;
+    return state_ != State::Failed;
+}
+
+template <typename Hash>
+bool PackIndexer<Hash>::resolve_deltas(std::string_view pack) {
+    // Deltas by base: OFS_DELTA by the position of the base entry, REF_DELTA by the base id.
+    std::vector<std::vector<uint32_t>> ofs_children(entries_.size());
+    std::unordered_map<ObjectId<Hash>, std::vector<uint32_t>, ObjectIdHash<Hash>> ref_children;
+    for (uint32_t i = 0; i < entries_.size(); i++) {
+        const Entry& entry = entries_[i];
+        if (entry.stored_type == ObjectType::OfsDelta) {
+            const auto base = std::lower_bound(entries_.begin(), entries_.begin() + i, entry.base_offset,
+                                               [](const Entry& e, uint64_t offset) { return e.offset < offset; });
+            if (base == entries_.begin() + i || base->offset != entry.base_offset) {
+                std::cerr << "Error: Delta at offset " << entry.offset << " has no base entry\n";
+                return false;
+            }
+            ofs_children[base - entries_.begin()].push_back(i);
+        } else if (entry.stored_type == ObjectType::RefDelta) {
+            ref_children[entry.base_id].push_back(i);
+        }
+    }
+
+    std::atomic<std::size_t> resolved{0};
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+    auto report = [&](const std::string& message) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed.exchange(true)) {
+            std::cerr << "Error: " << message << '\n';
+        }
+    };
+    auto inflate_entry = [&](const Entry& entry, std::string& out) {
+        const uint64_t start = entry.offset + entry.header_size;
+        return inflate_exact(pack.substr(start), entry.size, out);
+    };
+
+    TaskGroup group(pool_);
+    // Applies every delta against entry `base` (whose data is `data`); bases among them become tasks.
+    auto resolve_children = [&](auto& self, uint32_t base, std::shared_ptr<const std::string> data) -> void {
+        std::vector<uint32_t> children = ofs_children[base];
+        if (const auto it = ref_children.find(entries_[base].id); it != ref_children.end()) {
+            children.insert(children.end(), it->second.begin(), it->second.end());
+        }
+        std::string delta;
+        for (const uint32_t child : children) {
+            if (failed) {
+                return;
+            }
+            Entry& entry = entries_[child];
+            auto result = std::make_shared<std::string>();
+            if (!inflate_entry(entry, delta) || !apply_delta(*data, delta, *result)) {
+                report("Could not apply the delta at offset " + std::to_string(entry.offset));
+                return;
+            }
+            entry.type = entries_[base].type;
+            Hash hash;
+            hash.update(object_header(entry.type, result->size()));
+            hash.update(*result);
+            entry.id = hash.finish();
+            resolved++;
+            if (!ofs_children[child].empty() || ref_children.contains(entry.id)) {
+                group.run([&self, child, result = std::shared_ptr<const std::string>(std::move(result))] {
+                    self(self, child, result);
+                });
+            }
+        }
+    };
+    for (uint32_t i = 0; i < entries_.size(); i++) {
+        // Only whole objects start a chain; the types of deltas are being filled in meanwhile.
+        const Entry& entry = entries_[i];
+        if (entry.stored_type == ObjectType::OfsDelta || entry.stored_type == ObjectType::RefDelta ||
+            (ofs_children[i].empty() && !ref_children.contains(entry.id))) {
+            continue;
+        }
+        group.run([&, i] {
+            auto data = std::make_shared<std::string>();
+            if (!inflate_entry(entries_[i], *data)) {
+                report("Could not inflate the object at offset " + std::to_string(entries_[i].offset));
+                return;
+            }
+            resolve_children(resolve_children, i, std::move(data));
+        });
+    }
+    group.wait();
+    if (failed) {
+        return false;
+    }
+    if (resolved != deltas_) {
+        std::cerr << "Error: Pack has " << deltas_ - resolved << " unresolved deltas\n";
+        return false;
+    }
+    return true;
+}
+
+template <typename Hash>
+std::optional<PackWriteResult> PackIndexer<Hash>::finish() {
+    if (state_ == State::Failed) {
+        return std::nullopt;
+    }
+    if (state_ != State::Done) {
+        fail("Pack is truncated: received " + std::to_string(entries_.size()) + " of " +
+             std::to_string(object_count_) + " objects");
+        return std::nullopt;
+    }
+    file_.close();
+    if (!file_) {
+        state_ = State::Failed;
+        std::cerr << "Error: Could not write " << temp_path_ << '\n';
+        return std::nullopt;
+    }
+    bool ok;
+    {
+        MappedFile pack(temp_path_, 0);
+        ok = pack.is_open() && resolve_deltas(pack.view());
+    }
+    const std::string temp_idx = pack_dir_ + "/tmp_idx_" + std::to_string(getpid());
+    std::error_code ec;
+    if (ok) {
+        std::vector<PackIndexEntry<Hash>> index_entries(entries_.size());
+        for (std::size_t i = 0; i < entries_.size(); i++) {
+            index_entries[i] = {entries_[i].id, entries_[i].crc, entries_[i].offset};
+        }
+        ok = write_pack_index(index_entries, checksum_, temp_idx);
+        if (!ok) {
+            std::cerr << "Error: Could not write pack index " << temp_idx << '\n';
+        }
+    }
+    PackWriteResult result;
+    const std::string base_name = pack_dir_ + "/pack-" + checksum_.to_hex();
+    result.pack_path = base_name + ".pack";
+    result.idx_path = base_name + ".idx";
+    result.deltas = deltas_;
+    if (ok) {
+        // The pack goes into place first: a reader only looks at packs that have an index.
+        std::filesystem::rename(temp_path_, result.pack_path, ec);
+        if (!ec) {
+            std::filesystem::rename(temp_idx, result.idx_path, ec);
+        }
+        if (ec) {
+            std::cerr << "Error: Could not move pack into place: " << result.pack_path << '\n';
+            ok = false;
+        }
+    }
+    if (!ok) {
+        state_ = State::Failed;
+        std::filesystem::remove(temp_idx, ec);
+        return std::nullopt;
+    }
+    return result;
+}
+
+template class PackIndexer<Sha1>;
+template class PackIndexer<Sha256>;
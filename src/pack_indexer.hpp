@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+
+#include "object_id.hpp"
+#include "object_type.hpp"
+#include "pack_writer.hpp"
+
+class ThreadPool;
+
+/**
+ * Indexes a pack that arrives as a byte stream (the packfile section of a fetch), like `git index-pack
+ * --stdin`, and stores it as `pack-<hash>.pack` with its index in `pack_dir`.
+ *
+ * This class performs the following steps:
+ *
+ * 1. **Streaming**:
+ *    - `feed` takes the stream in pieces of any size, as they come off the network. Each piece is
+ *      appended to a temporary pack file and parsed as far as it goes: entry headers, then each entry's
+ *      zlib stream, inflated incrementally into a small buffer.
+ *    - Whole objects are hashed while they inflate, so their ids are known as soon as their last byte
+ *      has arrived and nothing but the entry's position is kept. Deltas are only checked against their
+ *      announced size; their bases are recorded (by offset for OFS_DELTA, by id for REF_DELTA).
+ *    - The pack checksum and each entry's CRC-32 are computed over the bytes on the way in.
+ *
+ * 2. **Delta Resolution** (`finish`):
+ *    - After checking the trailing checksum, the pack is mapped and deltas are resolved on `pool`:
+ *      one task per whole object that serves as a base, which inflates it, applies every delta made
+ *      against it and hashes the results. Resolved objects that are bases themselves become new tasks,
+ *      so different chains, and different branches of one chain, advance on all threads at once.
+ *    - Every delta must have its base in the pack (clones do not ask for thin packs).
+ *
+ * 3. **Index Writing**:
+ *    - Writes the index (see `write_pack_index`) and moves the pack, then the index, into place.
+ *
+ * Errors are printed when they are found; `feed` and `finish` then return `false`/`std::nullopt`.
+ * The temporary file is removed unless `finish` succeeds.
+ */
+template <typename Hash>
+class PackIndexer {
+public:
+    PackIndexer(std::string pack_dir, ThreadPool& pool);
+    ~PackIndexer();
+
+    PackIndexer(const PackIndexer&) = delete;
+    PackIndexer& operator=(const PackIndexer&) = delete;
+
+    bool feed(std::string_view data);
+    std::optional<PackWriteResult> finish();
+
+    // Number of objects the pack header announced (0 until it has arrived) and how many have arrived.
+    uint32_t object_count() const { return object_count_; }
+    std::size_t objects_received() const { return entries_.size(); }
+
+private:
+    enum class State { Header, EntryHeader, EntryData, Trailer, Done, Failed };
+
+    struct Entry {
+        uint64_t offset = 0;
+        uint64_t size = 0;         // Inflated size (of the delta itself, for delta entries).
+        uint64_t base_offset = 0;  // OFS_DELTA only.
+        ObjectId<Hash> base_id;    // REF_DELTA only.
+        ObjectId<Hash> id;         // Known on arrival for whole objects, after resolution for deltas.
+        uint32_t crc = 0;
+        uint16_t header_size = 0;  // Bytes before the zlib stream.
+        ObjectType type = ObjectType::None; // As stored; deltas get the type of their base when resolved.
+        ObjectType stored_type = ObjectType::None;
+    };
+
+    bool fail(const std::string& message);
+    // Consumes `size` bytes of the buffer at `pos_` as part of the pack (and of the current entry).
+    void consume(std::size_t size);
+    // Parses the entry header at `pos_`. Returns `false` if it has not fully arrived yet or is invalid
+    // (the latter after `fail`).
+    bool parse_entry_header();
+    // Inflates what has arrived of the current entry. Returns `false` once it needs more input.
+    bool inflate_entry_data();
+    bool resolve_deltas(std::string_view pack);
+
+    std::string pack_dir_;
+    std::string temp_path_;
+    ThreadPool& pool_;
+    std::ofstream file_;
+    State state_ = State::Header;
+
+    std::string buffer_; // Bytes that arrived but were not parsed yet start at `pos_`.
+    std::size_t pos_ = 0;
+    uint64_t offset_ = 0; // Pack offset of `buffer_[pos_]`.
+    Hash pack_hash_;
+
+    uint32_t object_count_ = 0;
+    std::vector<Entry> entries_;
+    Entry current_;
+    z_stream stream_{};
+    bool stream_open_ = false;
+    Hash object_hash_;
+    uint64_t inflated_ = 0;
+    std::vector<unsigned char> inflate_buffer_;
+    std::size_t deltas_ = 0;
+    ObjectId<Hash> checksum_;
+};
@@ -0,0 +1,356 @@
+#include "pack_writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "delta.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "thread_pool.hpp"
+#include "trace_perf.hpp"
+
+namespace {
+
+// Objects smaller than this are never worth a delta: the instructions alone would eat the savings.
+constexpr std::size_t MIN_DELTA_TARGET_SIZE = 64;
+
+// A segment of the sorted object list searched by one task; smaller lists are searched in one piece.
+constexpr std::size_t MIN_SEGMENT_SIZE = 1024;
+
+void append_be32(std::string& out, uint32_t value) {
+    const char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+    out.append(bytes, 4);
+}
+
+void append_be64(std::string& out, uint64_t value) {
+    append_be32(out, static_cast<uint32_t>(value >> 32));
+    append_be32(out, static_cast<uint32_t>(value));
+}
+
+/**
+ * Runs the windowed delta search over `order[begin, end)`. Bases are only taken from the same range,
+ * so separate ranges can be searched concurrently.
+ */
+template <typename Hash>
+void search_deltas(std::vector<PackObject<Hash>>& objects, const std::vector<uint32_t>& order, std::size_t begin,
+                   std::size_t end, const PackWriteOptions& options) {
+    struct Candidate {
+        uint32_t object;
+        std::unique_ptr<DeltaIndex> index; // Built the first time the object is tried as a base.
+    };
+    std::deque<Candidate> window; // Most recent first.
+    std::string delta;
+
+    for (std::size_t i = begin; i < end; ++i) {
+        PackObject<Hash>& target = objects[order[i]];
+        const std::size_t target_size = target.data.size();
+        if (target_size >= MIN_DELTA_TARGET_SIZE) {
+            // A delta must at least halve the object to be worth the extra reads when unpacking it.
+            std::size_t best_size = target_size / 2 - 20;
+            for (Candidate& candidate : window) {
+                const PackObject<Hash>& base = objects[candidate.object];
+                if (base.type != target.type) {
+                    break; // Sorted by type: everything further back differs too.
+                }
+                const std::size_t base_size = base.data.size();
+                if (base.depth >= options.depth || base_size < target_size / 32 ||
+                    (target_size > base_size && target_size - base_size >= best_size)) {
+                    continue;
+                }
+                if (!candidate.index) {
+                    candidate.index = std::make_unique<DeltaIndex>(base.data);
+                }
+                if (create_delta(*candidate.index, target.data, best_size, delta) && delta.size() <= best_size) {
+                    target.base = candidate.object;
+                    target.depth = base.depth + 1;
+                    target.delta.swap(delta);
+                    if (target.delta.size() <= 1) {
+                        break;
+                    }
+                    best_size = target.delta.size() - 1;
+                }
+            }
+        }
+
+        window.push_front({order[i], nullptr});
+        if (window.size() > options.window) {
+            window.pop_back();
+        }
+    }
+}
+
+template <typename Hash>
+void find_deltas(std::vector<PackObject<Hash>>& objects, const PackWriteOptions& options) {
+    if (options.window == 0 || options.depth == 0) {
+        return;
+    }
+    std::vector<uint32_t> order(objects.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        const PackObject<Hash>& x = objects[a];
+        const PackObject<Hash>& y = objects[b];
+        if (x.type != y.type) {
+            return x.type > y.type;
+        }
+        if (x.name_hash != y.name_hash) {
+            return x.name_hash > y.name_hash;
+        }
+        return x.data.size() > y.data.size();
+    });
+
+    const std::size_t segments = options.pool == nullptr
+        ? 1
+        : std::clamp<std::size_t>(order.size() / MIN_SEGMENT_SIZE, 1, options.pool->concurrency());
+    if (segments == 1) {
+        search_deltas(objects, order, 0, order.size(), options);
+        return;
+    }
+    TaskGroup group(*options.pool);
+    for (std::size_t segment = 0; segment < segments; ++segment) {
+        const std::size_t begin = order.size() * segment / segments;
+        const std::size_t end = order.size() * (segment + 1) / segments;
+        group.run([&, begin, end] { search_deltas(objects, order, begin, end, options); });
+    }
+    group.wait();
+}
+
+template <typename Hash>
+bool deflate_payload(PackObject<Hash>& object, int level) {
+    const std::string& payload = object.base >= 0 ? object.delta : object.data;
+    return deflate_object({}, payload, level, object.compressed);
+}
+
+template <typename Hash>
+bool compress_objects(std::vector<PackObject<Hash>>& objects, const PackWriteOptions& options) {
+    if (options.pool == nullptr) {
+        for (PackObject<Hash>& object : objects) {
+            if (!deflate_payload(object, options.compression_level)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    std::atomic<bool> ok{true};
+    TaskGroup group(*options.pool);
+    for (PackObject<Hash>& object : objects) {
+        group.run([&] {
+            if (!deflate_payload(object, options.compression_level)) {
+                ok = false;
+            }
+        });
+    }
+    group.wait();
+    return ok;
+}
+
+// Type and inflated size: 1|ttt|ssss, then 7 more size bits per byte (little-endian).
+std::string entry_header(ObjectType type, uint64_t size) {
+    std::string header;
+    unsigned char byte = static_cast<unsigned char>((static_cast<unsigned>(type) << 4) | (size & 0x0f));
+    size >>= 4;
+    while (size != 0) {
+        header.push_back(static_cast<char>(byte | 0x80));
+        byte = size & 0x7f;
+        size >>= 7;
+    }
+    header.push_back(static_cast<char>(byte));
+    return header;
+}
+
+// OFS_DELTA base distance: big-endian base-128 where every continuation byte also adds one.
+std::string ofs_delta_distance(uint64_t distance) {
+    unsigned char bytes[10];
+    std::size_t pos = sizeof(bytes) - 1;
+    bytes[pos] = distance & 0x7f;
+    while (distance >>= 7) {
+        bytes[--pos] = 0x80 | (--distance & 0x7f);
+    }
+    return std::string(reinterpret_cast<char *>(bytes + pos), sizeof(bytes) - pos);
+}
+
+/**
+ * Writes through to a file while keeping a running hash of everything written.
+ */
+template <typename Hash>
+class HashedFileWriter {
+public:
+    explicit HashedFileWriter(const std::string& path) : file_(path, std::ios::binary) {}
+
+    bool ok() const { return static_cast<bool>(file_); }
+    uint64_t offset() const { return offset_; }
+
+    void write(std::string_view data) {
+        sha_.update(data);
+        PerfScope scope(PerfPhase::ObjectWrite, data.size());
+        file_.write(data.data(), data.size());
+        offset_ += data.size();
+    }
+
+    // Appends the hash of everything written so far, closes the file and returns that hash.
+    ObjectId<Hash> finish() {
+        const ObjectId<Hash> hash = sha_.finish();
+        PerfScope scope(PerfPhase::ObjectWrite, hash.raw().size());
+        file_.write(hash.raw().data(), hash.raw().size());
+        file_.close();
+        return hash;
+    }
+
+private:
+    std::ofstream file_;
+    Hash sha_;
+    uint64_t offset_ = 0;
+};
+
+} // namespace
+
+uint32_t pack_name_hash(std::string_view path) {
+    uint32_t hash = 0;
+    for (const char c : path) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            continue;
+        }
+        hash = (hash >> 2) + (uint32_t(static_cast<unsigned char>(c)) << 24);
+    }
+    return hash;
+}
+
+template <typename Hash>
+bool write_pack_index(std::vector<PackIndexEntry<Hash>>& entries, const ObjectId<Hash>& pack_hash,
+                      const std::string& path) {
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.id < b.id; });
+
+    std::string idx = "\377tOc";
+    append_be32(idx, 2);
+    std::size_t next = 0;
+    for (int byte = 0; byte < 256; ++byte) {
+        while (next < entries.size() && entries[next].id.bytes[0] <= byte) {
+            ++next;
+        }
+        append_be32(idx, static_cast<uint32_t>(next));
+    }
+    for (const PackIndexEntry<Hash>& entry : entries) {
+        idx.append(entry.id.raw());
+    }
+    for (const PackIndexEntry<Hash>& entry : entries) {
+        append_be32(idx, entry.crc);
+    }
+    std::string large_offsets;
+    for (const PackIndexEntry<Hash>& entry : entries) {
+        if (entry.offset < 0x80000000u) {
+            append_be32(idx, static_cast<uint32_t>(entry.offset));
+        } else {
+            append_be32(idx, 0x80000000u | static_cast<uint32_t>(large_offsets.size() / 8));
+            append_be64(large_offsets, entry.offset);
+        }
+    }
+    idx += large_offsets;
+    idx.append(pack_hash.raw());
+
+    HashedFileWriter<Hash> idx_file(path);
+    idx_file.write(idx);
+    idx_file.finish();
+    return idx_file.ok();
+}
+
+template <typename Hash>
+std::optional<PackWriteResult> write_pack(std::vector<PackObject<Hash>>& objects, const std::string& pack_dir,
+                                          const PackWriteOptions& options) {
+    find_deltas(objects, options);
+    if (!compress_objects(objects, options)) {
+        std::cerr << "Error: Failed to compress objects for the pack.\n";
+        return std::nullopt;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(pack_dir, ec);
+    const std::string suffix = std::to_string(getpid());
+    const std::string temp_pack = pack_dir + "/tmp_pack_" + suffix;
+    const std::string temp_idx = pack_dir + "/tmp_idx_" + suffix;
+    auto fail = [&](const std::string& message) -> std::optional<PackWriteResult> {
+        std::cerr << "Error: " << message << '\n';
+        std::filesystem::remove(temp_pack, ec);
+        std::filesystem::remove(temp_idx, ec);
+        return std::nullopt;
+    };
+
+    HashedFileWriter<Hash> pack(temp_pack);
+    if (!pack.ok()) {
+        return fail("Could not open file for writing: " + temp_pack);
+    }
+    std::string header = "PACK";
+    append_be32(header, 2);
+    append_be32(header, static_cast<uint32_t>(objects.size()));
+    pack.write(header);
+
+    // Offsets of written entries; 0 means "not written yet" (no entry starts inside the header).
+    std::vector<uint64_t> offsets(objects.size(), 0);
+    std::vector<uint32_t> crcs(objects.size(), 0);
+    std::size_t deltas = 0;
+    auto write_entry = [&](auto& self, std::size_t i) -> void {
+        if (offsets[i] != 0) {
+            return;
+        }
+        PackObject<Hash>& object = objects[i];
+        if (object.base >= 0) {
+            self(self, static_cast<std::size_t>(object.base));
+        }
+        offsets[i] = pack.offset();
+        std::string entry = object.base >= 0
+            ? entry_header(ObjectType::OfsDelta, object.delta.size()) + ofs_delta_distance(offsets[i] - offsets[object.base])
+            : entry_header(object.type, object.data.size());
+        uLong crc = crc32(0, reinterpret_cast<const Bytef *>(entry.data()), entry.size());
+        crc = crc32(crc, reinterpret_cast<const Bytef *>(object.compressed.data()), object.compressed.size());
+        crcs[i] = static_cast<uint32_t>(crc);
+        pack.write(entry);
+        pack.write(object.compressed);
+        deltas += object.base >= 0;
+        // Payloads are not needed any more once written.
+        std::string().swap(object.compressed);
+    };
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        write_entry(write_entry, i);
+    }
+    const ObjectId<Hash> pack_hash = pack.finish();
+    if (!pack.ok()) {
+        return fail("Could not write pack " + temp_pack);
+    }
+
+    std::vector<PackIndexEntry<Hash>> index_entries(objects.size());
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        index_entries[i] = {objects[i].id, crcs[i], offsets[i]};
+    }
+    if (!write_pack_index(index_entries, pack_hash, temp_idx)) {
+        return fail("Could not write pack index " + temp_idx);
+    }
+
+    PackWriteResult result;
+    const std::string base_name = pack_dir + "/pack-" + pack_hash.to_hex();
+    result.pack_path = base_name + ".pack";
+    result.idx_path = base_name + ".idx";
+    result.deltas = deltas;
+    // The pack goes into place first: a reader only looks at packs that have an index.
+    std::filesystem::rename(temp_pack, result.pack_path, ec);
+    if (!ec) {
+        std::filesystem::rename(temp_idx, result.idx_path, ec);
+    }
+    if (ec) {
+        return fail("Could not move pack into place: " + result.pack_path);
+    }
+    return result;
+}
+
+template std::optional<PackWriteResult> write_pack(std::vector<PackObject<Sha1>>&, const std::string&,
+                                                   const PackWriteOptions&);
+template std::optional<PackWriteResult> write_pack(std::vector<PackObject<Sha256>>&, const std::string&,
+                                                   const PackWriteOptions&);
+template bool write_pack_index(std::vector<PackIndexEntry<Sha1>>&, const ObjectId<Sha1>&, const std::string&);
+template bool write_pack_index(std::vector<PackIndexEntry<Sha256>>&, const ObjectId<Sha256>&, const std::string&);
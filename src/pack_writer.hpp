@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compression.hpp"
+#include "object_id.hpp"
+#include "object_type.hpp"
+
+class ThreadPool;
+
+/**
+ * One object to be written into a pack, with its uncompressed content (no loose header).
+ */
+template <typename Hash>
+struct PackObject {
+    ObjectId<Hash> id;
+    ObjectType type = ObjectType::None;
+    std::string data;
+    uint32_t name_hash = 0; // `pack_name_hash` of the path the object was found at, 0 if none.
+
+    // Chosen by the delta search: the position of the base in the object list (or -1) and the delta.
+    int64_t base = -1;
+    std::string delta;
+    unsigned depth = 0;
+
+    std::string compressed; // The deflated payload, filled in while writing.
+};
+
+/**
+ * Git's path name hash used to order delta candidates: it is dominated by the last characters of
+ * the path, so files with the same name (and, to a lesser degree, the same extension) sort together.
+ */
+uint32_t pack_name_hash(std::string_view path);
+
+struct PackWriteOptions {
+    unsigned window = 10; // How many preceding objects are tried as delta bases.
+    unsigned depth = 50;  // Longest delta chain allowed.
+    int compression_level = DEFAULT_COMPRESSION_LEVEL; // See `CompressionLevels::pack`.
+    ThreadPool *pool = nullptr; // Delta search and compression run on the pool when given.
+};
+
+struct PackWriteResult {
+    std::string pack_path;
+    std::string idx_path;
+    std::size_t deltas = 0;
+};
+
+/**
+ * Writes `objects` as one packfile plus its version 2 index into `pack_dir`.
+ *
+ * This function performs the following steps:
+ *
+ * 1. **Delta Search**:
+ *    - Sorts the objects by type, name hash and size (largest first), so versions of the same file end up
+ *      next to each other, and slides a window of `options.window` objects over that order.
+ *    - Every object is tried as a delta against each earlier object in its window (see `create_delta`)
+ *      and keeps the smallest delta that saves at least half of its size. An index is built once per
+ *      window entry and reused for every target.
+ *    - With a thread pool, the sorted list is cut into contiguous segments searched concurrently.
+ *
+ * 2. **Compression**:
+ *    - Deflates every object's payload (its delta, or its data if it has no base), concurrently on the pool.
+ *
+ * 3. **Pack Writing**:
+ *    - Writes the objects in the order given, each base before the objects that are deltas of it, so every
+ *      delta can be stored as an OFS_DELTA pointing backwards.
+ *    - The file is named after its trailing checksum (`pack-<hash>.pack`, in the repository's hash), written under a temporary name and
+ *      renamed into place before the index, so readers never see a pack without a complete index.
+ *
+ * Returns `std::nullopt` (after printing an error) if anything could not be written.
+ */
+template <typename Hash>
+std::optional<PackWriteResult> write_pack(std::vector<PackObject<Hash>>& objects, const std::string& pack_dir,
+                                          const PackWriteOptions& options);
+
+// One object of a pack as its index records it.
+template <typename Hash>
+struct PackIndexEntry {
+    ObjectId<Hash> id;
+    uint32_t crc = 0; // CRC-32 of the whole entry as stored, header included.
+    uint64_t offset = 0;
+};
+
+/**
+ * Writes the version 2 index (see `PackIndex`) of the pack whose trailing checksum is `pack_hash` and
+ * which holds `entries` to `path`, sorting `entries` by id on the way. Returns `false` if it cannot be written.
+ */
+template <typename Hash>
+bool write_pack_index(std::vector<PackIndexEntry<Hash>>& entries, const ObjectId<Hash>& pack_hash,
+                      const std::string& path);
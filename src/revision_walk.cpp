@@ -0,0 +1,361 @@
+#include "revision_walk.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <queue>
+
+#include "commit.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+
+template <typename Hash>
+RevisionWalker<Hash>::RevisionWalker(ObjectStore<Hash>& store, const std::string& graph_path, bool use_graph)
+    : store_(store) {
+    if (use_graph && graph_.open(graph_path)) {
+        graph_nodes_.assign(graph_.size(), CommitGraph<Hash>::NONE);
+    }
+}
+
+template <typename Hash>
+uint32_t RevisionWalker<Hash>::add_node(Commit commit) {
+    const uint32_t node = static_cast<uint32_t>(nodes_.size());
+    node_of_.emplace(commit.id, node);
+    if (commit.graph_position != CommitGraph<Hash>::NONE) {
+        graph_nodes_[commit.graph_position] = node;
+    }
+    nodes_.push_back(std::move(commit));
+    return node;
+}
+
+template <typename Hash>
+std::optional<uint32_t> RevisionWalker<Hash>::graph_node(uint32_t position) {
+    if (graph_nodes_[position] != CommitGraph<Hash>::NONE) {
+        return graph_nodes_[position];
+    }
+    Commit commit;
+    commit.id = graph_.id_at(position);
+    commit.tree = graph_.tree_at(position);
+    commit.time = graph_.commit_time_at(position);
+    commit.generation = graph_.generation_at(position);
+    commit.graph_position = position;
+    return add_node(std::move(commit));
+}
+
+template <typename Hash>
+std::optional<uint32_t> RevisionWalker<Hash>::lookup(const ObjectId<Hash>& id) {
+    if (const auto it = node_of_.find(id); it != node_of_.end()) {
+        return it->second;
+    }
+    if (const std::optional<uint32_t> position = graph_.find(id)) {
+        return graph_node(*position);
+    }
+    const std::shared_ptr<const DecodedObject> object = store_.read(id);
+    if (!object) {
+        return std::nullopt;
+    }
+    if (object->type != ObjectType::Commit) {
+        std::cerr << "error: object " << id.to_hex() << " is a " << object_type_name(object->type)
+                  << ", not a commit\n";
+        return std::nullopt;
+    }
+    const std::optional<CommitView<Hash>> view = parse_commit<Hash>(object->data);
+    if (!view) {
+        std::cerr << "error: corrupt commit " << id.to_hex() << '\n';
+        return std::nullopt;
+    }
+    Commit commit;
+    commit.id = id;
+    commit.tree = view->tree;
+    commit.time = view->commit_time();
+    commit.parent_ids = view->parents;
+    return add_node(std::move(commit));
+}
+
+template <typename Hash>
+bool RevisionWalker<Hash>::load_parents(uint32_t node) {
+    if (nodes_[node].parents_loaded) {
+        return true;
+    }
+    std::vector<uint32_t> parents;
+    if (nodes_[node].graph_position != CommitGraph<Hash>::NONE) {
+        std::vector<uint32_t> positions;
+        if (!graph_.parents_at(nodes_[node].graph_position, positions)) {
+            std::cerr << "error: corrupt commit-graph entry for " << nodes_[node].id.to_hex() << '\n';
+            return false;
+        }
+        for (const uint32_t position : positions) {
+            parents.push_back(*graph_node(position));
+        }
+    } else {
+        // Copied, since looking parents up adds nodes.
+        const std::vector<ObjectId<Hash>> ids = nodes_[node].parent_ids;
+        for (const ObjectId<Hash>& id : ids) {
+            const std::optional<uint32_t> parent = lookup(id);
+            if (!parent) {
+                return false;
+            }
+            parents.push_back(*parent);
+        }
+    }
+    Commit& commit = nodes_[node];
+    commit.parents = std::move(parents);
+    commit.parents_loaded = true;
+    std::vector<ObjectId<Hash>>().swap(commit.parent_ids);
+    return true;
+}
+
+template <typename Hash>
+bool RevisionWalker<Hash>::pops_before(uint32_t a, uint32_t b) const {
+    const Commit& first = nodes_[a];
+    const Commit& second = nodes_[b];
+    if (first.generation != second.generation) {
+        return first.generation > second.generation;
+    }
+    return first.time > second.time;
+}
+
+template <typename Hash>
+bool RevisionWalker<Hash>::walk(const std::vector<uint32_t>& include, const std::vector<uint32_t>& exclude,
+                                const std::function<bool(uint32_t)>& visit) {
+    // Queue entries carry the order they were added in, which breaks ties like git's date-sorted list.
+    struct Entry {
+        uint32_t node;
+        uint64_t sequence;
+    };
+    uint64_t sequence = 0;
+    std::vector<uint8_t> flags;
+    auto flag = [&](uint32_t node) -> uint8_t& {
+        if (flags.size() <= node) {
+            flags.resize(nodes_.size() > node ? nodes_.size() : node + 1, 0);
+        }
+        return flags[node];
+    };
+    constexpr uint8_t ADDED = 1, UNINTERESTING = 2, QUEUED = 4;
+
+    if (exclude.empty()) {
+        auto later = [&](const Entry& a, const Entry& b) {
+            const int64_t time_a = nodes_[a.node].time, time_b = nodes_[b.node].time;
+            return time_a != time_b ? time_a < time_b : a.sequence > b.sequence;
+        };
+        std::priority_queue<Entry, std::vector<Entry>, decltype(later)> queue(later);
+        for (const uint32_t node : include) {
+            if (!(flag(node) & ADDED)) {
+                flag(node) |= ADDED;
+                queue.push({node, sequence++});
+            }
+        }
+        while (!queue.empty()) {
+            const uint32_t node = queue.top().node;
+            queue.pop();
+            if (!visit(node)) {
+                return true;
+            }
+            if (!load_parents(node)) {
+                return false;
+            }
+            for (const uint32_t parent : nodes_[node].parents) {
+                if (!(flag(parent) & ADDED)) {
+                    flag(parent) |= ADDED;
+                    queue.push({parent, sequence++});
+                }
+            }
+        }
+        return true;
+    }
+
+    // A limited walk. A commit is only decided on once every queued commit that could reach it has been
+    // popped, which ordering by generation guarantees; uninteresting commits keep the walk going only
+    // while interesting ones are left to classify.
+    auto after = [&](const Entry& a, const Entry& b) {
+        if (pops_before(b.node, a.node) || pops_before(a.node, b.node)) {
+            return pops_before(b.node, a.node);
+        }
+        return a.sequence > b.sequence;
+    };
+    std::priority_queue<Entry, std::vector<Entry>, decltype(after)> queue(after);
+    std::size_t interesting_queued = 0;
+    auto enqueue = [&](uint32_t node) {
+        uint8_t& f = flag(node);
+        f |= ADDED | QUEUED;
+        interesting_queued += !(f & UNINTERESTING);
+        queue.push({node, sequence++});
+    };
+    for (const uint32_t node : exclude) {
+        if (!(flag(node) & UNINTERESTING)) {
+            flag(node) |= UNINTERESTING;
+            enqueue(node);
+        }
+    }
+    for (const uint32_t node : include) {
+        if (!(flag(node) & ADDED)) {
+            enqueue(node);
+        }
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> reached; // (order reached, node) of interesting commits.
+    while (!queue.empty() && interesting_queued > 0) {
+        const Entry entry = queue.top();
+        queue.pop();
+        uint8_t& f = flag(entry.node);
+        f &= ~QUEUED;
+        const bool uninteresting = f & UNINTERESTING;
+        if (!uninteresting) {
+            --interesting_queued;
+            reached.push_back({entry.sequence, entry.node});
+        }
+        if (!load_parents(entry.node)) {
+            return false;
+        }
+        for (const uint32_t parent : nodes_[entry.node].parents) {
+            uint8_t& pf = flag(parent);
+            if (uninteresting && !(pf & UNINTERESTING)) {
+                // Marking an interesting queued commit uninteresting takes it off the count; one that
+                // was popped already (only possible with clock skew outside the graph) is queued again
+                // so the mark reaches its parents.
+                interesting_queued -= (pf & QUEUED) ? 1 : 0;
+                pf |= UNINTERESTING;
+                if (!(pf & QUEUED)) {
+                    enqueue(parent);
+                }
+            } else if (!(pf & ADDED)) {
+                enqueue(parent);
+            }
+        }
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> result;
+    for (const auto& [order, node] : reached) {
+        if (!(flag(node) & UNINTERESTING)) {
+            result.push_back({order, node});
+        }
+    }
+    std::stable_sort(result.begin(), result.end(), [&](const auto& a, const auto& b) {
+        return nodes_[a.second].time > nodes_[b.second].time;
+    });
+    for (const auto& [order, node] : result) {
+        if (!visit(node)) {
+            break;
+        }
+    }
+    return true;
+}
+
+template <typename Hash>
+std::optional<bool> RevisionWalker<Hash>::is_ancestor(uint32_t ancestor, uint32_t descendant) {
+    const uint32_t target_generation = nodes_[ancestor].generation;
+    std::vector<uint8_t> seen(nodes_.size(), 0);
+    std::vector<uint32_t> stack = {descendant};
+    while (!stack.empty()) {
+        const uint32_t node = stack.back();
+        stack.pop_back();
+        if (node == ancestor) {
+            return true;
+        }
+        if (node < seen.size() && seen[node]) {
+            continue;
+        }
+        if (seen.size() <= node) {
+            seen.resize(nodes_.size(), 0);
+        }
+        seen[node] = 1;
+        // Every ancestor of a graph commit is in the graph with a smaller generation, so a commit whose
+        // generation is not above the target's cannot reach it (a target outside the graph is never
+        // reached from inside).
+        const uint32_t generation = nodes_[node].generation;
+        if (generation != GENERATION_INFINITY && generation <= target_generation) {
+            continue;
+        }
+        if (!load_parents(node)) {
+            return std::nullopt;
+        }
+        stack.insert(stack.end(), nodes_[node].parents.begin(), nodes_[node].parents.end());
+    }
+    return false;
+}
+
+template <typename Hash>
+std::optional<std::vector<uint32_t>> RevisionWalker<Hash>::merge_bases(uint32_t a, uint32_t b) {
+    if (a == b) {
+        return std::vector<uint32_t>{a};
+    }
+    // Paint both histories down until every commit left in the queue is known to be below a common ancestor.
+    constexpr uint8_t PARENT1 = 1, PARENT2 = 2, STALE = 4, RESULT = 8;
+    std::vector<uint8_t> flags;
+    auto flag = [&](uint32_t node) -> uint8_t& {
+        if (flags.size() <= node) {
+            flags.resize(nodes_.size() > node ? nodes_.size() : node + 1, 0);
+        }
+        return flags[node];
+    };
+    // Entries remember whether they were counted in `fresh` (queued without STALE). An entry may turn
+    // stale while queued, which only makes the walk go on a little longer.
+    struct Entry {
+        uint32_t node;
+        bool fresh;
+    };
+    auto after = [&](const Entry& x, const Entry& y) { return pops_before(y.node, x.node); };
+    std::priority_queue<Entry, std::vector<Entry>, decltype(after)> queue(after);
+    std::size_t fresh = 0;
+    auto put = [&](uint32_t node) {
+        const bool is_fresh = !(flag(node) & STALE);
+        fresh += is_fresh;
+        queue.push({node, is_fresh});
+    };
+    flag(a) |= PARENT1;
+    flag(b) |= PARENT2;
+    put(a);
+    put(b);
+    std::vector<uint32_t> results;
+    while (!queue.empty() && fresh > 0) {
+        const uint32_t node = queue.top().node;
+        fresh -= queue.top().fresh;
+        queue.pop();
+        uint8_t paint = flag(node) & (PARENT1 | PARENT2 | STALE);
+        if (paint == (PARENT1 | PARENT2)) {
+            if (!(flag(node) & RESULT)) {
+                flag(node) |= RESULT;
+                results.push_back(node);
+            }
+            // Everything below a common ancestor is a common ancestor, but not a best one.
+            paint |= STALE;
+        }
+        if (!load_parents(node)) {
+            return std::nullopt;
+        }
+        for (const uint32_t parent : nodes_[node].parents) {
+            if ((flag(parent) & paint) == paint) {
+                continue;
+            }
+            flag(parent) |= paint;
+            put(parent);
+        }
+    }
+
+    std::vector<uint32_t> bases;
+    for (const uint32_t node : results) {
+        if (!(flag(node) & STALE)) {
+            bases.push_back(node);
+        }
+    }
+    std::stable_sort(bases.begin(), bases.end(), [&](uint32_t x, uint32_t y) { return nodes_[x].time > nodes_[y].time; });
+    // Drop bases that are ancestors of other bases; there are rarely more than two.
+    std::vector<uint32_t> best;
+    for (std::size_t i = 0; i < bases.size(); i++) {
+        bool redundant = false;
+        for (std::size_t j = 0; j < bases.size() && !redundant; j++) {
+            if (i == j) {
+                continue;
+            }
+            const std::optional<bool> below = is_ancestor(bases[i], bases[j]);
+            if (!below) {
+                return std::nullopt;
+            }
+            redundant = *below;
+        }
+        if (!redundant) {
+            best.push_back(bases[i]);
+        }
+    }
+    return best;
+}
+
+template class RevisionWalker<Sha1>;
+template class RevisionWalker<Sha256>;
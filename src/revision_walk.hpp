@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "commit_graph.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+
+/**
+ * History queries over the commits of an `ObjectStore`: date-ordered walks for `log`/`rev-list`,
+ * ancestry tests and merge bases.
+ *
+ * 1. **Nodes**:
+ *    - Every commit a query touches becomes a node, numbered in the order they are first seen, and stays
+ *      loaded for as long as the walker lives. Parents are loaded on demand, when a walk reaches them.
+ *
+ * 2. **Commit-Graph**:
+ *    - Commits in the commit-graph (see `CommitGraph`) are loaded from it: their tree, date, generation
+ *      and parent positions are a few loads from a mapping, and their parents are found by position, so
+ *      their objects are never read. Only commits newer than the graph are inflated and parsed.
+ *    - Commits outside the graph have an infinite generation (`GENERATION_INFINITY`), as in git.
+ *
+ * 3. **Generation Numbers**:
+ *    - A commit's ancestors all have smaller generations. Ancestry tests stop at commits whose
+ *      generation is not above the one they look for, and walks that must see every descendant of a
+ *      commit first (merge bases, walks with excluded commits) pop commits by generation, so with a
+ *      graph they stop as soon as the answer is known instead of at the root commits.
+ *
+ * Not thread-safe.
+ */
+template <typename Hash>
+class RevisionWalker {
+public:
+    static constexpr uint32_t GENERATION_INFINITY = 0xffffffff;
+
+    struct Commit {
+        ObjectId<Hash> id;
+        ObjectId<Hash> tree;
+        int64_t time = 0;
+        uint32_t generation = GENERATION_INFINITY;
+        std::vector<uint32_t> parents; // Node numbers, valid once `load_parents` succeeded.
+        bool parents_loaded = false;
+
+    private:
+        friend class RevisionWalker;
+        uint32_t graph_position = CommitGraph<Hash>::NONE;
+        std::vector<ObjectId<Hash>> parent_ids; // Until the parents are loaded, for commits outside the graph.
+    };
+
+    // Uses the commit-graph at `graph_path` if it exists and `use_graph` is set.
+    RevisionWalker(ObjectStore<Hash>& store, const std::string& graph_path, bool use_graph = true);
+
+    RevisionWalker(const RevisionWalker&) = delete;
+    RevisionWalker& operator=(const RevisionWalker&) = delete;
+
+    // Number of commits in the commit-graph in use (0 without one).
+    uint32_t graph_size() const { return graph_.size(); }
+
+    // The node of commit `id`, loading it on first use. Returns `std::nullopt` (after printing an error)
+    // if it is missing or not a commit.
+    std::optional<uint32_t> lookup(const ObjectId<Hash>& id);
+
+    const Commit& commit(uint32_t node) const { return nodes_[node]; }
+
+    // Loads the parents of `node` into `commit(node).parents`. Returns `false` (after printing an error)
+    // if one cannot be loaded.
+    bool load_parents(uint32_t node);
+
+    /**
+     * Visits the commits reachable from `include` but not from any of `exclude`, newest commit
+     * date first (ties in the order they were reached), until `visit` returns `false`.
+     *
+     * Without exclusions commits are handed to `visit` as the walk reaches them. With exclusions the
+     * walk first marks everything reachable from them as uninteresting, popping commits by generation
+     * so every commit is marked before it is decided on, then sorts the remaining commits by date.
+     * Returns `false` (after printing an error) if a commit cannot be loaded.
+     */
+    bool walk(const std::vector<uint32_t>& include, const std::vector<uint32_t>& exclude,
+              const std::function<bool(uint32_t)>& visit);
+
+    // Whether `ancestor` is reachable from `descendant` (a commit is its own ancestor).
+    // Returns `std::nullopt` (after printing an error) if a commit cannot be loaded.
+    std::optional<bool> is_ancestor(uint32_t ancestor, uint32_t descendant);
+
+    /**
+     * The best common ancestors of `a` and `b`: common ancestors that are not ancestors of another
+     * common ancestor, newest first. Empty if the histories are unrelated.
+     * Returns `std::nullopt` (after printing an error) if a commit cannot be loaded.
+     */
+    std::optional<std::vector<uint32_t>> merge_bases(uint32_t a, uint32_t b);
+
+private:
+    uint32_t add_node(Commit commit);
+    std::optional<uint32_t> graph_node(uint32_t position);
+
+    // Orders commits for walks that must see descendants first: larger generation, then newer date.
+    bool pops_before(uint32_t a, uint32_t b) const;
+
+    ObjectStore<Hash>& store_;
+    CommitGraph<Hash> graph_;
+    std::deque<Commit> nodes_; // A deque, so references stay valid as nodes are added.
+    std::unordered_map<ObjectId<Hash>, uint32_t, ObjectIdHash<Hash>> node_of_;
+    std::vector<uint32_t> graph_nodes_; // The node of every graph position loaded so far, or `NONE`.
+};
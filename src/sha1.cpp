@@ -0,0 +1,518 @@
+#include "sha1.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// The low-level SHA1_* interface is deprecated in OpenSSL 3 but is the only one that exposes the block function.
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#define SHA1_ARM 1
+#endif
+
+#include "trace_perf.hpp"
+
+namespace {
+
+constexpr uint32_t INITIAL_STATE[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+constexpr uint32_t ROUND_CONSTANTS[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void store_be32(unsigned char *p, uint32_t value) {
+    p[0] = static_cast<unsigned char>(value >> 24);
+    p[1] = static_cast<unsigned char>(value >> 16);
+    p[2] = static_cast<unsigned char>(value >> 8);
+    p[3] = static_cast<unsigned char>(value);
+}
+
+ObjectId<Sha1> digest_of(const uint32_t state[5]) {
+    unsigned char digest[Sha1::DIGEST_SIZE];
+    for (int i = 0; i < 5; i++) {
+        store_be32(digest + 4 * i, state[i]);
+    }
+    return ObjectId<Sha1>::from_raw(digest);
+}
+
+uint32_t rotl(uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); }
+
+void compress_portable(uint32_t state[5], const unsigned char *blocks, std::size_t count) {
+    for (; count > 0; count--, blocks += Sha1::BLOCK_SIZE) {
+        uint32_t w[16];
+        for (int t = 0; t < 16; t++) {
+            w[t] = load_be32(blocks + 4 * t);
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int t = 0; t < 80; t++) {
+            if (t >= 16) {
+                w[t & 15] = rotl(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1);
+            }
+            uint32_t f;
+            if (t < 20) {
+                f = d ^ (b & (c ^ d));
+            } else if (t < 40 || t >= 60) {
+                f = b ^ c ^ d;
+            } else {
+                f = (b & c) | (d & (b | c));
+            }
+            const uint32_t temp = rotl(a, 5) + f + e + ROUND_CONSTANTS[t / 20] + w[t & 15];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+/**
+ * OpenSSL's block function (with its own assembly for the CPU), run on a context seeded with `state`.
+ */
+void compress_openssl(uint32_t state[5], const unsigned char *blocks, std::size_t count) {
+    SHA_CTX ctx;
+    SHA1_Init(&ctx);
+    ctx.h0 = state[0];
+    ctx.h1 = state[1];
+    ctx.h2 = state[2];
+    ctx.h3 = state[3];
+    ctx.h4 = state[4];
+    SHA1_Update(&ctx, blocks, count * Sha1::BLOCK_SIZE);
+    state[0] = ctx.h0;
+    state[1] = ctx.h1;
+    state[2] = ctx.h2;
+    state[3] = ctx.h3;
+    state[4] = ctx.h4;
+}
+
+#if defined(SHA1_X86)
+
+/**
+ * SHA-NI: `sha1rnds4` does four rounds, `sha1nexte` derives the next E, `sha1msg1`/`sha1msg2` expand
+ * the message schedule. Group `i` covers rounds 4i..4i+3; while it runs, the schedule for the groups
+ * one to three ahead is advanced, so `msg[i % 4]` always holds the words the group needs.
+ */
+template <int I>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void shani_group(__m128i& abcd, __m128i (&e)[2],
+                                                                              __m128i (&msg)[4],
+                                                                              const unsigned char *block) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i& current = msg[I % 4];
+    if constexpr (I < 4) {
+        current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * I)), byte_swap);
+    }
+    __m128i& e_now = e[I % 2];
+    if constexpr (I == 0) {
+        e_now = _mm_add_epi32(e_now, current);
+    } else {
+        e_now = _mm_sha1nexte_epu32(e_now, current);
+    }
+    e[(I + 1) % 2] = abcd;
+    if constexpr (I >= 3 && I <= 18) {
+        msg[(I + 1) % 4] = _mm_sha1msg2_epu32(msg[(I + 1) % 4], current);
+    }
+    abcd = _mm_sha1rnds4_epu32(abcd, e_now, I / 5);
+    if constexpr (I >= 1 && I <= 16) {
+        msg[(I + 3) % 4] = _mm_sha1msg1_epu32(msg[(I + 3) % 4], current);
+    }
+    if constexpr (I >= 2 && I <= 17) {
+        msg[(I + 2) % 4] = _mm_xor_si128(msg[(I + 2) % 4], current);
+    }
+}
+
+template <int... I>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void shani_block(__m128i& abcd, __m128i (&e)[2],
+                                                                              const unsigned char *block,
+                                                                              std::integer_sequence<int, I...>) {
+    __m128i msg[4];
+    (shani_group<I>(abcd, e, msg, block), ...);
+}
+
+__attribute__((target("sha,sse4.1"))) void compress_shani(uint32_t state[5], const unsigned char *blocks,
+                                                           std::size_t count) {
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1b);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    for (; count > 0; count--, blocks += Sha1::BLOCK_SIZE) {
+        const __m128i abcd_saved = abcd;
+        const __m128i e0_saved = e0;
+        __m128i e[2] = {e0, _mm_setzero_si128()};
+        shani_block(abcd, e, blocks, std::make_integer_sequence<int, 20>());
+        // After the last group the next E is in e[0].
+        e0 = _mm_sha1nexte_epu32(e[0], e0_saved);
+        abcd = _mm_add_epi32(abcd, abcd_saved);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+__attribute__((target("avx2"))) inline __m256i rotl8(__m256i value, int bits) {
+    return _mm256_or_si256(_mm256_slli_epi32(value, bits), _mm256_srli_epi32(value, 32 - bits));
+}
+
+/**
+ * Eight messages in the eight 32-bit lanes of AVX2 registers. The message words are loaded eight
+ * at a time per lane and transposed, so each register holds the same word of every lane's block.
+ */
+__attribute__((target("avx2"))) void compress_lanes_avx2(uint32_t state[5][SHA1_LANES],
+                                                         const unsigned char *const blocks[SHA1_LANES]) {
+    const __m256i byte_swap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                              12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i w[16];
+    for (int half = 0; half < 2; half++) {
+        __m256i r[8];
+        for (std::size_t lane = 0; lane < SHA1_LANES; lane++) {
+            r[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(blocks[lane] + 32 * half));
+        }
+        __m256i t[8], u[8];
+        for (int i = 0; i < 8; i += 4) {
+            t[i + 0] = _mm256_unpacklo_epi32(r[i + 0], r[i + 1]);
+            t[i + 1] = _mm256_unpackhi_epi32(r[i + 0], r[i + 1]);
+            t[i + 2] = _mm256_unpacklo_epi32(r[i + 2], r[i + 3]);
+            t[i + 3] = _mm256_unpackhi_epi32(r[i + 2], r[i + 3]);
+            u[i + 0] = _mm256_unpacklo_epi64(t[i + 0], t[i + 2]);
+            u[i + 1] = _mm256_unpackhi_epi64(t[i + 0], t[i + 2]);
+            u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+            u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+        }
+        __m256i *out = w + 8 * half;
+        for (int i = 0; i < 4; i++) {
+            out[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), byte_swap);
+            out[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), byte_swap);
+        }
+    }
+
+    __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i *>(state[0]));
+    __m256i b = _mm256_load_si256(reinterpret_cast<const __m256i *>(state[1]));
+    __m256i c = _mm256_load_si256(reinterpret_cast<const __m256i *>(state[2]));
+    __m256i d = _mm256_load_si256(reinterpret_cast<const __m256i *>(state[3]));
+    __m256i e = _mm256_load_si256(reinterpret_cast<const __m256i *>(state[4]));
+    for (int t = 0; t < 80; t++) {
+        if (t >= 16) {
+            const __m256i mixed = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                                   _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+            w[t & 15] = rotl8(mixed, 1);
+        }
+        __m256i f;
+        if (t < 20) {
+            f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+        } else if (t < 40 || t >= 60) {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+        } else {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+        }
+        const __m256i k = _mm256_set1_epi32(static_cast<int>(ROUND_CONSTANTS[t / 20]));
+        const __m256i temp = _mm256_add_epi32(_mm256_add_epi32(rotl8(a, 5), f),
+                                              _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15]));
+        e = d;
+        d = c;
+        c = rotl8(b, 30);
+        b = a;
+        a = temp;
+    }
+    const __m256i words[5] = {a, b, c, d, e};
+    for (int i = 0; i < 5; i++) {
+        __m256i *slot = reinterpret_cast<__m256i *>(state[i]);
+        _mm256_store_si256(slot, _mm256_add_epi32(_mm256_load_si256(slot), words[i]));
+    }
+}
+
+bool cpu_has_sha_ni() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ebx & (1u << 29)) != 0 && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+}
+
+#endif // SHA1_X86
+
+#if defined(SHA1_ARM)
+
+#if defined(__clang__)
+#define SHA1_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA1_ARM_TARGET __attribute__((target("+sha2")))
+#endif
+
+/**
+ * ARMv8 SHA1 instructions: `sha1c`/`sha1p`/`sha1m` do four rounds with the choose, parity and
+ * majority functions, `sha1h` derives the next E, `sha1su0`/`sha1su1` expand the schedule.
+ */
+SHA1_ARM_TARGET void compress_armv8(uint32_t state[5], const unsigned char *blocks, std::size_t count) {
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e0 = state[4];
+    for (; count > 0; count--, blocks += Sha1::BLOCK_SIZE) {
+        const uint32x4_t abcd_saved = abcd;
+        const uint32_t e0_saved = e0;
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * i)));
+        }
+        uint32_t e = e0;
+        for (int group = 0; group < 20; group++) {
+            const uint32x4_t words = vaddq_u32(msg[group % 4], vdupq_n_u32(ROUND_CONSTANTS[group / 5]));
+            const uint32_t e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (group < 5) {
+                abcd = vsha1cq_u32(abcd, e, words);
+            } else if (group < 10 || group >= 15) {
+                abcd = vsha1pq_u32(abcd, e, words);
+            } else {
+                abcd = vsha1mq_u32(abcd, e, words);
+            }
+            e = e_next;
+            if (group < 16) {
+                // Words 4(group + 4).. from the four groups starting at this one.
+                msg[group % 4] = vsha1su1q_u32(vsha1su0q_u32(msg[group % 4], msg[(group + 1) % 4], msg[(group + 2) % 4]),
+                                               msg[(group + 3) % 4]);
+            }
+        }
+        e0 = e + e0_saved;
+        abcd = vaddq_u32(abcd, abcd_saved);
+    }
+    vst1q_u32(state, abcd);
+    state[4] = e0;
+}
+
+bool cpu_has_armv8_sha1() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#elif defined(__APPLE__)
+    return true; // Every Apple ARM64 CPU has the crypto extensions.
+#else
+    return false;
+#endif
+}
+
+#endif // SHA1_ARM
+
+std::vector<Sha1Backend> detect_backends() {
+    std::vector<Sha1Backend> backends;
+#if defined(SHA1_X86)
+    __builtin_cpu_init();
+    if (cpu_has_sha_ni()) {
+        backends.push_back({"shani", compress_shani, nullptr});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        backends.push_back({"avx2", compress_openssl, compress_lanes_avx2});
+    }
+#elif defined(SHA1_ARM)
+    if (cpu_has_armv8_sha1()) {
+        backends.push_back({"armv8", compress_armv8, nullptr});
+    }
+#endif
+    backends.push_back({"openssl", compress_openssl, nullptr});
+    backends.push_back({"portable", compress_portable, nullptr});
+    return backends;
+}
+
+const Sha1Backend& select_backend() {
+    const std::vector<Sha1Backend>& backends = sha1_backends();
+    if (const char *requested = std::getenv("GIT_SHA1_BACKEND"); requested != nullptr && *requested != '\0') {
+        for (const Sha1Backend& backend : backends) {
+            if (std::strcmp(backend.name, requested) == 0) {
+                return backend;
+            }
+        }
+        std::cerr << "warning: SHA-1 backend '" << requested << "' is not available, using '" << backends.front().name
+                  << "'.\n";
+    }
+    return backends.front();
+}
+
+/**
+ * Produces the padded message of one `HashJob<Sha1>` a block at a time. Blocks that lie inside `data`
+ * are handed out in place; the first blocks (with the header) and the last ones (with the padding)
+ * are assembled in `scratch`.
+ */
+struct Sha1Lane {
+    HashJob<Sha1> *job = nullptr;
+    uint64_t length = 0;
+    uint64_t padded_length = 0;
+    uint64_t offset = 0;
+    alignas(32) unsigned char scratch[Sha1::BLOCK_SIZE];
+
+    void start(HashJob<Sha1>& next) {
+        job = &next;
+        length = next.header.size() + next.data.size();
+        padded_length = ((length + 8) / Sha1::BLOCK_SIZE + 1) * Sha1::BLOCK_SIZE;
+        offset = 0;
+    }
+
+    bool done() const { return offset == padded_length; }
+
+    const unsigned char *next_block() {
+        const uint64_t begin = offset;
+        const uint64_t end = offset + Sha1::BLOCK_SIZE;
+        offset = end;
+        const uint64_t header_size = job->header.size();
+        if (begin >= header_size && end <= length) {
+            return reinterpret_cast<const unsigned char *>(job->data.data()) + (begin - header_size);
+        }
+        std::memset(scratch, 0, sizeof(scratch));
+        if (begin < header_size) {
+            const std::size_t n = std::min(end, header_size) - begin;
+            std::memcpy(scratch, job->header.data() + begin, n);
+        }
+        if (end > header_size && begin < length) {
+            const uint64_t from = std::max(begin, header_size);
+            const uint64_t to = std::min(end, length);
+            std::memcpy(scratch + (from - begin), job->data.data() + (from - header_size), to - from);
+        }
+        if (length >= begin && length < end) {
+            scratch[length - begin] = 0x80;
+        }
+        if (end == padded_length) {
+            const uint64_t bits = length * 8;
+            store_be32(scratch + 56, static_cast<uint32_t>(bits >> 32));
+            store_be32(scratch + 60, static_cast<uint32_t>(bits));
+        }
+        return scratch;
+    }
+};
+
+} // namespace
+
+const std::vector<Sha1Backend>& sha1_backends() {
+    static const std::vector<Sha1Backend> backends = detect_backends();
+    return backends;
+}
+
+const Sha1Backend& sha1_backend() {
+    static const Sha1Backend& backend = select_backend();
+    return backend;
+}
+
+Sha1::Sha1(const Sha1Backend& backend) : compress_(backend.compress) {
+    std::memcpy(state_, INITIAL_STATE, sizeof(state_));
+}
+
+void Sha1::update(const void *data, std::size_t size) {
+    PerfScope scope(PerfPhase::Hash, size);
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    length_ += size;
+    if (buffered_ > 0) {
+        const std::size_t n = std::min(size, BLOCK_SIZE - buffered_);
+        std::memcpy(block_ + buffered_, bytes, n);
+        buffered_ += n;
+        bytes += n;
+        size -= n;
+        if (buffered_ < BLOCK_SIZE) {
+            return;
+        }
+        compress_(state_, block_, 1);
+        buffered_ = 0;
+    }
+    if (const std::size_t blocks = size / BLOCK_SIZE; blocks > 0) {
+        compress_(state_, bytes, blocks);
+        bytes += blocks * BLOCK_SIZE;
+        size -= blocks * BLOCK_SIZE;
+    }
+    std::memcpy(block_, bytes, size);
+    buffered_ = size;
+}
+
+ObjectId<Sha1> Sha1::finish() {
+    const uint64_t bits = length_ * 8;
+    block_[buffered_++] = 0x80;
+    if (buffered_ > BLOCK_SIZE - 8) {
+        std::memset(block_ + buffered_, 0, BLOCK_SIZE - buffered_);
+        compress_(state_, block_, 1);
+        buffered_ = 0;
+    }
+    std::memset(block_ + buffered_, 0, BLOCK_SIZE - 8 - buffered_);
+    store_be32(block_ + 56, static_cast<uint32_t>(bits >> 32));
+    store_be32(block_ + 60, static_cast<uint32_t>(bits));
+    compress_(state_, block_, 1);
+    return digest_of(state_);
+}
+
+ObjectId<Sha1> Sha1::hash(std::string_view data) {
+    Sha1 sha;
+    sha.update(data);
+    return sha.finish();
+}
+
+void Sha1::hash_many(std::span<HashJob<Sha1>> jobs) {
+    const Sha1Backend& backend = sha1_backend();
+    if (backend.compress_lanes == nullptr || jobs.size() < 2) {
+        for (HashJob<Sha1>& job : jobs) {
+            Sha1 sha(backend);
+            sha.update(job.header);
+            sha.update(job.data);
+            job.id = sha.finish();
+        }
+        return;
+    }
+
+    PerfScope scope(PerfPhase::Hash);
+    for (const HashJob<Sha1>& job : jobs) {
+        scope.add_bytes(job.header.size() + job.data.size());
+    }
+    alignas(32) uint32_t state[5][SHA1_LANES];
+    alignas(32) static constexpr unsigned char idle_block[Sha1::BLOCK_SIZE] = {};
+    Sha1Lane lanes[SHA1_LANES];
+    std::size_t next_job = 0;
+    while (true) {
+        std::size_t active = 0;
+        for (std::size_t lane = 0; lane < SHA1_LANES; lane++) {
+            if (lanes[lane].job == nullptr && next_job < jobs.size()) {
+                lanes[lane].start(jobs[next_job++]);
+                for (int word = 0; word < 5; word++) {
+                    state[word][lane] = INITIAL_STATE[word];
+                }
+            }
+            active += lanes[lane].job != nullptr;
+        }
+        // Once the queue is empty and few lanes are left, lockstep rounds would mostly hash idle
+        // blocks: finish those messages one at a time instead.
+        if (next_job == jobs.size() && active <= 2) {
+            break;
+        }
+        const unsigned char *blocks[SHA1_LANES];
+        for (std::size_t lane = 0; lane < SHA1_LANES; lane++) {
+            blocks[lane] = lanes[lane].job != nullptr ? lanes[lane].next_block() : idle_block;
+        }
+        backend.compress_lanes(state, blocks);
+        for (std::size_t lane = 0; lane < SHA1_LANES; lane++) {
+            if (lanes[lane].job != nullptr && lanes[lane].done()) {
+                uint32_t lane_state[5];
+                for (int word = 0; word < 5; word++) {
+                    lane_state[word] = state[word][lane];
+                }
+                lanes[lane].job->id = digest_of(lane_state);
+                lanes[lane].job = nullptr;
+            }
+        }
+    }
+    for (std::size_t lane = 0; lane < SHA1_LANES; lane++) {
+        if (lanes[lane].job == nullptr) {
+            continue;
+        }
+        uint32_t lane_state[5];
+        for (int word = 0; word < 5; word++) {
+            lane_state[word] = state[word][lane];
+        }
+        while (!lanes[lane].done()) {
+            backend.compress(lane_state, lanes[lane].next_block(), 1);
+        }
+        lanes[lane].job->id = digest_of(lane_state);
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "object_id.hpp"
+
+/**
+ * Compresses `count` consecutive 64-byte blocks into the five-word SHA-1 `state`.
+ */
+using Sha1BlockFunction = void (*)(uint32_t state[5], const unsigned char *blocks, std::size_t count);
+
+/**
+ * Compresses one 64-byte block for each of `SHA1_LANES` independent messages at once.
+ * `state[word][lane]` holds the state of every lane; `blocks[lane]` points at that lane's block.
+ */
+constexpr std::size_t SHA1_LANES = 8;
+using Sha1LanesFunction = void (*)(uint32_t state[5][SHA1_LANES], const unsigned char *const blocks[SHA1_LANES]);
+
+/**
+ * A SHA-1 implementation. `compress` is always set; `compress_lanes` is set for backends that hash
+ * several messages side by side in SIMD registers, which only beats one fast stream on small inputs.
+ */
+struct Sha1Backend {
+    const char *name;
+    Sha1BlockFunction compress;
+    Sha1LanesFunction compress_lanes;
+};
+
+/**
+ * Every backend that can run on this CPU, in order of preference:
+ *   - "shani":    the x86 SHA extensions (SHA-NI), detected with `cpuid`.
+ *   - "armv8":    the ARMv8 SHA1 instructions, detected from the kernel's hardware capabilities.
+ *   - "avx2":     an 8-lane AVX2 multi-buffer mode, with OpenSSL for single streams.
+ *   - "openssl":  OpenSSL's block function, which has its own assembly for many CPUs.
+ *   - "portable": plain C++, always available.
+ * Backends whose instructions are missing are not listed.
+ */
+const std::vector<Sha1Backend>& sha1_backends();
+
+/**
+ * The backend used by `Sha1`: the first of `sha1_backends()`, unless the
+ * `GIT_SHA1_BACKEND` environment variable names another available one. Chosen once per process.
+ */
+const Sha1Backend& sha1_backend();
+
+/**
+ * An incremental SHA-1 context running on the selected backend, and the `Hash` parameter of
+ * `ObjectId<Sha1>` for repositories in the default object format.
+ *
+ * `update` hands whole blocks straight from the caller's buffer to the backend; only the partial
+ * block at either end of a piece is copied.
+ */
+class Sha1 {
+public:
+    static constexpr std::size_t BLOCK_SIZE = 64;
+    static constexpr std::size_t DIGEST_SIZE = 20;
+    // The value of `extensions.objectFormat` selecting this hash.
+    static constexpr std::string_view NAME = "sha1";
+
+    explicit Sha1(const Sha1Backend& backend = sha1_backend());
+
+    void update(const void *data, std::size_t size);
+    void update(std::string_view data) { update(data.data(), data.size()); }
+
+    // Pads the message and returns its hash. The context must not be used afterwards.
+    ObjectId<Sha1> finish();
+
+    // The hash of `data` in one call.
+    static ObjectId<Sha1> hash(std::string_view data);
+
+    /**
+     * Hashes all `jobs`. With a multi-buffer backend, up to `SHA1_LANES` messages advance together, one
+     * block per lane per step, and a lane whose message is done is refilled with the next job; the last
+     * few long messages are finished one at a time. Otherwise the jobs are hashed one after another.
+     */
+    static void hash_many(std::span<HashJob<Sha1>> jobs);
+
+private:
+    Sha1BlockFunction compress_;
+    uint32_t state_[5];
+    uint64_t length_ = 0;
+    unsigned char block_[BLOCK_SIZE];
+    std::size_t buffered_ = 0;
+};
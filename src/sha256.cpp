@@ -0,0 +1,332 @@
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// The low-level SHA256_* interface is deprecated in OpenSSL 3 but is the only one that exposes the block function.
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#define SHA256_ARM 1
+#endif
+
+#include "trace_perf.hpp"
+
+namespace {
+
+constexpr uint32_t INITIAL_STATE[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+alignas(16) constexpr uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void store_be32(unsigned char *p, uint32_t value) {
+    p[0] = static_cast<unsigned char>(value >> 24);
+    p[1] = static_cast<unsigned char>(value >> 16);
+    p[2] = static_cast<unsigned char>(value >> 8);
+    p[3] = static_cast<unsigned char>(value);
+}
+
+uint32_t rotr(uint32_t value, int bits) { return (value >> bits) | (value << (32 - bits)); }
+
+void compress_portable(uint32_t state[8], const unsigned char *blocks, std::size_t count) {
+    for (; count > 0; count--, blocks += Sha256::BLOCK_SIZE) {
+        uint32_t w[64];
+        for (int t = 0; t < 16; t++) {
+            w[t] = load_be32(blocks + 4 * t);
+        }
+        for (int t = 16; t < 64; t++) {
+            const uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            const uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t++) {
+            const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                                ROUND_CONSTANTS[t] + w[t];
+            const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+/**
+ * OpenSSL's block function (with its own assembly for the CPU), run on a context seeded with `state`.
+ */
+void compress_openssl(uint32_t state[8], const unsigned char *blocks, std::size_t count) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    std::memcpy(ctx.h, state, sizeof(ctx.h));
+    SHA256_Update(&ctx, blocks, count * Sha256::BLOCK_SIZE);
+    std::memcpy(state, ctx.h, sizeof(ctx.h));
+}
+
+#if defined(SHA256_X86)
+
+/**
+ * SHA-NI: `sha256rnds2` does two rounds on the state split into ABEF and CDGH halves,
+ * `sha256msg1`/`sha256msg2` expand the message schedule. Group `i` covers rounds 4i..4i+3; while it
+ * runs, the schedule for the groups one to three ahead is advanced, so `msg[i % 4]` always holds the
+ * words the group needs.
+ */
+template <int I>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void shani_group(__m128i& abef, __m128i& cdgh,
+                                                                              __m128i (&msg)[4],
+                                                                              const unsigned char *block) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i& current = msg[I % 4];
+    if constexpr (I < 4) {
+        current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * I)), byte_swap);
+    }
+    __m128i words =
+        _mm_add_epi32(current, _mm_load_si128(reinterpret_cast<const __m128i *>(ROUND_CONSTANTS + 4 * I)));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+    if constexpr (I >= 3 && I <= 14) {
+        __m128i& next = msg[(I + 1) % 4];
+        next = _mm_add_epi32(next, _mm_alignr_epi8(current, msg[(I + 3) % 4], 4));
+        next = _mm_sha256msg2_epu32(next, current);
+    }
+    words = _mm_shuffle_epi32(words, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, words);
+    if constexpr (I >= 1 && I <= 12) {
+        msg[(I + 3) % 4] = _mm_sha256msg1_epu32(msg[(I + 3) % 4], current);
+    }
+}
+
+template <int... I>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void shani_block(__m128i& abef, __m128i& cdgh,
+                                                                              const unsigned char *block,
+                                                                              std::integer_sequence<int, I...>) {
+    __m128i msg[4];
+    (shani_group<I>(abef, cdgh, msg, block), ...);
+}
+
+__attribute__((target("sha,sse4.1"))) void compress_shani(uint32_t state[8], const unsigned char *blocks,
+                                                           std::size_t count) {
+    // The instructions want the state as ABEF and CDGH rather than ABCD and EFGH.
+    const __m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+    const __m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4));
+    const __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+    const __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+    for (; count > 0; count--, blocks += Sha256::BLOCK_SIZE) {
+        const __m128i abef_saved = abef;
+        const __m128i cdgh_saved = cdgh;
+        shani_block(abef, cdgh, blocks, std::make_integer_sequence<int, 16>());
+        abef = _mm_add_epi32(abef, abef_saved);
+        cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+    }
+    const __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+    const __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+bool cpu_has_sha_ni() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ebx & (1u << 29)) != 0 && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+}
+
+#endif // SHA256_X86
+
+#if defined(SHA256_ARM)
+
+#if defined(__clang__)
+#define SHA256_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA256_ARM_TARGET __attribute__((target("+sha2")))
+#endif
+
+/**
+ * ARMv8 SHA2 instructions: `sha256h`/`sha256h2` do four rounds on the two state halves,
+ * `sha256su0`/`sha256su1` expand the schedule.
+ */
+SHA256_ARM_TARGET void compress_armv8(uint32_t state[8], const unsigned char *blocks, std::size_t count) {
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32x4_t efgh = vld1q_u32(state + 4);
+    for (; count > 0; count--, blocks += Sha256::BLOCK_SIZE) {
+        const uint32x4_t abcd_saved = abcd;
+        const uint32x4_t efgh_saved = efgh;
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * i)));
+        }
+        for (int group = 0; group < 16; group++) {
+            const uint32x4_t words = vaddq_u32(msg[group % 4], vld1q_u32(ROUND_CONSTANTS + 4 * group));
+            if (group < 12) {
+                // Words 4(group + 4).. from the four groups starting at this one.
+                msg[group % 4] = vsha256su1q_u32(vsha256su0q_u32(msg[group % 4], msg[(group + 1) % 4]),
+                                                 msg[(group + 2) % 4], msg[(group + 3) % 4]);
+            }
+            const uint32x4_t abcd_before = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, words);
+            efgh = vsha256h2q_u32(efgh, abcd_before, words);
+        }
+        abcd = vaddq_u32(abcd, abcd_saved);
+        efgh = vaddq_u32(efgh, efgh_saved);
+    }
+    vst1q_u32(state, abcd);
+    vst1q_u32(state + 4, efgh);
+}
+
+bool cpu_has_armv8_sha2() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#elif defined(__APPLE__)
+    return true; // Every Apple ARM64 CPU has the crypto extensions.
+#else
+    return false;
+#endif
+}
+
+#endif // SHA256_ARM
+
+std::vector<Sha256Backend> detect_backends() {
+    std::vector<Sha256Backend> backends;
+#if defined(SHA256_X86)
+    __builtin_cpu_init();
+    if (cpu_has_sha_ni()) {
+        backends.push_back({"shani", compress_shani});
+    }
+#elif defined(SHA256_ARM)
+    if (cpu_has_armv8_sha2()) {
+        backends.push_back({"armv8", compress_armv8});
+    }
+#endif
+    backends.push_back({"openssl", compress_openssl});
+    backends.push_back({"portable", compress_portable});
+    return backends;
+}
+
+const Sha256Backend& select_backend() {
+    const std::vector<Sha256Backend>& backends = sha256_backends();
+    if (const char *requested = std::getenv("GIT_SHA256_BACKEND"); requested != nullptr && *requested != '\0') {
+        for (const Sha256Backend& backend : backends) {
+            if (std::strcmp(backend.name, requested) == 0) {
+                return backend;
+            }
+        }
+        std::cerr << "warning: SHA-256 backend '" << requested << "' is not available, using '"
+                  << backends.front().name << "'.\n";
+    }
+    return backends.front();
+}
+
+} // namespace
+
+const std::vector<Sha256Backend>& sha256_backends() {
+    static const std::vector<Sha256Backend> backends = detect_backends();
+    return backends;
+}
+
+const Sha256Backend& sha256_backend() {
+    static const Sha256Backend& backend = select_backend();
+    return backend;
+}
+
+Sha256::Sha256(const Sha256Backend& backend) : compress_(backend.compress) {
+    std::memcpy(state_, INITIAL_STATE, sizeof(state_));
+}
+
+void Sha256::update(const void *data, std::size_t size) {
+    PerfScope scope(PerfPhase::Hash, size);
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    length_ += size;
+    if (buffered_ > 0) {
+        const std::size_t n = std::min(size, BLOCK_SIZE - buffered_);
+        std::memcpy(block_ + buffered_, bytes, n);
+        buffered_ += n;
+        bytes += n;
+        size -= n;
+        if (buffered_ < BLOCK_SIZE) {
+            return;
+        }
+        compress_(state_, block_, 1);
+        buffered_ = 0;
+    }
+    if (const std::size_t blocks = size / BLOCK_SIZE; blocks > 0) {
+        compress_(state_, bytes, blocks);
+        bytes += blocks * BLOCK_SIZE;
+        size -= blocks * BLOCK_SIZE;
+    }
+    std::memcpy(block_, bytes, size);
+    buffered_ = size;
+}
+
+ObjectId<Sha256> Sha256::finish() {
+    const uint64_t bits = length_ * 8;
+    block_[buffered_++] = 0x80;
+    if (buffered_ > BLOCK_SIZE - 8) {
+        std::memset(block_ + buffered_, 0, BLOCK_SIZE - buffered_);
+        compress_(state_, block_, 1);
+        buffered_ = 0;
+    }
+    std::memset(block_ + buffered_, 0, BLOCK_SIZE - 8 - buffered_);
+    store_be32(block_ + 56, static_cast<uint32_t>(bits >> 32));
+    store_be32(block_ + 60, static_cast<uint32_t>(bits));
+    compress_(state_, block_, 1);
+    unsigned char digest[DIGEST_SIZE];
+    for (int i = 0; i < 8; i++) {
+        store_be32(digest + 4 * i, state_[i]);
+    }
+    return ObjectId<Sha256>::from_raw(digest);
+}
+
+ObjectId<Sha256> Sha256::hash(std::string_view data) {
+    Sha256 sha;
+    sha.update(data);
+    return sha.finish();
+}
+
+void Sha256::hash_many(std::span<HashJob<Sha256>> jobs) {
+    for (HashJob<Sha256>& job : jobs) {
+        Sha256 sha;
+        sha.update(job.header);
+        sha.update(job.data);
+        job.id = sha.finish();
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "object_id.hpp"
+
+/**
+ * Compresses `count` consecutive 64-byte blocks into the eight-word SHA-256 `state`.
+ */
+using Sha256BlockFunction = void (*)(uint32_t state[8], const unsigned char *blocks, std::size_t count);
+
+/**
+ * A SHA-256 implementation.
+ */
+struct Sha256Backend {
+    const char *name;
+    Sha256BlockFunction compress;
+};
+
+/**
+ * Every backend that can run on this CPU, in order of preference:
+ *   - "shani":    the x86 SHA extensions (SHA-NI), detected with `cpuid`.
+ *   - "armv8":    the ARMv8 SHA2 instructions, detected from the kernel's hardware capabilities.
+ *   - "openssl":  OpenSSL's block function, which has its own assembly for many CPUs.
+ *   - "portable": plain C++, always available.
+ * Backends whose instructions are missing are not listed.
+ */
+const std::vector<Sha256Backend>& sha256_backends();
+
+/**
+ * The backend used by `Sha256`: the first of `sha256_backends()`, unless the `GIT_SHA256_BACKEND`
+ * environment variable names another available one. Chosen once per process.
+ */
+const Sha256Backend& sha256_backend();
+
+/**
+ * An incremental SHA-256 context running on the selected backend, and the `Hash` parameter of
+ * `ObjectId<Sha256>` for repositories with `extensions.objectFormat = sha256`.
+ *
+ * `update` hands whole blocks straight from the caller's buffer to the backend; only the partial
+ * block at either end of a piece is copied.
+ */
+class Sha256 {
+public:
+    static constexpr std::size_t BLOCK_SIZE = 64;
+    static constexpr std::size_t DIGEST_SIZE = 32;
+    // The value of `extensions.objectFormat` selecting this hash.
+    static constexpr std::string_view NAME = "sha256";
+
+    explicit Sha256(const Sha256Backend& backend = sha256_backend());
+
+    void update(const void *data, std::size_t size);
+    void update(std::string_view data) { update(data.data(), data.size()); }
+
+    // Pads the message and returns its hash. The context must not be used afterwards.
+    ObjectId<Sha256> finish();
+
+    // The hash of `data` in one call.
+    static ObjectId<Sha256> hash(std::string_view data);
+
+    // Hashes all `jobs`, one after another: there is no multi-buffer SHA-256 backend yet.
+    static void hash_many(std::span<HashJob<Sha256>> jobs);
+
+private:
+    Sha256BlockFunction compress_;
+    uint32_t state_[8];
+    uint64_t length_ = 0;
+    unsigned char block_[BLOCK_SIZE];
+    std::size_t buffered_ = 0;
+};
@@ -0,0 +1,294 @@
+#include "smart_http.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::string_view UPLOAD_PACK_REQUEST = "application/x-git-upload-pack-request";
+constexpr std::string_view UPLOAD_PACK_RESULT = "application/x-git-upload-pack-result";
+constexpr std::string_view UPLOAD_PACK_ADVERTISEMENT = "application/x-git-upload-pack-advertisement";
+
+// The payload of a text packet without its line feed.
+std::string_view chomp(std::string_view line) {
+    if (line.ends_with('\n')) {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+bool check_response(const HttpResponse& response, std::string_view expected_type) {
+    if (response.status() != 200) {
+        std::cerr << "Error: " << response.url().to_string() << " returned HTTP " << response.status() << '\n';
+        return false;
+    }
+    const std::optional<std::string> type = response.header("Content-Type");
+    if (!type || !type->starts_with(expected_type)) {
+        std::cerr << "Error: " << response.url().to_string() << " is not a smart git server (Content-Type: "
+                  << type.value_or("none") << ")\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+namespace pkt_line {
+
+void append(std::string& out, std::string_view payload) {
+    static constexpr char digits[] = "0123456789abcdef";
+    const std::size_t size = payload.size() + 4;
+    out += digits[(size >> 12) & 0xf];
+    out += digits[(size >> 8) & 0xf];
+    out += digits[(size >> 4) & 0xf];
+    out += digits[size & 0xf];
+    out += payload;
+}
+
+} // namespace pkt_line
+
+bool PktLineReader::fill(std::size_t size) {
+    if (pos_ > 0 && pos_ == buffer_.size()) {
+        buffer_.clear();
+        pos_ = 0;
+    }
+    char chunk[64 * 1024];
+    while (buffer_.size() - pos_ < size) {
+        const long n = response_.read(chunk, sizeof(chunk));
+        if (n <= 0) {
+            return false;
+        }
+        // Drop what was consumed before growing, so the buffer stays about one packet large.
+        buffer_.erase(0, pos_);
+        pos_ = 0;
+        buffer_.append(chunk, static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+PktLineReader::Packet PktLineReader::next(std::string_view& payload) {
+    if (!fill(4)) {
+        if (buffer_.size() == pos_) {
+            return Packet::End;
+        }
+        std::cerr << "Error: The server response ended inside a pkt-line\n";
+        return Packet::Error;
+    }
+    unsigned size = 0;
+    const char *length = buffer_.data() + pos_;
+    if (std::from_chars(length, length + 4, size, 16).ptr != length + 4) {
+        std::cerr << "Error: Malformed pkt-line in the server response: '" << std::string_view(length, 4) << "'\n";
+        return Packet::Error;
+    }
+    pos_ += 4;
+    switch (size) {
+        case 0: return Packet::Flush;
+        case 1: return Packet::Delim;
+        case 2: return Packet::ResponseEnd;
+        case 3:
+            std::cerr << "Error: Malformed pkt-line in the server response\n";
+            return Packet::Error;
+        default:
+            break;
+    }
+    if (!fill(size - 4)) {
+        std::cerr << "Error: The server response ended inside a pkt-line\n";
+        return Packet::Error;
+    }
+    payload = std::string_view(buffer_).substr(pos_, size - 4);
+    pos_ += size - 4;
+    return Packet::Data;
+}
+
+bool SmartHttpRemote::connect() {
+    while (url_.path.size() > 1 && url_.path.ends_with('/')) {
+        url_.path.pop_back();
+    }
+    Url discovery = url_;
+    discovery.path += "/info/refs?service=git-upload-pack";
+    std::unique_ptr<HttpResponse> response =
+        http_request("GET", discovery, {"Accept: */*", "Git-Protocol: version=2"}, "", options_);
+    if (!response || !check_response(*response, UPLOAD_PACK_ADVERTISEMENT)) {
+        return false;
+    }
+    // A redirected advertisement moves the whole repository, as in git.
+    url_ = response->url();
+    url_.path.erase(url_.path.size() - std::string_view("/info/refs?service=git-upload-pack").size());
+
+    PktLineReader reader(*response);
+    std::string_view line;
+    PktLineReader::Packet packet = reader.next(line);
+    // Some servers still start with the v0 service announcement.
+    if (packet == PktLineReader::Packet::Data && line.starts_with("# service=")) {
+        while ((packet = reader.next(line)) == PktLineReader::Packet::Data) {
+        }
+        packet = reader.next(line);
+    }
+    if (packet != PktLineReader::Packet::Data || chomp(line) != "version 2") {
+        std::cerr << "Error: " << url_.to_string() << " does not support git protocol version 2\n";
+        return false;
+    }
+    while ((packet = reader.next(line)) == PktLineReader::Packet::Data) {
+        capabilities_.emplace_back(chomp(line));
+    }
+    if (packet != PktLineReader::Packet::Flush) {
+        if (packet != PktLineReader::Packet::Error) {
+            std::cerr << "Error: Truncated capability advertisement from " << url_.to_string() << '\n';
+        }
+        return false;
+    }
+    for (const std::string& capability : capabilities_) {
+        if (capability.starts_with("object-format=")) {
+            const std::optional<ObjectFormat> format = object_format_from_name(std::string_view(capability).substr(14));
+            if (!format) {
+                std::cerr << "Error: The remote uses an unknown object format: " << capability.substr(14) << '\n';
+                return false;
+            }
+            object_format_ = *format;
+        }
+    }
+    const bool fetch = std::any_of(capabilities_.begin(), capabilities_.end(), [](const std::string& capability) {
+        return capability == "fetch" || capability.starts_with("fetch=");
+    });
+    if (!fetch) {
+        std::cerr << "Error: " << url_.to_string() << " does not offer the fetch command\n";
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<HttpResponse> SmartHttpRemote::post_command(std::string_view command,
+                                                            const std::vector<std::string>& arguments) {
+    std::string body;
+    pkt_line::append(body, "command=" + std::string(command) + "\n");
+    pkt_line::append(body, "agent=git/mygit\n");
+    if (object_format_ != ObjectFormat::Sha1) {
+        // A SHA-1 client may leave the format out; any other has to say it.
+        pkt_line::append(body, "object-format=" + std::string(object_format_ == ObjectFormat::Sha256 ? Sha256::NAME : Sha1::NAME) + "\n");
+    }
+    pkt_line::append_delim(body);
+    for (const std::string& argument : arguments) {
+        pkt_line::append(body, argument + "\n");
+    }
+    pkt_line::append_flush(body);
+
+    Url target = url_;
+    target.path += "/git-upload-pack";
+    std::unique_ptr<HttpResponse> response = http_request(
+        "POST", target,
+        {"Content-Type: " + std::string(UPLOAD_PACK_REQUEST), "Accept: " + std::string(UPLOAD_PACK_RESULT),
+         "Git-Protocol: version=2"},
+        body, options_);
+    if (!response || !check_response(*response, UPLOAD_PACK_RESULT)) {
+        return nullptr;
+    }
+    return response;
+}
+
+bool SmartHttpRemote::list_refs(const std::vector<std::string>& prefixes, std::vector<RemoteRef>& refs) {
+    std::vector<std::string> arguments = {"symrefs", "peel"};
+    for (const std::string& prefix : prefixes) {
+        arguments.push_back("ref-prefix " + prefix);
+    }
+    const std::unique_ptr<HttpResponse> response = post_command("ls-refs", arguments);
+    if (!response) {
+        return false;
+    }
+    // "<id> <name>[ symref-target:<target>][ peeled:<id>]"; unborn HEADs are not asked for.
+    PktLineReader reader(*response);
+    std::string_view line;
+    PktLineReader::Packet packet;
+    while ((packet = reader.next(line)) == PktLineReader::Packet::Data) {
+        line = chomp(line);
+        RemoteRef ref;
+        std::size_t start = 0;
+        for (int field = 0; start <= line.size(); field++) {
+            const std::size_t end = std::min(line.find(' ', start), line.size());
+            const std::string_view value = line.substr(start, end - start);
+            if (field == 0) {
+                ref.id = value;
+            } else if (field == 1) {
+                ref.name = value;
+            } else if (value.starts_with("symref-target:")) {
+                ref.symref_target = value.substr(14);
+            } else if (value.starts_with("peeled:")) {
+                ref.peeled = value.substr(7);
+            }
+            start = end + 1;
+        }
+        if (ref.name.empty()) {
+            std::cerr << "Error: Malformed ls-refs line: " << line << '\n';
+            return false;
+        }
+        refs.push_back(std::move(ref));
+    }
+    if (packet != PktLineReader::Packet::Flush) {
+        if (packet != PktLineReader::Packet::Error) {
+            std::cerr << "Error: Truncated ref list from " << url_.to_string() << '\n';
+        }
+        return false;
+    }
+    return true;
+}
+
+bool SmartHttpRemote::fetch(const std::vector<std::string>& wants,
+                            const std::function<bool(std::string_view)>& on_pack_data) {
+    std::vector<std::string> arguments = {"ofs-delta"};
+    if (!isatty(STDERR_FILENO)) {
+        arguments.push_back("no-progress");
+    }
+    for (const std::string& want : wants) {
+        arguments.push_back("want " + want);
+    }
+    arguments.push_back("done");
+    const std::unique_ptr<HttpResponse> response = post_command("fetch", arguments);
+    if (!response) {
+        return false;
+    }
+
+    // Sections ("shallow-info", "wanted-refs", ...) until "packfile", each ended by a delimiter.
+    PktLineReader reader(*response);
+    std::string_view line;
+    PktLineReader::Packet packet;
+    bool in_packfile = false;
+    bool section_start = true;
+    while ((packet = reader.next(line)) == PktLineReader::Packet::Data || packet == PktLineReader::Packet::Delim) {
+        if (packet == PktLineReader::Packet::Delim) {
+            section_start = true;
+            continue;
+        }
+        if (section_start) {
+            in_packfile = chomp(line) == "packfile";
+            section_start = false;
+            continue;
+        }
+        if (!in_packfile || line.empty()) {
+            continue;
+        }
+        const char band = line.front();
+        line.remove_prefix(1);
+        if (band == 1) {
+            if (!on_pack_data(line)) {
+                return false;
+            }
+        } else if (band == 2) {
+            std::cerr << "remote: " << line;
+        } else if (band == 3) {
+            std::cerr << "remote error: " << chomp(line) << '\n';
+            return false;
+        }
+    }
+    if (packet != PktLineReader::Packet::Flush) {
+        if (packet != PktLineReader::Packet::Error) {
+            std::cerr << "Error: Truncated fetch response from " << url_.to_string() << '\n';
+        }
+        return false;
+    }
+    if (!in_packfile) {
+        std::cerr << "Error: The server sent no pack\n";
+        return false;
+    }
+    return true;
+}
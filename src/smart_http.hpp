@@ -0,0 +1,94 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http_client.hpp"
+#include "object_format.hpp"
+
+/**
+ * pkt-lines, the framing of git's wire protocol: four hex digits giving the length of the line
+ * including themselves, then the payload. The lengths 0, 1 and 2 are special packets without payload.
+ */
+namespace pkt_line {
+
+constexpr std::size_t MAX_SIZE = 65520;
+
+// Appends `payload` as one pkt-line.
+void append(std::string& out, std::string_view payload);
+
+// Appends a flush packet ("0000"), which ends a message.
+inline void append_flush(std::string& out) { out += "0000"; }
+
+// Appends a delimiter packet ("0001"), which separates the sections of a message (protocol v2).
+inline void append_delim(std::string& out) { out += "0001"; }
+
+} // namespace pkt_line
+
+/**
+ * Reads pkt-lines from an HTTP response body as it arrives.
+ */
+class PktLineReader {
+public:
+    enum class Packet { Data, Flush, Delim, ResponseEnd, End, Error };
+
+    explicit PktLineReader(HttpResponse& response) : response_(response) {}
+
+    // Reads the next packet; for `Data`, `payload` holds it until the next call. `End` means the body ended
+    // between packets; `Error` (printed) means it ended inside one or was not pkt-lines.
+    Packet next(std::string_view& payload);
+
+private:
+    bool fill(std::size_t size);
+
+    HttpResponse& response_;
+    std::string buffer_;
+    std::size_t pos_ = 0;
+};
+
+// One ref as a protocol v2 `ls-refs` lists it.
+struct RemoteRef {
+    std::string name;
+    std::string id;            // In hex, in the remote's object format.
+    std::string symref_target; // For symbolic refs such as HEAD.
+    std::string peeled;        // For annotated tags: the object the tag points at.
+};
+
+/**
+ * A repository served over git's smart HTTP protocol, version 2.
+ *
+ * `connect` fetches `<url>/info/refs?service=git-upload-pack` with `Git-Protocol: version=2`, which a v2
+ * server answers with its capabilities instead of a ref list. Commands are then POSTs to
+ * `<url>/git-upload-pack`: `ls-refs` to list refs and `fetch` for a pack. The pack comes multiplexed
+ * on side-band channels: 1 carries pack data, handed to the caller as it arrives, 2 progress (shown on
+ * stderr), 3 a fatal error.
+ */
+class SmartHttpRemote {
+public:
+    SmartHttpRemote(Url url, HttpOptions options) : url_(std::move(url)), options_(options) {}
+
+    // Reads the capability advertisement. Returns `false` (after printing an error) if the server cannot
+    // be reached or does not speak protocol v2.
+    bool connect();
+
+    // The object format of the remote repository (`object-format` capability, SHA-1 if not given).
+    ObjectFormat object_format() const { return object_format_; }
+
+    // Lists the refs under `prefixes` (and HEAD, if asked for) with symbolic targets and peeled tags.
+    bool list_refs(const std::vector<std::string>& prefixes, std::vector<RemoteRef>& refs);
+
+    // Asks for a pack with everything reachable from `wants` (hex ids) and passes its bytes to `on_pack_data`
+    // as they arrive; returning `false` from it aborts. Returns `false` (after printing an error) on failure.
+    bool fetch(const std::vector<std::string>& wants, const std::function<bool(std::string_view)>& on_pack_data);
+
+private:
+    std::unique_ptr<HttpResponse> post_command(std::string_view command, const std::vector<std::string>& arguments);
+
+    Url url_; // Without a trailing '/'.
+    HttpOptions options_;
+    std::vector<std::string> capabilities_;
+    ObjectFormat object_format_ = ObjectFormat::Sha1;
+};
@@ -0,0 +1,238 @@
+#include "stat_cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#include <type_traits>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "trace_perf.hpp"
+
+namespace {
+constexpr char STAT_CACHE_SIGNATURE[4] = {'S', 'T', 'C', 'H'};
+constexpr uint32_t STAT_CACHE_VERSION = 2;
+
+void put_u32(std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+void put_u64(std::string& out, uint64_t value) {
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+    put_u32(out, static_cast<uint32_t>(value));
+}
+
+// Sequential big-endian reader over the loaded cache file; any overrun marks it as failed.
+struct Reader {
+    std::string_view data;
+    std::size_t pos = 0;
+    bool ok = true;
+
+    uint64_t get(int bytes) {
+        if (pos + bytes > data.size()) {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value = (value << 8) | static_cast<unsigned char>(data[pos++]);
+        }
+        return value;
+    }
+
+    template <typename Hash>
+    ObjectId<Hash> get_id() {
+        if (pos + ObjectId<Hash>::RAW_SIZE > data.size()) {
+            ok = false;
+            return ObjectId<Hash>();
+        }
+        pos += ObjectId<Hash>::RAW_SIZE;
+        return ObjectId<Hash>::from_raw(data.data() + pos - ObjectId<Hash>::RAW_SIZE);
+    }
+
+    std::string get_bytes(std::size_t count) {
+        if (pos + count > data.size()) {
+            ok = false;
+            return "";
+        }
+        pos += count;
+        return std::string(data.substr(pos - count, count));
+    }
+};
+}
+
+bool read_stat_data(const std::string& path, StatData& stat_data) {
+    PerfScope scope(PerfPhase::DirectoryWalk);
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stat_data.ctime_sec = st.st_ctim.tv_sec;
+    stat_data.ctime_nsec = st.st_ctim.tv_nsec;
+    stat_data.mtime_sec = st.st_mtim.tv_sec;
+    stat_data.mtime_nsec = st.st_mtim.tv_nsec;
+    stat_data.inode = st.st_ino;
+    stat_data.size = st.st_size;
+    stat_data.mode = st.st_mode;
+    return true;
+}
+
+template <typename Hash>
+void StatCache<Hash>::load(const std::string& file_path) {
+    MappedFile file;
+    if (!file.open(file_path)) {
+        return;
+    }
+    const std::string_view data = file.view();
+    if (data.size() < sizeof(STAT_CACHE_SIGNATURE) + 8 + ObjectId<Hash>::RAW_SIZE ||
+        !std::equal(std::begin(STAT_CACHE_SIGNATURE), std::end(STAT_CACHE_SIGNATURE), data.begin())) {
+        return;
+    }
+    // Ignore the whole file if its trailing checksum does not match the contents.
+    const ObjectId<Hash> checksum = Hash::hash(data.substr(0, data.size() - ObjectId<Hash>::RAW_SIZE));
+    if (checksum.raw() != data.substr(data.size() - ObjectId<Hash>::RAW_SIZE)) {
+        return;
+    }
+
+    Reader reader{data, sizeof(STAT_CACHE_SIGNATURE)};
+    if (reader.get(4) != STAT_CACHE_VERSION) {
+        return;
+    }
+    const uint64_t count = reader.get(4);
+    std::unordered_map<std::string, Entry> entries;
+    entries.reserve(count);
+    for (uint64_t i = 0; i < count && reader.ok; i++) {
+        Entry entry;
+        entry.stat_data.ctime_sec = static_cast<int64_t>(reader.get(8));
+        entry.stat_data.ctime_nsec = static_cast<int64_t>(reader.get(8));
+        entry.stat_data.mtime_sec = static_cast<int64_t>(reader.get(8));
+        entry.stat_data.mtime_nsec = static_cast<int64_t>(reader.get(8));
+        entry.stat_data.inode = reader.get(8);
+        entry.stat_data.size = reader.get(8);
+        entry.stat_data.mode = static_cast<uint32_t>(reader.get(4));
+        entry.id = reader.get_id<Hash>();
+        std::string path = reader.get_bytes(reader.get(4));
+        entries.emplace(std::move(path), std::move(entry));
+    }
+    const uint64_t tree_count = reader.get(4);
+    std::unordered_map<std::string, TreeEntry> trees;
+    trees.reserve(tree_count);
+    for (uint64_t i = 0; i < tree_count && reader.ok; i++) {
+        TreeEntry tree;
+        tree.entry_count = reader.get(4);
+        tree.id = reader.get_id<Hash>();
+        std::string path = reader.get_bytes(reader.get(4));
+        trees.emplace(std::move(path), std::move(tree));
+    }
+    if (!reader.ok || reader.pos != data.size() - ObjectId<Hash>::RAW_SIZE) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(file_path.c_str(), &st) == 0) {
+        cache_mtime_sec_ = st.st_mtim.tv_sec;
+        cache_mtime_nsec_ = st.st_mtim.tv_nsec;
+    }
+    previous_ = std::move(entries);
+    previous_trees_ = std::move(trees);
+}
+
+template <typename Hash>
+bool StatCache<Hash>::save(const std::string& file_path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Sort by path so the file is byte-for-byte reproducible.
+    auto sorted_by_path = [](const auto& map) {
+        std::vector<const typename std::decay_t<decltype(map)>::value_type *> sorted;
+        sorted.reserve(map.size());
+        for (const auto& item : map) {
+            sorted.push_back(&item);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->first < b->first; });
+        return sorted;
+    };
+    const auto sorted = sorted_by_path(current_);
+    const auto sorted_trees = sorted_by_path(current_trees_);
+
+    std::string data(STAT_CACHE_SIGNATURE, sizeof(STAT_CACHE_SIGNATURE));
+    put_u32(data, STAT_CACHE_VERSION);
+    put_u32(data, static_cast<uint32_t>(sorted.size()));
+    for (const auto *item : sorted) {
+        const StatData& st = item->second.stat_data;
+        put_u64(data, st.ctime_sec);
+        put_u64(data, st.ctime_nsec);
+        put_u64(data, st.mtime_sec);
+        put_u64(data, st.mtime_nsec);
+        put_u64(data, st.inode);
+        put_u64(data, st.size);
+        put_u32(data, st.mode);
+        data += item->second.id.raw();
+        put_u32(data, static_cast<uint32_t>(item->first.size()));
+        data += item->first;
+    }
+    put_u32(data, static_cast<uint32_t>(sorted_trees.size()));
+    for (const auto *item : sorted_trees) {
+        put_u32(data, static_cast<uint32_t>(item->second.entry_count));
+        data += item->second.id.raw();
+        put_u32(data, static_cast<uint32_t>(item->first.size()));
+        data += item->first;
+    }
+    data += Hash::hash(data).raw();
+
+    const std::string temp_path = file_path + ".lock";
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    file.write(data.data(), data.size());
+    file.close();
+    if (!file || std::rename(temp_path.c_str(), file_path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+template <typename Hash>
+bool StatCache<Hash>::lookup(const std::string& path, const StatData& stat_data, ObjectId<Hash>& id) const {
+    auto it = previous_.find(path);
+    if (it == previous_.end() || !(it->second.stat_data == stat_data)) {
+        return false;
+    }
+    // Racily clean: modified in the same tick the cache was written, the contents may differ.
+    if (stat_data.mtime_sec > cache_mtime_sec_ ||
+        (stat_data.mtime_sec == cache_mtime_sec_ && stat_data.mtime_nsec >= cache_mtime_nsec_)) {
+        return false;
+    }
+    id = it->second.id;
+    return true;
+}
+
+template <typename Hash>
+void StatCache<Hash>::record(const std::string& path, const StatData& stat_data, const ObjectId<Hash>& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_[path] = Entry{stat_data, id};
+}
+
+template <typename Hash>
+bool StatCache<Hash>::lookup_tree(const std::string& path, std::size_t entry_count, ObjectId<Hash>& id) const {
+    auto it = previous_trees_.find(path);
+    if (it == previous_trees_.end() || it->second.entry_count != entry_count) {
+        return false;
+    }
+    id = it->second.id;
+    return true;
+}
+
+template <typename Hash>
+void StatCache<Hash>::record_tree(const std::string& path, std::size_t entry_count, const ObjectId<Hash>& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_trees_[path] = TreeEntry{entry_count, id};
+}
+
+template class StatCache<Sha1>;
+template class StatCache<Sha256>;
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "object_id.hpp"
+
+/**
+ * The subset of `lstat` information used to decide whether a file changed since it was last hashed.
+ */
+struct StatData {
+    int64_t ctime_sec = 0;
+    int64_t ctime_nsec = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    uint32_t mode = 0;
+
+    bool operator==(const StatData&) const = default;
+};
+
+/**
+ * Reads the stat data of `path` without following symlinks. Returns `false` if `lstat` fails.
+ */
+bool read_stat_data(const std::string& path, StatData& stat_data);
+
+/**
+ * A persistent path -> (stat data, blob hash) cache, in the spirit of `.git/index`, that lets
+ * `write-tree` reuse the hash of every file whose stat data has not changed since the last run.
+ * It also remembers the tree hash of every directory (like git's cache-tree extension), so
+ * directories whose entries are all unchanged do not have their tree rebuilt.
+ *
+ * The cache is stored in `.git/stat-cache` as:
+ *   "STCH" | version (u32) | entry count (u32) | entries... | tree count (u32) | trees... | hash of everything before it
+ * where each entry is
+ *   ctime sec/nsec, mtime sec/nsec (u64 each) | inode (u64) | size (u64) | mode (u32) | raw id | path length (u32) | path
+ * each tree is
+ *   number of tree entries (u32) | raw tree id | path length (u32) | path
+ * and all integers are big-endian. The root directory is stored under the path ".". Ids and the
+ * checksum use the repository's hash `Hash`.
+ *
+ * Entries loaded from disk are read-only; hashes recorded during a run go into a fresh table, so the
+ * saved cache only contains files that still exist. `lookup` and `record` are safe to call from many threads.
+ *
+ * Like git, an entry whose mtime is not older than the cache file itself is treated as "racily clean":
+ * the file could have changed again within the same timestamp tick, so its hash is never reused.
+ */
+template <typename Hash>
+class StatCache {
+public:
+    // Loads the cache from `file_path`. A missing or corrupt file just yields an empty cache.
+    void load(const std::string& file_path);
+
+    // Writes all recorded entries to `file_path` (via a temporary file and rename). Returns `false` on failure.
+    bool save(const std::string& file_path) const;
+
+    // Returns `true` and sets `id` if `path` was cached with exactly `stat_data`.
+    bool lookup(const std::string& path, const StatData& stat_data, ObjectId<Hash>& id) const;
+
+    // Records the blob id computed (or reused) for `path` in this run.
+    void record(const std::string& path, const StatData& stat_data, const ObjectId<Hash>& id);
+
+    // Returns `true` and sets `id` if the directory `path` was cached with `entry_count` entries.
+    bool lookup_tree(const std::string& path, std::size_t entry_count, ObjectId<Hash>& id) const;
+
+    // Records the tree id of the directory `path` for this run.
+    void record_tree(const std::string& path, std::size_t entry_count, const ObjectId<Hash>& id);
+
+private:
+    struct Entry {
+        StatData stat_data;
+        ObjectId<Hash> id;
+    };
+
+    struct TreeEntry {
+        std::size_t entry_count;
+        ObjectId<Hash> id;
+    };
+
+    std::unordered_map<std::string, Entry> previous_;
+    std::unordered_map<std::string, Entry> current_;
+    std::unordered_map<std::string, TreeEntry> previous_trees_;
+    std::unordered_map<std::string, TreeEntry> current_trees_;
+    mutable std::mutex mutex_;
+    int64_t cache_mtime_sec_ = 0;
+    int64_t cache_mtime_nsec_ = 0;
+};
@@ -0,0 +1,153 @@
+#include "thread_pool.hpp"
+
+#include <chrono>
+#include <cstdlib>
+
+namespace {
+// The pool and queue the current thread is a worker of, used to route submissions to the local queue.
+thread_local const ThreadPool *tls_pool = nullptr;
+thread_local std::size_t tls_queue = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+    const unsigned workers = threads > 1 ? threads - 1 : 0;
+    // Queue 0 is shared by threads outside the pool, queue i + 1 belongs to worker i.
+    for (unsigned i = 0; i <= workers; i++) {
+        queues_.push_back(std::make_unique<WorkQueue>());
+    }
+    for (unsigned i = 0; i < workers; i++) {
+        workers_.emplace_back([this, i] { worker_loop(i + 1); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+std::size_t ThreadPool::current_queue() const {
+    return tls_pool == this ? tls_queue : 0;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    WorkQueue& queue = *queues_[current_queue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        // Taking the sleep mutex orders this increment with a worker checking `queued_` before sleeping.
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        queued_++;
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::pop_task(std::size_t own_queue, std::function<void()>& task) {
+    {
+        // Newest local work first.
+        WorkQueue& queue = *queues_[own_queue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued_--;
+            return true;
+        }
+    }
+    // Otherwise steal the oldest task of another queue.
+    for (std::size_t offset = 1; offset < queues_.size(); offset++) {
+        WorkQueue& queue = *queues_[(own_queue + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::run_pending_task() {
+    std::function<void()> task;
+    if (!pop_task(current_queue(), task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(std::size_t queue_index) {
+    tls_pool = this;
+    tls_queue = queue_index;
+    std::function<void()> task;
+    while (true) {
+        if (pop_task(queue_index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    pending_++;
+    pool_.submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+        // Decrement under the lock so a waiter that sees zero cannot destroy the group while we still use it.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) {
+            done_.notify_all();
+        }
+    });
+}
+
+void TaskGroup::wait_no_throw() {
+    while (pending_ > 0) {
+        if (pool_.run_pending_task()) {
+            continue;
+        }
+        // Nothing left to help with: the remaining tasks are running on other threads.
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending_ == 0; });
+    }
+    // Synchronize with the last task leaving its critical section.
+    std::lock_guard<std::mutex> lock(mutex_);
+}
+
+void TaskGroup::wait() {
+    wait_no_throw();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+unsigned parse_job_count(const char *value) {
+    long jobs = value ? std::strtol(value, nullptr, 10) : 0;
+    if (jobs <= 0) {
+        jobs = std::thread::hardware_concurrency();
+    }
+    return jobs > 0 ? static_cast<unsigned>(jobs) : 1;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A small work-stealing thread pool.
+ *
+ * Every worker owns a task queue. Tasks submitted from a worker go to the back of that worker's
+ * own queue and are popped from the back again (depth first, cache friendly), while idle workers
+ * steal from the front of other queues (oldest, usually largest, work first). Threads that are not
+ * workers of the pool share one extra queue.
+ *
+ * A pool created with `threads = N` starts `N - 1` workers: the thread that waits for the work
+ * (see `TaskGroup::wait`) runs tasks as well, so `N` threads are busy in total and `N = 1` runs
+ * everything on the calling thread.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queues `task` for execution on any thread of the pool.
+    void submit(std::function<void()> task);
+
+    // Runs one queued task on the calling thread. Returns `false` if there was nothing to run.
+    bool run_pending_task();
+
+    // Total number of threads working on the pool's tasks, including the waiting caller.
+    unsigned concurrency() const { return static_cast<unsigned>(workers_.size()) + 1; }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker_loop(std::size_t queue_index);
+    bool pop_task(std::size_t own_queue, std::function<void()>& task);
+    std::size_t current_queue() const;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<std::size_t> queued_{0};
+    bool stopping_ = false;
+};
+
+/**
+ * Tracks a set of tasks on a `ThreadPool` so the caller can wait for all of them.
+ *
+ * Tasks may add more tasks to the same group while running. `wait` returns once every task has
+ * finished, executing queued tasks itself in the meantime. The first exception thrown by a task is
+ * rethrown from `wait`.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool) : pool_(pool) {}
+    ~TaskGroup() { wait_no_throw(); }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    void wait_no_throw();
+
+    ThreadPool& pool_;
+    std::atomic<std::size_t> pending_{0};
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::exception_ptr error_;
+};
+
+/**
+ * Parses a `-j N` job count, falling back to the number of hardware threads for 0 or invalid input.
+ */
+unsigned parse_job_count(const char *value);
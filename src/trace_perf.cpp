@@ -0,0 +1,93 @@
+#include "trace_perf.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+
+struct PhaseTotals {
+    std::atomic<uint64_t> nanoseconds{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+std::array<PhaseTotals, PERF_PHASE_COUNT> phase_totals;
+
+// Empty for stderr.
+std::string report_path;
+
+constexpr const char *PHASE_NAMES[PERF_PHASE_COUNT] = {
+    "directory walk", "file reads", "hashing", "deflate", "inflate", "object writes",
+};
+
+// Formats a duration as git's trace does: seconds with microsecond precision.
+std::string seconds(uint64_t nanoseconds) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6f", nanoseconds / 1e9);
+    return text;
+}
+
+} // namespace
+
+namespace perf_trace {
+
+void enable(std::string_view value) {
+    if (value.empty() || value == "0" || value == "false") {
+        return;
+    }
+    if (value == "1" || value == "2" || value == "true") {
+        report_path.clear();
+    } else if (value.starts_with('/')) {
+        report_path = value;
+    } else {
+        std::cerr << "warning: unknown trace value for 'GIT_TRACE_PERFORMANCE': " << value << '\n'
+                  << "         If you want to trace into a file, then please set it to an absolute path.\n";
+        return;
+    }
+    enabled_flag = true;
+}
+
+void enable_from_environment() {
+    if (const char *value = std::getenv("GIT_TRACE_PERFORMANCE"); value != nullptr) {
+        enable(value);
+    }
+}
+
+void add(PerfPhase phase, std::chrono::steady_clock::duration elapsed, uint64_t bytes) {
+    PhaseTotals& totals = phase_totals[static_cast<std::size_t>(phase)];
+    totals.nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                                 std::memory_order_relaxed);
+    totals.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void report(std::string_view command, std::chrono::steady_clock::duration total) {
+    std::string text = "performance: " +
+                       seconds(std::chrono::duration_cast<std::chrono::nanoseconds>(total).count()) +
+                       " s: git command: " + std::string(command) + '\n';
+    for (std::size_t i = 0; i < PERF_PHASE_COUNT; i++) {
+        const uint64_t nanoseconds = phase_totals[i].nanoseconds.load(std::memory_order_relaxed);
+        const uint64_t bytes = phase_totals[i].bytes.load(std::memory_order_relaxed);
+        if (nanoseconds == 0 && bytes == 0) {
+            continue;
+        }
+        text += "performance: " + seconds(nanoseconds) + " s: " + PHASE_NAMES[i] + ": " + std::to_string(bytes) +
+                (static_cast<PerfPhase>(i) == PerfPhase::DirectoryWalk ? " entries\n" : " bytes\n");
+    }
+    if (report_path.empty()) {
+        std::cerr << text;
+        return;
+    }
+    // Appended in one write, so the reports of concurrent commands do not interleave.
+    std::FILE *file = std::fopen(report_path.c_str(), "a");
+    if (file == nullptr) {
+        std::cerr << "warning: could not open '" << report_path << "' for tracing\n";
+        return;
+    }
+    std::fwrite(text.data(), 1, text.size(), file);
+    std::fclose(file);
+}
+
+} // namespace perf_trace
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * The phases whose time and bytes `--trace-perf` (or `GIT_TRACE_PERFORMANCE`) reports per command.
+ *
+ * Each phase is measured where the work happens, so they do not overlap: a blob written by `write-tree`
+ * shows up as a file read, then hashing, then deflate, then an object write. Files are memory-mapped
+ * (see `MappedFile`), so the page faults of a large file mostly land in the phase that first touches its
+ * contents, usually hashing.
+ */
+enum class PerfPhase {
+    DirectoryWalk, // Listing working tree directories and stat'ing files; bytes are the number of entries listed.
+    FileRead,      // Opening and reading or mapping files and objects.
+    Hash,          // SHA-1 or SHA-256 over object data.
+    Deflate,       // zlib or libdeflate compression; bytes are the input.
+    Inflate,       // zlib decompression; bytes are the output.
+    ObjectWrite,   // Writing loose objects, packs and indexes, and moving them into place.
+};
+
+constexpr std::size_t PERF_PHASE_COUNT = 6;
+
+namespace perf_trace {
+
+// Set once, before the command starts; every `PerfScope` checks it so tracing costs nothing when off.
+inline bool enabled_flag = false;
+
+inline bool enabled() { return enabled_flag; }
+
+/**
+ * Turns tracing on for `--trace-perf` (`value` "1", report on stderr) or from `GIT_TRACE_PERFORMANCE`,
+ * which takes git's values: "1", "2" or "true" for stderr, an absolute path to append to that file,
+ * and "", "0" or "false" for off. Anything else is ignored with a warning.
+ */
+void enable(std::string_view value);
+
+// Reads `GIT_TRACE_PERFORMANCE`, see `enable`.
+void enable_from_environment();
+
+// Adds one measurement to `phase`. Safe to call from any thread.
+void add(PerfPhase phase, std::chrono::steady_clock::duration elapsed, uint64_t bytes);
+
+/**
+ * Writes the totals of every phase that did any work, after the total wall time of `command`.
+ * Phase times are summed over all threads, so with `-j` they can add up to more than the total.
+ */
+void report(std::string_view command, std::chrono::steady_clock::duration total);
+
+} // namespace perf_trace
+
+/**
+ * Measures the lifetime of the scope as time spent in `phase`, along with the bytes counted on it.
+ * Does nothing (not even read the clock) unless tracing is enabled.
+ */
+class PerfScope {
+public:
+    explicit PerfScope(PerfPhase phase, uint64_t bytes = 0) : phase_(phase), bytes_(bytes), active_(perf_trace::enabled()) {
+        if (active_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+    ~PerfScope() {
+        if (active_) {
+            perf_trace::add(phase_, std::chrono::steady_clock::now() - start_, bytes_);
+        }
+    }
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+    void add_bytes(uint64_t bytes) { bytes_ += bytes; }
+
+private:
+    PerfPhase phase_;
+    uint64_t bytes_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "object_id.hpp"
+
+/**
+ * The file modes a tree entry can have. The values are the octal modes git stores.
+ */
+enum class TreeEntryMode : uint32_t {
+    Directory = 040000,
+    Regular = 0100644,
+    Executable = 0100755,
+    Symlink = 0120000,
+    Gitlink = 0160000, // A submodule commit.
+};
+
+// The mode as it is written in tree objects: octal without leading zeros, e.g. "40000" or "100644".
+constexpr std::string_view tree_mode_text(TreeEntryMode mode) {
+    switch (mode) {
+        case TreeEntryMode::Directory: return "40000";
+        case TreeEntryMode::Regular: return "100644";
+        case TreeEntryMode::Executable: return "100755";
+        case TreeEntryMode::Symlink: return "120000";
+        case TreeEntryMode::Gitlink: return "160000";
+    }
+    return "100644";
+}
+
+/**
+ * Git's order of tree entries: names compare bytewise, except that a directory compares as if its name
+ * ended in '/'. So a file "foo.c" comes before a directory "foo" ('.' < '/'), which comes before a file
+ * "foo0". Trees in any other order are rejected by `git fsck` (treeNotSorted).
+ */
+constexpr bool tree_entry_less(std::string_view a, bool a_is_tree, std::string_view b, bool b_is_tree) {
+    const std::size_t common = std::min(a.size(), b.size());
+    // `char_traits<char>` compares like memcmp, as unsigned bytes.
+    if (const int order = a.substr(0, common).compare(b.substr(0, common)); order != 0) {
+        return order < 0;
+    }
+    const unsigned char next_a = a.size() > common ? a[common] : a_is_tree ? '/' : '\0';
+    const unsigned char next_b = b.size() > common ? b[common] : b_is_tree ? '/' : '\0';
+    return next_a < next_b;
+}
+
+/**
+ * One entry of a tree that is being built. `name` points into storage owned by the builder.
+ */
+template <typename Hash>
+struct TreeEntry {
+    TreeEntryMode mode = TreeEntryMode::Regular;
+    std::string_view name;
+    ObjectId<Hash> id;
+
+    bool is_tree() const { return mode == TreeEntryMode::Directory; }
+};
+
+/**
+ * Sorts `entries` into git's tree order and returns the full tree object,
+ *
+ *   tree <size>\0<mode> <name>\0<raw id><mode> <name>\0<raw id>...
+ *
+ * written into one string sized up front, so serializing allocates exactly once.
+ */
+template <typename Hash>
+std::string serialize_tree(std::span<TreeEntry<Hash>> entries) {
+    std::sort(entries.begin(), entries.end(), [](const TreeEntry<Hash>& a, const TreeEntry<Hash>& b) {
+        return tree_entry_less(a.name, a.is_tree(), b.name, b.is_tree());
+    });
+    std::size_t content_size = 0;
+    for (const TreeEntry<Hash>& entry : entries) {
+        content_size += tree_mode_text(entry.mode).size() + 1 + entry.name.size() + 1 + ObjectId<Hash>::RAW_SIZE;
+    }
+    const std::string size_text = std::to_string(content_size);
+    std::string tree;
+    tree.reserve(5 + size_text.size() + 1 + content_size);
+    tree += "tree ";
+    tree += size_text;
+    tree += '\0';
+    for (const TreeEntry<Hash>& entry : entries) {
+        tree += tree_mode_text(entry.mode);
+        tree += ' ';
+        tree += entry.name;
+        tree += '\0';
+        tree += entry.id.raw();
+    }
+    return tree;
+}
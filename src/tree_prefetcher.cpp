@@ -0,0 +1,64 @@
+#include "tree_prefetcher.hpp"
+
+#include <chrono>
+#include <vector>
+
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "tree_view.hpp"
+
+template <typename Hash>
+void TreePrefetcher<Hash>::prefetch(const ObjectId<Hash>& id) {
+    auto promise = std::make_shared<std::promise<std::shared_ptr<const DecodedObject>>>();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pending_.emplace(id, promise->get_future().share()).second) {
+            return;
+        }
+    }
+    group_.run([this, id, promise] {
+        try {
+            std::shared_ptr<const DecodedObject> object = store_.read(id);
+            if (object && object->type == ObjectType::Tree) {
+                // Queue the subtrees before publishing the tree, so the walker never asks for one too early.
+                std::vector<ObjectId<Hash>> subtrees;
+                for (const TreeEntryView<Hash>& entry : TreeView<Hash>(object->data)) {
+                    if (entry.is_tree()) {
+                        subtrees.push_back(entry.id);
+                    }
+                }
+                for (auto subtree = subtrees.rbegin(); subtree != subtrees.rend(); ++subtree) {
+                    prefetch(*subtree);
+                }
+            }
+            promise->set_value(std::move(object));
+        } catch (...) {
+            // Hand the failure to whoever waits for this tree in `get`.
+            promise->set_exception(std::current_exception());
+        }
+    });
+}
+
+template <typename Hash>
+std::shared_ptr<const DecodedObject> TreePrefetcher<Hash>::get(const ObjectId<Hash>& id) {
+    Result result;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = pending_.find(id);
+        if (found == pending_.end()) {
+            return store_.read(id);
+        }
+        result = std::move(found->second);
+        pending_.erase(found);
+    }
+    // Help with queued work until the tree is ready; if nothing is queued it is being decoded right now.
+    while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        if (!pool_.run_pending_task()) {
+            result.wait();
+        }
+    }
+    return result.get();
+}
+
+template class TreePrefetcher<Sha1>;
+template class TreePrefetcher<Sha256>;
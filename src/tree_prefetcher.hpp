@@ -0,0 +1,46 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Decodes the trees below a tree on a thread pool ahead of a walker that visits them in order.
+ *
+ * `prefetch(id)` queues the tree `id` for inflating; once decoded, its subtrees are queued in turn, so
+ * the whole hierarchy is decoded concurrently while the caller is still busy with the first entries.
+ * `get(id)` then hands out a prefetched tree, waiting for (or helping with) the work if it is not done
+ * yet. Trees that were never prefetched are read directly from the store.
+ *
+ * Subtrees are queued in reverse order: the calling thread pops its own queue newest first, so when it
+ * helps out it decodes the tree it needs next, while idle workers steal from the other end.
+ */
+template <typename Hash>
+class TreePrefetcher {
+public:
+    TreePrefetcher(ObjectStore<Hash>& store, ThreadPool& pool) : store_(store), pool_(pool), group_(pool) {}
+
+    TreePrefetcher(const TreePrefetcher&) = delete;
+    TreePrefetcher& operator=(const TreePrefetcher&) = delete;
+
+    // Queues decoding of tree `id` and, recursively, of every tree below it.
+    void prefetch(const ObjectId<Hash>& id);
+
+    // Returns the decoded object `id`, or null (after printing an error) if it cannot be read.
+    std::shared_ptr<const DecodedObject> get(const ObjectId<Hash>& id);
+
+private:
+    using Result = std::shared_future<std::shared_ptr<const DecodedObject>>;
+
+    ObjectStore<Hash>& store_;
+    ThreadPool& pool_;
+    std::mutex mutex_;
+    std::unordered_map<ObjectId<Hash>, Result, ObjectIdHash<Hash>> pending_;
+    // Declared last so it is destroyed first: it waits for outstanding prefetches, which use the members above.
+    TaskGroup group_;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <iterator>
+#include <string_view>
+
+#include "object_id.hpp"
+
+/**
+ * One entry of a tree object, pointing into the buffer the tree was decompressed into.
+ */
+template <typename Hash>
+struct TreeEntryView {
+    std::string_view mode; // e.g. "100644", "100755", "120000" or "40000".
+    std::string_view name;
+    ObjectId<Hash> id;
+
+    bool is_tree() const { return mode == "40000"; }
+};
+
+/**
+ * A zero-copy view over the content of a tree object (without its "tree <size>\0" header):
+ *
+ *   <mode> <name>\0<raw id><mode> <name>\0<raw id>...
+ *
+ * Iterating yields `TreeEntryView`s whose mode and name are `std::string_view` slices of the
+ * underlying buffer, so walking a tree allocates nothing and takes time linear in its size. The
+ * buffer must outlive the view and its entries. Git writes tree entries in sorted order, so they
+ * come out already sorted.
+ *
+ * Raw ids are `ObjectId<Hash>::RAW_SIZE` bytes: 20 for SHA-1 repositories, 32 for SHA-256 ones.
+ * A malformed entry ends the iteration early and makes `corrupt()` return `true`.
+ */
+template <typename Hash>
+class TreeView {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = TreeEntryView<Hash>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const TreeEntryView<Hash> *;
+        using reference = const TreeEntryView<Hash>&;
+
+        iterator() = default;
+
+        reference operator*() const { return entry_; }
+        pointer operator->() const { return &entry_; }
+
+        iterator& operator++() {
+            parse();
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator previous = *this;
+            parse();
+            return previous;
+        }
+
+        friend bool operator==(const iterator& a, const iterator& b) { return a.current_ == b.current_; }
+
+    private:
+        friend class TreeView;
+
+        iterator(const TreeView *view, std::size_t offset) : view_(view), next_(offset) { parse(); }
+
+        // Parses the entry starting at `next_`, or turns into the end iterator.
+        void parse() {
+            const std::string_view data = view_->data_;
+            current_ = next_;
+            if (current_ >= data.size()) {
+                current_ = std::string_view::npos;
+                return;
+            }
+            const std::size_t space = data.find(' ', current_);
+            const std::size_t nul = space == std::string_view::npos ? space : data.find('\0', space + 1);
+            if (nul == std::string_view::npos || nul + 1 + ObjectId<Hash>::RAW_SIZE > data.size()) {
+                view_->corrupt_ = true;
+                current_ = std::string_view::npos;
+                return;
+            }
+            entry_.mode = data.substr(current_, space - current_);
+            entry_.name = data.substr(space + 1, nul - space - 1);
+            entry_.id = ObjectId<Hash>::from_raw(data.data() + nul + 1);
+            next_ = nul + 1 + ObjectId<Hash>::RAW_SIZE;
+        }
+
+        const TreeView *view_ = nullptr;
+        std::size_t current_ = std::string_view::npos; // Offset of the current entry, npos at the end.
+        std::size_t next_ = 0;
+        TreeEntryView<Hash> entry_;
+    };
+
+    explicit TreeView(std::string_view data) : data_(data) {}
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(); }
+
+    // `true` once iteration stopped at an entry that could not be parsed.
+    bool corrupt() const { return corrupt_; }
+
+private:
+    std::string_view data_;
+    mutable bool corrupt_ = false;
+};